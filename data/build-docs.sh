@@ -23,7 +23,7 @@ set -e
 mkdir doc-temp || true
 cd doc-temp
 
-gdbus-codegen --generate-docbook=docbook ../registry.xml ../provider.xml
+gdbus-codegen --generate-docbook=docbook ../registry.xml ../provider.xml ../stats.xml
 
 find . -name "docbook*.xml" -exec docbook2x-texi {} \;
 
@@ -45,6 +45,7 @@ static char constexpr SIZE_IN_BYTES[] = "size_in_bytes";            // int64_t,
 static char constexpr CREATION_TIME[] = "creation_time";            // String, ISO 8601 format
 static char constexpr LAST_MODIFIED_TIME[] = "last_modified_time";  // String, ISO 8601 format
 static char constexpr CHILD_COUNT[] = "child_count";                // int64_t, >= 0
+static char constexpr RECURSIVE_SIZE_IN_BYTES[] = "recursive_size_in_bytes";  // int64_t, >= 0
 static char constexpr DESCRIPTION[] = "description";                // String
 static char constexpr DISPLAY_NAME[] = "display_name";              // String
 static char constexpr FREE_SPACE_BYTES[] = "free_space_bytes";      // int64_t, >= 0
@@ -57,5 +58,14 @@ static char constexpr DOWNLOAD_URL[] = "download_url";              // String
 static char constexpr ALL[] = "__ALL__";
 
 }  // namespace metadata
+
+namespace capability
+{
+
+static char constexpr DOWNLOAD_RANGE[] = "download_range";  // Provider supports downloading byte ranges
+static char constexpr RESUMABLE_UPLOAD[] = "resumable_upload";  // Provider supports resuming interrupted uploads
+static char constexpr SEARCH[] = "search";                      // Provider supports searching a subtree by name
+
+}  // namespace capability
 }  // namespace storage
 }  // namespace unity
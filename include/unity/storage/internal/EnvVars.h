@@ -35,6 +35,33 @@ constexpr int REGISTRY_IDLE_TIMEOUT_DFLT = 30;
 constexpr char PROVIDER_IDLE_TIMEOUT[] = "SF_PROVIDER_IDLE_TIMEOUT";
 constexpr int PROVIDER_IDLE_TIMEOUT_DFLT = 30;
 
+// Maximum number of items in a List or Search reply. Larger results are handed out page by page.
+constexpr char PROVIDER_LIST_PAGE_SIZE[] = "SF_PROVIDER_LIST_PAGE_SIZE";
+constexpr int PROVIDER_LIST_PAGE_SIZE_DFLT = 1000;
+
+// Seconds for which the remaining pages of a large result are kept.
+constexpr char PROVIDER_LIST_CURSOR_TTL[] = "SF_PROVIDER_LIST_CURSOR_TTL";
+constexpr int PROVIDER_LIST_CURSOR_TTL_DFLT = 300;
+
+// Maximum number of large results kept per account, and per client. Once a limit is reached,
+// the oldest result is dropped.
+constexpr char PROVIDER_MAX_LIST_CURSORS[] = "SF_PROVIDER_MAX_LIST_CURSORS";
+constexpr int PROVIDER_MAX_LIST_CURSORS_DFLT = 256;
+constexpr char PROVIDER_MAX_CLIENT_LIST_CURSORS[] = "SF_PROVIDER_MAX_CLIENT_LIST_CURSORS";
+constexpr int PROVIDER_MAX_CLIENT_LIST_CURSORS_DFLT = 16;
+
+// Maximum number of requests per account that a provider works on concurrently. More are queued.
+constexpr char PROVIDER_MAX_REQUESTS[] = "SF_PROVIDER_MAX_REQUESTS";
+constexpr int PROVIDER_MAX_REQUESTS_DFLT = 32;
+
+// Maximum number of requests of a single client that a provider works on concurrently.
+constexpr char PROVIDER_MAX_CLIENT_REQUESTS[] = "SF_PROVIDER_MAX_CLIENT_REQUESTS";
+constexpr int PROVIDER_MAX_CLIENT_REQUESTS_DFLT = 8;
+
+// If non-zero, providers collect request statistics and export them with the Stats interface.
+constexpr char PROVIDER_STATS[] = "SF_PROVIDER_STATS";
+constexpr int PROVIDER_STATS_DFLT = 0;
+
 // Helper class to make retrieval of environment variables type-safe and
 // to sanity check the setting, if applicable. Also returns a default
 // setting, if applicable.
@@ -44,11 +71,22 @@ class EnvVars
 public:
     static int registry_timeout_ms();
     static int provider_timeout_ms();
+    static int provider_list_page_size();
+    static int provider_list_cursor_ttl_ms();
+    static int provider_max_list_cursors();
+    static int provider_max_client_list_cursors();
+    static int provider_max_requests();
+    static int provider_max_client_requests();
+    static bool provider_stats();
 
     // Returns value of var_name in the environment, if set, and an empty string otherwise.
     // Can be used for any environment variable, not just the ones defined above.
     static std::string get(char const* var_name);
 
+    // Returns value of var_name in the environment as an integer, or dflt if it is not set.
+    // If the setting is not an integer >= min, logs a warning and returns dflt.
+    static int get_int(char const* var_name, int dflt, int min);
+
 private:
     static int get_timeout_ms(char const* var_name, int dflt);
 };
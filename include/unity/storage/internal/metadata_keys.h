@@ -37,6 +37,7 @@ static std::unordered_map<std::string, MetadataType> const known_metadata =
     { metadata::CREATION_TIME, MetadataType::iso_8601_date_time },
     { metadata::LAST_MODIFIED_TIME, MetadataType::iso_8601_date_time },
     { metadata::CHILD_COUNT, MetadataType::non_zero_pos_int64 },
+    { metadata::RECURSIVE_SIZE_IN_BYTES, MetadataType::non_zero_pos_int64 },
     { metadata::DESCRIPTION, MetadataType::string },
     { metadata::DISPLAY_NAME, MetadataType::string },
     { metadata::FREE_SPACE_BYTES, MetadataType::non_zero_pos_int64 },
@@ -27,9 +27,11 @@
 #include <boost/variant.hpp>
 
 #include <sys/types.h>
+#include <exception>
 #include <map>
 #include <memory>
 #include <string>
+#include <tuple>
 #include <vector>
 
 namespace unity
@@ -42,6 +44,15 @@ namespace provider
 class DownloadJob;
 class UploadJob;
 
+// How urgently a client needs the result of a request. The framework starts requests
+// in this order, and providers may use it to order their own work.
+enum class Priority
+{
+    interactive,    // Quick operations, such as metadata() and lookup()
+    bulk,           // Operations that may take a while, such as list(), copy(), and the batch operations
+    background,     // Uploads and downloads
+};
+
 struct UNITY_STORAGE_EXPORT Context
 {
     uid_t uid;
@@ -49,8 +60,22 @@ struct UNITY_STORAGE_EXPORT Context
     std::string security_label;
 
     Credentials credentials;
+
+    // Set by the framework according to the method, unless the client has asked
+    // for a particular priority for all its requests.
+    Priority priority = Priority::interactive;
+};
+
+// Outcome for one item of metadata_items(), move_items(), or copy_items(). If error is set,
+// the operation failed for that item and item is default-constructed.
+struct UNITY_STORAGE_EXPORT BatchResult
+{
+    Item item;
+    std::exception_ptr error;
 };
 
+typedef std::vector<BatchResult> BatchResultList;
+
 class UNITY_STORAGE_EXPORT ProviderBase : public std::enable_shared_from_this<ProviderBase>
 {
 public:
@@ -95,6 +120,62 @@ public:
     virtual boost::future<Item> copy(
         std::string const& item_id, std::string const& new_parent_id,
         std::string const& new_name, std::vector<std::string> const& keys, Context const& context) = 0;
+
+    // The methods below were added after the first release of this class. New virtual methods
+    // go at the end, so the vtable slots of the existing ones don't move.
+
+    // Downloads length bytes starting at offset; a negative length means "to the end of the file".
+    // Providers that override this should include capability::DOWNLOAD_RANGE in capabilities().
+    // The default implementation handles only whole-file ranges and forwards them to download().
+    virtual boost::future<std::unique_ptr<DownloadJob>> download_range(
+        std::string const& item_id, std::string const& match_etag,
+        int64_t offset, int64_t length,
+        Context const& context);
+
+    // Continues an upload that was suspended because the client disconnected (see UploadJob::suspend()).
+    // Returns the new job and the number of bytes that were committed already; the client
+    // sends only the remaining bytes. Providers that override this should include
+    // capability::RESUMABLE_UPLOAD in capabilities(). The default implementation fails.
+    virtual boost::future<std::tuple<std::unique_ptr<UploadJob>, int64_t>> resume_upload(
+        std::string const& upload_id, std::vector<std::string> const& keys,
+        Context const& context);
+
+    // Returns the files and folders below item_id whose name matches pattern (shell wildcards,
+    // ignoring case), paged like list(). Providers that override this should include
+    // capability::SEARCH in capabilities(). The default implementation fails.
+    virtual boost::future<std::tuple<ItemList,std::string>> search(
+        std::string const& item_id, std::string const& pattern, std::string const& page_token,
+        std::vector<std::string> const& keys,
+        Context const& context);
+
+    // Batch variant of metadata(), with one result per item in the order of item_ids (see delete_items()).
+    // The default implementation calls metadata() for each item, as delete_items() calls delete_item().
+    virtual boost::future<BatchResultList> metadata_items(
+        std::vector<std::string> const& item_ids, std::vector<std::string> const& keys,
+        Context const& context);
+
+    // Batch variants of delete_item(), move() and copy(). The returned future becomes ready once all
+    // items have been dealt with and holds one result per item, in the order of item_ids (a null
+    // exception_ptr for each item that was deleted); the failure of one item does not affect the
+    // others. For move_items() and copy_items(), new_names[i] is
+    // the name for item_ids[i]. The default implementations call the single-item methods with a
+    // small number of items in progress at a time, so they run concurrently if those methods are
+    // asynchronous, without queueing the whole batch at once. As for any other request, the
+    // single-item methods are called from the main thread.
+    // Unlike a single-item request, a batch is not restarted after re-authenticating if an item
+    // fails with UnauthorizedException, because the other items may have succeeded already;
+    // the error is returned for that item instead.
+    virtual boost::future<std::vector<std::exception_ptr>> delete_items(
+        std::vector<std::string> const& item_ids, Context const& context);
+    virtual boost::future<BatchResultList> move_items(
+        std::vector<std::string> const& item_ids, std::string const& new_parent_id,
+        std::vector<std::string> const& new_names, std::vector<std::string> const& keys, Context const& context);
+    virtual boost::future<BatchResultList> copy_items(
+        std::vector<std::string> const& item_ids, std::string const& new_parent_id,
+        std::vector<std::string> const& new_names, std::vector<std::string> const& keys, Context const& context);
+
+    // Names of the optional features supported by the provider (see unity::storage::capability).
+    virtual std::vector<std::string> capabilities() const;
 };
 
 }
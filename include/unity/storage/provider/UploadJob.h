@@ -55,6 +55,12 @@ public:
     virtual boost::future<void> cancel() = 0;
     virtual boost::future<Item> finish() = 0;
 
+    // Called instead of cancel() if the client disconnects before the upload
+    // is finished. Providers that support resumable uploads keep the data
+    // received so far, so ProviderBase::resume_upload() can continue the
+    // upload later. The default implementation calls cancel().
+    virtual boost::future<void> suspend();
+
 protected:
     UploadJob(internal::UploadJobImpl *p) UNITY_STORAGE_HIDDEN;
     internal::UploadJobImpl *p_ = nullptr;
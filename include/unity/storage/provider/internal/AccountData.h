@@ -47,7 +47,9 @@ namespace internal
 {
 
 class DBusPeerCache;
+class ListCursors;
 class PendingJobs;
+class RequestStats;
 
 class AccountData : public QObject
 {
@@ -68,6 +70,9 @@ public:
     DBusPeerCache& dbus_peer();
     std::shared_ptr<unity::storage::internal::InactivityTimer> inactivity_timer();
     PendingJobs& jobs();
+    ListCursors& list_cursors();
+    // Null unless statistics are enabled (SF_PROVIDER_STATS).
+    RequestStats* stats();
 
 Q_SIGNALS:
     void authenticated();
@@ -77,6 +82,8 @@ private:
     std::shared_ptr<DBusPeerCache> const dbus_peer_;
     std::shared_ptr<unity::storage::internal::InactivityTimer> const inactivity_timer_;
     std::unique_ptr<PendingJobs> const jobs_;
+    std::unique_ptr<ListCursors> const list_cursors_;
+    std::unique_ptr<RequestStats> const stats_;
 
     Q_DISABLE_COPY(AccountData)
 };
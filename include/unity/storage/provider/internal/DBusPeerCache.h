@@ -29,6 +29,8 @@
 #pragma GCC diagnostic pop
 #include <QString>
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <map>
 #include <memory>
@@ -66,6 +68,11 @@ public:
     // Retrieve the security credentials for the given D-Bus peer.
     boost::future<Credentials> get(QString const& peer);
 
+    // Number of get() calls that were answered from the cache, and that had to ask the bus daemon
+    // (or wait for an earlier request to the bus daemon).
+    int64_t hits() const noexcept;
+    int64_t misses() const noexcept;
+
 private:
     struct Request;
 
@@ -75,6 +82,8 @@ private:
     std::map<QString,Credentials> cache_;
     std::map<QString,Credentials> old_cache_;
     std::map<QString,std::unique_ptr<Request>> pending_;
+    std::atomic<int64_t> hits_;
+    std::atomic<int64_t> misses_;
 
     void received_credentials(QString const& peer, QDBusPendingReply<QVariantMap> const& reply);
 };
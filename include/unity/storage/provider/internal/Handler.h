@@ -28,6 +28,7 @@
 #include <QDBusConnection>
 #include <QDBusMessage>
 
+#include <chrono>
 #include <functional>
 #include <memory>
 
@@ -51,10 +52,18 @@ public:
 
     Handler(std::shared_ptr<AccountData> const& account,
             Callback const& callback,
-            QDBusConnection const& bus, QDBusMessage const& message);
+            QDBusConnection const& bus, QDBusMessage const& message,
+            Priority priority);
 
     void begin();
 
+    QDBusMessage const& message() const;
+    // Only valid once finished() has been emitted.
+    QDBusMessage const& reply() const;
+    // Time from creation to the first call to begin(), and to sending the reply.
+    std::chrono::microseconds wait_time() const;
+    std::chrono::microseconds latency() const;
+
 private Q_SLOTS:
     void on_authenticated();
     void credentials_received();
@@ -71,6 +80,7 @@ private:
     Callback const callback_;
     QDBusConnection const bus_;
     QDBusMessage const message_;
+    Priority const priority_;
     unity::storage::internal::ActivityNotifier activity_;
 
     boost::future<void> creds_future_;
@@ -78,6 +88,9 @@ private:
     Context context_;
     QDBusMessage reply_;
     bool retry_ = false;
+    std::chrono::steady_clock::time_point const created_;
+    std::chrono::steady_clock::time_point begun_;
+    std::chrono::steady_clock::time_point finished_;
 
     Q_DISABLE_COPY(Handler)
 };
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <unity/storage/provider/Item.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-align"
+#pragma GCC diagnostic ignored "-Wctor-dtor-privacy"
+#pragma GCC diagnostic ignored "-Wswitch-default"
+#include <QDBusConnection>
+#include <QDBusServiceWatcher>
+#include <QObject>
+#include <QString>
+#pragma GCC diagnostic pop
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+// Holds the tail of List and Search results that are too large for a single reply.
+//
+// add() cuts the result down to the page size and keeps the remainder under a new
+// token, which the client passes back as the page token of its next request.
+// next_page() hands out the following page from memory, without calling the provider.
+// Once all pages have been handed out, the client gets the next token the provider
+// returned with the original result, so pagination by the provider still works.
+//
+// Tokens are single-use and only valid for the client that received them. The remainder
+// is dropped when the client disconnects from the bus, or when it has not been asked for
+// within the TTL (SF_PROVIDER_LIST_CURSOR_TTL). To bound memory use, we keep at most
+// SF_PROVIDER_MAX_CLIENT_LIST_CURSORS remainders per client and SF_PROVIDER_MAX_LIST_CURSORS
+// in total; once a limit is reached, the oldest remainder (of the client, or of all clients)
+// is dropped, and its token becomes invalid.
+
+class ListCursors : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ListCursors(QDBusConnection const& bus, QObject *parent=nullptr);
+    virtual ~ListCursors();
+
+    // True if token was returned by add() or next_page(), rather than by the provider.
+    static bool is_cursor_token(std::string const& token);
+
+    // Removes everything beyond the first page from items and returns the token for the
+    // next page. Returns next_token if items fits into a single page.
+    // method and item_id identify the request, so a token cannot be used with a different one.
+    std::string add(QString const& client_bus_name,
+                    std::string const& method,
+                    std::string const& item_id,
+                    ItemList& items,
+                    std::string const& next_token);
+
+    // Returns the page for token and the token for the page after that.
+    // Throws InvalidArgumentException if the token is unknown or has expired.
+    std::tuple<ItemList,std::string> next_page(QString const& client_bus_name,
+                                               std::string const& method,
+                                               std::string const& item_id,
+                                               std::string const& token);
+
+private Q_SLOTS:
+    void service_disconnected(QString const& service_name);
+
+private:
+    struct Cursor
+    {
+        std::string method;
+        std::string item_id;
+        ItemList items;                                   // Not yet handed out
+        ItemList::size_type pos;
+        std::string next_token;                           // From the provider
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    typedef std::map<std::pair<QString,std::string>,Cursor> CursorMap;
+
+    std::string store(QString const& client_bus_name, Cursor&& cursor);
+    void purge_expired();
+    void drop_oldest(CursorMap::iterator begin, CursorMap::iterator end);
+    void watch_peer(QString const& bus_name);
+    void unwatch_peer(QString const& bus_name);
+
+    ItemList::size_type const page_size_;
+    std::chrono::milliseconds const ttl_;
+    size_t const max_cursors_;
+    size_t const max_client_cursors_;
+
+    std::mutex lock_;
+    // Key is client_bus_name and token.
+    CursorMap cursors_;
+    int64_t next_id_ = 0;
+
+    QDBusServiceWatcher watcher_;
+    std::map<QString,int> services_;
+
+    Q_DISABLE_COPY(ListCursors)
+};
+
+}
+}
+}
+}
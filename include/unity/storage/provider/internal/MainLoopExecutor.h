@@ -22,6 +22,7 @@
 #include <boost/thread/executor.hpp>
 #include <QObject>
 
+#include <atomic>
 #include <functional>
 
 namespace unity
@@ -45,21 +46,44 @@ namespace internal
 
 #define EXEC_IN_MAIN MainLoopExecutor::instance(),
 
+/* submit() may be called from any thread. Closures go onto a lock-free
+ * queue, and only the first submit() after the queue was drained posts an
+ * event to wake up the main loop. The event handler then runs all queued
+ * closures in one go, so a burst of continuations costs a single event
+ * dispatch. To keep the main loop responsive, a batch stops after a time
+ * slice, and the remaining closures run after the pending events.
+ */
+
 class MainLoopExecutor : public QObject, public boost::executors::executor {
     Q_OBJECT
 public:
     static MainLoopExecutor& instance();
 
     void submit(work&& closure) override;
+    // Once closed, submit() throws boost::sync_queue_is_closed. Queued closures still run.
     void close() override;
     bool closed() override;
+    // Runs one queued closure. Returns false if there is none, or if not called from the main thread.
     bool try_executing_one() override;
 
     bool event(QEvent *event) override;
 
 private:
+    struct Node;
+
     MainLoopExecutor();
+    ~MainLoopExecutor();
     void execute(work& closure) noexcept;
+    void wake_up();
+    bool pop(work& closure);
+    void run_batch();
+
+    // Intrusive multi-producer, single-consumer queue (D. Vyukov).
+    // Producers push at head_, the main thread pops at tail_.
+    std::atomic<Node*> head_;
+    Node* tail_;
+    std::atomic<bool> wake_up_pending_;
+    std::atomic<bool> closed_;
 
     Q_DISABLE_COPY(MainLoopExecutor)
 };
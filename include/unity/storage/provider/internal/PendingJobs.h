@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <boost/thread/future.hpp>
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-align"
 #pragma GCC diagnostic ignored "-Wctor-dtor-privacy"
@@ -62,6 +63,9 @@ public:
     void add_upload(QString const& client_bus_name, std::unique_ptr<UploadJob> &&job);
     std::shared_ptr<UploadJob> remove_upload(QString const& client_bus_name, std::string const& upload_id);
 
+    int num_downloads();
+    int num_uploads();
+
 private Q_SLOTS:
     void service_disconnected(QString const& service_name);
 
@@ -69,8 +73,10 @@ private:
     void watch_peer(QString const& bus_name);
     void unwatch_peer(QString const& bus_name);
 
+    // f is the result of cancelling (or suspending) the job.
     template <typename Job>
     void cancel_job(std::shared_ptr<Job> const& job,
+                    boost::future<void> f,
                     std::string const& identifier);
 
     std::mutex lock_;
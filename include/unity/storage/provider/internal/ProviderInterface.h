@@ -20,6 +20,7 @@
 
 #include <unity/storage/internal/ItemMetadata.h>
 #include <unity/storage/provider/internal/Handler.h>
+#include <unity/storage/provider/internal/RequestScheduler.h>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-align"
@@ -30,6 +31,8 @@
 #include <QDBusConnection>
 #include <QDBusContext>
 #include <QDBusUnixFileDescriptor>
+#include <QStringList>
+#include <QVariantMap>
 #pragma GCC diagnostic pop
 
 #include <map>
@@ -61,8 +64,15 @@ private:
 public Q_SLOTS:
     QList<IMD> Roots(QList<QString> const& keys);
     QList<IMD> List(QString const& item_id, QString const& page_token, QList<QString> const& keys, QString& next_token);
+    QList<IMD> Search(QString const& item_id, QString const& pattern, QString const& page_token,
+                      QList<QString> const& keys, QString& next_token);
     QList<IMD> Lookup(QString const& parent_id, QString const& name, QList<QString> const& keys);
     IMD Metadata(QString const& item_id, QList<QString> const& keys);
+    QList<IMD> MetadataMany(QList<QString> const& item_ids,
+                            QList<QString> const& keys,
+                            QStringList& error_names,
+                            QStringList& error_messages,
+                            QVariantList& error_details);
     IMD CreateFolder(QString const& parent_id, QString const& name, QList<QString> const& keys);
     QString CreateFile(QString const& parent_id,
                        QString const& name,
@@ -78,9 +88,18 @@ public Q_SLOTS:
                    QDBusUnixFileDescriptor& file_descriptor);
     IMD FinishUpload(QString const& upload_id);
     void CancelUpload(QString const& upload_id);
+    int64_t ResumeUpload(QString const& upload_id,
+                         QList<QString> const& keys,
+                         QDBusUnixFileDescriptor& file_descriptor);
     QString Download(QString const& item_id, QString const& match_etag, QDBusUnixFileDescriptor& file_descriptor);
+    QString DownloadRange(QString const& item_id,
+                          QString const& match_etag,
+                          int64_t offset,
+                          int64_t length,
+                          QDBusUnixFileDescriptor& file_descriptor);
     void FinishDownload(QString const& download_id);
     void Delete(QString const& item_id);
+    QStringList DeleteMany(QList<QString> const& item_ids, QStringList& error_messages, QVariantList& error_details);
     IMD Move(QString const& item_id,
              QString const& new_parent_id,
              QString const& new_name,
@@ -89,14 +108,35 @@ public Q_SLOTS:
              QString const& new_parent_id,
              QString const& new_name,
              QList<QString> const& metadata_keys);
+    QList<IMD> MoveMany(QList<QString> const& item_ids,
+                        QString const& new_parent_id,
+                        QList<QString> const& new_names,
+                        QList<QString> const& metadata_keys,
+                        QStringList& error_names,
+                        QStringList& error_messages,
+                        QVariantList& error_details);
+    QList<IMD> CopyMany(QList<QString> const& item_ids,
+                        QString const& new_parent_id,
+                        QList<QString> const& new_names,
+                        QList<QString> const& metadata_keys,
+                        QStringList& error_names,
+                        QStringList& error_messages,
+                        QVariantList& error_details);
+    QStringList Capabilities();
+    void SetPriority(QString const& priority);
+
+    // com.canonical.StorageFramework.Stats
+    QVariantMap Snapshot(bool reset);
 
 private Q_SLOTS:
     void request_finished();
 
 private:
-    void queue_request(Handler::Callback callback);
+    // cost is the number of items for batch requests. See RequestScheduler.
+    void queue_request(Handler::Callback callback, int64_t cost = 1);
 
     std::shared_ptr<AccountData> const account_;
+    RequestScheduler scheduler_;
     std::map<Handler*, std::unique_ptr<Handler>> requests_;
 
     Q_DISABLE_COPY(ProviderInterface)
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <unity/storage/provider/ProviderBase.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-align"
+#pragma GCC diagnostic ignored "-Wctor-dtor-privacy"
+#pragma GCC diagnostic ignored "-Wswitch-default"
+#include <QDBusConnection>
+#include <QDBusServiceWatcher>
+#include <QObject>
+#include <QString>
+#pragma GCC diagnostic pop
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+class Handler;
+
+// Decides when the requests for an account are started, so a client that sends
+// a flood of requests cannot starve the other clients, and quick requests do not
+// have to wait for slow ones.
+//
+// Each client (keyed by its unique bus name) has its own queue per priority. At most
+// SF_PROVIDER_MAX_CLIENT_REQUESTS requests of a client, and at most
+// SF_PROVIDER_MAX_REQUESTS requests in total, run at the same time. Of the total,
+// bulk and background requests together may use three quarters, and background
+// requests a quarter, so there is always room for interactive requests.
+//
+// Whenever a request finishes, queued interactive requests are considered first,
+// then bulk, then background ones. Within a priority, clients take turns using
+// deficit round robin: each turn adds a fixed quantum to the client's credit, and
+// the client's requests are started for as long as the credit covers their cost.
+// A batch request costs as much as the number of items in it.
+//
+// Used from the main thread only.
+
+class RequestScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Stats
+    {
+        int64_t queued;          // Requests waiting to be started.
+        int64_t in_flight;       // Requests started and not finished yet.
+        int64_t clients;         // Clients with queued or running requests.
+        int64_t started;         // Requests started since the scheduler was created.
+        int64_t total_wait_us;   // Time the started requests spent in the queue.
+        int64_t max_wait_us;
+    };
+
+    explicit RequestScheduler(QObject* parent = nullptr);
+    virtual ~RequestScheduler();
+
+    // Queues the handler, and starts it right away if the caps permit.
+    void submit(QString const& client_bus_name, Handler* handler, Priority priority, int64_t cost = 1);
+
+    // Must be called once a started handler has sent its reply.
+    void finished(Handler* handler);
+
+    // Makes all further requests of the client use the given priority, instead of the
+    // one for the method, unless the one for the method is lower. The setting is
+    // dropped when the client disconnects.
+    void set_client_priority(QString const& client_bus_name, Priority priority, QDBusConnection const& bus);
+    void clear_client_priority(QString const& client_bus_name);
+    // Returns the client's priority, or dflt if the client has not set one or dflt is lower.
+    Priority client_priority(QString const& client_bus_name, Priority dflt) const;
+
+    Stats stats() const;
+
+private Q_SLOTS:
+    void service_disconnected(QString const& service_name);
+
+private:
+    static constexpr int NUM_PRIORITIES = 3;
+
+    struct Request
+    {
+        Handler* handler;
+        int64_t cost;
+        std::chrono::steady_clock::time_point queued_at;
+    };
+
+    struct Client
+    {
+        std::array<std::deque<Request>, NUM_PRIORITIES> queues;
+        std::array<int64_t, NUM_PRIORITIES> deficits {};
+        int in_flight = 0;
+    };
+
+    struct Running
+    {
+        QString client_bus_name;
+        int priority;
+    };
+
+    void dispatch();
+    void dispatch(int priority);
+    bool may_start(int priority) const;
+    void start(Client& client, QString const& client_bus_name, int priority);
+    void erase_if_idle(QString const& client_bus_name);
+
+    int const max_requests_;
+    int const max_client_requests_;
+    std::array<int, NUM_PRIORITIES> limits_;            // Number of requests at this priority or lower that may run.
+
+    std::map<QString,Client> clients_;
+    std::array<std::deque<QString>, NUM_PRIORITIES> active_;   // Clients with queued requests, in round robin order.
+    std::map<Handler*,Running> running_;                // Started handlers.
+    std::array<int, NUM_PRIORITIES> running_by_priority_ {};
+    int64_t queued_ = 0;
+    int64_t started_ = 0;
+    int64_t total_wait_us_ = 0;
+    int64_t max_wait_us_ = 0;
+
+    std::map<QString,Priority> client_priorities_;
+    QDBusServiceWatcher watcher_;
+
+    Q_DISABLE_COPY(RequestScheduler)
+};
+
+}
+}
+}
+}
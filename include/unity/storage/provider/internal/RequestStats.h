@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-align"
+#pragma GCC diagnostic ignored "-Wctor-dtor-privacy"
+#pragma GCC diagnostic ignored "-Wswitch-default"
+#include <QString>
+#include <QVariantMap>
+#pragma GCC diagnostic pop
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+// Per-method counters for the requests of an account, for the Stats interface.
+//
+// The set of methods and error types is fixed when the object is created, so record()
+// only does relaxed atomic increments and never takes a lock or allocates.
+// Latencies go into a histogram with four buckets per power of two, so percentiles
+// are accurate to within 25%.
+//
+// snapshot() is not atomic as a whole: a request that finishes while the snapshot is
+// taken may be counted in some fields and not others. If reset is true, each counter
+// is read and cleared in one step, so no request is lost between two snapshots.
+
+class RequestStats
+{
+public:
+    RequestStats();
+    ~RequestStats();
+
+    RequestStats(RequestStats const&) = delete;
+    RequestStats& operator=(RequestStats const&) = delete;
+
+    // error_name is the D-Bus error name of the reply, or empty if the request succeeded.
+    // Requests for unknown methods are ignored.
+    void record(QString const& method, QString const& error_name, int64_t latency_us, int64_t wait_us) noexcept;
+    void add_bytes_uploaded(int64_t bytes) noexcept;
+
+    // Returns a map with an entry per method that was called, plus "bytes_uploaded".
+    QVariantMap snapshot(bool reset);
+
+private:
+    static constexpr int NUM_BUCKETS = 160;   // Up to 2^41 us (25 days)
+
+    struct MethodCounters;
+
+    static int bucket(int64_t us) noexcept;
+    static int64_t bucket_limit(int b) noexcept;
+
+    std::map<QString, std::unique_ptr<MethodCounters>> methods_;
+    std::atomic<int64_t> bytes_uploaded_;
+};
+
+}
+}
+}
+}
@@ -59,6 +59,7 @@ public:
     void report_error(std::exception_ptr p);
     boost::future<Item> finish(UploadJob& job);
     boost::future<void> cancel(UploadJob& job);
+    boost::future<void> suspend(UploadJob& job);
 
 public Q_SLOTS:
     virtual void complete_init();
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QString>
+#include <QVariantList>
+
+#include <exception>
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+// The D-Bus error that is returned to the client for an exception thrown by a provider:
+// the error name and message, plus any additional arguments of the error reply
+// (such as the key of a NotExistsException).
+
+struct DBusError
+{
+    QString name;
+    QString message;
+    QVariantList args;
+};
+
+DBusError marshal_error(std::exception_ptr const& ep);
+
+}
+}
+}
+}
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <unity/storage/qt/Item.h>
+
 #include <QMetaType>
 #include <QStringList>
 
@@ -37,8 +39,10 @@ class ItemImpl;
 
 }
 
+class CapabilitiesJob;
 class ItemJob;
 class ItemListJob;
+class VoidJob;
 
 class Q_DECL_EXPORT Account final
 {
@@ -67,6 +71,25 @@ public:
 
     Q_INVOKABLE unity::storage::qt::ItemListJob* roots(QStringList const& keys = QStringList()) const;
     Q_INVOKABLE unity::storage::qt::ItemJob* get(QString const& itemId, QStringList const& keys = QStringList()) const;
+    // Like get(), but for several items with a single request. The job reports the items that
+    // were found and, if any of them could not be retrieved, ends with the error for the first one.
+    Q_INVOKABLE unity::storage::qt::ItemListJob* getItems(QStringList const& itemIds,
+                                                          QStringList const& keys = QStringList()) const;
+
+    // Batch versions of Item::deleteItem(), Item::move(), and Item::copy() that use a single
+    // request for all items. The items keep their names. The jobs report the items that
+    // were moved or copied and, if any item failed, end with the error for the first one.
+    Q_INVOKABLE unity::storage::qt::VoidJob* deleteItems(QList<unity::storage::qt::Item> const& items) const;
+    Q_INVOKABLE unity::storage::qt::ItemListJob* moveItems(QList<unity::storage::qt::Item> const& items,
+                                                           unity::storage::qt::Item const& newParent,
+                                                           QStringList const& keys = QStringList()) const;
+    Q_INVOKABLE unity::storage::qt::ItemListJob* copyItems(QList<unity::storage::qt::Item> const& items,
+                                                           unity::storage::qt::Item const& newParent,
+                                                           QStringList const& keys = QStringList()) const;
+
+    // Optional features supported by the provider. For example, check for "download_range"
+    // before calling Item::createDownloader() with an offset and length.
+    Q_INVOKABLE unity::storage::qt::CapabilitiesJob* capabilities() const;
 
     bool operator==(Account const&) const;
     bool operator!=(Account const&) const;
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QStringList>
+
+#include <memory>
+
+namespace unity
+{
+namespace storage
+{
+namespace qt
+{
+namespace internal
+{
+
+class CapabilitiesJobImpl;
+
+}  // namespace internal
+
+class StorageError;
+
+// Retrieves the optional features supported by an account's provider, such as
+// "download_range" (see unity::storage::capability). Providers that predate
+// capabilities finish with an empty list.
+
+class Q_DECL_EXPORT CapabilitiesJob final : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool isValid READ isValid NOTIFY statusChanged FINAL)
+    Q_PROPERTY(unity::storage::qt::CapabilitiesJob::Status status READ status NOTIFY statusChanged FINAL)
+    Q_PROPERTY(unity::storage::qt::StorageError error READ error NOTIFY statusChanged FINAL)
+    Q_PROPERTY(QStringList capabilities READ capabilities NOTIFY statusChanged FINAL)
+
+public:
+    virtual ~CapabilitiesJob();
+
+    enum Status { Loading, Finished, Error };
+    Q_ENUMS(Status)
+
+    bool isValid() const;
+    Status status() const;
+    StorageError error() const;
+    QStringList capabilities() const;
+
+Q_SIGNALS:
+    void statusChanged(unity::storage::qt::CapabilitiesJob::Status status) const;
+
+private:
+    CapabilitiesJob(std::unique_ptr<internal::CapabilitiesJobImpl> p);
+
+    std::unique_ptr<internal::CapabilitiesJobImpl> const p_;
+
+    friend class internal::CapabilitiesJobImpl;
+};
+
+}  // namespace qt
+}  // namespace storage
+}  // namespace unity
+
+Q_DECLARE_METATYPE(unity::storage::qt::CapabilitiesJob::Status)
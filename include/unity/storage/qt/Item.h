@@ -111,9 +111,16 @@ public:
                                                              qint64 sizeInBytes,
                                                              QStringList const& keys = QStringList()) const;
     Q_INVOKABLE unity::storage::qt::Downloader* createDownloader(ConflictPolicy policy) const;
+    // Downloads length bytes starting at offset. Only for providers that list "download_range"
+    // in Account::capabilities().
+    Q_INVOKABLE unity::storage::qt::Downloader* createDownloader(ConflictPolicy policy,
+                                                                 qint64 offset,
+                                                                 qint64 length) const;
 
     Q_INVOKABLE unity::storage::qt::ItemListJob* list(QStringList const& keys = QStringList()) const;
     Q_INVOKABLE unity::storage::qt::ItemListJob* lookup(QString const& name, QStringList const& = QStringList()) const;
+    Q_INVOKABLE unity::storage::qt::ItemListJob* search(QString const& pattern,
+                                                        QStringList const& keys = QStringList()) const;
     Q_INVOKABLE unity::storage::qt::ItemJob* createFolder(QString const& name, QStringList const& = QStringList()) const;
     Q_INVOKABLE unity::storage::qt::Uploader* createFile(QString const& name,
                                                          ConflictPolicy policy,
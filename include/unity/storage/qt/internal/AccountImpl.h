@@ -19,6 +19,7 @@
 #pragma once
 
 #include <unity/storage/qt/Item.h>
+#include <unity/storage/qt/StorageError.h>
 #include <unity/storage/internal/AccountDetails.h>
 
 class ProviderInterface;
@@ -29,6 +30,9 @@ namespace storage
 {
 namespace qt
 {
+
+class CapabilitiesJob;
+
 namespace internal
 {
 
@@ -52,6 +56,11 @@ public:
 
     ItemListJob* roots(QStringList const& keys) const;
     ItemJob* get(QString const& itemId, QStringList const& keys) const;
+    ItemListJob* getItems(QStringList const& itemIds, QStringList const& keys) const;
+    VoidJob* deleteItems(QList<Item> const& items) const;
+    ItemListJob* moveItems(QList<Item> const& items, Item const& newParent, QStringList const& keys) const;
+    ItemListJob* copyItems(QList<Item> const& items, Item const& newParent, QStringList const& keys) const;
+    CapabilitiesJob* capabilities() const;
 
     bool operator==(AccountImpl const&) const;
     bool operator!=(AccountImpl const&) const;
@@ -65,6 +74,10 @@ public:
     std::shared_ptr<RuntimeImpl> runtime_impl() const;
     std::shared_ptr<ProviderInterface> provider() const;
 
+    // False once a call has shown that the provider predates MetadataMany.
+    bool supports_metadata_many() const;
+    void set_supports_metadata_many(bool supported);
+
     static Account make_account(std::shared_ptr<RuntimeImpl> const& runtime_impl,
                                 storage::internal::AccountDetails const& details);
 
@@ -72,10 +85,18 @@ private:
     AccountImpl(std::shared_ptr<RuntimeImpl> const& runtime_impl,
                 storage::internal::AccountDetails const& details);
 
+    StorageError check_batch_precondition(QString const& method, QList<Item> const& items) const;
+    ItemListJob* move_or_copy_items(QString const& method,
+                                    QList<Item> const& items,
+                                    Item const& newParent,
+                                    QStringList const& keys,
+                                    bool copy) const;
+
     bool is_valid_;
     storage::internal::AccountDetails details_;
     std::weak_ptr<RuntimeImpl> runtime_impl_;
     std::shared_ptr<ProviderInterface> provider_;
+    bool supports_metadata_many_ = true;
 
     friend class unity::storage::qt::Account;
 };
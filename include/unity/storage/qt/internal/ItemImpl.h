@@ -64,9 +64,10 @@ public:
     ItemJob* move(Item const& newParent, QString const& newName, QStringList const& keys) const;
     VoidJob* deleteItem() const;
     Uploader* createUploader(Item::ConflictPolicy policy, qint64 sizeInBytes, QStringList const& keys) const;
-    Downloader* createDownloader(Item::ConflictPolicy policy) const;
+    Downloader* createDownloader(Item::ConflictPolicy policy, qint64 offset, qint64 length) const;
     ItemListJob* list(QStringList const& keys) const;
     ItemListJob* lookup(QString const& name, QStringList const& keys) const;
+    ItemListJob* search(QString const& pattern, QStringList const& keys) const;
     ItemJob* createFolder(QString const& name, QStringList const& keys) const;
     Uploader* createFile(QString const& name) const;
     Uploader* createFile(QString const& name,
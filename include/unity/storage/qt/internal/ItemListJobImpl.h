@@ -56,6 +56,10 @@ public:
                                  QString const& method,
                                  QDBusPendingReply<QList<storage::internal::ItemMetadata>>& reply,
                                  std::function<void(storage::internal::ItemMetadata const&)> const& validate);
+    static ItemListJob* make_job(std::shared_ptr<AccountImpl> const& account_impl,
+                                 QString const& method,
+                                 QDBusPendingReply<QList<storage::internal::ItemMetadata>, QStringList, QStringList, QVariantList>& reply,
+                                 std::function<void(storage::internal::ItemMetadata const&)> const& validate);
     static ItemListJob* make_job(StorageError const& error);
 
 private:
@@ -69,6 +73,13 @@ private:
                     QDBusPendingReply<QList<storage::internal::ItemMetadata>>& reply,
                     std::function<void(storage::internal::ItemMetadata const&)> const& validate);
 
+    ItemListJobImpl(std::shared_ptr<AccountImpl> const& account_impl,
+                    QString const& method,
+                    QDBusPendingReply<QList<storage::internal::ItemMetadata>, QStringList, QStringList, QVariantList>& reply,
+                    std::function<void(storage::internal::ItemMetadata const&)> const& validate);
+
+    QList<Item> make_items(QList<storage::internal::ItemMetadata> const& metadata);
+
     std::shared_ptr<ItemImpl> item_impl_;
 };
 
@@ -44,7 +44,6 @@ namespace internal
 {
 
 class AccountImpl;
-class MultiItemJobImpl;
 
 class ListJobImplBase : public QObject
 {
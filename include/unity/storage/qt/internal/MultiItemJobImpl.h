@@ -22,6 +22,7 @@
 #include <unity/storage/qt/ItemListJob.h>
 
 #include <QDBusPendingReply>
+#include <QVector>
 
 namespace unity
 {
@@ -41,28 +42,44 @@ namespace internal
 
 class AccountImpl;
 
+// Retrieves the metadata for several items with a single MetadataMany call. Providers that
+// predate MetadataMany reply with UnknownMethod; for those, the job falls back to one
+// Metadata call per item, and the account remembers not to try MetadataMany again.
+// Either way, the job reports the items that were found in a single itemsReady signal and,
+// if any item could not be retrieved, ends with the error for the first one.
+
 class MultiItemJobImpl : public ListJobImplBase
 {
     Q_OBJECT
 public:
-    using ReplyType = QList<QDBusPendingReply<storage::internal::ItemMetadata>>;
     using ValidateFunc = std::function<void(storage::internal::ItemMetadata const&)>;
 
     virtual ~MultiItemJobImpl() = default;
 
     static ItemListJob* make_job(std::shared_ptr<AccountImpl> const& account_impl,
                                  QString const& method,
-                                 ReplyType& replies,
+                                 QStringList const& item_ids,
+                                 QStringList const& keys,
                                  ValidateFunc const& validate);
 
 private:
     MultiItemJobImpl() = default;
     MultiItemJobImpl(std::shared_ptr<AccountImpl> const& account_impl,
                      QString const& method,
-                     ReplyType& replies,
+                     QStringList const& item_ids,
+                     QStringList const& keys,
                      ValidateFunc const& validate);
 
-    int replies_remaining_;
+    void get_all();
+    void get_each();
+    void item_done();
+    void finish(QList<storage::internal::ItemMetadata> const& metadata, StorageError const& error);
+
+    QStringList item_ids_;
+    QStringList keys_;
+    QVector<storage::internal::ItemMetadata> metadata_;  // For get_each(), one entry per item.
+    QVector<StorageError> errors_;
+    int replies_remaining_ = 0;
 };
 
 }  // namespace internal
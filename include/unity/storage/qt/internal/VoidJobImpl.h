@@ -37,6 +37,7 @@ namespace qt
 namespace internal
 {
 
+class AccountImpl;
 class ItemImpl;
 
 class VoidJobImpl : public QObject
@@ -52,18 +53,25 @@ public:
     static VoidJob* make_job(std::shared_ptr<ItemImpl> const& item_impl,
                              QString const& method,
                              QDBusPendingReply<void>& reply);
+    static VoidJob* make_job(std::shared_ptr<AccountImpl> const& account_impl,
+                             QString const& method,
+                             QDBusPendingReply<QStringList, QStringList, QVariantList>& reply);
     static VoidJob* make_job(StorageError const& e);
 
 private:
     VoidJobImpl(std::shared_ptr<ItemImpl> const& item_impl,
                 QString const& method,
                 QDBusPendingReply<void>& reply);
+    VoidJobImpl(std::shared_ptr<AccountImpl> const& account_impl,
+                QString const& method,
+                QDBusPendingReply<QStringList, QStringList, QVariantList>& reply);
     VoidJobImpl(StorageError const& e);
 
     VoidJob* public_instance_;
     VoidJob::Status status_;
     StorageError error_;
     QString method_;
+    std::shared_ptr<AccountImpl> account_impl_;
     std::shared_ptr<ItemImpl> item_impl_;
 };
 
@@ -20,6 +20,9 @@
 
 #include <unity/storage/qt/StorageError.h>
 
+#include <QStringList>
+#include <QVariantList>
+
 class QDBusPendingCallWatcher;
 
 namespace unity
@@ -33,6 +36,12 @@ namespace internal
 
 StorageError unmarshal_error(QDBusPendingCallWatcher const& call);
 
+// Returns the error for the first item that failed in the reply of a batch method
+// (DeleteMany, etc.), or an error of type NoError if all items succeeded.
+StorageError unmarshal_error(QStringList const& error_names,
+                             QStringList const& error_messages,
+                             QVariantList const& error_details);
+
 }  // namespace internal
 }  // namespace qt
 }  // storage
@@ -42,9 +42,49 @@ int EnvVars::provider_timeout_ms()
     return get_timeout_ms(PROVIDER_IDLE_TIMEOUT, PROVIDER_IDLE_TIMEOUT_DFLT);
 }
 
+int EnvVars::provider_list_page_size()
+{
+    return get_int(PROVIDER_LIST_PAGE_SIZE, PROVIDER_LIST_PAGE_SIZE_DFLT, 1);
+}
+
+int EnvVars::provider_list_cursor_ttl_ms()
+{
+    return get_timeout_ms(PROVIDER_LIST_CURSOR_TTL, PROVIDER_LIST_CURSOR_TTL_DFLT);
+}
+
+int EnvVars::provider_max_list_cursors()
+{
+    return get_int(PROVIDER_MAX_LIST_CURSORS, PROVIDER_MAX_LIST_CURSORS_DFLT, 1);
+}
+
+int EnvVars::provider_max_client_list_cursors()
+{
+    return get_int(PROVIDER_MAX_CLIENT_LIST_CURSORS, PROVIDER_MAX_CLIENT_LIST_CURSORS_DFLT, 1);
+}
+
+int EnvVars::provider_max_requests()
+{
+    return get_int(PROVIDER_MAX_REQUESTS, PROVIDER_MAX_REQUESTS_DFLT, 1);
+}
+
+int EnvVars::provider_max_client_requests()
+{
+    return get_int(PROVIDER_MAX_CLIENT_REQUESTS, PROVIDER_MAX_CLIENT_REQUESTS_DFLT, 1);
+}
+
+bool EnvVars::provider_stats()
+{
+    return get_int(PROVIDER_STATS, PROVIDER_STATS_DFLT, 0) != 0;
+}
+
 int EnvVars::get_timeout_ms(char const* var_name, int dflt)
 {
-    int timeout = dflt;
+    return get_int(var_name, dflt, 0) * 1000;
+}
+
+int EnvVars::get_int(char const* var_name, int dflt, int min)
+{
+    int value = dflt;
 
     auto const val = get(var_name);
     if (!val.empty())
@@ -57,11 +97,11 @@ int EnvVars::get_timeout_ms(char const* var_name, int dflt)
             {
                 throw invalid_argument("unexpected trailing character(s)");
             }
-            if (int_val < 0)
+            if (int_val < min)
             {
-                throw invalid_argument("value must be >= 0");
+                throw invalid_argument("value must be >= " + to_string(min));
             }
-            timeout = int_val;
+            value = int_val;
         }
         catch (std::exception const& e)
         {
@@ -71,7 +111,7 @@ int EnvVars::get_timeout_ms(char const* var_name, int dflt)
             qWarning().nospace() << "Using default value of " << dflt;
         }
     }
-    return timeout * 1000;
+    return value;
 }
 
 string EnvVars::get(char const* var_name)
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "ContentTypeCache.h"
+
+#include <unity/storage/internal/gobj_memory.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <cassert>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#include <gio/gio.h>
+#pragma GCC diagnostic pop
+
+using namespace std;
+
+namespace
+{
+
+char const* const DIRECTORY_CONTENT_TYPE = "inode/directory";
+char const* const UNKNOWN_CONTENT_TYPE = "application/octet-stream";
+
+// Extensions for which the shared MIME database has exactly one glob,
+// so the answer is the same as the one from GIO. Keys are lower case.
+
+unordered_map<string, string> const extension_types =
+{
+    { "bmp",  "image/bmp" },
+    { "css",  "text/css" },
+    { "csv",  "text/csv" },
+    { "gif",  "image/gif" },
+    { "htm",  "text/html" },
+    { "html", "text/html" },
+    { "jpe",  "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "jpg",  "image/jpeg" },
+    { "json", "application/json" },
+    { "mkv",  "video/x-matroska" },
+    { "mov",  "video/quicktime" },
+    { "mp3",  "audio/mpeg" },
+    { "mp4",  "video/mp4" },
+    { "pdf",  "application/pdf" },
+    { "png",  "image/png" },
+    { "svg",  "image/svg+xml" },
+    { "tif",  "image/tiff" },
+    { "tiff", "image/tiff" },
+    { "txt",  "text/plain" },
+    { "webm", "video/webm" },
+    { "webp", "image/webp" },
+    { "xml",  "application/xml" },
+    { "zip",  "application/zip" }
+};
+
+string gio_content_type(string const& path)
+{
+    using namespace unity::storage::internal;
+
+    gobj_ptr<GFile> file(g_file_new_for_path(path.c_str()));
+    assert(file);  // Cannot fail according to doc.
+
+    GError* err = nullptr;
+    gobj_ptr<GFileInfo> full_info(g_file_query_info(file.get(),
+                                                    G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE,
+                                                    G_FILE_QUERY_INFO_NONE,
+                                                    /* cancellable */ NULL,
+                                                    &err));
+    if (!full_info)
+    {
+        g_clear_error(&err);           // LCOV_EXCL_LINE
+        return UNKNOWN_CONTENT_TYPE;   // LCOV_EXCL_LINE
+    }
+
+    string content_type = g_file_info_get_attribute_string(full_info.get(), G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE);
+    if (content_type.empty())
+    {
+        return UNKNOWN_CONTENT_TYPE;  // LCOV_EXCL_LINE
+    }
+    return content_type;
+}
+
+}  // namespace
+
+bool ContentTypeCache::Key::operator==(Key const& other) const noexcept
+{
+    return dev == other.dev && ino == other.ino && mtime_nsecs == other.mtime_nsecs;
+}
+
+size_t ContentTypeCache::KeyHash::operator()(Key const& k) const noexcept
+{
+    size_t h = hash<ino_t>()(k.ino);
+    h = h * 31 + hash<dev_t>()(k.dev);
+    h = h * 31 + hash<int64_t>()(k.mtime_nsecs);
+    return h;
+}
+
+ContentTypeCache::ContentTypeCache(int max_entries)
+    : max_entries_(max_entries)
+    , hits_(0)
+    , misses_(0)
+    , fast_path_(0)
+{
+    assert(max_entries > 0);
+}
+
+string ContentTypeCache::get(string const& path, struct stat const& st)
+{
+    if (S_ISDIR(st.st_mode))
+    {
+        lock_guard<mutex> guard(mutex_);
+        ++fast_path_;
+        return DIRECTORY_CONTENT_TYPE;
+    }
+
+    auto const slash = path.rfind('/');
+    string const filename = slash == string::npos ? path : path.substr(slash + 1);
+    auto const dot = filename.rfind('.');
+    if (dot != string::npos && dot != 0)
+    {
+        auto it = extension_types.find(boost::algorithm::to_lower_copy(filename.substr(dot + 1)));
+        if (it != extension_types.end())
+        {
+            lock_guard<mutex> guard(mutex_);
+            ++fast_path_;
+            return it->second;
+        }
+    }
+
+    Key const key{ st.st_dev, st.st_ino, int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec };
+    {
+        lock_guard<mutex> guard(mutex_);
+        auto it = map_.find(key);
+        if (it != map_.end() && it->second->filename == filename)
+        {
+            lru_.splice(lru_.begin(), lru_, it->second);  // Move to front.
+            ++hits_;
+            return it->second->content_type;
+        }
+        ++misses_;
+    }
+
+    // We don't hold the lock while calling into GIO. If two threads look up the same
+    // file concurrently, both call GIO, which is harmless.
+    string content_type = gio_content_type(path);
+
+    lock_guard<mutex> guard(mutex_);
+    auto it = map_.find(key);
+    if (it != map_.end())
+    {
+        lru_.erase(it->second);
+        map_.erase(it);
+    }
+    lru_.push_front(Entry{ key, filename, content_type });
+    map_[key] = lru_.begin();
+    if (int(map_.size()) > max_entries_)
+    {
+        map_.erase(lru_.back().key);
+        lru_.pop_back();
+    }
+    return content_type;
+}
+
+ContentTypeCache::Stats ContentTypeCache::stats() const
+{
+    lock_guard<mutex> guard(mutex_);
+    return Stats{ hits_, misses_, fast_path_, int64_t(map_.size()) };
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <sys/stat.h>
+
+// Resolves content types for the local provider.
+//
+// Directories are always "inode/directory". For files with a common extension,
+// we use a built-in table that matches what GIO returns. Everything else
+// is looked up with GIO (which is expensive), and the result is cached,
+// keyed by device, inode, and modification time. The cache holds at most
+// max_entries entries and evicts the least-recently used one first.
+// All methods are thread-safe.
+
+class ContentTypeCache
+{
+public:
+    struct Stats
+    {
+        int64_t hits;
+        int64_t misses;       // Number of GIO lookups.
+        int64_t fast_path;    // Number of lookups resolved by type or file extension.
+        int64_t size;         // Current number of entries.
+    };
+
+    // max_entries must be > 0.
+    explicit ContentTypeCache(int max_entries);
+
+    ContentTypeCache(ContentTypeCache const&) = delete;
+    ContentTypeCache& operator=(ContentTypeCache const&) = delete;
+
+    // Returns the content type for the file or directory at path, with st the result of stat() for path.
+    std::string get(std::string const& path, struct stat const& st);
+
+    Stats stats() const;
+
+private:
+    struct Key
+    {
+        dev_t dev;
+        ino_t ino;
+        int64_t mtime_nsecs;
+
+        bool operator==(Key const& other) const noexcept;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(Key const& k) const noexcept;
+    };
+
+    struct Entry
+    {
+        Key key;
+        std::string filename;      // The GIO result depends on the name, so a renamed file is a miss.
+        std::string content_type;
+    };
+
+    typedef std::list<Entry> LRUList;  // Most-recently used entry at the front.
+
+    int const max_entries_;
+    mutable std::mutex mutex_;
+    LRUList lru_;
+    std::unordered_map<Key, LRUList::iterator, KeyHash> map_;
+    int64_t hits_;
+    int64_t misses_;
+    int64_t fast_path_;
+};
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "CrossDeviceMover.h"
+
+#include "FileCopier.h"
+#include "LocalProvider.h"
+#include "TreeCopier.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+
+using namespace unity::storage::provider;
+using namespace std;
+
+namespace
+{
+
+// Cross-device moves are limited by device bandwidth, so a few threads are enough.
+int constexpr MOVER_THREADS = 2;
+int constexpr MOVER_QUEUE_DEPTH = 256;
+
+}  // namespace
+
+CrossDeviceMover::CrossDeviceMover(LocalProvider const& provider)
+    : provider_(provider)
+    , cancelled_(false)
+    , pool_(MOVER_THREADS, MOVER_QUEUE_DEPTH)
+{
+}
+
+CrossDeviceMover::~CrossDeviceMover()
+{
+    cancel();
+}
+
+boost::future<Item> CrossDeviceMover::move(string const& method,
+                                           string const& source,
+                                           string const& target,
+                                           vector<string> const& keys)
+{
+    auto do_move = [this, method, source, target, keys]
+    {
+        using namespace boost::filesystem;
+
+        CopyOptions options;
+        options.sync = true;
+        options.cancelled = &cancelled_;
+
+        // rename() would have moved a symlink rather than what it points at, so we don't follow it.
+        struct stat st;
+        if (lstat(source.c_str(), &st) == -1)
+        {
+            throw_storage_exception(method, "lstat", source, errno);
+        }
+
+        path const target_path = target;
+        path const tmp_path = target_path.parent_path()
+                              / unique_path(string(TMPFILE_PREFIX) + "-%%%%-%%%%-%%%%-%%%%");
+        try
+        {
+            if (S_ISDIR(st.st_mode))
+            {
+                if (mkdir(tmp_path.c_str(), st.st_mode & 07777) == -1)
+                {
+                    throw_storage_exception(method, "mkdir", tmp_path.native(), errno);
+                }
+                // Everything in the tree is recreated, so nothing is lost when the source is removed.
+                TreeCopier copier(pool_, method, options, TreeCopier::Special::recreate);
+                copier.copy_contents(source, tmp_path.native());
+            }
+            else if (S_ISREG(st.st_mode))
+            {
+                FileCopier::copy(method, source, tmp_path.native(), options);
+            }
+            else
+            {
+                TreeCopier::copy_special(method, source, st, tmp_path.native());
+            }
+            FileCopier::throw_if_cancelled(method, source, options);
+            rename(tmp_path, target_path);
+        }
+        catch (...)
+        {
+            boost::system::error_code ec;
+            remove_all(tmp_path, ec);  // Don't leave a partial copy behind.
+            throw;
+        }
+        fsync_dir(method, target_path.parent_path().native());
+
+        // The copy is safely on disk, so it's now OK to remove the original.
+        remove_all(source);
+        if (provider_.usage_cache())
+        {
+            provider_.usage_cache()->removed(source, st);
+            provider_.usage_cache()->added(target);
+        }
+        return provider_.make_item(method, target_path, keys);
+    };
+
+    return invoke_async(pool_, method, do_move);
+}
+
+void CrossDeviceMover::cancel() noexcept
+{
+    cancelled_ = true;
+}
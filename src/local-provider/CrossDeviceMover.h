@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <unity/storage/provider/Item.h>
+
+#include <boost/thread/future.hpp>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+class LocalProvider;
+
+// Moves files and directories between file systems, where rename() fails with EXDEV.
+//
+// The source is copied to a temporary name next to the target, using the
+// fastest copy mechanism the file systems support. Once everything is on disk
+// (file data and directory entries are fsync'd), the copy is renamed into place
+// and only then is the source removed. Symlinks are not followed, and symlinks,
+// FIFOs, sockets and device nodes are recreated, as rename() would have kept them.
+// If anything goes wrong, including an entry that cannot be recreated, the partial
+// copy is removed and the source is left alone.
+//
+// Such a move can take minutes, so it runs on a small pool of its own instead
+// of tying up the provider's pool. After cancel(), which the destructor calls,
+// all moves that are in progress, queued, or submitted later fail with a
+// CancelledException.
+
+class CrossDeviceMover
+{
+public:
+    CrossDeviceMover(LocalProvider const& provider);
+    ~CrossDeviceMover();
+
+    CrossDeviceMover(CrossDeviceMover const&) = delete;
+    CrossDeviceMover& operator=(CrossDeviceMover const&) = delete;
+
+    boost::future<unity::storage::provider::Item> move(std::string const& method,
+                                                       std::string const& source,
+                                                       std::string const& target,
+                                                       std::vector<std::string> const& keys);
+    void cancel() noexcept;
+
+private:
+    LocalProvider const& provider_;
+    std::atomic<bool> cancelled_;
+    ThreadPool pool_;  // Must be last, so it finishes its tasks before anything else is destroyed.
+};
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "DirStream.h"
+
+#include "utils.h"
+
+#include <cassert>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+using namespace std;
+
+DirStream::DirStream(string const& method, string const& path)
+    : method_(method)
+    , path_(path)
+    , dir_(opendir(path.c_str()))
+    , type_(DT_UNKNOWN)
+    , at_end_(false)
+{
+    if (!dir_)
+    {
+        throw_storage_exception(method, "opendir", path, errno);
+    }
+    advance();
+}
+
+DirStream::~DirStream()
+{
+    closedir(dir_);
+}
+
+string const& DirStream::path() const noexcept
+{
+    return path_;
+}
+
+int DirStream::fd() const noexcept
+{
+    return dirfd(dir_);
+}
+
+bool DirStream::at_end() const noexcept
+{
+    return at_end_;
+}
+
+string const& DirStream::name() const noexcept
+{
+    assert(!at_end_);
+    return name_;
+}
+
+void DirStream::advance()
+{
+    for (;;)
+    {
+        errno = 0;
+        auto dirent = readdir(dir_);
+        if (!dirent)
+        {
+            if (errno != 0)
+            {
+                throw_storage_exception(method_, "readdir", path_, errno);  // LCOV_EXCL_LINE
+            }
+            at_end_ = true;
+            name_.clear();
+            return;
+        }
+        if (strcmp(dirent->d_name, ".") != 0 && strcmp(dirent->d_name, "..") != 0)
+        {
+            name_ = dirent->d_name;
+            type_ = dirent->d_type;
+            return;
+        }
+    }
+}
+
+bool DirStream::stat(struct stat& st) const noexcept
+{
+    assert(!at_end_);
+    return fstatat(dirfd(dir_), name_.c_str(), &st, 0) == 0;
+}
+
+bool DirStream::lstat(struct stat& st) const noexcept
+{
+    assert(!at_end_);
+    return fstatat(dirfd(dir_), name_.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+bool DirStream::is_dir() const noexcept
+{
+    assert(!at_end_);
+    if (type_ != DT_UNKNOWN)
+    {
+        return type_ == DT_DIR;
+    }
+    struct stat st;
+    return fstatat(dirfd(dir_), name_.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <string>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Thin wrapper around opendir()/readdir(). Unlike boost::filesystem::directory_iterator,
+// this gives access to the directory fd, so callers can use fstatat() and friends
+// on the entries without resolving the directory path again for each entry.
+// "." and ".." are skipped.
+
+class DirStream
+{
+public:
+    // Throws a StorageException if the directory cannot be opened.
+    DirStream(std::string const& method, std::string const& path);
+    ~DirStream();
+
+    DirStream(DirStream const&) = delete;
+    DirStream& operator=(DirStream const&) = delete;
+
+    std::string const& path() const noexcept;
+    int fd() const noexcept;
+
+    bool at_end() const noexcept;
+    std::string const& name() const noexcept;  // Name of the current entry. Precondition: !at_end()
+    void advance();
+
+    // Stat the current entry relative to the directory fd, following symlinks.
+    // Returns false if the entry has disappeared or cannot be examined.
+    bool stat(struct stat& st) const noexcept;
+
+    // Same as stat(), but does not follow symlinks.
+    bool lstat(struct stat& st) const noexcept;
+
+    // True if the current entry is a directory (not a symlink to one). Free if the
+    // file system fills in d_type, otherwise this costs an fstatat().
+    bool is_dir() const noexcept;
+
+private:
+    std::string const method_;
+    std::string const path_;
+    DIR* dir_;
+    std::string name_;
+    unsigned char type_;
+    bool at_end_;
+};
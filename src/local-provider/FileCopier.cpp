@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "FileCopier.h"
+
+#include "utils.h"
+
+#include <unity/storage/provider/Exceptions.h>
+#include <unity/util/ResourcePtr.h>
+
+#include <boost/exception/enable_current_exception.hpp>
+#include <QDebug>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace unity::storage::provider;
+using namespace std;
+
+namespace
+{
+
+// Cancellation is checked after each chunk, so the chunk size bounds how long it takes to notice.
+int64_t constexpr COPY_CHUNK_SIZE = 64 * 1024 * 1024;  // Max bytes per copy_file_range() call
+size_t constexpr BUFFER_SIZE = 1024 * 1024;            // Buffer size for read()/write() fallback
+
+atomic<int64_t> reflinks(0);
+atomic<int64_t> copy_file_range_copies(0);
+atomic<int64_t> read_write_copies(0);
+atomic<int64_t> bytes_copied(0);
+atomic<int> last_strategy(-1);
+
+// These errors mean "this file system (or kernel) can't do this", as opposed to a real I/O error.
+
+bool not_supported(int err)
+{
+    return err == EOPNOTSUPP || err == ENOTTY || err == ENOSYS || err == EXDEV || err == EINVAL;
+}
+
+// Returns false if copy_file_range() is not supported for these files, or if
+// it copied nothing at all (which happens on some pseudo file systems).
+
+bool copy_with_copy_file_range(string const& method,
+                               string const& target,
+                               int in_fd,
+                               int out_fd,
+                               CopyOptions const& options)
+{
+#ifdef __NR_copy_file_range
+    int64_t total = 0;
+    for (;;)
+    {
+        FileCopier::throw_if_cancelled(method, target, options);
+        auto rc = syscall(__NR_copy_file_range, in_fd, nullptr, out_fd, nullptr, COPY_CHUNK_SIZE, 0);
+        if (rc == -1)
+        {
+            if (total == 0 && not_supported(errno))
+            {
+                return false;
+            }
+            throw_storage_exception(method, "copy_file_range", target, errno);
+        }
+        if (rc == 0)
+        {
+            break;
+        }
+        total += rc;
+    }
+    bytes_copied += total;
+    if (total == 0)
+    {
+        return false;  // Empty file, or a file system that returns 0. The fallback will find out.
+    }
+    return true;
+#else
+    (void)method;
+    (void)target;
+    (void)in_fd;
+    (void)out_fd;
+    (void)options;
+    return false;
+#endif
+}
+
+void copy_with_read_write(string const& method,
+                          string const& source,
+                          string const& target,
+                          int in_fd,
+                          int out_fd,
+                          CopyOptions const& options)
+{
+    posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    unique_ptr<char[]> buf(new char[BUFFER_SIZE]);
+    for (;;)
+    {
+        FileCopier::throw_if_cancelled(method, target, options);
+        auto bytes_read = read(in_fd, buf.get(), BUFFER_SIZE);
+        if (bytes_read == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;  // LCOV_EXCL_LINE
+            }
+            throw_storage_exception(method, "read", source, errno);  // LCOV_EXCL_LINE
+        }
+        if (bytes_read == 0)
+        {
+            break;
+        }
+        char const* p = buf.get();
+        while (bytes_read > 0)
+        {
+            auto bytes_written = write(out_fd, p, bytes_read);
+            if (bytes_written == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;  // LCOV_EXCL_LINE
+                }
+                throw_storage_exception(method, "write", target, errno);
+            }
+            p += bytes_written;
+            bytes_read -= bytes_written;
+            bytes_copied += bytes_written;
+        }
+    }
+}
+
+}  // namespace
+
+FileCopier::Strategy FileCopier::copy(string const& method,
+                                      string const& source,
+                                      string const& target,
+                                      CopyOptions const& options)
+{
+    throw_if_cancelled(method, target, options);
+
+    typedef unity::util::ResourcePtr<int, function<void(int)>> FdPtr;
+    auto closer = [](int fd){ if (fd != -1) ::close(fd); };
+
+    FdPtr in_fd(::open(source.c_str(), O_RDONLY | O_CLOEXEC), closer);
+    if (in_fd.get() == -1)
+    {
+        throw_storage_exception(method, "open", source, errno);
+    }
+    struct stat st;
+    if (fstat(in_fd.get(), &st) == -1)
+    {
+        throw_storage_exception(method, "fstat", source, errno);  // LCOV_EXCL_LINE
+    }
+
+    FdPtr out_fd(::open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777), closer);
+    if (out_fd.get() == -1)
+    {
+        throw_storage_exception(method, "open", target, errno);
+    }
+
+    try
+    {
+        Strategy strategy;
+        if (ioctl(out_fd.get(), FICLONE, in_fd.get()) == 0)
+        {
+            strategy = reflink;
+            ++reflinks;
+        }
+        else if (!not_supported(errno))
+        {
+            throw_storage_exception(method, "ioctl(FICLONE)", target, errno);  // LCOV_EXCL_LINE
+        }
+        else if (copy_with_copy_file_range(method, target, in_fd.get(), out_fd.get(), options))
+        {
+            strategy = copy_file_range;
+            ++copy_file_range_copies;
+        }
+        else
+        {
+            copy_with_read_write(method, source, target, in_fd.get(), out_fd.get(), options);
+            strategy = read_write;
+            ++read_write_copies;
+        }
+
+        if (options.sync && fsync(out_fd.get()) == -1)
+        {
+            throw_storage_exception(method, "fsync", target, errno);  // LCOV_EXCL_LINE
+        }
+
+        // close() can report errors from delayed allocation or NFS, so we check it.
+        if (::close(out_fd.release()) == -1)
+        {
+            throw_storage_exception(method, "close", target, errno);  // LCOV_EXCL_LINE
+        }
+
+        if (last_strategy.exchange(strategy) != strategy)
+        {
+            qDebug().nospace() << "FileCopier: copied \"" << QString::fromStdString(target)
+                               << "\" with " << strategy_name(strategy);
+        }
+        return strategy;
+    }
+    catch (...)
+    {
+        ::unlink(target.c_str());
+        throw;
+    }
+}
+
+void FileCopier::throw_if_cancelled(string const& method, string const& path, CopyOptions const& options)
+{
+    if (options.cancelled && *options.cancelled)
+    {
+        string msg = method + ": copy of \"" + path + "\" was cancelled";
+        throw boost::enable_current_exception(CancelledException(msg));
+    }
+}
+
+FileCopier::Stats FileCopier::stats() noexcept
+{
+    return Stats{ reflinks, copy_file_range_copies, read_write_copies, bytes_copied };
+}
+
+char const* FileCopier::strategy_name(Strategy strategy) noexcept
+{
+    switch (strategy)
+    {
+        case reflink:
+            return "reflink";
+        case copy_file_range:
+            return "copy_file_range()";
+        case read_write:
+            return "read()/write()";
+        default:
+            return "unknown strategy";  // LCOV_EXCL_LINE
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <atomic>
+#include <string>
+
+// Copies regular files using the cheapest mechanism the file system supports:
+//
+// - ioctl(FICLONE) creates a reflink (btrfs, xfs), which shares the data blocks
+//   with the source and takes constant time.
+// - copy_file_range() copies inside the kernel, without going through user
+//   space (and, on NFS and some other file systems, on the server).
+// - A read()/write() loop with a large buffer is the fallback if neither works.
+//
+// Counts of the strategies used are kept for the lifetime of the process. The strategy
+// is logged whenever it differs from the one used for the previous copy, so a fallback
+// to a slower mechanism shows up in the log.
+
+struct CopyOptions
+{
+    bool sync = false;                             // fsync() each target file before closing it
+    std::atomic<bool> const* cancelled = nullptr;  // If set, polled while copying
+};
+
+class FileCopier
+{
+public:
+    enum Strategy { reflink, copy_file_range, read_write };
+
+    struct Stats
+    {
+        int64_t reflinks;
+        int64_t copy_file_range_copies;
+        int64_t read_write_copies;
+        int64_t bytes_copied;  // Does not include reflinked bytes.
+    };
+
+    // Copies the contents and permission bits of source to target, which must not exist.
+    // Throws a StorageException on failure, in which case target is removed.
+    // If options.cancelled becomes true, the copy stops with a CancelledException.
+    static Strategy copy(std::string const& method,
+                         std::string const& source,
+                         std::string const& target,
+                         CopyOptions const& options = CopyOptions());
+
+    // Throws a CancelledException if options.cancelled is set and true.
+    static void throw_if_cancelled(std::string const& method, std::string const& path, CopyOptions const& options);
+
+    static Stats stats() noexcept;
+
+    static char const* strategy_name(Strategy strategy) noexcept;
+};
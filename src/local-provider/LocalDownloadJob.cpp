@@ -23,6 +23,14 @@
 #include <unity/storage/internal/safe_strerror.h>
 #include <unity/storage/provider/Exceptions.h>
 
+#include <algorithm>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
 using namespace unity::storage::provider;
 using namespace std;
 
@@ -30,34 +38,92 @@ static int next_download_id = 0;
 
 string const method = "download()";
 
+namespace
+{
+
+int64_t constexpr SEND_SIZE = 1024 * 1024;      // Max bytes per burst
+int constexpr SOCKET_BUFFER_SIZE = 1024 * 1024;  // Fewer wake-ups than with the default
+size_t constexpr BUFFER_SIZE = 64 * 1024;        // For read()/write() fallback
+
+void close_fd(int fd)
+{
+    if (fd != -1)
+    {
+        ::close(fd);
+    }
+}
+
+// If the client closes its end of the socket, we want EPIPE, not SIGPIPE.
+// SIGPIPE is blocked while we write, and discarded if we raised it.
+
+class SigpipeBlocker
+{
+public:
+    SigpipeBlocker()
+    {
+        sigemptyset(&sigpipe_);
+        sigaddset(&sigpipe_, SIGPIPE);
+        sigset_t pending;
+        was_pending_ = sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE) == 1;
+        pthread_sigmask(SIG_BLOCK, &sigpipe_, &old_mask_);
+    }
+
+    ~SigpipeBlocker()
+    {
+        sigset_t pending;
+        if (!was_pending_ && sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE) == 1)
+        {
+            struct timespec const no_wait = { 0, 0 };
+            sigtimedwait(&sigpipe_, nullptr, &no_wait);
+        }
+        pthread_sigmask(SIG_SETMASK, &old_mask_, nullptr);
+    }
+
+    SigpipeBlocker(SigpipeBlocker const&) = delete;
+    SigpipeBlocker& operator=(SigpipeBlocker const&) = delete;
+
+private:
+    sigset_t sigpipe_;
+    sigset_t old_mask_;
+    bool was_pending_;
+};
+
+}  // namespace
+
+LocalDownloadJob::SendState::SendState()
+    : job(nullptr)
+    , stopped(false)
+    , in_fd(-1, close_fd)
+    , out_fd(-1, close_fd)
+    , bytes_to_write(0)
+    , use_sendfile(true)
+    , buf_len(0)
+    , buf_pos(0)
+    , done(false)
+{
+}
+
 LocalDownloadJob::LocalDownloadJob(shared_ptr<LocalProvider> const& provider,
                                    string const& item_id,
-                                   string const& match_etag)
+                                   string const& match_etag,
+                                   int64_t offset,
+                                   int64_t length)
     : DownloadJob(to_string(++next_download_id))
     , provider_(provider)
     , item_id_(item_id)
+    , offset_(offset)
+    , state_(make_shared<SendState>())
 {
-    using namespace boost::filesystem;
-
     // Sanitize parameters.
-    provider_->throw_if_not_valid(method, item_id_);
-    try
+    struct stat st;
+    provider_->throw_if_not_valid(method, item_id_, &st);
+    if (!S_ISREG(st.st_mode))
     {
-        auto st = status(item_id_);
-        if (!is_regular_file(st))
-        {
-            throw InvalidArgumentException(method + ": \"" + item_id_ + "\" is not a file");
-        }
+        throw InvalidArgumentException(method + ": \"" + item_id_ + "\" is not a file");
     }
-    // LCOV_EXCL_START  // Too small a window to hit with a test.
-    catch (filesystem_error const& e)
-    {
-        throw_storage_exception(method, e);
-    }
-    // LCOV_EXCL_STOP
     if (!match_etag.empty())
     {
-        int64_t mtime = get_mtime_nsecs(method, item_id_);
+        int64_t mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
         if (to_string(mtime) != match_etag)
         {
             throw ConflictException(method + ": etag mismatch");
@@ -66,114 +132,252 @@ LocalDownloadJob::LocalDownloadJob(shared_ptr<LocalProvider> const& provider,
 
     // Make input file ready.
     QString filename = QString::fromStdString(item_id);
-    file_.reset(new QFile(filename));
-    if (!file_->open(QIODevice::ReadOnly))
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
     {
         throw_storage_exception(method,
-                                ": cannot open \"" + item_id + "\": " + file_->errorString().toStdString(),
-                                file_->error());
+                                ": cannot open \"" + item_id + "\": " + file.errorString().toStdString(),
+                                file.error());
     }
-    bytes_to_write_ = file_->size();
+    file_size_ = file.size();
+    if (offset < 0 || offset > file_size_)
+    {
+        string msg = method + ": invalid offset " + to_string(offset) + " for \"" + item_id_ + "\" of size "
+                     + to_string(file_size_);
+        throw InvalidArgumentException(msg);
+    }
+    range_size_ = length < 0 ? file_size_ - offset : min(length, file_size_ - offset);
+    bytes_to_write_ = range_size_;
+    state_->bytes_to_write = range_size_;
+    state_->in_fd.reset(fcntl(file.handle(), F_DUPFD_CLOEXEC, 0));
+    if (state_->in_fd.get() == -1)
+    {
+        // LCOV_EXCL_START
+        string msg = "LocalDownloadJob(): dup() failed: " + unity::storage::internal::safe_strerror(errno);
+        throw ResourceException(msg, errno);
+        // LCOV_EXCL_STOP
+    }
+    if (offset_ != 0 && lseek(state_->in_fd.get(), offset_, SEEK_SET) == -1)
+    {
+        throw_storage_exception(method, "lseek", item_id_, errno);  // LCOV_EXCL_LINE
+    }
+    posix_fadvise(state_->in_fd.get(), offset_, range_size_, POSIX_FADV_SEQUENTIAL);
 
     // Make write socket ready.
-    int dup_fd = dup(write_socket());
-    if (dup_fd == -1)
+    state_->out_fd.reset(fcntl(write_socket(), F_DUPFD_CLOEXEC, 0));
+    if (state_->out_fd.get() == -1)
     {
         // LCOV_EXCL_START
         string msg = "LocalDownloadJob(): dup() failed: " + unity::storage::internal::safe_strerror(errno);
         throw ResourceException(msg, errno);
         // LCOV_EXCL_STOP
     }
-    write_socket_.setSocketDescriptor(dup_fd, QLocalSocket::ConnectedState, QIODevice::WriteOnly);
-    connect(&write_socket_, &QIODevice::bytesWritten, this, &LocalDownloadJob::on_bytes_written);
+    int flags = fcntl(state_->out_fd.get(), F_GETFL);
+    if (flags == -1 || fcntl(state_->out_fd.get(), F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        // LCOV_EXCL_START
+        string msg = "LocalDownloadJob(): fcntl() failed: " + unity::storage::internal::safe_strerror(errno);
+        throw ResourceException(msg, errno);
+        // LCOV_EXCL_STOP
+    }
+    int buf_size = SOCKET_BUFFER_SIZE;
+    setsockopt(state_->out_fd.get(), SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));  // Best effort.
+    state_->job = this;
 
-    // Kick off the read-write cycle.
-    QMetaObject::invokeMethod(this, "read_and_write_chunk", Qt::QueuedConnection);
+    // Kick off the transfer. The socket is writable right away, so this also
+    // takes care of reporting completion for an empty range.
+    notifier_.reset(new QSocketNotifier(state_->out_fd.get(), QSocketNotifier::Write));
+    connect(notifier_.get(), &QSocketNotifier::activated, this, &LocalDownloadJob::on_ready_write);
 }
 
-LocalDownloadJob::~LocalDownloadJob() = default;
+LocalDownloadJob::~LocalDownloadJob()
+{
+    stop_sending();
+}
 
 boost::future<void> LocalDownloadJob::cancel()
 {
-    disconnect(&write_socket_, nullptr, this, nullptr);
-    write_socket_.abort();
-    file_->close();
+    stop_sending();
     return boost::make_ready_future();
 }
 
 boost::future<void> LocalDownloadJob::finish()
 {
-    if (bytes_to_write_ > 0)
+    int64_t const bytes_to_write = state_ ? state_->bytes_to_write.load() : bytes_to_write_;
+    if (bytes_to_write > 0)
     {
-        auto file_size = file_->size();
-        auto written = file_size - bytes_to_write_;
-        string msg = "finish() method called too early, file \"" + item_id_ + "\" has size "
-                     + to_string(file_size) + " but only " + to_string(written) + " bytes were consumed";
+        auto written = range_size_ - bytes_to_write;
+        string msg = "finish() method called too early, ";
+        if (offset_ == 0 && range_size_ == file_size_)
+        {
+            msg += "file \"" + item_id_ + "\" has size " + to_string(range_size_);
+        }
+        else
+        {
+            msg += "range of " + to_string(range_size_) + " bytes at offset " + to_string(offset_)
+                   + " of file \"" + item_id_ + "\" was requested";
+        }
+        msg += " but only " + to_string(written) + " bytes were consumed";
         cancel();
         return boost::make_exceptional_future<void>(LogicException(msg));
     }
     // LCOV_EXCL_START
-    // Not reachable because we call report_complete() in read_and_write_chunk().
+    // Not reachable because we call report_complete() in on_sent().
     return boost::make_ready_future();
     // LCOV_EXCL_STOP
 }
 
-void LocalDownloadJob::on_bytes_written(qint64 bytes)
+void LocalDownloadJob::on_ready_write()
 {
-    bytes_to_write_ -= bytes;
-    assert(bytes_to_write_ >= 0);
-    read_and_write_chunk();
+    if (!state_)
+    {
+        return;  // LCOV_EXCL_LINE  // The download is over.
+    }
+
+    notifier_->setEnabled(false);  // Until the burst is done.
+    auto state = state_;
+    auto item_id = item_id_;
+    try
+    {
+        provider_->thread_pool().submit([state, item_id]{ send_burst(state, item_id); });
+    }
+    catch (ResourceException const&)
+    {
+        send_burst(state, item_id);  // LCOV_EXCL_LINE  // Pool is overloaded, so we do it ourselves.
+    }
 }
 
-void LocalDownloadJob::read_and_write_chunk()
+// Runs on the pool. Sends what the socket accepts and lets the job know how it went.
+
+void LocalDownloadJob::send_burst(shared_ptr<SendState> const& state, string const& item_id)
 {
-    static qint64 constexpr READ_SIZE = 64 * 1024;
+    try
+    {
+        state->done = send_available(*state, item_id);
+    }
+    catch (std::exception const&)
+    {
+        state->error = current_exception();
+    }
+    lock_guard<mutex> lock(state->mutex);
+    if (state->job)
+    {
+        QMetaObject::invokeMethod(state->job, "on_sent", Qt::QueuedConnection);
+    }
+}
 
-    if (bytes_to_write_ == 0)
+void LocalDownloadJob::on_sent()
+{
+    if (!state_)
+    {
+        return;  // Cancelled while the burst was running.
+    }
+    if (state_->error)
     {
-        file_->close();
-        write_socket_.close();
+        auto ep = state_->error;
+        stop_sending();
+        report_error(ep);
+        return;
+    }
+    if (state_->done)
+    {
+        stop_sending();  // The client sees EOF once report_complete() closes the original socket, too.
         report_complete();
         return;
     }
+    notifier_->setEnabled(true);  // More to come.
+}
 
-    QByteArray buf;
-    buf.resize(READ_SIZE);
-    auto bytes_read = file_->read(buf.data(), buf.size());
-    try
+// Send as much as the socket accepts without blocking, up to SEND_SIZE bytes,
+// so a pool thread isn't tied up by a single download. Returns true once everything has been sent.
+
+bool LocalDownloadJob::send_available(SendState& state, string const& item_id)
+{
+    SigpipeBlocker blocker;
+
+    int const in_fd = state.in_fd.get();
+    int const out_fd = state.out_fd.get();
+    int64_t budget = SEND_SIZE;
+    while (state.bytes_to_write > 0 && budget > 0 && !state.stopped)
     {
-        if (bytes_read == -1)
+        ssize_t bytes_written;
+        if (state.use_sendfile)
         {
-            // LCOV_EXCL_START
-            string msg = string("\"") + item_id_ + "\": read error: " + file_->errorString().toStdString();
-            throw_storage_exception(method, msg, file_->error());
-            // LCOV_EXCL_STOP
+            bytes_written = sendfile(out_fd, in_fd, nullptr, min(state.bytes_to_write.load(), budget));
+            if (bytes_written == -1 && (errno == EINVAL || errno == ENOSYS))
+            {
+                // LCOV_EXCL_START
+                // The file system doesn't support sendfile(), so we fall back to read() and write().
+                state.use_sendfile = false;
+                state.buf.reset(new char[BUFFER_SIZE]);
+                continue;
+                // LCOV_EXCL_STOP
+            }
+        }
+        // LCOV_EXCL_START
+        else
+        {
+            if (state.buf_pos == state.buf_len)
+            {
+                state.buf_pos = 0;
+                state.buf_len = read(in_fd, state.buf.get(), min(state.bytes_to_write.load(), int64_t(BUFFER_SIZE)));
+                if (state.buf_len == -1)
+                {
+                    state.buf_len = 0;
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    throw_storage_exception(method, "read", item_id, errno);
+                }
+            }
+            bytes_written = state.buf_len == 0
+                            ? 0
+                            : write(out_fd, state.buf.get() + state.buf_pos, state.buf_len - state.buf_pos);
+            if (bytes_written > 0)
+            {
+                state.buf_pos += bytes_written;
+            }
         }
-        buf.resize(bytes_read);
+        // LCOV_EXCL_STOP
 
-        auto bytes_written = write_socket_.write(buf);
-        if (bytes_written == -1)
+        if (bytes_written > 0)
         {
-            // LCOV_EXCL_START
-            string msg = string("\"") + item_id_ + "\": socket error: " + write_socket_.errorString().toStdString();
-            throw_storage_exception(method, msg, write_socket_.error());
-            // LCOV_EXCL_STOP
+            state.bytes_to_write -= bytes_written;
+            budget -= bytes_written;
+            continue;
         }
-        else if (bytes_written != bytes_read)
+        if (bytes_written == 0)
         {
             // LCOV_EXCL_START
-            string msg = string("\"") + item_id_ + "\": socket write error, requested " + to_string(bytes_read)
-                         + " B, but wrote only " + to_string(bytes_written) + " B.";
-            throw_storage_exception(method, msg, QLocalSocket::UnknownSocketError);
+            string msg = method + ": \"" + item_id + "\": file was truncated during download";
+            throw ResourceException(msg, 0);
             // LCOV_EXCL_STOP
         }
+        if (errno == EAGAIN)
+        {
+            return false;  // The notifier tells us when there is room again.
+        }
+        if (errno == EINTR)
+        {
+            continue;  // LCOV_EXCL_LINE
+        }
+        throw_storage_exception(method, state.use_sendfile ? "sendfile" : "write", item_id, errno);  // LCOV_EXCL_LINE
     }
-    // LCOV_EXCL_START
-    catch (std::exception const&)
+    return state.bytes_to_write == 0;
+}
+
+// A burst that is still running keeps the state, and so the descriptors, until it is done.
+
+void LocalDownloadJob::stop_sending()
+{
+    notifier_.reset();
+    if (state_)
     {
-        write_socket_.abort();
-        file_->close();
-        report_error(current_exception());
+        lock_guard<mutex> lock(state_->mutex);
+        state_->job = nullptr;
+        state_->stopped = true;
+        bytes_to_write_ = state_->bytes_to_write;
     }
-    // LCOV_EXCL_STOP
+    state_.reset();
 }
@@ -20,35 +20,81 @@
 
 #include <unity/storage/provider/DownloadJob.h>
 
+#include <unity/util/ResourcePtr.h>
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wctor-dtor-privacy"
 #pragma GCC diagnostic ignored "-Wswitch-default"
 #include <QFile>
-#include <QLocalSocket>
+#include <QSocketNotifier>
 #pragma GCC diagnostic pop
 
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+
 class LocalProvider;
 
+// The file contents are sent with sendfile(), so the data never passes through
+// user space. A QSocketNotifier tells us when the (non-blocking) socket can take
+// more data, so a download does not need a thread of its own. Each notification
+// sends a bounded burst on the provider's thread pool, so reading the file never
+// blocks the main loop, and a fast client cannot tie up a pool thread. The notifier
+// stays disabled until the burst is done. A download can be limited to a byte range
+// of the file.
+
 class LocalDownloadJob : public QObject, public unity::storage::provider::DownloadJob
 {
     Q_OBJECT
 public:
     LocalDownloadJob(std::shared_ptr<LocalProvider> const& provider,
                      std::string const& item_id,
-                     std::string const& match_etag);
+                     std::string const& match_etag,
+                     int64_t offset = 0,
+                     int64_t length = -1);  // Negative means "to the end of the file"
     virtual ~LocalDownloadJob();
 
     virtual boost::future<void> cancel() override;
     virtual boost::future<void> finish() override;
 
 private Q_SLOTS:
-    void on_bytes_written(qint64 bytes);
-    void read_and_write_chunk();
+    void on_ready_write();
+    void on_sent();
 
 private:
+    typedef unity::util::ResourcePtr<int, std::function<void(int)>> FdPtr;
+
+    // Shared with the pool thread that runs a burst. Once the download is over,
+    // job is null, and the descriptors are closed when the last burst lets go of the state.
+    struct SendState
+    {
+        SendState();
+
+        std::mutex mutex;
+        LocalDownloadJob* job;  // Protected by mutex
+        std::atomic<bool> stopped;
+        FdPtr in_fd;
+        FdPtr out_fd;  // Non-blocking dup of write_socket()
+        std::atomic<int64_t> bytes_to_write;
+        bool use_sendfile;
+        std::unique_ptr<char[]> buf;  // Only if sendfile() is not available
+        ssize_t buf_len;
+        ssize_t buf_pos;
+        bool done;                 // Result of the last burst
+        std::exception_ptr error;  // Result of the last burst
+    };
+
+    static void send_burst(std::shared_ptr<SendState> const& state, std::string const& item_id);
+    static bool send_available(SendState& state, std::string const& item_id);
+    void stop_sending();
+
     std::shared_ptr<LocalProvider> const provider_;
     std::string const item_id_;
-    std::unique_ptr<QFile> file_;
-    QLocalSocket write_socket_;
-    int64_t bytes_to_write_;
+    int64_t file_size_;
+    int64_t offset_;
+    int64_t range_size_;      // Number of bytes to send in total
+    int64_t bytes_to_write_;  // Only up to date once the download is over
+    std::shared_ptr<SendState> state_;  // Null once the download is over
+    std::unique_ptr<QSocketNotifier> notifier_;
 };
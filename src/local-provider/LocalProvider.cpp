@@ -18,14 +18,37 @@
 
 #include "LocalProvider.h"
 
+#include "DirStream.h"
+#include "FileCopier.h"
 #include "LocalDownloadJob.h"
 #include "LocalUploadJob.h"
+#include "TreeCopier.h"
+#include "UploadManifest.h"
 #include "utils.h"
 
-#include <unity/storage/internal/gobj_memory.h>
+#include <unity/storage/internal/EnvVars.h>
 #include <unity/storage/provider/Exceptions.h>
 
 #include <boost/algorithm/string.hpp>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QEvent>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include <fcntl.h>
+#if defined(__has_include)
+#if __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#endif
+#endif
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wold-style-cast"
@@ -35,6 +58,7 @@
 
 using namespace unity::storage::provider;
 using namespace std;
+using unity::storage::internal::EnvVars;
 
 namespace
 {
@@ -92,40 +116,6 @@ string get_root_dir(string const& method)
     return data_dir;
 }
 
-// Copy a file or directory (recursively). Ignore anything that has the temp file prefix
-// or is not a file or directory.
-
-void copy_recursively(boost::filesystem::path const& source, boost::filesystem::path const& target)
-{
-    using namespace boost::filesystem;
-
-    if (is_reserved_path(source))
-    {
-        return;  // Don't copy temporary directories.
-    }
-
-    auto s = status(source);
-    if (is_regular_file(s))
-    {
-        copy_file(source, target);
-    }
-    else if (is_directory(s))
-    {
-        copy_directory(source, target);  // Poorly named in boost; this creates the target dir without recursion
-        for (directory_iterator it(source); it != directory_iterator(); ++it)
-        {
-            path source_entry = it->path();
-            path target_entry = target;
-            target_entry /= source_entry.filename();
-            copy_recursively(source_entry, target_entry);
-        }
-    }
-    else
-    {
-        // Ignore everything that's not a directory or file.
-    }
-}
-
 // Convert nanoseconds since the epoch into ISO 8601 date-time.
 
 string make_iso_date(int64_t nsecs_since_epoch)
@@ -141,130 +131,292 @@ string make_iso_date(int64_t nsecs_since_epoch)
     return buf;
 }
 
-string get_content_type(string const& filename)
-{
-    using namespace unity::storage::internal;
+// Max number of directory streams we keep open for paged list() calls.
+// If a client abandons a listing, the cursor expires after LIST_CURSOR_TTL seconds
+// or, if more than this many listings are in progress, when it is the oldest one.
+
+constexpr int MAX_LIST_CURSORS = 64;
+
+// How long we cache the result of statvfs() for a device.
 
-    static string const unknown_content_type = "application/octet-stream";
+constexpr chrono::seconds SPACE_CACHE_TTL(2);
 
-    gobj_ptr<GFile> file(g_file_new_for_path(filename.c_str()));
-    assert(file);  // Cannot fail according to doc.
+// Return the number of worker threads for the I/O thread pool.
+// Most of what the pool does is blocking file system I/O, so we use more threads than there are cores.
 
-    GError* err = nullptr;
-    gobj_ptr<GFileInfo> full_info(g_file_query_info(file.get(),
-                                                    G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE,
-                                                    G_FILE_QUERY_INFO_NONE,
-                                                    /* cancellable */ NULL,
-                                                    &err));
-    if (!full_info)
+int get_thread_pool_size()
+{
+    int num_threads = EnvVars::get_int(THREAD_POOL_SIZE, THREAD_POOL_SIZE_DFLT, 0);
+    if (num_threads == 0)
     {
-        return unknown_content_type;  // LCOV_EXCL_LINE
+        num_threads = max(4, 2 * int(thread::hardware_concurrency()));
     }
+    return num_threads;
+}
+
+#if defined(SYS_openat2) && !defined(RESOLVE_BENEATH)
+
+// The C library knows the system call, but the kernel headers are too old to
+// have <linux/openat2.h>. These definitions are the same as in that header.
+
+struct open_how
+{
+    uint64_t flags;
+    uint64_t mode;
+    uint64_t resolve;
+};
 
-    string content_type = g_file_info_get_attribute_string(full_info.get(), G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE);
-    if (content_type.empty())
+#define RESOLVE_NO_MAGICLINKS 0x02
+#define RESOLVE_NO_SYMLINKS 0x04
+#define RESOLVE_BENEATH 0x08
+
+#endif
+
+// openat2() relative to dirfd that fails with EXDEV or ELOOP if path would resolve
+// to anything outside dirfd or contains a symlink. glibc has no wrapper for it.
+// If we are built without openat2() support, this fails with ENOSYS, as it does
+// on kernels before 5.6.
+
+int openat2_beneath(int dirfd, string const& path, int flags)
+{
+#ifdef SYS_openat2
+    struct open_how how = {};
+    how.flags = flags | O_CLOEXEC;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS | RESOLVE_NO_MAGICLINKS;
+    int fd;
+    do
     {
-        return unknown_content_type;  // LCOV_EXCL_LINE
+        fd = int(syscall(SYS_openat2, dirfd, path.c_str(), &how, sizeof(how)));
     }
-    return content_type;
+    while (fd == -1 && errno == EAGAIN);  // A concurrent rename made the kernel give up; try again.
+    return fd;
+#else
+    (void)dirfd;
+    (void)path;
+    (void)flags;
+    errno = ENOSYS;
+    return -1;
+#endif
 }
 
-// Simple wrapper template that deals with exception handling so we don't
-// have to repeat ourselves endlessly in the various lambdas below.
-// The auto deduction of the return type requires C++ 14.
+// Runs functions in the thread of the main loop. Upload jobs are QObjects,
+// so a job that is set up on the pool has to be created there.
 
-template<typename F>
-auto invoke_async(string const& method, F& functor)
+class MainLoopRunner : public QObject
 {
-    auto lambda = [method, functor]
+public:
+    static MainLoopRunner& instance()
     {
-        try
-        {
-            return functor();
-        }
-        catch (StorageException const&)
-        {
-            throw;
-        }
-        catch (boost::filesystem::filesystem_error const& e)
+        static MainLoopRunner instance;
+        return instance;
+    }
+
+    // May be called from any thread.
+    void post(function<void()> f)
+    {
+        QCoreApplication::postEvent(this, new CallEvent(std::move(f)));
+    }
+
+    bool event(QEvent* e) override
+    {
+        if (e->type() != QEvent::User)
         {
-            throw_storage_exception(method, e);
+            return QObject::event(e);
         }
-        // LCOV_EXCL_START
-        catch (std::exception const& e)
+        static_cast<CallEvent*>(e)->f();
+        return true;
+    }
+
+private:
+    struct CallEvent : public QEvent
+    {
+        explicit CallEvent(function<void()> func)
+            : QEvent(QEvent::User)
+            , f(std::move(func))
         {
-            throw boost::enable_current_exception(UnknownException(e.what()));
         }
-        // LCOV_EXCL_STOP
+
+        function<void()> const f;
     };
-    // TODO: boost::async is potentially expensive for some operations. Consider boost::asio thread pool?
-    return boost::async(boost::launch::async, lambda);
+
+    MainLoopRunner()
+    {
+        // The first call to instance() may come from a pool thread.
+        moveToThread(QCoreApplication::instance()->thread());
+    }
+};
+
+[[ noreturn ]]
+void throw_invalid_id(string const& method, string const& id)
+{
+    throw boost::enable_current_exception(InvalidArgumentException(method + ": invalid id: \"" + id + "\""));
+}
+
+// Set to false the first time openat2() fails with ENOSYS (kernels before 5.6, or
+// built without openat2() support).
+
+atomic<bool> have_openat2(true);
+
+int open_root(boost::filesystem::path const& root)
+{
+    int fd = ::open(root.native().c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        throw_storage_exception("LocalProvider()", "open", root.native(), errno);  // LCOV_EXCL_LINE
+    }
+    return fd;
 }
 
 }  // namespace
 
 LocalProvider::LocalProvider()
     : root_(boost::filesystem::canonical(get_root_dir("LocalProvider()")))
+    , root_fd_(open_root(root_), [](int fd){ if (fd != -1) ::close(fd); })
+    , pool_(get_thread_pool_size(), EnvVars::get_int(THREAD_POOL_QUEUE_DEPTH, THREAD_POOL_QUEUE_DEPTH_DFLT, 1))
+    , page_size_(EnvVars::get_int(LIST_PAGE_SIZE, LIST_PAGE_SIZE_DFLT, 1))
+    , cursor_ttl_(EnvVars::get_int(LIST_CURSOR_TTL, LIST_CURSOR_TTL_DFLT, 1))
+    , content_types_(EnvVars::get_int(CONTENT_TYPE_CACHE_SIZE, CONTENT_TYPE_CACHE_SIZE_DFLT, 1))
+    , metadata_cache_(int64_t(EnvVars::get_int(METADATA_CACHE_SIZE, METADATA_CACHE_SIZE_DFLT, 0)) * 1024,
+                      EnvVars::get_int(METADATA_CACHE_WATCHES, METADATA_CACHE_WATCHES_DFLT, 1))
+    , uploads_dir_(root_ / UPLOADS_DIR)
+    , upload_ttl_(EnvVars::get_int(UPLOAD_TTL, UPLOAD_TTL_DFLT, 0))
+    , reaper_((root_ / TRASH_DIR).native())
+    , mover_(*this)
 {
+    reaper_.resume();  // Finish deleting whatever was left over from last time.
+    purge_uploads();
+
+    if (EnvVars::get_int(SEARCH_INDEX, SEARCH_INDEX_DFLT, 0) != 0)
+    {
+        int num_threads = EnvVars::get_int(SEARCH_INDEX_THREADS, SEARCH_INDEX_THREADS_DFLT, 0);
+        if (num_threads == 0)
+        {
+            num_threads = max(1, int(thread::hardware_concurrency()));
+        }
+        search_index_.reset(new SearchIndex(root_.native(),
+                                            (root_ / SEARCH_INDEX_FILE).native(),
+                                            num_threads,
+                                            EnvVars::get_int(SEARCH_INDEX_WATCHES, SEARCH_INDEX_WATCHES_DFLT, 0)));
+    }
+
+    if (EnvVars::get_int(USAGE_CACHE, USAGE_CACHE_DFLT, 0) != 0)
+    {
+        int num_threads = EnvVars::get_int(USAGE_CACHE_THREADS, USAGE_CACHE_THREADS_DFLT, 0);
+        if (num_threads == 0)
+        {
+            num_threads = max(1, int(thread::hardware_concurrency()));
+        }
+        usage_cache_.reset(new UsageCache(root_.native(), num_threads));
+    }
 }
 
 LocalProvider::~LocalProvider() = default;
 
-boost::future<ItemList> LocalProvider::roots(vector<string> const& /* keys */, Context const& /* context */)
+boost::future<ItemList> LocalProvider::roots(vector<string> const& keys, Context const& /* context */)
 {
-    vector<Item> roots{ make_item("roots()", root_, status(root_)) };
+    vector<Item> roots{ make_item("roots()", root_, keys) };
     return boost::make_ready_future(roots);
 }
 
 boost::future<tuple<ItemList, string>> LocalProvider::list(string const& item_id,
                                                            string const& page_token,
-                                                           vector<string> const& /* keys */,
+                                                           vector<string> const& keys,
                                                            Context const& /* context */)
 {
     string const method = "list()";
 
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
-    auto do_list = [This, method, item_id, page_token]
+    auto do_list = [This, method, item_id, page_token, keys]
     {
-        using namespace boost::filesystem;
-
         This->throw_if_not_valid(method, item_id);
-        vector<Item> items;
-        for (directory_iterator it(item_id); it != directory_iterator(); ++it)
+
+        // If we have a page token, we continue where the previous call left off.
+        // Otherwise, we use the cached entry names if we can and fall back to
+        // reading the directory.
+        ListCursor cursor;
+        if (page_token.empty())
         {
-            auto dirent = *it;
-            auto path = dirent.path();
-            if (is_reserved_path(path))
+            cursor = ListCursor{item_id, nullptr, This->metadata_cache_.list(method, item_id), 0, false, {}};
+            if (!cursor.listing)
             {
-                continue;  // Hide temp files that we create during copy() and move().
+                cursor.dir = make_shared<DirStream>(method, item_id);
             }
-            Item i;
-            try
+        }
+        else
+        {
+            cursor = This->take_cursor(method, item_id, page_token, false);
+        }
+        vector<Item> items;
+        string next_token;
+        if (This->next_page(method, cursor, keys, items))
+        {
+            next_token = This->add_cursor(std::move(cursor));
+        }
+        return tuple<ItemList, string>(items, next_token);
+    };
+
+    return invoke_async(pool_, method, do_list);
+}
+
+boost::future<tuple<ItemList, string>> LocalProvider::search(string const& item_id,
+                                                             string const& pattern,
+                                                             string const& page_token,
+                                                             vector<string> const& keys,
+                                                             Context const& context)
+{
+    string const method = "search()";
+
+    if (!search_index_)
+    {
+        return ProviderBase::search(item_id, pattern, page_token, keys, context);
+    }
+
+    auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
+    auto do_search = [This, method, item_id, pattern, page_token, keys]
+    {
+        ListCursor cursor;
+        if (page_token.empty())
+        {
+            struct stat st;
+            This->throw_if_not_valid(method, item_id, &st);
+            if (!S_ISDIR(st.st_mode))
             {
-                auto st = dirent.status();
-                i = This->make_item(method, path, st);
-                items.push_back(i);
+                string msg = method + ": \"" + item_id + "\" is not a folder";
+                throw boost::enable_current_exception(InvalidArgumentException(msg));
             }
-            catch (std::exception const&)
+            if (pattern.empty())
             {
-                // We ignore weird errors (such as entries that are not files or folders).
+                string msg = method + ": pattern cannot be empty";
+                throw boost::enable_current_exception(InvalidArgumentException(msg));
             }
+            cursor = ListCursor{item_id, nullptr, This->search_index_->search(item_id, pattern), 0, true, {}};
         }
-        return tuple<ItemList, string>(items, "");
+        else
+        {
+            This->throw_if_not_valid(method, item_id);
+            cursor = This->take_cursor(method, item_id, page_token, true);
+        }
+        vector<Item> items;
+        string next_token;
+        if (This->next_page(method, cursor, keys, items))
+        {
+            next_token = This->add_cursor(std::move(cursor));
+        }
+        return tuple<ItemList, string>(items, next_token);
     };
 
-    return invoke_async(method, do_list);
+    return invoke_async(pool_, method, do_search);
 }
 
 boost::future<ItemList> LocalProvider::lookup(string const& parent_id,
                                               string const& name,
-                                              vector<string> const& /* keys */,
+                                              vector<string> const& keys,
                                               Context const& /* context */)
 {
     string const method = "lookup()";
 
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
-    auto do_lookup = [This, method, parent_id, name]
+    auto do_lookup = [This, method, parent_id, name, keys]
     {
         using namespace boost::filesystem;
 
@@ -273,42 +425,40 @@ boost::future<ItemList> LocalProvider::lookup(string const& parent_id,
         path p = parent_id;
         p /= sanitized_name;
         This->throw_if_not_valid(method, p.native());
-        auto st = status(p);
-        return vector<Item>{ This->make_item(method, p, st) };
+        return vector<Item>{ This->make_item(method, p, keys) };
     };
 
-    return invoke_async(method, do_lookup);
+    return invoke_async(pool_, method, do_lookup);
 }
 
 boost::future<Item> LocalProvider::metadata(string const& item_id,
-                                            vector<string> const& /* keys */,
+                                            vector<string> const& keys,
                                             Context const& /* context */)
 {
     string const method = "metadata()";
 
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
-    auto do_metadata = [This, method, item_id]
+    auto do_metadata = [This, method, item_id, keys]
     {
         using namespace boost::filesystem;
 
         This->throw_if_not_valid(method, item_id);
         path p = item_id;
-        auto st = status(p);
-        return This->make_item(method, p, st);
+        return This->make_item(method, p, keys);
     };
 
-    return invoke_async(method, do_metadata);
+    return invoke_async(pool_, method, do_metadata);
 }
 
 boost::future<Item> LocalProvider::create_folder(string const& parent_id,
                                                  string const& name,
-                                                 vector<string> const& /* keys */,
+                                                 vector<string> const& keys,
                                                  Context const& /* context */)
 {
     string const method = "create_folder()";
 
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
-    auto do_create = [This, method, parent_id, name]
+    auto do_create = [This, method, parent_id, name, keys]
     {
         using namespace boost::filesystem;
 
@@ -323,11 +473,14 @@ boost::future<Item> LocalProvider::create_folder(string const& parent_id,
             throw boost::enable_current_exception(ExistsException(msg, p.native(), name));
         }
         create_directory(p);
-        auto st = status(p);
-        return This->make_item(method, p, st);
+        if (This->usage_cache_)
+        {
+            This->usage_cache_->added(p.native());
+        }
+        return This->make_item(method, p, keys);
     };
 
-    return invoke_async(method, do_create);
+    return invoke_async(pool_, method, do_create);
 }
 
 boost::future<unique_ptr<UploadJob>> LocalProvider::create_file(string const& parent_id,
@@ -335,34 +488,101 @@ boost::future<unique_ptr<UploadJob>> LocalProvider::create_file(string const& pa
                                                                 int64_t size,
                                                                 string const& /* content_type */,
                                                                 bool allow_overwrite,
-                                                                vector<string> const& /* keys */,
+                                                                vector<string> const& keys,
                                                                 Context const& /* context */)
 {
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
     boost::promise<unique_ptr<UploadJob>> p;
-    p.set_value(make_unique<LocalUploadJob>(This, parent_id, name, size, allow_overwrite));
+    p.set_value(make_unique<LocalUploadJob>(This, parent_id, name, size, allow_overwrite, keys));
     return p.get_future();
 }
 
 boost::future<unique_ptr<UploadJob>> LocalProvider::update(string const& item_id,
                                                            int64_t size,
                                                            string const& old_etag,
-                                                           vector<string> const& /* keys */,
+                                                           vector<string> const& keys,
                                                            Context const& /* context */)
 {
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
     boost::promise<unique_ptr<UploadJob>> p;
-    p.set_value(make_unique<LocalUploadJob>(This, item_id, size, old_etag));
+    p.set_value(make_unique<LocalUploadJob>(This, item_id, size, old_etag, keys));
     return p.get_future();
 }
 
+boost::future<tuple<unique_ptr<UploadJob>, int64_t>> LocalProvider::resume_upload(string const& upload_id,
+                                                                                  vector<string> const& keys,
+                                                                                  Context const& context)
+{
+    string const method = "resume_upload()";
+
+    if (!resumable_uploads())
+    {
+        return ProviderBase::resume_upload(upload_id, keys, context);
+    }
+
+    // The upload ID names the manifest, so anything that isn't one of our IDs
+    // could point outside the uploads directory.
+    string const msg = method + ": no such upload: \"" + upload_id + "\"";
+    if (upload_id.empty() || upload_id.find_first_not_of("0123456789abcdef") != string::npos)
+    {
+        throw NotExistsException(msg, upload_id);
+    }
+
+    // Purging and reading the manifest block on the file system, so they run on the pool.
+    // The job itself is created in the main thread once the manifest has been read.
+    auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
+    auto do_resume = [This, method, msg, upload_id, keys]
+    {
+        This->purge_uploads();
+
+        auto const manifest_path = (This->uploads_dir_ / upload_id).native();
+        UploadManifest manifest;
+        try
+        {
+            manifest = UploadManifest::read(method, manifest_path);
+        }
+        catch (NotExistsException const&)
+        {
+            // Never existed, finished, cancelled, or expired.
+            throw boost::enable_current_exception(NotExistsException(msg, upload_id));
+        }
+
+        auto p = make_shared<boost::promise<tuple<unique_ptr<UploadJob>, int64_t>>>();
+        MainLoopRunner::instance().post([This, upload_id, manifest_path, manifest, keys, p]
+        {
+            try
+            {
+                auto job = make_unique<LocalUploadJob>(This, upload_id, manifest_path, manifest, keys);
+                int64_t const committed = job->committed_size();
+                p->set_value(make_tuple(unique_ptr<UploadJob>(std::move(job)), committed));
+            }
+            catch (std::exception const&)
+            {
+                p->set_exception(boost::current_exception());
+            }
+        });
+        return p->get_future();
+    };
+
+    return invoke_async(pool_, method, do_resume).unwrap();
+}
+
 boost::future<unique_ptr<DownloadJob>> LocalProvider::download(string const& item_id,
                                                                string const& match_etag,
-                                                               Context const& /* context */)
+                                                               Context const& context)
+{
+    return download_range(item_id, match_etag, 0, -1, context);
+}
+
+boost::future<unique_ptr<DownloadJob>> LocalProvider::download_range(string const& item_id,
+                                                                     string const& match_etag,
+                                                                     int64_t offset,
+                                                                     int64_t length,
+                                                                     Context const& /* context */)
 {
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
     boost::promise<unique_ptr<DownloadJob>> p;
-    p.set_value(make_unique<LocalDownloadJob>(This, item_id, match_etag));
+    p.set_value(make_unique<LocalDownloadJob>(This, item_id, match_etag, offset, length));
     return p.get_future();
 }
 
@@ -375,28 +595,38 @@ boost::future<void> LocalProvider::delete_item(string const& item_id, Context co
     {
         using namespace boost::filesystem;
 
-        This->throw_if_not_valid(method, item_id);
-        if (canonical(item_id).native() == This->root_)
+        struct stat st;
+        This->throw_if_not_valid(method, item_id, &st);
+        if (item_id == This->root_.native())
         {
             string msg = method + ": cannot delete root";
             throw boost::enable_current_exception(LogicException(msg));
         }
-        remove_all(item_id);
+        // Renaming the item into the trash takes constant time, no matter how much is
+        // underneath it. The reaper deletes it in the background.
+        if (!This->reaper_.trash(method, item_id))
+        {
+            remove_all(item_id);  // Item is on a different file system than the trash.
+        }
+        if (This->usage_cache_)
+        {
+            This->usage_cache_->removed(item_id, st);
+        }
     };
 
-    return invoke_async(method, do_delete);
+    return invoke_async(pool_, method, do_delete);
 }
 
 boost::future<Item> LocalProvider::move(string const& item_id,
                                         string const& new_parent_id,
                                         string const& new_name,
-                                        vector<string> const& /* keys */,
+                                        vector<string> const& keys,
                                         Context const& /* context */)
 {
     string const method = "move()";
 
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
-    auto do_move = [This, method, item_id, new_parent_id, new_name]
+    auto do_move = [This, method, item_id, new_parent_id, new_name, keys]
     {
         using namespace boost::filesystem;
 
@@ -417,36 +647,51 @@ boost::future<Item> LocalProvider::move(string const& item_id,
         // possible for it to have been created since. If so, if the target is a file or an empty
         // directory, it will be removed. In practice, this is unlikely to happen and, if it does,
         // it is not the end of the world.
-        // TODO: deal with EXDEV
-        rename(item_id, target_path);
-        auto st = status(target_path);
-        return This->make_item(method, target_path, st);
+        boost::system::error_code ec;
+        rename(item_id, target_path, ec);
+        if (!ec)
+        {
+            if (This->usage_cache_)
+            {
+                This->usage_cache_->moved(item_id, target_path.native());
+            }
+            return boost::make_ready_future(This->make_item(method, target_path, keys));
+        }
+        if (ec != boost::system::errc::cross_device_link)
+        {
+            throw filesystem_error("boost::filesystem::rename", item_id, target_path, ec);
+        }
+
+        // Source and target are on different file systems, so we have to copy. That can take
+        // a long time, so it happens in the background and doesn't hold up this thread.
+        return This->mover_.move(method, item_id, target_path.native(), keys);
     };
 
-    return invoke_async(method, do_move);
+    return invoke_async(pool_, method, do_move).unwrap();
 }
 
 boost::future<Item> LocalProvider::copy(string const& item_id,
                                         string const& new_parent_id,
                                         string const& new_name,
-                                        vector<string> const& /* keys */,
+                                        vector<string> const& keys,
                                         Context const& /* context */)
 {
     string const method = "copy()";
 
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
-    auto do_copy = [This, method, item_id, new_parent_id, new_name]
+    auto do_copy = [This, method, item_id, new_parent_id, new_name, keys]
     {
         using namespace boost::filesystem;
 
-        This->throw_if_not_valid(method, item_id);
+        struct stat st;
+        This->throw_if_not_valid(method, item_id, &st);
         This->throw_if_not_valid(method, new_parent_id);
         auto sanitized_name = sanitize(method, new_name);
 
         path parent_path = new_parent_id;
         path target_path = parent_path / sanitized_name;
 
-        if (is_directory(item_id))
+        if (S_ISDIR(st.st_mode))
         {
             if (exists(target_path))
             {
@@ -457,130 +702,504 @@ boost::future<Item> LocalProvider::copy(string const& item_id,
             // For recursive copy, we create a temporary directory in lieu of target_path and recursively copy
             // everything into the temporary directory. This ensures that we don't invalidate directory iterators
             // by creating things while we are iterating, potentially getting trapped in an infinite loop.
-            path tmp_path = canonical(parent_path);
+            // The files are copied in parallel on the pool. Only if everything was copied successfully
+            // do we rename the temporary directory, so the copy appears all at once or not at all.
+            path tmp_path = parent_path;
             tmp_path /= unique_path(string(TMPFILE_PREFIX) + "-%%%%-%%%%-%%%%-%%%%");
             create_directories(tmp_path);
-            for (directory_iterator it(item_id); it != directory_iterator(); ++it)
+            try
             {
-                if (is_reserved_path(it->path()))
-                {
-                    continue;  // Don't recurse into the temporary directory
-                }
-                file_status s = it->status();
-                if (is_directory(s) || is_regular_file(s))
-                {
-                    path source_entry = it->path();
-                    path target_entry = tmp_path;
-                    target_entry /= source_entry.filename();
-                    copy_recursively(source_entry, target_entry);
-                }
+                TreeCopier copier(This->pool_, method);
+                copier.copy_contents(item_id, tmp_path.native());
+                rename(tmp_path, target_path);
+            }
+            catch (...)
+            {
+                boost::system::error_code ec;
+                remove_all(tmp_path, ec);  // Don't leave a partial copy behind.
+                throw;
             }
-            rename(tmp_path, target_path);
         }
         else
         {
-            copy_file(item_id, target_path);
+            FileCopier::copy(method, item_id, target_path.native());
+        }
+        if (This->usage_cache_)
+        {
+            This->usage_cache_->added(target_path.native());
         }
 
-        auto st = status(target_path);
-        return This->make_item(method, target_path, st);
+        return This->make_item(method, target_path, keys);
     };
 
-    return invoke_async(method, do_copy);
+    return invoke_async(pool_, method, do_copy);
+}
+
+vector<string> LocalProvider::capabilities() const
+{
+    vector<string> caps{ unity::storage::capability::DOWNLOAD_RANGE };
+    if (search_index_)
+    {
+        caps.push_back(unity::storage::capability::SEARCH);
+    }
+    if (resumable_uploads())
+    {
+        caps.push_back(unity::storage::capability::RESUMABLE_UPLOAD);
+    }
+    return caps;
+}
+
+// Remember the position of a partially-read directory and return a page token for it.
+
+string LocalProvider::add_cursor(ListCursor cursor)
+{
+    // The token is random, so clients cannot guess each other's tokens.
+    string token = boost::filesystem::unique_path("%%%%-%%%%-%%%%-%%%%").native();
+
+    lock_guard<mutex> guard(cursors_lock_);
+    purge_cursors();
+    if (cursors_.size() >= size_t(MAX_LIST_CURSORS))
+    {
+        auto oldest = min_element(cursors_.begin(), cursors_.end(),
+                                  [](auto const& a, auto const& b)
+                                  {
+                                      return a.second.expiry < b.second.expiry;
+                                  });
+        cursors_.erase(oldest);
+    }
+    cursor.expiry = chrono::steady_clock::now() + cursor_ttl_;
+    cursors_[token] = std::move(cursor);
+    return token;
+}
+
+// Return the cursor for a page token. Each token can be used only once;
+// the next call to list() returns a new token.
+
+LocalProvider::ListCursor LocalProvider::take_cursor(string const& method,
+                                                    string const& item_id,
+                                                    string const& page_token,
+                                                    bool search)
+{
+    lock_guard<mutex> guard(cursors_lock_);
+    purge_cursors();
+    auto it = cursors_.find(page_token);
+    if (it == cursors_.end() || it->second.item_id != item_id || it->second.search != search)
+    {
+        string msg = method + ": invalid or expired page token: \"" + page_token + "\"";
+        throw boost::enable_current_exception(InvalidArgumentException(msg));
+    }
+    auto cursor = std::move(it->second);
+    cursors_.erase(it);
+    return cursor;
+}
+
+// Append up to page_size_ items from cursor to items. Returns true if there are more.
+
+bool LocalProvider::next_page(string const& method,
+                              ListCursor& cursor,
+                              vector<string> const& keys,
+                              vector<Item>& items) const
+{
+    using namespace boost::filesystem;
+
+    path const dir_path = cursor.item_id;
+    if (cursor.listing)
+    {
+        auto const& names = *cursor.listing;
+        for (; cursor.pos < names.size() && int(items.size()) < page_size_; ++cursor.pos)
+        {
+            auto const p = dir_path / names[cursor.pos];
+            if (is_reserved_path(p))
+            {
+                continue;
+            }
+            // Served from the cache for files. Folders and symlinks cost a stat(). Entries
+            // that have disappeared since we got the names are skipped.
+            struct stat st;
+            if (!metadata_cache_.stat(p.native(), st) || (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)))
+            {
+                continue;
+            }
+            items.push_back(make_item(method, p, st, keys));
+        }
+        return cursor.pos < names.size();
+    }
+
+    auto& dir = cursor.dir;
+    for (; !dir->at_end() && int(items.size()) < page_size_; dir->advance())
+    {
+        auto const& name = dir->name();
+        if (is_reserved_path(name))
+        {
+            continue;  // Hide temp files that we create during copy() and move().
+        }
+        // One fstatat() per entry, relative to the directory fd. We ignore entries that
+        // have disappeared since we read the directory, dangling symlinks, and entries
+        // that are neither files nor folders.
+        struct stat st;
+        if (!dir->stat(st) || (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)))
+        {
+            continue;
+        }
+        items.push_back(make_item(method, dir_path / name, st, keys));
+    }
+    return !dir->at_end();
+}
+
+// Close the directory streams of abandoned listings. Called with cursors_lock_ held.
+
+void LocalProvider::purge_cursors()
+{
+    auto const now = chrono::steady_clock::now();
+    for (auto it = cursors_.begin(); it != cursors_.end(); )
+    {
+        if (it->second.expiry <= now)
+        {
+            it = cursors_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+// Remove the partial files and manifests of interrupted uploads that were not resumed
+// within the TTL. A partial file that is locked belongs to an upload in progress.
+
+void LocalProvider::purge_uploads()
+{
+    using namespace boost::filesystem;
+
+    string const method = "purge_uploads()";
+
+    boost::system::error_code ec;
+    directory_iterator it(uploads_dir_, ec);
+    if (ec)
+    {
+        return;  // No resumable upload was ever started.
+    }
+    auto const expiry = time(nullptr) - upload_ttl_.count();
+    vector<path> expired;
+    for (directory_iterator end; !ec && it != end; it.increment(ec))
+    {
+        auto const mtime = last_write_time(it->path(), ec);
+        if (!ec && mtime <= expiry)
+        {
+            expired.push_back(it->path());
+        }
+        ec.clear();
+    }
+
+    for (auto const& manifest_path : expired)
+    {
+        if (manifest_path.extension() != ".new")  // Left behind if we crashed while writing a manifest.
+        {
+            try
+            {
+                auto const manifest = UploadManifest::read(method, manifest_path.native());
+                int fd = open(manifest.partial_path.c_str(), O_WRONLY | O_CLOEXEC);
+                if (fd != -1)
+                {
+                    bool const in_progress = flock(fd, LOCK_EX | LOCK_NB) == -1;
+                    if (!in_progress)
+                    {
+                        ::unlink(manifest.partial_path.c_str());
+                    }
+                    close(fd);
+                    if (in_progress)
+                    {
+                        continue;
+                    }
+                }
+            }
+            catch (StorageException const& e)
+            {
+                qWarning().noquote() << QString::fromStdString(e.what());  // LCOV_EXCL_LINE
+            }
+        }
+        remove(manifest_path, ec);
+    }
+}
+
+ThreadPool& LocalProvider::thread_pool()
+{
+    return pool_;
 }
 
-// Make sure that id does not point outside the root.
+UsageCache* LocalProvider::usage_cache() const
+{
+    return usage_cache_.get();
+}
 
-void LocalProvider::throw_if_not_valid(string const& method, string const& id) const
+bool LocalProvider::resumable_uploads() const
+{
+    return upload_ttl_.count() > 0;
+}
+
+string LocalProvider::make_manifest_path(string const& method, string const& upload_id) const
+{
+    if (mkdir(uploads_dir_.native().c_str(), 0700) == -1 && errno != EEXIST)
+    {
+        throw_storage_exception(method, "mkdir", uploads_dir_.native(), errno);  // LCOV_EXCL_LINE
+    }
+    return (uploads_dir_ / upload_id).native();
+}
+
+// Make sure that id does not point outside the root. Instead of resolving id with
+// canonical(), which costs an lstat() per path component, we reject anything that isn't
+// in canonical form lexically and then let openat2() resolve it relative to the root,
+// which fails if the path contains a symlink or escapes the root. That is a single
+// system call and the resulting fd also gives us the stat() result for free.
+
+void LocalProvider::throw_if_not_valid(string const& method, string const& id, struct stat* st) const
 {
     using namespace boost::filesystem;
 
-    string suspect_id;
+    // id must denote the root or have the root as a prefix.
+    auto const& root_id = root_.native();
+    string rel_path = ".";
+    if (id != root_id)
+    {
+        if (!boost::starts_with(id, root_id + "/"))
+        {
+            throw_invalid_id(method, id);
+        }
+        rel_path = id.substr(root_id.size() + 1);
+
+        // Disallow things such as <root>/blah/../blah even though they lead to the correct path.
+        vector<string> components;
+        boost::split(components, rel_path, boost::is_any_of("/"));
+        for (auto const& c : components)
+        {
+            if (c.empty() || c == "." || c == "..")
+            {
+                throw_invalid_id(method, id);
+            }
+        }
+    }
+
+    if (have_openat2)
+    {
+        int fd = openat2_beneath(root_fd_.get(), rel_path, O_PATH);
+        if (fd != -1)
+        {
+            int rc = st ? fstat(fd, st) : 0;
+            int const fstat_errno = errno;
+            ::close(fd);
+            if (rc == -1)
+            {
+                throw_storage_exception(method, "fstat", id, fstat_errno);  // LCOV_EXCL_LINE
+            }
+            return;
+        }
+        switch (errno)
+        {
+            case ELOOP:   // Symlink in the path.
+            case EXDEV:   // Escapes the root.
+                throw_invalid_id(method, id);
+            case ENOSYS:
+                have_openat2 = false;  // LCOV_EXCL_LINE
+                break;                 // LCOV_EXCL_LINE
+            default:
+                throw_storage_exception(method, "openat2", id, errno);
+        }
+    }
+
+    // LCOV_EXCL_START
+    // Old kernel. canonical() resolves symlinks, so, if it returns something else, id
+    // contains a symlink.
     try
     {
-        suspect_id = canonical(id).native();
+        if (canonical(id).native() != id)
+        {
+            throw_invalid_id(method, id);
+        }
     }
     catch (filesystem_error const& e)
     {
         throw_storage_exception(method, e);
     }
-
-    // Disallow things such as <root>/blah/../blah even though they lead to the correct path.
-    if (suspect_id != id)
+    if (st && ::stat(id.c_str(), st) == -1)
     {
-        throw boost::enable_current_exception(InvalidArgumentException(method + ": invalid id: \"" + id + "\""));
+        throw_storage_exception(method, "stat", id, errno);
     }
-    // id must denote the root or have the root as a prefix.
-    auto const root_id = root_.native();
-    if (id != root_id && !boost::starts_with(id, root_id + "/"))
+    // LCOV_EXCL_STOP
+}
+
+// Return an Item for item_path. This costs one stat() for the item itself,
+// unless the metadata cache has it.
+
+Item LocalProvider::make_item(string const& method,
+                              boost::filesystem::path const& item_path,
+                              vector<string> const& keys) const
+{
+    struct stat st;
+    if (!metadata_cache_.stat(item_path.native(), st))
     {
-        throw boost::enable_current_exception(InvalidArgumentException(method + ": invalid id: \"" + id + "\""));
+        throw_storage_exception(method, "stat", item_path.native(), errno);
     }
+    return make_item(method, item_path, st, keys);
 }
 
-// Return an Item initialized from item_path and st.
+// Return an Item initialized from item_path and st. Only the metadata in keys is
+// computed; an empty key list or metadata::ALL selects everything we support,
+// except for the MD5 digest and the folder usage, which must be asked for by name.
+// For files, the size and modification time are always included because
+// the client requires them. Everything comes from st and the space and
+// content type caches, so this does not make any system calls for most items.
+// The MD5 digest costs a getxattr() and is omitted until it has been computed.
+// The child count and recursive size of a folder come from the usage cache and are
+// omitted until its initial scan has got that far.
 
 Item LocalProvider::make_item(string const& method,
                               boost::filesystem::path const& item_path,
-                              boost::filesystem::file_status const& st) const
+                              struct stat const& st,
+                              vector<string> const& keys) const
 {
     using namespace unity::storage;
     using namespace unity::storage::metadata;
-    using namespace boost::filesystem;
+
+    auto named = [&keys](char const* key)
+    {
+        return find(keys.begin(), keys.end(), key) != keys.end();
+    };
+    bool const all_keys = keys.empty() || named(ALL);
+    auto wanted = [&named, all_keys](char const* key)
+    {
+        return all_keys || named(key);
+    };
 
     map<string, MetadataValue> meta;
 
     string const item_id = item_path.native();
-    int64_t const mtime_nsecs = get_mtime_nsecs(method, item_id);
-    string const iso_mtime = make_iso_date(mtime_nsecs);
 
     ItemType type;
     string name = item_path.filename().native();
     vector<string> parents{item_path.parent_path().native()};
     string etag;
-    switch (st.type())
-    {
-        case regular_file:
-            type = ItemType::file;
-            etag = to_string(mtime_nsecs);
-            meta.insert({SIZE_IN_BYTES, int64_t(file_size(item_path))});
-            break;
-        case directory_file:
-            if (item_path == root_)
+    if (S_ISREG(st.st_mode))
+    {
+        type = ItemType::file;
+    }
+    else if (S_ISDIR(st.st_mode))
+    {
+        if (item_path == root_)
+        {
+            name = "/";
+            parents.clear();
+            type = ItemType::root;
+        }
+        else
+        {
+            type = ItemType::folder;
+        }
+    }
+    else
+    {
+        throw boost::enable_current_exception(
+                NotExistsException(method + ": \"" + item_id + "\" is neither a file nor a folder", item_id));
+    }
+
+    int64_t const mtime_nsecs = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    if (type == ItemType::file)
+    {
+        etag = to_string(mtime_nsecs);
+        meta.insert({SIZE_IN_BYTES, int64_t(st.st_size)});
+        meta.insert({LAST_MODIFIED_TIME, make_iso_date(mtime_nsecs)});
+    }
+    else if (wanted(LAST_MODIFIED_TIME))
+    {
+        meta.insert({LAST_MODIFIED_TIME, make_iso_date(mtime_nsecs)});
+    }
+
+    if (wanted(FREE_SPACE_BYTES) || wanted(USED_SPACE_BYTES))
+    {
+        auto const info = get_space(method, item_id, st.st_dev);
+        if (wanted(FREE_SPACE_BYTES))
+        {
+            meta.insert({FREE_SPACE_BYTES, info.free_bytes});
+        }
+        if (wanted(USED_SPACE_BYTES))
+        {
+            meta.insert({USED_SPACE_BYTES, info.used_bytes});
+        }
+    }
+
+    if (wanted(CONTENT_TYPE))
+    {
+        meta.insert({CONTENT_TYPE, content_types_.get(item_id, st)});
+    }
+
+    if (type == ItemType::file && named(MD5))
+    {
+        auto const md5 = md5_cache_.get(item_id, st);
+        if (!md5.empty())
+        {
+            meta.insert({MD5, md5});
+        }
+    }
+
+    if (type != ItemType::file && usage_cache_ && (named(CHILD_COUNT) || named(RECURSIVE_SIZE_IN_BYTES)))
+    {
+        UsageCache::Usage usage;
+        if (usage_cache_->get(item_id, st, usage))
+        {
+            if (named(CHILD_COUNT))
             {
-                name = "/";
-                parents.clear();
-                type = ItemType::root;
+                meta.insert({CHILD_COUNT, usage.child_count});
             }
-            else
+            if (named(RECURSIVE_SIZE_IN_BYTES) && usage.bytes >= 0)
             {
-                type = ItemType::folder;
+                meta.insert({RECURSIVE_SIZE_IN_BYTES, usage.bytes});
             }
-            break;
-        default:
-            throw boost::enable_current_exception(
-                    NotExistsException(method + ": \"" + item_id + "\" is neither a file nor a folder", item_id));
+        }
     }
 
+    if (wanted(WRITABLE))
+    {
+        bool writable;
+        if (type == ItemType::file)
+        {
+            writable = st.st_mode & S_IWUSR;
+        }
+        else
+        {
+            writable = st.st_mode & S_IWUSR && st.st_mode & S_IXUSR;
+        }
+        meta.insert({WRITABLE, writable});
+    }
 
-    auto const info = space(item_path);
-    meta.insert({FREE_SPACE_BYTES, int64_t(info.available)});
-    meta.insert({USED_SPACE_BYTES, int64_t(info.capacity - info.available)});
+    return Item{ item_id, parents, name, etag, type, meta };
+}
 
-    meta.insert({LAST_MODIFIED_TIME, iso_mtime});
-    meta.insert({CONTENT_TYPE, get_content_type(item_id)});
+// Return free and used space for the file system that contains path. All items in a
+// listing (usually) share the same file system, so we cache the result per device
+// for a short while instead of calling statvfs() for every item.
 
-    auto perms = st.permissions();
-    bool writable;
-    if (type == ItemType::file)
+LocalProvider::SpaceInfo LocalProvider::get_space(string const& method, string const& path, dev_t dev) const
+{
+    auto const now = chrono::steady_clock::now();
     {
-        writable = perms & owner_write;
+        lock_guard<mutex> guard(space_lock_);
+        auto it = space_cache_.find(dev);
+        if (it != space_cache_.end() && it->second.expiry > now)
+        {
+            return it->second;
+        }
     }
-    else
+
+    struct statvfs st;
+    if (statvfs(path.c_str(), &st) == -1)
     {
-        writable = perms & owner_write && perms & owner_exe;
+        throw_storage_exception(method, "statvfs", path, errno);  // LCOV_EXCL_LINE
     }
-    meta.insert({WRITABLE, writable});
-
-    return Item{ item_id, parents, name, etag, type, meta };
+    SpaceInfo info;
+    info.free_bytes = int64_t(st.f_bavail * st.f_frsize);
+    info.used_bytes = int64_t((st.f_blocks - st.f_bavail) * st.f_frsize);
+    info.expiry = now + SPACE_CACHE_TTL;
+
+    lock_guard<mutex> guard(space_lock_);
+    space_cache_[dev] = info;
+    return info;
 }
@@ -18,10 +18,29 @@
 
 #pragma once
 
+#include "ContentTypeCache.h"
+#include "CrossDeviceMover.h"
+#include "DirStream.h"
+#include "Md5Cache.h"
+#include "MetadataCache.h"
+#include "SearchIndex.h"
+#include "ThreadPool.h"
+#include "TrashReaper.h"
+#include "UsageCache.h"
+
 #include <unity/storage/provider/ProviderBase.h>
 
+#include <unity/util/ResourcePtr.h>
+
 #include <boost/filesystem.hpp>
 
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+
+#include <sys/stat.h>
+
 class LocalProvider : public unity::storage::provider::ProviderBase
 {
 public:
@@ -35,6 +54,11 @@ public:
         std::string const& item_id, std::string const& page_token,
         std::vector<std::string> const& metadata_keys,
         unity::storage::provider::Context const& ctx) override;
+    boost::future<std::tuple<unity::storage::provider::ItemList, std::string>> search(
+        std::string const& item_id, std::string const& pattern,
+        std::string const& page_token,
+        std::vector<std::string> const& metadata_keys,
+        unity::storage::provider::Context const& ctx) override;
     boost::future<unity::storage::provider::ItemList> lookup(
         std::string const& parent_id, std::string const& name,
         std::vector<std::string> const& metadata_keys,
@@ -57,10 +81,19 @@ public:
         std::string const& old_etag,
         std::vector<std::string> const& metadata_keys,
         unity::storage::provider::Context const& ctx) override;
+    boost::future<std::tuple<std::unique_ptr<unity::storage::provider::UploadJob>, int64_t>> resume_upload(
+        std::string const& upload_id,
+        std::vector<std::string> const& metadata_keys,
+        unity::storage::provider::Context const& ctx) override;
     boost::future<std::unique_ptr<unity::storage::provider::DownloadJob>> download(
         std::string const& item_id,
         std::string const& match_etag,
         unity::storage::provider::Context const& ctx) override;
+    boost::future<std::unique_ptr<unity::storage::provider::DownloadJob>> download_range(
+        std::string const& item_id,
+        std::string const& match_etag,
+        int64_t offset, int64_t length,
+        unity::storage::provider::Context const& ctx) override;
     boost::future<void> delete_item(std::string const& item_id,
         unity::storage::provider::Context const& ctx) override;
     boost::future<unity::storage::provider::Item> move(
@@ -73,12 +106,85 @@ public:
         std::string const& new_name,
         std::vector<std::string> const& metadata_keys,
         unity::storage::provider::Context const& ctx) override;
+    std::vector<std::string> capabilities() const override;
 
-    void throw_if_not_valid(std::string const& method, std::string const& id) const;
+    // metadata_items(), delete_items(), move_items(), and copy_items() are inherited. Each item
+    // of a batch becomes a separate task on the pool, so the items are processed in parallel.
+
+    // Pool for all blocking file system operations. The job classes use it, too.
+    ThreadPool& thread_pool();
+
+    // nullptr if child_count and recursive_size_in_bytes are disabled. Changes must be reported to it.
+    UsageCache* usage_cache() const;
+
+    // True if uploads interrupted by a disconnect are kept for resume_upload().
+    bool resumable_uploads() const;
+    // Returns the manifest path for a resumable upload, creating the uploads directory if necessary.
+    std::string make_manifest_path(std::string const& method, std::string const& upload_id) const;
+
+    // Throws unless id is a canonical path at or below the root. If st is not null,
+    // it is set to the stat() result for id.
+    void throw_if_not_valid(std::string const& method, std::string const& id, struct stat* st = nullptr) const;
+    unity::storage::provider::Item make_item(std::string const& method,
+                                             boost::filesystem::path const& item_path,
+                                             std::vector<std::string> const& keys) const;
     unity::storage::provider::Item make_item(std::string const& method,
                                              boost::filesystem::path const& item_path,
-                                             boost::filesystem::file_status const& st) const;
+                                             struct stat const& st,
+                                             std::vector<std::string> const& keys) const;
 
 private:
+    // The position of a list() or search() call that returned a partial page. Either an
+    // open directory stream or, if the listing came from the metadata cache or the
+    // search index, the paths relative to item_id and the index of the next one.
+    struct ListCursor
+    {
+        std::string item_id;
+        std::shared_ptr<DirStream> dir;
+        MetadataCache::Listing listing;
+        size_t pos;
+        bool search;
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    std::string add_cursor(ListCursor cursor);
+    ListCursor take_cursor(std::string const& method,
+                           std::string const& item_id,
+                           std::string const& page_token,
+                           bool search);
+    bool next_page(std::string const& method,
+                   ListCursor& cursor,
+                   std::vector<std::string> const& keys,
+                   std::vector<unity::storage::provider::Item>& items) const;
+    void purge_cursors();
+
+    void purge_uploads();
+
+    struct SpaceInfo
+    {
+        int64_t free_bytes;
+        int64_t used_bytes;
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    SpaceInfo get_space(std::string const& method, std::string const& path, dev_t dev) const;
+
     boost::filesystem::path const root_;
+    unity::util::ResourcePtr<int, std::function<void(int)>> root_fd_;  // O_PATH, for openat2()
+    ThreadPool pool_;
+    int const page_size_;
+    std::chrono::seconds const cursor_ttl_;
+    std::mutex cursors_lock_;
+    std::map<std::string, ListCursor> cursors_;  // Keyed by page token
+    mutable ContentTypeCache content_types_;
+    mutable Md5Cache md5_cache_;
+    mutable MetadataCache metadata_cache_;
+    std::unique_ptr<SearchIndex> search_index_;  // nullptr if search is disabled
+    std::unique_ptr<UsageCache> usage_cache_;    // nullptr if folder usage is disabled
+    mutable std::mutex space_lock_;
+    mutable std::map<dev_t, SpaceInfo> space_cache_;
+    boost::filesystem::path const uploads_dir_;
+    std::chrono::seconds const upload_ttl_;
+    TrashReaper reaper_;
+    CrossDeviceMover mover_;  // Must be last, so cross-device moves are cancelled before anything else goes away.
 };
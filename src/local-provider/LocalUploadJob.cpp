@@ -23,21 +23,67 @@
 #include <unity/storage/internal/safe_strerror.h>
 #include <unity/storage/provider/Exceptions.h>
 
+#include <algorithm>
+
 #include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
 
 using namespace unity::storage::provider;
 using namespace std;
 
 static int next_upload_id = 0;
 
-LocalUploadJob::LocalUploadJob(shared_ptr<LocalProvider> const& provider, int64_t size, const string& method)
-    : UploadJob(to_string(++next_upload_id))
+namespace
+{
+
+int constexpr PIPE_SIZE = 1024 * 1024;   // Max bytes moved per splice() call
+int64_t constexpr BUFFER_SIZE = 64 * 1024;  // For read()/write() fallback
+
+void close_fd(int fd)
+{
+    if (fd != -1)
+    {
+        ::close(fd);
+    }
+}
+
+// The ID of a resumable upload names its manifest and must remain
+// unique across restarts, so it is random rather than a counter.
+
+string new_upload_id(LocalProvider const& provider)
+{
+    if (provider.resumable_uploads())
+    {
+        return boost::filesystem::unique_path("%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%").native();
+    }
+    return to_string(++next_upload_id);
+}
+
+}  // namespace
+
+LocalUploadJob::LocalUploadJob(shared_ptr<LocalProvider> const& provider,
+                               int64_t size,
+                               const string& method,
+                               vector<string> const& keys,
+                               string const& upload_id)
+    : UploadJob(upload_id)
     , provider_(provider)
     , size_(size)
     , bytes_to_write_(size)
     , method_(method)
     , state_(in_progress)
-    , tmp_fd_([](int fd){ if (fd != -1) ::close(fd); })
+    , keys_(keys)
+    , tmp_fd_(close_fd)
+    , use_linkat_(false)
+    , committed_(0)
+    , read_fd_(close_fd)
+    , eof_(false)
+    , use_splice_(true)
+    , pipe_read_fd_(close_fd)
+    , pipe_write_fd_(close_fd)
+    , pipe_size_(0)
+    , hashed_(0)
 {
 }
 
@@ -45,8 +91,9 @@ LocalUploadJob::LocalUploadJob(shared_ptr<LocalProvider> const& provider,
                                string const& parent_id,
                                string const& name,
                                int64_t size,
-                               bool allow_overwrite)
-    : LocalUploadJob(provider, size, "create_file()")
+                               bool allow_overwrite,
+                               vector<string> const& keys)
+    : LocalUploadJob(provider, size, "create_file()", keys, new_upload_id(*provider))
 {
     using namespace boost::filesystem;
 
@@ -71,32 +118,20 @@ LocalUploadJob::LocalUploadJob(shared_ptr<LocalProvider> const& provider,
 LocalUploadJob::LocalUploadJob(shared_ptr<LocalProvider> const& provider,
                                string const& item_id,
                                int64_t size,
-                               string const& old_etag)
-    : LocalUploadJob(provider, size, "update()")
+                               string const& old_etag,
+                               vector<string> const& keys)
+    : LocalUploadJob(provider, size, "update()", keys, new_upload_id(*provider))
 {
-    using namespace boost::filesystem;
-
     item_id_ = item_id;
-    provider_->throw_if_not_valid(method_, item_id);
-    try
-    {
-        auto st = status(item_id);
-        if (!is_regular_file(st))
-        {
-            throw InvalidArgumentException(method_ + ": \"" + item_id + "\" is not a file");
-        }
-    }
-    // LCOV_EXCL_START
-    catch (filesystem_error const& e)
+    struct stat st;
+    provider_->throw_if_not_valid(method_, item_id, &st);
+    if (!S_ISREG(st.st_mode))
     {
-        // The call to status could throw if the file is unlinked immediately
-        // after the call to throw_if_not_valid.
-        throw_storage_exception(method_, e);
+        throw InvalidArgumentException(method_ + ": \"" + item_id + "\" is not a file");
     }
-    // LCOV_EXCL_STOP
     if (!old_etag.empty())
     {
-        int64_t mtime = get_mtime_nsecs(method_, item_id);
+        int64_t mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
         if (to_string(mtime) != old_etag)
         {
             throw ConflictException(method_ + ": etag mismatch");
@@ -107,15 +142,110 @@ LocalUploadJob::LocalUploadJob(shared_ptr<LocalProvider> const& provider,
     prepare_channels();
 }
 
+LocalUploadJob::LocalUploadJob(shared_ptr<LocalProvider> const& provider,
+                               string const& upload_id,
+                               string const& manifest_path,
+                               UploadManifest const& manifest,
+                               vector<string> const& keys)
+    : LocalUploadJob(provider, manifest.size, "resume_upload()", keys, upload_id)
+{
+    item_id_ = manifest.item_id;
+    if (manifest.is_update)
+    {
+        old_etag_ = manifest.old_etag;
+    }
+    else
+    {
+        parent_id_ = boost::filesystem::path(item_id_).parent_path().native();
+        allow_overwrite_ = manifest.allow_overwrite;
+    }
+    manifest_path_ = manifest_path;
+    tmp_path_ = manifest.partial_path;
+    committed_ = manifest.committed;
+    bytes_to_write_ = size_ - committed_;
+
+    prepare_channels();
+}
+
 LocalUploadJob::~LocalUploadJob() = default;
 
+int64_t LocalUploadJob::committed_size() const
+{
+    return committed_;
+}
+
 void LocalUploadJob::prepare_channels()
+{
+    if (!tmp_path_.empty())
+    {
+        reopen_partial_file();
+    }
+    else if (provider_->resumable_uploads())
+    {
+        create_partial_file();
+    }
+    else
+    {
+        open_tmp_file();
+    }
+    // Reserve the space for the rest of the file up front. Not all file systems can do this,
+    // so we only care about running out of space.
+    if (bytes_to_write_ > 0
+        && fallocate(tmp_fd_.get(), FALLOC_FL_KEEP_SIZE, committed_, bytes_to_write_) == -1
+        && errno == ENOSPC)
+    {
+        int err = errno;
+        remove_tmp_file();
+        throw_storage_exception(method_, "fallocate", item_id_, err);
+    }
+
+    // Make read socket ready.
+    read_fd_.reset(fcntl(read_socket(), F_DUPFD_CLOEXEC, 0));
+    if (read_fd_.get() == -1)
+    {
+        // LCOV_EXCL_START
+        string msg = method_ + ": dup() failed: " + unity::storage::internal::safe_strerror(errno);
+        throw boost::enable_current_exception(ResourceException(msg, errno));
+        // LCOV_EXCL_STOP
+    }
+    int flags = fcntl(read_fd_.get(), F_GETFL);
+    if (flags == -1 || fcntl(read_fd_.get(), F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        // LCOV_EXCL_START
+        string msg = method_ + ": fcntl() failed: " + unity::storage::internal::safe_strerror(errno);
+        throw boost::enable_current_exception(ResourceException(msg, errno));
+        // LCOV_EXCL_STOP
+    }
+
+    // The pipe for splice(). If we can't get one, we fall back to a buffer.
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC | O_NONBLOCK) == 0)
+    {
+        pipe_read_fd_.reset(pipe_fds[0]);
+        pipe_write_fd_.reset(pipe_fds[1]);
+        fcntl(pipe_fds[1], F_SETPIPE_SZ, PIPE_SIZE);  // Best effort, capacity is limited by /proc/sys/fs/pipe-max-size.
+        pipe_size_ = fcntl(pipe_fds[1], F_GETPIPE_SZ);
+    }
+    if (pipe_size_ <= 0)
+    {
+        stop_splicing();  // LCOV_EXCL_LINE
+    }
+    if (committed_ == 0 && !use_splice_)
+    {
+        md5_.reset(new Md5Digest);  // LCOV_EXCL_LINE
+    }
+
+    notifier_.reset(new QSocketNotifier(read_fd_.get(), QSocketNotifier::Read));
+    connect(notifier_.get(), &QSocketNotifier::activated, this, &LocalUploadJob::on_bytes_ready);
+}
+
+void LocalUploadJob::open_tmp_file()
 {
     using namespace boost::filesystem;
 
     // Open tmp file for writing.
     auto parent_path = path(item_id_).parent_path();
-    tmp_fd_.reset(open(parent_path.native().c_str(), O_TMPFILE | O_WRONLY, 0600));
+    tmp_fd_.reset(open(parent_path.native().c_str(), O_TMPFILE | O_RDWR, 0600));
     if (tmp_fd_.get() == -1)
     {
         // Some kernels on the phones don't support O_TMPFILE and return various errno values when this fails.
@@ -132,30 +262,143 @@ void LocalUploadJob::prepare_channels()
                          + unity::storage::internal::safe_strerror(errno);
             throw ResourceException(msg, errno);
         }
-        // LCOV_EXCL_START
-        file_.reset(new QFile(QString::fromStdString(tmpfile)));
-        file_->open(QIODevice::WriteOnly);
-        // LCOV_EXCL_STOP
+        tmp_path_ = tmpfile;  // LCOV_EXCL_LINE
     }
     else
     {
         use_linkat_ = true;
-        file_.reset(new QFile);
-        file_->open(tmp_fd_.get(), QIODevice::WriteOnly, QFileDevice::DontCloseHandle);
     }
+}
 
-    // Make read socket ready.
-    int dup_fd = dup(read_socket());
-    if (dup_fd == -1)
+// Create the named partial file for a new resumable upload, next to the target
+// so it can be renamed into place, and record it in a manifest.
+
+void LocalUploadJob::create_partial_file()
+{
+    using namespace boost::filesystem;
+
+    manifest_path_ = provider_->make_manifest_path(method_, upload_id());
+    auto partial = path(item_id_).parent_path() / (string(TMPFILE_PREFIX) + "-upload-" + upload_id());
+    tmp_fd_.reset(open(partial.native().c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+    if (tmp_fd_.get() == -1)
     {
-        // LCOV_EXCL_START
-        string msg = method_ + ": dup() failed: " + unity::storage::internal::safe_strerror(errno);
-        throw ResourceException(msg, errno);
-        // LCOV_EXCL_STOP
+        throw_storage_exception(method_, "open", partial.native(), errno);
+    }
+    tmp_path_ = partial.native();
+    lock_partial_file();
+    try
+    {
+        make_manifest().write(method_, manifest_path_);
+    }
+    catch (StorageException const&)
+    {
+        ::unlink(tmp_path_.c_str());
+        throw;
+    }
+}
+
+// Reopen the partial file of a suspended upload. Anything beyond the committed
+// size may not have been flushed before the provider stopped, so it is discarded.
+
+void LocalUploadJob::reopen_partial_file()
+{
+    tmp_fd_.reset(open(tmp_path_.c_str(), O_WRONLY | O_CLOEXEC));
+    if (tmp_fd_.get() == -1)
+    {
+        if (errno == ENOENT)
+        {
+            // The partial file was removed, so the manifest is useless.
+            ::unlink(manifest_path_.c_str());
+            throw boost::enable_current_exception(NotExistsException(method_ + ": no such upload: \"" + upload_id() + "\"", upload_id()));
+        }
+        throw_storage_exception(method_, "open", tmp_path_, errno);  // LCOV_EXCL_LINE
+    }
+    lock_partial_file();
+
+    try
+    {
+        check_preconditions();
+    }
+    catch (StorageException const&)
+    {
+        remove_tmp_file();  // The upload can never succeed.
+        throw;
+    }
+    if (ftruncate(tmp_fd_.get(), committed_) == -1)
+    {
+        throw_storage_exception(method_, "ftruncate", tmp_path_, errno);  // LCOV_EXCL_LINE
+    }
+    if (lseek(tmp_fd_.get(), committed_, SEEK_SET) == -1)
+    {
+        throw_storage_exception(method_, "lseek", tmp_path_, errno);  // LCOV_EXCL_LINE
+    }
+}
+
+// The lock is held for as long as a job owns the partial file. It stops the
+// upload from being resumed twice, and stops the provider from purging it.
+
+void LocalUploadJob::lock_partial_file()
+{
+    if (flock(tmp_fd_.get(), LOCK_EX | LOCK_NB) == -1)
+    {
+        if (errno == EWOULDBLOCK)
+        {
+            throw boost::enable_current_exception(LogicException(method_ + ": upload \"" + upload_id() + "\" is still in progress"));
+        }
+        throw_storage_exception(method_, "flock", tmp_path_, errno);  // LCOV_EXCL_LINE
+    }
+}
+
+// Check for an etag mismatch or overwrite, in case the file was changed after the upload started.
+
+void LocalUploadJob::check_preconditions()
+{
+    if (!parent_id_.empty())
+    {
+        // create_file()
+        if (!allow_overwrite_ && boost::filesystem::exists(item_id_))
+        {
+            string msg = method_ + ": \"" + item_id_ + "\" exists already";
+            BOOST_THROW_EXCEPTION(
+                ExistsException(msg, item_id_, boost::filesystem::path(item_id_).filename().native()));
+        }
+    }
+    else if (!old_etag_.empty())
+    {
+        // update()
+        int64_t mtime = get_mtime_nsecs(method_, item_id_);
+        if (to_string(mtime) != old_etag_)
+        {
+            BOOST_THROW_EXCEPTION(ConflictException(method_ + ": etag mismatch"));
+        }
+    }
+}
+
+UploadManifest LocalUploadJob::make_manifest() const
+{
+    UploadManifest m;
+    m.item_id = item_id_;
+    m.partial_path = tmp_path_;
+    m.size = size_;
+    m.committed = size_ - bytes_to_write_;
+    m.is_update = parent_id_.empty();
+    m.allow_overwrite = m.is_update ? false : allow_overwrite_;
+    m.old_etag = old_etag_;
+    return m;
+}
+
+// Remove a named temp file, and the manifest if the upload is resumable.
+
+void LocalUploadJob::remove_tmp_file()
+{
+    if (!use_linkat_)
+    {
+        ::unlink(tmp_path_.c_str());
+    }
+    if (!manifest_path_.empty())
+    {
+        ::unlink(manifest_path_.c_str());
     }
-    read_socket_.setSocketDescriptor(dup_fd, QLocalSocket::ConnectedState, QIODevice::ReadOnly);
-    connect(&read_socket_, &QLocalSocket::readyRead, this, &LocalUploadJob::on_bytes_ready);
-    connect(&read_socket_, &QIODevice::readChannelFinished, this, &LocalUploadJob::on_read_channel_finished);
 }
 
 boost::future<void> LocalUploadJob::cancel()
@@ -167,6 +410,48 @@ boost::future<void> LocalUploadJob::cancel()
     return boost::make_ready_future();
 }
 
+// The client went away. If the upload is resumable, we store what the client sent
+// before it disconnected and record the committed size in the manifest.
+
+boost::future<void> LocalUploadJob::suspend()
+{
+    if (manifest_path_.empty() || state_ != in_progress)
+    {
+        return cancel();
+    }
+
+    try
+    {
+        read_available();
+    }
+    catch (std::exception const&)
+    {
+        abort_upload();  // The client is gone, so there is nobody to report the error to.
+        return boost::make_ready_future();
+    }
+
+    state_ = cancelled;
+    notifier_.reset();
+    read_fd_.dealloc();
+    try
+    {
+        if (fdatasync(tmp_fd_.get()) == -1)
+        {
+            throw_storage_exception(method_, "fdatasync", tmp_path_, errno);  // LCOV_EXCL_LINE
+        }
+        make_manifest().write(method_, manifest_path_);
+    }
+    // LCOV_EXCL_START
+    catch (StorageException const&)
+    {
+        remove_tmp_file();
+        return boost::make_exceptional_future<void>(boost::current_exception());
+    }
+    // LCOV_EXCL_STOP
+    tmp_fd_.dealloc();  // Releases the lock, so the upload can be resumed straight away.
+    return boost::make_ready_future();
+}
+
 boost::future<Item> LocalUploadJob::finish()
 {
     on_bytes_ready();  // Read any remaining unread buffered data.
@@ -184,34 +469,14 @@ boost::future<Item> LocalUploadJob::finish()
 
     try
     {
-        // We check again for an etag mismatch or overwrite, in case the file was updated after the upload started.
-        if (!parent_id_.empty())
-        {
-            // create_file()
-            if (!allow_overwrite_ && boost::filesystem::exists(item_id_))
-            {
-                string msg = method_ + ": \"" + item_id_ + "\" exists already";
-                boost::filesystem::path(item_id_).filename().native();
-                BOOST_THROW_EXCEPTION(
-                    ExistsException(msg, item_id_, boost::filesystem::path(item_id_).filename().native()));
-            }
-        }
-        else if (!old_etag_.empty())
-        {
-            // update()
-            int64_t mtime = get_mtime_nsecs(method_, item_id_);
-            if (to_string(mtime) != old_etag_)
-            {
-                BOOST_THROW_EXCEPTION(ConflictException(method_ + ": etag mismatch"));
-            }
-        }
+        check_preconditions();
 
-        if (!file_->flush())  // Make sure that all buffered data is written.
+        // The usage cache needs to know how much we are replacing.
+        struct stat old_st;
+        int64_t old_size = -1;
+        if (provider_->usage_cache() && ::lstat(item_id_.c_str(), &old_st) == 0 && S_ISREG(old_st.st_mode))
         {
-            // LCOV_EXCL_START
-            string msg = "finish(): cannot flush output file: " + file_->errorString().toStdString();
-            throw_storage_exception("finish()", msg, file_->error());
-            // LCOV_EXCL_STOP
+            old_size = old_st.st_size;
         }
 
         // Link the anonymous tmp file into the file system.
@@ -232,25 +497,47 @@ boost::future<Item> LocalUploadJob::finish()
         }
         else
         {
-            // LCOV_EXCL_START
-            auto old_path = file_->fileName().toStdString();
+            auto old_path = tmp_path_;
             if (rename(old_path.c_str(), item_id_.c_str()) == -1)
             {
+                // LCOV_EXCL_START
                 string msg = "finish(): rename \"" + old_path + "\" to \"" + item_id_ + "\" failed: "
                              + safe_strerror(errno);
                 BOOST_THROW_EXCEPTION(ResourceException(msg, errno));
+                // LCOV_EXCL_STOP
             }
-            // LCOV_EXCL_STOP
+            if (!manifest_path_.empty())
+            {
+                ::unlink(manifest_path_.c_str());
+            }
+        }
+
+        if (md5_ && hashed_ == size_)
+        {
+            Md5Cache::store(tmp_fd_.get(), md5_->hex_digest());
+        }
+        if (provider_->usage_cache())
+        {
+            provider_->usage_cache()->file_written(item_id_, old_size);
         }
 
-        file_->close();
-        read_socket_.close();
+        notifier_.reset();
+        read_fd_.dealloc();
 
-        auto st = boost::filesystem::status(item_id_);
-        return boost::make_ready_future<Item>(provider_->make_item(method_, item_id_, st));
+        // Collecting the metadata requires more system calls (and a GIO lookup), so we do that on the pool.
+        auto provider = provider_;
+        auto method = method_;
+        auto item_id = item_id_;
+        auto keys = keys_;
+        auto do_make_item = [provider, method, item_id, keys]
+        {
+            return provider->make_item(method, item_id, keys);
+        };
+        return invoke_async(provider_->thread_pool(), method_, do_make_item);
     }
     catch (StorageException const&)
     {
+        remove_tmp_file();
         return boost::make_exceptional_future<Item>(boost::current_exception());
     }
     // LCOV_EXCL_START
@@ -274,64 +561,163 @@ boost::future<Item> LocalUploadJob::finish()
 
 void LocalUploadJob::on_bytes_ready()
 {
-    if (bytes_to_write_ < 0)
+    if (bytes_to_write_ < 0 || !read_fd_.has_resource())
     {
-        return;  // LCOV_EXCL_LINE  // We received too many bytes earlier.
+        return;  // LCOV_EXCL_LINE  // We received too many bytes earlier, or the upload is over.
     }
 
     try
     {
-        auto buf = read_socket_.readAll();
-        if (buf.size() != 0)
+        read_available();
+    }
+    catch (std::exception const&)
+    {
+        abort_upload();
+        report_error(current_exception());
+    }
+}
+
+// Move whatever the socket has to offer into the temp file, without blocking.
+// We always ask for one byte more than we expect, so we notice if the client
+// sends too much.
+
+void LocalUploadJob::read_available()
+{
+    while (!eof_)
+    {
+        int64_t const max_bytes = min(bytes_to_write_ + 1, use_splice_ ? pipe_size_ : BUFFER_SIZE);
+        ssize_t bytes_read;
+        if (use_splice_)
+        {
+            bytes_read = splice(read_fd_.get(), nullptr, pipe_write_fd_.get(), nullptr, max_bytes,
+                                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        }
+        else
+        {
+            bytes_read = read(read_fd_.get(), buf_.get(), max_bytes);
+        }
+        if (bytes_read == -1)
         {
-            bytes_to_write_ -= buf.size();
-            if (bytes_to_write_ < 0)
+            if (errno == EAGAIN)
             {
-                string msg = method_ + ": received more than the expected number (" + to_string(size_) + ") of bytes";
-                throw LogicException(msg);
+                return;  // Wait for the next notification.
             }
-            auto bytes_written = file_->write(buf);
-            if (bytes_written == -1)
+            // LCOV_EXCL_START
+            if (errno == EINTR)
             {
-                // LCOV_EXCL_START
-                string msg = "write error: " + file_->errorString().toStdString();
-                throw_storage_exception(method_, msg, file_->error());
-                // LCOV_EXCL_STOP
+                continue;
             }
-            else if (bytes_written != buf.size())
+            if (use_splice_ && errno == EINVAL)
             {
-                // LCOV_EXCL_START
-                string msg = "write error, requested " + to_string(buf.size()) + " B, but wrote only "
-                             + to_string(bytes_written) + " B.";
-                throw_storage_exception(method_, msg, QFileDevice::FatalError);
-                // LCOV_EXCL_STOP
+                stop_splicing();  // Socket type doesn't support splice().
+                continue;
             }
+            throw_storage_exception(method_, use_splice_ ? "splice" : "read", item_id_, errno);
+            // LCOV_EXCL_STOP
+        }
+        if (bytes_read == 0)
+        {
+            eof_ = true;
+            notifier_->setEnabled(false);  // Otherwise, it would keep firing.
+            return;
+        }
+
+        bytes_to_write_ -= bytes_read;
+        if (bytes_to_write_ < 0)
+        {
+            string msg = method_ + ": received more than the expected number (" + to_string(size_) + ") of bytes";
+            throw LogicException(msg);
+        }
+        if (use_splice_)
+        {
+            write_from_pipe(bytes_read);
+        }
+        else
+        {
+            write_from_buffer(buf_.get(), bytes_read);
         }
     }
-    catch (std::exception const&)
+}
+
+// Move bytes from the pipe into the temp file.
+
+void LocalUploadJob::write_from_pipe(int64_t bytes)
+{
+    while (bytes > 0)
     {
-        abort_upload();
-        report_error(current_exception());
+        auto bytes_written = splice(pipe_read_fd_.get(), nullptr, tmp_fd_.get(), nullptr, bytes, SPLICE_F_MOVE);
+        if (bytes_written == -1)
+        {
+            // LCOV_EXCL_START
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EINVAL)
+            {
+                // The file system doesn't support splice(), so we drain the pipe through the buffer.
+                stop_splicing();
+                unique_ptr<char[]> pipe_buf(new char[BUFFER_SIZE]);
+                while (bytes > 0)
+                {
+                    auto bytes_read = read(pipe_read_fd_.get(), pipe_buf.get(), min(bytes, BUFFER_SIZE));
+                    if (bytes_read == -1)
+                    {
+                        throw_storage_exception(method_, "read", item_id_, errno);
+                    }
+                    write_from_buffer(pipe_buf.get(), bytes_read);
+                    bytes -= bytes_read;
+                }
+                return;
+            }
+            throw_storage_exception(method_, "splice", item_id_, errno);
+            // LCOV_EXCL_STOP
+        }
+        bytes -= bytes_written;
+    }
+}
+
+void LocalUploadJob::write_from_buffer(char const* buf, int64_t bytes)
+{
+    while (bytes > 0)
+    {
+        auto bytes_written = write(tmp_fd_.get(), buf, bytes);
+        if (bytes_written == -1)
+        {
+            // LCOV_EXCL_START
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw_storage_exception(method_, "write", item_id_, errno);
+            // LCOV_EXCL_STOP
+        }
+        if (md5_)
+        {
+            md5_->update(buf, bytes_written);
+            hashed_ += bytes_written;
+        }
+        buf += bytes_written;
+        bytes -= bytes_written;
     }
 }
 
-void LocalUploadJob::on_read_channel_finished()
+// Switch to read()/write() for the remainder of the upload.
+
+void LocalUploadJob::stop_splicing()
 {
-    on_bytes_ready();  // In case there s still buffered data to be read.
+    use_splice_ = false;
+    if (!buf_)
+    {
+        buf_.reset(new char[BUFFER_SIZE]);
+    }
 }
 
 void LocalUploadJob::abort_upload()
 {
     state_ = cancelled;
-    disconnect(&read_socket_, nullptr, this, nullptr);
-    read_socket_.abort();
-    file_->close();
-    if (!use_linkat_)
-    {
-        // LCOV_EXCL_START
-        string filename = file_->fileName().toStdString();
-        ::unlink(filename.c_str());  // Don't leave any temp file behind.
-        // LCOV_EXCL_STOP
-    }
+    notifier_.reset();
+    read_fd_.dealloc();
+    remove_tmp_file();  // Don't leave any temp file behind.
     bytes_to_write_ = 0;
 }
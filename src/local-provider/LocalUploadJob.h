@@ -18,6 +18,9 @@
 
 #pragma once
 
+#include "Md5Cache.h"
+#include "UploadManifest.h"
+
 #include <unity/storage/provider/UploadJob.h>
 
 #include <unity/util/ResourcePtr.h>
@@ -25,55 +28,113 @@
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wctor-dtor-privacy"
 #pragma GCC diagnostic ignored "-Wswitch-default"
-#include <QFile>
-#include <QLocalSocket>
+#include <QSocketNotifier>
 #pragma GCC diagnostic pop
 
+#include <functional>
+#include <memory>
+
 class LocalProvider;
 
+// Incoming data is moved from the socket to the temp file with splice(), via a pipe,
+// so it never passes through user space. If splice() isn't supported for the socket
+// or the file system, a fixed-size buffer is used instead. Either way, memory use
+// does not depend on the upload size. The temp file is preallocated from the
+// declared size, so a lack of space is detected up front and the file is not fragmented.
+//
+// If the provider has resumable uploads enabled, the temp file is a named partial file
+// with an UploadManifest. When the client disconnects, suspend() flushes the partial
+// file and records how many bytes it holds, and the resume_upload() constructor
+// continues from there.
+//
+// If the data goes through the buffer, its MD5 digest is computed from the buffer as
+// it arrives and is stored with the file by finish(). Spliced data never reaches user
+// space, and a resumed upload does not have the digest of the earlier part, so in
+// those cases the digest is left to be computed lazily by Md5Cache.
+
 class LocalUploadJob : public QObject, public unity::storage::provider::UploadJob
 {
     Q_OBJECT
 public:
-    LocalUploadJob(std::shared_ptr<LocalProvider> const& provider, int64_t size, const std::string& method);
+    LocalUploadJob(std::shared_ptr<LocalProvider> const& provider,
+                   int64_t size,
+                   const std::string& method,
+                   std::vector<std::string> const& keys,
+                   std::string const& upload_id);
 
     // create_file()
     LocalUploadJob(std::shared_ptr<LocalProvider> const& provider,
                    std::string const& parent_id,
                    std::string const& name,
                    int64_t size,
-                   bool allow_overwrite);
+                   bool allow_overwrite,
+                   std::vector<std::string> const& keys = {});
     // update()
     LocalUploadJob(std::shared_ptr<LocalProvider> const& provider,
                    std::string const& item_id,
                    int64_t size,
-                   std::string const& old_etag);
+                   std::string const& old_etag,
+                   std::vector<std::string> const& keys = {});
+    // resume_upload()
+    LocalUploadJob(std::shared_ptr<LocalProvider> const& provider,
+                   std::string const& upload_id,
+                   std::string const& manifest_path,
+                   UploadManifest const& manifest,
+                   std::vector<std::string> const& keys = {});
     virtual ~LocalUploadJob();
 
     virtual boost::future<void> cancel() override;
     virtual boost::future<unity::storage::provider::Item> finish() override;
+    virtual boost::future<void> suspend() override;
+
+    // Number of bytes that were already stored when the job was created.
+    int64_t committed_size() const;
 
 private Q_SLOTS:
     void on_bytes_ready();
-    void on_read_channel_finished();
 
 private:
     enum State { in_progress, finished, cancelled };
 
+    typedef unity::util::ResourcePtr<int, std::function<void(int)>> FdPtr;
+
     void prepare_channels();
+    void open_tmp_file();
+    void create_partial_file();
+    void reopen_partial_file();
+    void lock_partial_file();
+    void check_preconditions();
+    UploadManifest make_manifest() const;
+    void remove_tmp_file();
+    void read_available();
+    void write_from_pipe(int64_t bytes);
+    void write_from_buffer(char const* buf, int64_t bytes);
+    void stop_splicing();
     void abort_upload();
 
     std::shared_ptr<LocalProvider> const provider_;
     int64_t const size_;
     int64_t bytes_to_write_;
-    std::unique_ptr<QFile> file_;
-    QLocalSocket read_socket_;
     std::string const method_;
     State state_;
     std::string item_id_;
     std::string old_etag_;   // Empty for create_file()
     std::string parent_id_;  // Empty for update()
     bool allow_overwrite_;   // Undefined for update()
-    unity::util::ResourcePtr<int, std::function<void(int)>> tmp_fd_;
+    std::vector<std::string> const keys_;  // Metadata keys for the item returned by finish()
+    FdPtr tmp_fd_;
+    std::string tmp_path_;  // Empty if tmp_fd_ is an O_TMPFILE
     bool use_linkat_;
+    std::string manifest_path_;  // Empty unless the upload is resumable
+    int64_t committed_;          // Bytes in the partial file when the job was created
+    FdPtr read_fd_;         // Non-blocking dup of read_socket()
+    std::unique_ptr<QSocketNotifier> notifier_;
+    bool eof_;
+    bool use_splice_;
+    FdPtr pipe_read_fd_;
+    FdPtr pipe_write_fd_;
+    int64_t pipe_size_;
+    std::unique_ptr<char[]> buf_;  // Only if splice() is not available
+    std::unique_ptr<Md5Digest> md5_;  // Null if we don't compute the digest
+    int64_t hashed_;                  // Number of bytes added to md5_
 };
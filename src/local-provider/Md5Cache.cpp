@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "Md5Cache.h"
+
+#include "utils.h"
+
+#include <unity/storage/provider/Exceptions.h>
+
+#include <QDebug>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#include <glib.h>
+#pragma GCC diagnostic pop
+
+using namespace unity::storage::provider;
+using namespace std;
+
+namespace
+{
+
+char const MD5_XATTR[] = "user.storage-framework.md5";  // Value is "<mtime_nsecs> <hex digest>"
+
+int constexpr HASH_QUEUE_DEPTH = 1024;
+int64_t constexpr HASH_CHUNK_SIZE = 1024 * 1024;
+
+int64_t mtime_nsecs(struct stat const& st)
+{
+    return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+}  // namespace
+
+Md5Digest::Md5Digest()
+    : checksum_(g_checksum_new(G_CHECKSUM_MD5))
+{
+}
+
+Md5Digest::~Md5Digest()
+{
+    g_checksum_free(checksum_);
+}
+
+void Md5Digest::update(void const* buf, int64_t len)
+{
+    g_checksum_update(checksum_, static_cast<guchar const*>(buf), len);
+}
+
+string Md5Digest::hex_digest()
+{
+    return g_checksum_get_string(checksum_);
+}
+
+Md5Cache::Md5Cache()
+    : stopping_(false)
+    , hits_(0)
+    , misses_(0)
+    , computed_(0)
+    , errors_(0)
+    , pool_(1, HASH_QUEUE_DEPTH)
+{
+}
+
+Md5Cache::~Md5Cache()
+{
+    stopping_ = true;  // Abandon whatever is still queued.
+}
+
+string Md5Cache::get(string const& path, struct stat const& st)
+{
+    char buf[128];
+    auto len = getxattr(path.c_str(), MD5_XATTR, buf, sizeof(buf) - 1);
+    if (len > 0)
+    {
+        buf[len] = '\0';
+        string const value = buf;
+        auto const pos = value.find(' ');
+        if (pos != string::npos && value.substr(0, pos) == to_string(mtime_nsecs(st)))
+        {
+            ++hits_;
+            return value.substr(pos + 1);
+        }
+    }
+    else if (len == -1 && errno == ENOTSUP)
+    {
+        return "";  // LCOV_EXCL_LINE  // We could not store the digest, so there is no point computing it.
+    }
+    ++misses_;
+
+    {
+        lock_guard<mutex> guard(lock_);
+        if (!pending_.insert(path).second)
+        {
+            return "";  // Already queued.
+        }
+    }
+    try
+    {
+        pool_.submit([this, path]{ compute(path); });
+    }
+    catch (StorageException const&)
+    {
+        // The queue is full. We'll try again next time the digest is asked for.
+        lock_guard<mutex> guard(lock_);
+        pending_.erase(path);
+    }
+    return "";
+}
+
+void Md5Cache::store(int fd, string const& digest) noexcept
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        return;  // LCOV_EXCL_LINE
+    }
+    string const value = to_string(mtime_nsecs(st)) + " " + digest;
+    fsetxattr(fd, MD5_XATTR, value.data(), value.size(), 0);
+}
+
+Md5Cache::Stats Md5Cache::stats() const
+{
+    Stats s;
+    s.hits = hits_;
+    s.misses = misses_;
+    s.computed = computed_;
+    s.errors = errors_;
+    return s;
+}
+
+// Hash the file and store the digest, unless the file was modified while we were reading it.
+
+void Md5Cache::compute(string const& path) noexcept
+{
+    lower_thread_priority();
+
+    int fd = -1;
+    try
+    {
+        if (stopping_)
+        {
+            return;
+        }
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            throw_storage_exception("Md5Cache", "open", path, errno);
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        struct stat before;
+        if (fstat(fd, &before) == -1)
+        {
+            throw_storage_exception("Md5Cache", "fstat", path, errno);  // LCOV_EXCL_LINE
+        }
+
+        Md5Digest md5;
+        unique_ptr<char[]> buf(new char[HASH_CHUNK_SIZE]);
+        for (;;)
+        {
+            if (stopping_)
+            {
+                close(fd);
+                return;
+            }
+            auto bytes_read = read(fd, buf.get(), HASH_CHUNK_SIZE);
+            if (bytes_read == -1)
+            {
+                // LCOV_EXCL_START
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw_storage_exception("Md5Cache", "read", path, errno);
+                // LCOV_EXCL_STOP
+            }
+            if (bytes_read == 0)
+            {
+                break;
+            }
+            md5.update(buf.get(), bytes_read);
+        }
+
+        struct stat after;
+        if (fstat(fd, &after) == 0 && mtime_nsecs(after) == mtime_nsecs(before))
+        {
+            store(fd, md5.hex_digest());
+            ++computed_;
+        }
+    }
+    catch (StorageException const& e)
+    {
+        ++errors_;
+        qWarning().noquote() << QString::fromStdString(e.what());
+    }
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    lock_guard<mutex> guard(lock_);
+    pending_.erase(path);
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include <sys/stat.h>
+
+struct _GChecksum;
+
+// Incremental MD5 digest.
+
+class Md5Digest
+{
+public:
+    Md5Digest();
+    ~Md5Digest();
+
+    Md5Digest(Md5Digest const&) = delete;
+    Md5Digest& operator=(Md5Digest const&) = delete;
+
+    void update(void const* buf, int64_t len);
+
+    // Returns the digest as a lower-case hex string. No more data can be added after this.
+    std::string hex_digest();
+
+private:
+    _GChecksum* checksum_;
+};
+
+// MD5 digests of files, kept in an extended attribute of the file together
+// with the modification time they were computed for. A digest is returned only
+// while the mtime still matches, so it never describes stale content.
+//
+// Uploads store the digest they computed while receiving the data. For other
+// files, get() schedules the digest to be computed in the background, on a
+// single thread at the lowest CPU and I/O priority. All methods are thread-safe.
+
+class Md5Cache
+{
+public:
+    struct Stats
+    {
+        int64_t hits;
+        int64_t misses;
+        int64_t computed;  // Number of files hashed in the background.
+        int64_t errors;
+    };
+
+    Md5Cache();
+    ~Md5Cache();
+
+    Md5Cache(Md5Cache const&) = delete;
+    Md5Cache& operator=(Md5Cache const&) = delete;
+
+    // Returns the digest of the file at path, with st the result of stat() for path.
+    // If no valid digest is stored, returns the empty string and computes the
+    // digest in the background, so a later call can return it.
+    std::string get(std::string const& path, struct stat const& st);
+
+    // Stores the digest for the file open as fd. Errors are ignored because
+    // the file system may not support extended attributes.
+    static void store(int fd, std::string const& digest) noexcept;
+
+    Stats stats() const;
+
+private:
+    void compute(std::string const& path) noexcept;
+
+    std::atomic<bool> stopping_;
+    std::atomic<int64_t> hits_;
+    std::atomic<int64_t> misses_;
+    std::atomic<int64_t> computed_;
+    std::atomic<int64_t> errors_;
+    std::mutex lock_;
+    std::set<std::string> pending_;  // Files queued for hashing
+    ThreadPool pool_;                // Last, so it is joined before anything else goes away.
+};
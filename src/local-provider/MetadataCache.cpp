@@ -0,0 +1,455 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "MetadataCache.h"
+
+#include "DirStream.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <cassert>
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+
+// Everything that can change the names in a directory or the stat() result of a file in it.
+// IN_DELETE_SELF and IN_MOVE_SELF tell us that the paths we have cached are no longer valid.
+
+constexpr uint32_t WATCH_MASK = IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MODIFY
+                                | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+constexpr uint32_t NAMES_CHANGED = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+constexpr size_t EVENT_BUF_SIZE = 64 * 1024;
+
+// Rough memory cost of the things we cache, including container overhead.
+
+constexpr int64_t DIR_COST = 256;
+
+int64_t file_cost(string const& name)
+{
+    return sizeof(struct stat) + 64 + name.size();
+}
+
+int64_t listing_cost(vector<string> const& names)
+{
+    int64_t bytes = 0;
+    for (auto const& n : names)
+    {
+        bytes += sizeof(string) + n.size();
+    }
+    return bytes;
+}
+
+// The parent directory and name of path, or false for a path without a parent.
+
+bool split_path(string const& path, string& dir, string& name)
+{
+    auto const slash = path.rfind('/');
+    if (slash == string::npos || slash == 0 || slash == path.size() - 1)
+    {
+        return false;
+    }
+    dir = path.substr(0, slash);
+    name = path.substr(slash + 1);
+    return true;
+}
+
+// lstat() and, for a symlink, stat(). Sets is_reg if path is a regular file
+// that is not a symlink, which is what we are allowed to cache.
+
+bool stat_path(string const& path, struct stat& st, bool& is_reg)
+{
+    is_reg = false;
+    if (::lstat(path.c_str(), &st) == -1)
+    {
+        return false;
+    }
+    if (S_ISLNK(st.st_mode))
+    {
+        return ::stat(path.c_str(), &st) == 0;
+    }
+    is_reg = S_ISREG(st.st_mode);
+    return true;
+}
+
+}  // namespace
+
+MetadataCache::MetadataCache(int64_t max_bytes, int max_watches)
+    : max_bytes_(max_bytes)
+    , max_watches_(max_watches)
+    , fd_(-1)
+    , next_gen_(0)
+    , bytes_(0)
+    , hits_(0)
+    , misses_(0)
+    , list_hits_(0)
+    , list_misses_(0)
+    , invalidations_(0)
+    , evictions_(0)
+    , watch_failures_(0)
+{
+    if (max_bytes_ > 0 && max_watches_ > 0)
+    {
+        // If we can't get an inotify fd, the cache stays disabled.
+        fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        event_buf_.resize(EVENT_BUF_SIZE);
+    }
+}
+
+MetadataCache::~MetadataCache()
+{
+    if (fd_ != -1)
+    {
+        ::close(fd_);
+    }
+}
+
+bool MetadataCache::stat(string const& path, struct stat& st)
+{
+    string dir;
+    string name;
+    if (fd_ == -1 || !split_path(path, dir, name))
+    {
+        return ::stat(path.c_str(), &st) == 0;
+    }
+
+    int64_t gen = -1;
+    {
+        lock_guard<mutex> guard(mutex_);
+        drain();
+        auto it = dirs_.find(dir);
+        if (it != dirs_.end())
+        {
+            auto f = it->second.files.find(name);
+            if (f != it->second.files.end())
+            {
+                ++hits_;
+                touch(it->second);
+                st = f->second;
+                return true;
+            }
+            gen = it->second.gen;
+        }
+        ++misses_;
+    }
+
+    bool is_reg;
+    if (!stat_path(path, st, is_reg))
+    {
+        return false;
+    }
+    if (!is_reg)
+    {
+        return true;
+    }
+    if (gen == -1)
+    {
+        // First file we see in this directory. Whatever we got from stat() before
+        // the watch existed can't be trusted, so we need to stat() again.
+        {
+            lock_guard<mutex> guard(mutex_);
+            auto it = add_dir(dir);
+            if (it == dirs_.end())
+            {
+                return true;
+            }
+            gen = it->second.gen;
+        }
+        if (!stat_path(path, st, is_reg))
+        {
+            return false;
+        }
+        if (!is_reg)
+        {
+            return true;
+        }
+    }
+
+    // If an event for the directory arrived since we took gen, st may be stale already.
+    lock_guard<mutex> guard(mutex_);
+    drain();
+    auto it = dirs_.find(dir);
+    if (it != dirs_.end() && it->second.gen == gen && it->second.files.emplace(name, st).second)
+    {
+        add_bytes(it->second, file_cost(name));
+        evict();
+    }
+    return true;
+}
+
+MetadataCache::Listing MetadataCache::list(string const& method, string const& dir_path)
+{
+    if (fd_ == -1)
+    {
+        return nullptr;
+    }
+
+    int64_t gen;
+    {
+        lock_guard<mutex> guard(mutex_);
+        drain();
+        auto it = dirs_.find(dir_path);
+        if (it != dirs_.end() && it->second.listing)
+        {
+            ++list_hits_;
+            touch(it->second);
+            return it->second.listing;
+        }
+        ++list_misses_;
+        if (it == dirs_.end())
+        {
+            it = add_dir(dir_path);
+            if (it == dirs_.end())
+            {
+                return nullptr;
+            }
+        }
+        gen = it->second.gen;
+    }
+
+    // Read the directory without holding the lock. We also pick up the stat() results
+    // for the files, so the caller's stat() calls for the entries are hits.
+    DirStream dir(method, dir_path);
+    auto names = make_shared<vector<string>>();
+    vector<pair<string, struct stat>> files;
+    for (; !dir.at_end(); dir.advance())
+    {
+        auto const& name = dir.name();
+        names->push_back(name);
+        struct stat st;
+        if (fstatat(dir.fd(), name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(st.st_mode))
+        {
+            files.emplace_back(name, st);
+        }
+    }
+    Listing listing = move(names);
+
+    lock_guard<mutex> guard(mutex_);
+    drain();
+    auto it = dirs_.find(dir_path);
+    if (it != dirs_.end() && it->second.gen == gen)
+    {
+        auto& ds = it->second;
+        drop_listing(ds);
+        ds.listing = listing;
+        int64_t bytes = listing_cost(*listing);
+        for (auto const& f : files)
+        {
+            if (ds.files.insert(f).second)
+            {
+                bytes += file_cost(f.first);
+            }
+        }
+        add_bytes(ds, bytes);
+        evict();
+    }
+    return listing;
+}
+
+MetadataCache::Stats MetadataCache::stats() const
+{
+    lock_guard<mutex> guard(mutex_);
+    return Stats{ hits_, misses_, list_hits_, list_misses_, invalidations_,
+                  evictions_, watch_failures_, int64_t(dirs_.size()), bytes_ };
+}
+
+// Apply all pending inotify events. Called with mutex_ held.
+
+void MetadataCache::drain()
+{
+    for (;;)
+    {
+        ssize_t const n = ::read(fd_, event_buf_.data(), event_buf_.size());
+        if (n <= 0)
+        {
+            return;  // EAGAIN: nothing pending.
+        }
+        for (char const* p = event_buf_.data(); p < event_buf_.data() + n; )
+        {
+            auto ev = reinterpret_cast<struct inotify_event const*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                // We lost events, so nothing we have can be trusted.
+                ++invalidations_;
+                clear();
+                continue;
+            }
+            auto w = watches_.find(ev->wd);
+            if (w == watches_.end())
+            {
+                continue;  // Stale event for a directory we dropped already.
+            }
+            auto it = dirs_.find(w->second);
+            assert(it != dirs_.end());
+            if (ev->mask & IN_IGNORED)
+            {
+                drop_dir(it, false);  // The kernel removed the watch.
+                continue;
+            }
+            string const dir = it->first;
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT))
+            {
+                ++invalidations_;
+                drop_tree(dir);
+                continue;
+            }
+
+            auto& ds = it->second;
+            ds.gen = ++next_gen_;
+            bool dropped = false;
+            if ((ev->mask & NAMES_CHANGED) && ds.listing)
+            {
+                drop_listing(ds);
+                dropped = true;
+            }
+            if (ev->len > 0)
+            {
+                string const name = ev->name;
+                if (ds.files.erase(name) != 0)
+                {
+                    add_bytes(ds, -file_cost(name));
+                    dropped = true;
+                }
+                if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_DELETE | IN_MOVED_FROM)))
+                {
+                    // The watches below a renamed directory report under their old paths.
+                    drop_tree(dir + "/" + name);
+                }
+            }
+            if (dropped)
+            {
+                ++invalidations_;
+            }
+        }
+    }
+}
+
+// Return the entry for dir, adding a watch for it if necessary.
+// Returns dirs_.end() if we can't watch dir. Called with mutex_ held.
+
+MetadataCache::DirMap::iterator MetadataCache::add_dir(string const& dir)
+{
+    auto it = dirs_.find(dir);
+    if (it != dirs_.end())
+    {
+        return it;
+    }
+    while (int(dirs_.size()) >= max_watches_ && !lru_.empty())
+    {
+        drop_dir(dirs_.find(lru_.back()), true);
+        ++evictions_;
+    }
+
+    int const wd = inotify_add_watch(fd_, dir.c_str(), WATCH_MASK);
+    if (wd == -1)
+    {
+        ++watch_failures_;  // Most likely, we have hit fs.inotify.max_user_watches.
+        return dirs_.end();
+    }
+    if (watches_.find(wd) != watches_.end())
+    {
+        // Same directory under a different path (via a symlink or bind mount).
+        // Events would be reported for the other path only, so we don't cache this one.
+        ++watch_failures_;
+        return dirs_.end();
+    }
+    watches_[wd] = dir;
+    lru_.push_front(dir);
+    bytes_ += DIR_COST;
+    return dirs_.emplace(dir, DirState{ wd, ++next_gen_, nullptr, {}, DIR_COST, lru_.begin() }).first;
+}
+
+void MetadataCache::touch(DirState& ds)
+{
+    lru_.splice(lru_.begin(), lru_, ds.lru_pos);
+}
+
+void MetadataCache::drop_dir(DirMap::iterator it, bool rm_watch)
+{
+    auto& ds = it->second;
+    bytes_ -= ds.bytes;
+    lru_.erase(ds.lru_pos);
+    watches_.erase(ds.wd);
+    if (rm_watch)
+    {
+        inotify_rm_watch(fd_, ds.wd);  // Fails harmlessly if the kernel has removed the watch already.
+    }
+    dirs_.erase(it);
+}
+
+// Drop dir and everything below it.
+
+void MetadataCache::drop_tree(string const& dir)
+{
+    auto it = dirs_.find(dir);
+    if (it != dirs_.end())
+    {
+        drop_dir(it, true);
+    }
+    string const prefix = dir + "/";
+    it = dirs_.lower_bound(prefix);
+    while (it != dirs_.end() && boost::starts_with(it->first, prefix))
+    {
+        auto next = std::next(it);
+        drop_dir(it, true);
+        it = next;
+    }
+}
+
+void MetadataCache::drop_listing(DirState& ds)
+{
+    if (ds.listing)
+    {
+        add_bytes(ds, -listing_cost(*ds.listing));
+        ds.listing = nullptr;
+    }
+}
+
+void MetadataCache::clear()
+{
+    while (!dirs_.empty())
+    {
+        drop_dir(dirs_.begin(), true);
+    }
+}
+
+void MetadataCache::add_bytes(DirState& ds, int64_t bytes)
+{
+    ds.bytes += bytes;
+    bytes_ += bytes;
+}
+
+// Drop least-recently used directories until we are within the limits.
+
+void MetadataCache::evict()
+{
+    while (bytes_ > max_bytes_ && !lru_.empty())
+    {
+        drop_dir(dirs_.find(lru_.back()), true);
+        ++evictions_;
+    }
+}
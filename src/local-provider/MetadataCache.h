@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+// Caches stat() results for files and the entry names of directories, so repeated
+// metadata(), lookup(), and list() calls for the same items don't hit the file system.
+//
+// Nothing is cached for a directory unless we have an inotify watch on it. Before
+// each lookup, we drain the pending inotify events and drop whatever they affect.
+// The kernel queues an event before the system call that caused it returns, so a
+// lookup never returns data that was stale at the time the lookup started, whether
+// the change was made by us or by someone else.
+//
+// Only regular files are cached. A directory's own modification time changes when
+// something is added to it, which is reported to the directory, not to its parent,
+// and a symlink's target can change without any event, so folders and symlinks are
+// always stat()ed. Changes that inotify does not report (writes via mmap(), writes
+// via a hard link in another directory) are not seen until the entry is evicted.
+//
+// The cache evicts the least-recently used directory (and removes its watch) if it
+// would use more than max_bytes or more than max_watches watches. If inotify runs
+// out of watches or is not available, the affected directories are not cached.
+// max_bytes == 0 disables the cache. All methods are thread-safe.
+
+class MetadataCache
+{
+public:
+    struct Stats
+    {
+        int64_t hits;             // stat() calls served from memory.
+        int64_t misses;
+        int64_t list_hits;        // list() calls served from memory.
+        int64_t list_misses;
+        int64_t invalidations;    // Number of inotify events that dropped something.
+        int64_t evictions;        // Directories dropped to stay within the limits.
+        int64_t watch_failures;   // inotify_add_watch() failures.
+        int64_t watches;          // Current number of watched directories.
+        int64_t bytes;            // Approximate current memory use.
+    };
+
+    // Names of the entries in a directory, in readdir() order, without "." and "..".
+    typedef std::shared_ptr<std::vector<std::string> const> Listing;
+
+    MetadataCache(int64_t max_bytes, int max_watches);
+    ~MetadataCache();
+
+    MetadataCache(MetadataCache const&) = delete;
+    MetadataCache& operator=(MetadataCache const&) = delete;
+
+    // Same as ::stat(): follows symlinks, returns false and sets errno on error.
+    bool stat(std::string const& path, struct stat& st);
+
+    // Returns the entries of the directory at dir_path, or nullptr if the directory
+    // cannot be cached, in which case the caller should read the directory itself.
+    // Throws a StorageException if the directory cannot be read.
+    Listing list(std::string const& method, std::string const& dir_path);
+
+    Stats stats() const;
+
+private:
+    struct DirState
+    {
+        int wd;
+        int64_t gen;                                            // Changes with every event for the directory.
+        Listing listing;                                        // nullptr unless list() has read the directory.
+        std::unordered_map<std::string, struct stat> files;     // Keyed by name.
+        int64_t bytes;
+        std::list<std::string>::iterator lru_pos;
+    };
+
+    typedef std::map<std::string, DirState> DirMap;  // Ordered, so we can find all subdirectories of a path.
+
+    void drain();
+    DirMap::iterator add_dir(std::string const& dir);
+    void touch(DirState& ds);
+    void drop_dir(DirMap::iterator it, bool rm_watch);
+    void drop_tree(std::string const& dir);
+    void drop_listing(DirState& ds);
+    void clear();
+    void add_bytes(DirState& ds, int64_t bytes);
+    void evict();
+
+    int64_t const max_bytes_;
+    int const max_watches_;
+    int fd_;                                   // inotify fd, -1 if the cache is disabled.
+    mutable std::mutex mutex_;
+    DirMap dirs_;
+    std::unordered_map<int, std::string> watches_;
+    std::list<std::string> lru_;               // Most-recently used directory at the front.
+    std::vector<char> event_buf_;
+    int64_t next_gen_;
+    int64_t bytes_;
+    int64_t hits_;
+    int64_t misses_;
+    int64_t list_hits_;
+    int64_t list_misses_;
+    int64_t invalidations_;
+    int64_t evictions_;
+    int64_t watch_failures_;
+};
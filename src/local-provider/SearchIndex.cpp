@@ -0,0 +1,610 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "SearchIndex.h"
+
+#include "DirStream.h"
+#include "utils.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <algorithm>
+#include <fstream>
+
+#include <fnmatch.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+
+// We only need to know about names that come and go.
+
+constexpr uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+constexpr size_t EVENT_BUF_SIZE = 64 * 1024;
+
+// Max number of directory scans waiting for a thread. If there are more, we scan inline.
+
+constexpr int MAX_QUEUED_SCANS = 100000;
+
+char const* const INDEX_VERSION = "1";
+
+// So we can search the live index and the saved one with the same code.
+
+template<typename Node>
+vector<string> const& names_of(Node const& node)
+{
+    return node.names;
+}
+
+vector<string> const& names_of(vector<string> const& names)
+{
+    return names;
+}
+
+}  // namespace
+
+SearchIndex::SearchIndex(string const& root, string const& index_path, int num_threads, int max_watches)
+    : root_(root)
+    , index_path_(index_path)
+    , max_watches_(max_watches)
+    , fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+    , stop_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+    , event_buf_(EVENT_BUF_SIZE)
+    , next_gen_(0)
+    , next_epoch_(0)
+    , build_epoch_(0)
+    , rebuilds_(0)
+    , ready_(false)
+    , stopping_(false)
+    , pool_(num_threads, MAX_QUEUED_SCANS)
+{
+}
+
+SearchIndex::~SearchIndex()
+{
+    stopping_ = true;
+    if (watcher_.joinable())
+    {
+        uint64_t one = 1;
+        if (write(stop_fd_, &one, sizeof(one)) != sizeof(one))
+        {
+            abort();  // LCOV_EXCL_LINE  // Impossible for an eventfd.
+        }
+        watcher_.join();
+    }
+    {
+        // Scans that are still queued or running bail out early, but we have to wait
+        // for them because they use the inotify fd.
+        unique_lock<mutex> lock(mutex_);
+        idle_.wait(lock, [this]{ return pending_.empty(); });
+        if (ready_)
+        {
+            save();
+        }
+    }
+    if (fd_ != -1)
+    {
+        ::close(fd_);
+    }
+    if (stop_fd_ != -1)
+    {
+        ::close(stop_fd_);
+    }
+}
+
+SearchIndex::Results SearchIndex::search(string const& dir, string const& pattern)
+{
+    call_once(started_, &SearchIndex::start, this);
+
+    // Apply pending events, so we see changes made before this call.
+    vector<string> new_dirs;
+    int64_t epoch;
+    {
+        lock_guard<mutex> lock(mutex_);
+        epoch = drain(new_dirs);
+    }
+    schedule_scans(new_dirs, epoch);
+    new_dirs.clear();
+
+    unique_lock<mutex> lock(mutex_);
+    bool const use_saved = !ready_ && saved_;
+    if (!use_saved)
+    {
+        // Scans for changes that arrive while we wait belong to later epochs, so we don't wait for them.
+        idle_.wait(lock, [this, epoch]{ return !scans_pending(epoch) || stopping_; });
+
+        // Nobody tells us about changes in unwatched directories, so we have to read them again.
+        string const prefix = dir + "/";
+        vector<string> unwatched;
+        for (auto it = dirs_.lower_bound(dir); it != dirs_.end() && (it->first == dir || boost::starts_with(it->first, prefix)); ++it)
+        {
+            if (it->second.wd == -1)
+            {
+                unwatched.push_back(it->first);
+            }
+        }
+        if (!unwatched.empty())
+        {
+            int64_t const rescan_epoch = ++next_epoch_;
+            lock.unlock();
+            for (auto const& d : unwatched)
+            {
+                try
+                {
+                    scan_dir(d, new_dirs, rescan_epoch);
+                }
+                catch (std::exception const&)
+                {
+                    // Gone or unreadable. The event or scan for its parent takes care of it.
+                }
+            }
+            schedule_scans(new_dirs, rescan_epoch);
+            lock.lock();
+            idle_.wait(lock, [this, rescan_epoch]{ return !scans_pending(rescan_epoch) || stopping_; });
+        }
+    }
+
+    auto results = make_shared<vector<string>>();
+    string const prefix = dir + "/";
+    auto match = [&](string const& d, vector<string> const& names)
+    {
+        string const rel_dir = d == dir ? "" : d.substr(prefix.size()) + "/";
+        for (auto const& name : names)
+        {
+            if (fnmatch(pattern.c_str(), name.c_str(), FNM_CASEFOLD) == 0)
+            {
+                results->push_back(rel_dir + name);
+            }
+        }
+    };
+    auto match_subtree = [&](auto const& index)
+    {
+        auto it = index.find(dir);
+        if (it == index.end())
+        {
+            return;
+        }
+        for (; it != index.end() && (it->first == dir || boost::starts_with(it->first, prefix)); ++it)
+        {
+            match(it->first, names_of(it->second));
+        }
+    };
+    if (use_saved)
+    {
+        match_subtree(*saved_);
+    }
+    else
+    {
+        match_subtree(dirs_);
+    }
+    lock.unlock();
+
+    sort(results->begin(), results->end());
+    return results;
+}
+
+void SearchIndex::wait_until_idle()
+{
+    unique_lock<mutex> lock(mutex_);
+    idle_.wait(lock, [this]{ return pending_.empty(); });
+}
+
+SearchIndex::Stats SearchIndex::stats() const
+{
+    lock_guard<mutex> lock(mutex_);
+    Stats s{ int64_t(dirs_.size()), 0, 0, 0, rebuilds_, ready_ };
+    for (auto const& p : pending_)
+    {
+        s.pending_scans += p.second;
+    }
+    for (auto const& d : dirs_)
+    {
+        s.entries += d.second.names.size();
+        if (d.second.wd == -1)
+        {
+            ++s.unwatched;
+        }
+    }
+    return s;
+}
+
+// Called once, by the first search().
+
+void SearchIndex::start()
+{
+    load();
+    int64_t epoch;
+    {
+        lock_guard<mutex> lock(mutex_);
+        epoch = build_epoch_ = ++next_epoch_;
+        ++pending_[epoch];
+    }
+    schedule_scans({ root_ }, epoch);
+
+    // Without inotify, every directory is unwatched, so searches read the tree again.
+    if (fd_ != -1 && stop_fd_ != -1)
+    {
+        watcher_ = thread(&SearchIndex::run_watcher, this);
+    }
+}
+
+// Queue a scan for each of dirs. The caller has added them to pending_ for epoch already.
+
+void SearchIndex::schedule_scans(vector<string> const& dirs, int64_t epoch)
+{
+    for (auto const& dir : dirs)
+    {
+        try
+        {
+            pool_.submit([this, dir, epoch]
+            {
+                thread_local bool lowered = false;
+                if (!lowered)
+                {
+                    lower_thread_priority();  // Only our own pool's threads.
+                    lowered = true;
+                }
+                scan_task(dir, epoch);
+            });
+        }
+        catch (std::exception const&)
+        {
+            scan_task(dir, epoch);  // Queue full or pool closed.
+        }
+    }
+}
+
+// Scans for the subdirectories we find belong to the same epoch.
+
+void SearchIndex::scan_task(string const& dir, int64_t epoch)
+{
+    vector<string> new_dirs;
+    if (!stopping_)
+    {
+        try
+        {
+            scan_dir(dir, new_dirs, epoch);
+        }
+        catch (std::exception const&)
+        {
+            // The directory has disappeared or can't be read, so there is nothing to index.
+        }
+    }
+    schedule_scans(new_dirs, epoch);
+    scan_finished(epoch);
+}
+
+// Read the names in dir and replace what we have for it. Subdirectories we don't
+// know about yet are added to new_dirs (and to pending_ for epoch); the caller must
+// schedule them. Subdirectories that have gone away are dropped.
+
+void SearchIndex::scan_dir(string const& dir, vector<string>& new_dirs, int64_t epoch)
+{
+    for (;;)
+    {
+        int64_t gen;
+        {
+            lock_guard<mutex> lock(mutex_);
+            auto it = dirs_.find(dir);
+            if (it == dirs_.end())
+            {
+                it = dirs_.emplace(dir, DirNode{ -1, 0, {} }).first;
+            }
+            // The watch must be in place before we read the directory, so we can't miss anything.
+            if (it->second.wd == -1 && fd_ != -1 && int(watches_.size()) < max_watches_)
+            {
+                int const wd = inotify_add_watch(fd_, dir.c_str(), WATCH_MASK);
+                if (wd != -1 && watches_.find(wd) == watches_.end())
+                {
+                    it->second.wd = wd;
+                    watches_[wd] = dir;
+                }
+            }
+            it->second.gen = ++next_gen_;
+            gen = it->second.gen;
+        }
+
+        vector<string> names;
+        vector<string> subdirs;
+        for (DirStream d("search()", dir); !d.at_end(); d.advance())
+        {
+            if (is_reserved_path(d.name()))
+            {
+                continue;
+            }
+            names.push_back(d.name());
+            if (d.is_dir())
+            {
+                subdirs.push_back(d.name());
+            }
+        }
+        sort(subdirs.begin(), subdirs.end());
+
+        lock_guard<mutex> lock(mutex_);
+        auto it = dirs_.find(dir);
+        if (it == dirs_.end())
+        {
+            return;  // Dropped while we were reading it.
+        }
+        if (it->second.gen != gen)
+        {
+            continue;  // Changed while we were reading it.
+        }
+        for (auto const& name : it->second.names)
+        {
+            if (!binary_search(subdirs.begin(), subdirs.end(), name))
+            {
+                drop_tree(dir + "/" + name);
+            }
+        }
+        for (auto const& name : subdirs)
+        {
+            string child = dir + "/" + name;
+            if (dirs_.find(child) == dirs_.end())
+            {
+                new_dirs.push_back(move(child));
+                ++pending_[epoch];
+            }
+        }
+        it->second.names = move(names);
+        return;
+    }
+}
+
+// Apply all pending inotify events. New directories are added to new_dirs (and
+// to pending_ for a new epoch, which we return); the caller must schedule them.
+// Called with mutex_ held.
+
+int64_t SearchIndex::drain(vector<string>& new_dirs)
+{
+    int64_t const epoch = ++next_epoch_;
+    if (fd_ == -1)
+    {
+        return epoch;
+    }
+    bool overflow = false;
+    for (;;)
+    {
+        ssize_t const n = ::read(fd_, event_buf_.data(), event_buf_.size());
+        if (n <= 0)
+        {
+            break;  // EAGAIN: nothing pending.
+        }
+        for (char const* p = event_buf_.data(); p < event_buf_.data() + n; )
+        {
+            auto ev = reinterpret_cast<struct inotify_event const*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                overflow = true;
+                continue;
+            }
+            auto w = watches_.find(ev->wd);
+            if (w == watches_.end())
+            {
+                continue;  // Stale event for a directory we dropped already.
+            }
+            auto it = dirs_.find(w->second);
+            if (ev->mask & IN_IGNORED)
+            {
+                // The directory is gone; the event for its parent drops it.
+                if (it != dirs_.end() && it->second.wd == ev->wd)
+                {
+                    it->second.wd = -1;
+                }
+                watches_.erase(w);
+                continue;
+            }
+            if (it == dirs_.end() || ev->len == 0 || is_reserved_path(ev->name))
+            {
+                continue;
+            }
+
+            auto& node = it->second;
+            node.gen = ++next_gen_;
+            string const name = ev->name;
+            string const child = it->first + "/" + name;
+            auto pos = find(node.names.begin(), node.names.end(), name);
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+            {
+                if (pos == node.names.end())
+                {
+                    node.names.push_back(name);
+                }
+                if ((ev->mask & IN_ISDIR) && dirs_.find(child) == dirs_.end())
+                {
+                    new_dirs.push_back(child);  // Moved in with whatever is below it.
+                    ++pending_[epoch];
+                }
+            }
+            else
+            {
+                if (pos != node.names.end())
+                {
+                    node.names.erase(pos);
+                }
+                if (ev->mask & IN_ISDIR)
+                {
+                    drop_tree(child);
+                }
+            }
+        }
+    }
+    if (overflow)
+    {
+        // We have lost events, so we have to start over. Scans still in progress
+        // find that their directory is gone.
+        for (auto const& w : watches_)
+        {
+            inotify_rm_watch(fd_, w.first);
+        }
+        watches_.clear();
+        dirs_.clear();
+        ++rebuilds_;
+        ready_ = false;
+        build_epoch_ = epoch;
+        new_dirs.assign(1, root_);
+        pending_[epoch] = 1;
+    }
+    return epoch;
+}
+
+// Drop dir and everything below it. Called with mutex_ held.
+
+void SearchIndex::drop_tree(string const& dir)
+{
+    string const prefix = dir + "/";
+    auto it = dirs_.lower_bound(dir);
+    while (it != dirs_.end() && (it->first == dir || boost::starts_with(it->first, prefix)))
+    {
+        if (it->second.wd != -1)
+        {
+            inotify_rm_watch(fd_, it->second.wd);  // Fails harmlessly if the kernel removed the watch already.
+            watches_.erase(it->second.wd);
+        }
+        it = dirs_.erase(it);
+    }
+}
+
+void SearchIndex::scan_finished(int64_t epoch)
+{
+    lock_guard<mutex> lock(mutex_);
+    auto it = pending_.find(epoch);
+    if (--it->second == 0)
+    {
+        pending_.erase(it);
+        if (!ready_ && !stopping_ && !scans_pending(build_epoch_))
+        {
+            ready_ = true;
+            saved_.reset();
+        }
+        idle_.notify_all();
+    }
+}
+
+// True if any scans for epoch or an earlier one are still queued or running.
+// Called with mutex_ held.
+
+bool SearchIndex::scans_pending(int64_t epoch) const
+{
+    return !pending_.empty() && pending_.begin()->first <= epoch;
+}
+
+void SearchIndex::run_watcher()
+{
+    struct pollfd fds[2] = { { fd_, POLLIN, 0 }, { stop_fd_, POLLIN, 0 } };
+    while (!stopping_)
+    {
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;  // LCOV_EXCL_LINE
+            }
+            return;  // LCOV_EXCL_LINE
+        }
+        if (fds[1].revents != 0)
+        {
+            return;
+        }
+        vector<string> new_dirs;
+        int64_t epoch;
+        {
+            lock_guard<mutex> lock(mutex_);
+            epoch = drain(new_dirs);
+        }
+        schedule_scans(new_dirs, epoch);
+    }
+}
+
+// The saved index is the version, followed by, for each directory, its path relative
+// to the root, the number of names, and the names, all terminated by NUL bytes.
+// Anything unexpected (including a count that doesn't fit) means we don't use it.
+
+void SearchIndex::load()
+{
+    ifstream in(index_path_, ios::binary);
+    string field;
+    if (!getline(in, field, '\0') || field != INDEX_VERSION)
+    {
+        return;
+    }
+    unique_ptr<SavedIndex> saved(new SavedIndex);
+    string rel_dir;
+    while (getline(in, rel_dir, '\0'))
+    {
+        if (!getline(in, field, '\0') || field.empty() || field.find_first_not_of("0123456789") != string::npos)
+        {
+            return;
+        }
+        unsigned long long count;
+        try
+        {
+            count = stoull(field);
+        }
+        catch (std::logic_error const&)
+        {
+            return;  // Out of range.
+        }
+        auto& names = (*saved)[rel_dir.empty() ? root_ : root_ + "/" + rel_dir];
+        for (; count > 0; --count)
+        {
+            names.emplace_back();
+            if (!getline(in, names.back(), '\0'))
+            {
+                return;
+            }
+        }
+    }
+    saved_ = move(saved);
+}
+
+// Best effort; if we can't save the index, the next instance waits for the scan.
+// Called with mutex_ held.
+
+void SearchIndex::save() const
+{
+    string const tmp_path = index_path_ + ".new";
+    {
+        ofstream out(tmp_path, ios::binary | ios::trunc);
+        out << INDEX_VERSION << '\0';
+        for (auto const& d : dirs_)
+        {
+            string const rel_dir = d.first == root_ ? "" : d.first.substr(root_.size() + 1);
+            out << rel_dir << '\0' << d.second.names.size() << '\0';
+            for (auto const& name : d.second.names)
+            {
+                out << name << '\0';
+            }
+        }
+        out.close();
+        if (!out)
+        {
+            unlink(tmp_path.c_str());  // LCOV_EXCL_LINE
+            return;                    // LCOV_EXCL_LINE
+        }
+    }
+    rename(tmp_path.c_str(), index_path_.c_str());
+}
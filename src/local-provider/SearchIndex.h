@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// In-memory index of the names of all files and folders below the root, for search().
+//
+// Nothing happens until the first search(), so a provider that is never searched
+// does not pay for a walk of the tree or for inotify watches. The first search()
+// starts a parallel scan of the tree on a private pool at low priority. Each directory
+// gets an inotify watch before it is read, and a background thread applies the events
+// to the index, so the index stays current without rescanning. A directory that cannot
+// be watched (because we have reached max_watches or fs.inotify.max_user_watches) is
+// read again by every search() that covers it. If the inotify queue overflows, the index
+// is rebuilt.
+//
+// Each batch of scans is tagged with an epoch. A search() waits only for the scans that
+// were started before it, not for scans caused by changes made while it is waiting,
+// so a tree that changes all the time cannot hold up searches indefinitely.
+//
+// The destructor saves the index in index_path. The next instance loads it and uses it
+// to answer searches while the scan is in progress, so searches don't have to wait
+// for the scan after a restart. Results from the saved index may include items that
+// no longer exist and miss items that were added while we were not running; the caller
+// must check that the items exist. A saved index that cannot be parsed is ignored.
+//
+// Symlinks are not followed, and anything with the temp file prefix is not indexed.
+// All methods are thread-safe.
+
+class SearchIndex
+{
+public:
+    struct Stats
+    {
+        int64_t dirs;             // Number of indexed directories.
+        int64_t entries;          // Number of indexed names.
+        int64_t unwatched;        // Directories without an inotify watch.
+        int64_t pending_scans;
+        int64_t rebuilds;         // Number of rebuilds caused by inotify queue overflow.
+        bool ready;               // True if the initial scan has finished.
+    };
+
+    // Paths relative to the searched directory.
+    typedef std::shared_ptr<std::vector<std::string> const> Results;
+
+    SearchIndex(std::string const& root, std::string const& index_path, int num_threads, int max_watches);
+    ~SearchIndex();
+
+    SearchIndex(SearchIndex const&) = delete;
+    SearchIndex& operator=(SearchIndex const&) = delete;
+
+    // Returns the files and folders below dir (which must be the root or a directory below it)
+    // whose name matches the shell wildcard pattern, ignoring case, sorted by path.
+    // The first call starts the index. Waits for the initial scan to finish unless
+    // there is a saved index.
+    Results search(std::string const& dir, std::string const& pattern);
+
+    // Waits until all scans have finished. Returns immediately if search() has
+    // not been called yet. For testing.
+    void wait_until_idle();
+
+    Stats stats() const;
+
+private:
+    struct DirNode
+    {
+        int wd;                          // -1 if the directory is not watched.
+        int64_t gen;                     // Changes with every event for the directory.
+        std::vector<std::string> names;
+    };
+
+    typedef std::map<std::string, DirNode> DirMap;                    // Ordered, so we can find subtrees.
+    typedef std::map<std::string, std::vector<std::string>> SavedIndex;  // Names, keyed by directory.
+
+    void start();
+    void schedule_scans(std::vector<std::string> const& dirs, int64_t epoch);
+    void scan_task(std::string const& dir, int64_t epoch);
+    void scan_dir(std::string const& dir, std::vector<std::string>& new_dirs, int64_t epoch);
+    int64_t drain(std::vector<std::string>& new_dirs);
+    void drop_tree(std::string const& dir);
+    void scan_finished(int64_t epoch);
+    bool scans_pending(int64_t epoch) const;
+    void run_watcher();
+    void load();
+    void save() const;
+
+    std::string const root_;
+    std::string const index_path_;
+    int const max_watches_;
+    int fd_;           // inotify fd
+    int stop_fd_;      // eventfd that tells the watcher thread to stop
+    mutable std::mutex mutex_;
+    std::condition_variable idle_;
+    DirMap dirs_;
+    std::unordered_map<int, std::string> watches_;
+    std::unique_ptr<SavedIndex> saved_;   // Loaded at startup, dropped once the scan has finished.
+    std::vector<char> event_buf_;
+    int64_t next_gen_;
+    std::map<int64_t, int64_t> pending_;  // Number of scans that are queued or running, by epoch.
+    int64_t next_epoch_;
+    int64_t build_epoch_;                 // Epoch of the initial scan or the latest rebuild.
+    int64_t rebuilds_;
+    bool ready_;
+    std::atomic<bool> stopping_;
+    std::once_flag started_;
+    std::thread watcher_;
+    ThreadPool pool_;                     // Must be last, so it is destroyed first.
+};
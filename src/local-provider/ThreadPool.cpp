@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "ThreadPool.h"
+
+#include <unity/storage/provider/Exceptions.h>
+
+#include <boost/exception/enable_current_exception.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include <errno.h>
+
+using namespace unity::storage::provider;
+using namespace std;
+
+struct ThreadPool::State
+{
+    struct Task
+    {
+        work closure;
+        chrono::steady_clock::time_point queued_at;
+    };
+
+    struct WorkerQueue
+    {
+        mutex lock;
+        deque<Task> tasks;
+    };
+
+    State(int num_threads, int max_queue_depth);
+
+    void push(int worker, work&& closure);
+    bool pop(int worker, Task& task);
+    void execute(Task& task) noexcept;
+    void run(int worker);
+
+    int const max_queue_depth;
+    vector<unique_ptr<WorkerQueue>> queues;
+
+    // reserved counts the closures that were accepted by submit(), including any
+    // that are still being pushed. available counts the closures that were pushed
+    // and not yet popped. Idle workers sleep on idle_cond until available is > 0.
+    atomic<int> reserved;
+    atomic<int> available;
+    atomic<unsigned> next_queue;
+    atomic<bool> closed;
+    mutex idle_lock;
+    condition_variable idle_cond;
+
+    atomic<int64_t> threads_created;
+    atomic<int64_t> submitted;
+    atomic<int64_t> executed;
+    atomic<int64_t> rejected;
+    atomic<int64_t> stolen;
+    atomic<int64_t> queue_wait_nsecs;
+    atomic<int64_t> max_queue_wait_nsecs;
+};
+
+namespace
+{
+
+// Identifies the pool and worker that the calling thread belongs to, if any.
+thread_local void const* current_state = nullptr;
+thread_local int current_worker = -1;
+
+}  // namespace
+
+ThreadPool::State::State(int num_threads, int max_queue_depth)
+    : max_queue_depth(max_queue_depth)
+    , reserved(0)
+    , available(0)
+    , next_queue(0)
+    , closed(false)
+    , threads_created(0)
+    , submitted(0)
+    , executed(0)
+    , rejected(0)
+    , stolen(0)
+    , queue_wait_nsecs(0)
+    , max_queue_wait_nsecs(0)
+{
+    for (int i = 0; i < num_threads; ++i)
+    {
+        queues.emplace_back(new WorkerQueue);
+    }
+}
+
+void ThreadPool::State::push(int worker, work&& closure)
+{
+    {
+        lock_guard<mutex> guard(queues[worker]->lock);
+        queues[worker]->tasks.push_back(Task{move(closure), chrono::steady_clock::now()});
+    }
+    {
+        lock_guard<mutex> guard(idle_lock);
+        ++available;
+    }
+    idle_cond.notify_one();
+}
+
+// Pops the oldest task from the worker's own queue or, if that is empty,
+// steals the newest task from one of the other queues. A worker value of -1
+// means that the caller is not a worker of this pool.
+
+bool ThreadPool::State::pop(int worker, Task& task)
+{
+    int const num_queues = queues.size();
+    int const first = worker >= 0 ? worker : next_queue % num_queues;
+    for (int i = 0; i < num_queues; ++i)
+    {
+        int const victim = (first + i) % num_queues;
+        auto& q = *queues[victim];
+        lock_guard<mutex> guard(q.lock);
+        if (q.tasks.empty())
+        {
+            continue;
+        }
+        if (victim == worker)
+        {
+            task = move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+        else
+        {
+            task = move(q.tasks.back());
+            q.tasks.pop_back();
+            ++stolen;
+        }
+        --available;
+        --reserved;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::State::execute(Task& task) noexcept
+{
+    int64_t wait_nsecs = (chrono::steady_clock::now() - task.queued_at) / chrono::nanoseconds(1);
+    queue_wait_nsecs += wait_nsecs;
+    int64_t max_wait = max_queue_wait_nsecs;
+    while (wait_nsecs > max_wait && !max_queue_wait_nsecs.compare_exchange_weak(max_wait, wait_nsecs))
+    {
+    }
+
+    ++executed;
+    task.closure();  // Closures submitted by boost::async() never throw.
+    task.closure = work();  // Release anything captured by the closure before we go idle.
+}
+
+void ThreadPool::State::run(int worker)
+{
+    current_state = this;
+    current_worker = worker;
+
+    Task task;
+    for (;;)
+    {
+        if (pop(worker, task))
+        {
+            execute(task);
+            continue;
+        }
+        unique_lock<mutex> lock(idle_lock);
+        idle_cond.wait(lock, [this]{ return available > 0 || closed; });
+        if (available <= 0 && closed)
+        {
+            return;
+        }
+    }
+}
+
+ThreadPool::ThreadPool(int num_threads, int max_queue_depth)
+    : state_(make_shared<State>(num_threads, max_queue_depth))
+{
+    assert(num_threads > 0);
+    assert(max_queue_depth > 0);
+
+    auto state = state_;
+    for (int i = 0; i < num_threads; ++i)
+    {
+        threads_.emplace_back([state, i]{ state->run(i); });
+        ++state_->threads_created;
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    close();
+    for (auto& t : threads_)
+    {
+        if (t.get_id() == this_thread::get_id())
+        {
+            // The pool is being destroyed by a closure that dropped the last reference
+            // to its owner. The worker holds its own reference to the state and
+            // exits once the queues are drained.
+            t.detach();  // LCOV_EXCL_LINE
+        }
+        else
+        {
+            t.join();
+        }
+    }
+}
+
+void ThreadPool::close()
+{
+    {
+        lock_guard<mutex> guard(state_->idle_lock);
+        state_->closed = true;
+    }
+    state_->idle_cond.notify_all();
+}
+
+bool ThreadPool::closed()
+{
+    return state_->closed;
+}
+
+void ThreadPool::submit(work&& closure)
+{
+    if (state_->closed)
+    {
+        throw boost::enable_current_exception(LogicException("ThreadPool::submit(): thread pool is closed"));
+    }
+    if (++state_->reserved > state_->max_queue_depth)
+    {
+        --state_->reserved;
+        ++state_->rejected;
+        string msg = "ThreadPool::submit(): too many pending requests (limit is "
+                     + to_string(state_->max_queue_depth) + ")";
+        throw boost::enable_current_exception(ResourceException(msg, EAGAIN));
+    }
+    ++state_->submitted;
+
+    int worker;
+    if (current_state == state_.get())
+    {
+        worker = current_worker;  // Keep work created by a worker on that worker's queue.
+    }
+    else
+    {
+        worker = state_->next_queue++ % state_->queues.size();
+    }
+    state_->push(worker, move(closure));
+}
+
+bool ThreadPool::try_executing_one()
+{
+    State::Task task;
+    if (!state_->pop(current_state == state_.get() ? current_worker : -1, task))
+    {
+        return false;
+    }
+    state_->execute(task);
+    return true;
+}
+
+int ThreadPool::num_threads() const noexcept
+{
+    return threads_.size();
+}
+
+int ThreadPool::max_queue_depth() const noexcept
+{
+    return state_->max_queue_depth;
+}
+
+int ThreadPool::queue_depth() const noexcept
+{
+    return max(0, state_->reserved.load());
+}
+
+ThreadPool::Stats ThreadPool::stats() const noexcept
+{
+    Stats s;
+    s.threads_created = state_->threads_created;
+    s.submitted = state_->submitted;
+    s.executed = state_->executed;
+    s.rejected = state_->rejected;
+    s.stolen = state_->stolen;
+    s.queue_wait_nsecs = state_->queue_wait_nsecs;
+    s.max_queue_wait_nsecs = state_->max_queue_wait_nsecs;
+    return s;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <boost/thread/executors/executor.hpp>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Bounded, work-stealing thread pool for the blocking file system operations
+// of the local provider. Use it with boost::async(pool, closure).
+//
+// Each worker thread has its own queue. Closures submitted by a worker go onto
+// that worker's queue; closures submitted by any other thread are distributed
+// round-robin. A worker that runs out of work steals from the other queues,
+// so a worker that is stuck on a slow operation does not hold up the closures
+// that were queued behind it.
+//
+// The number of queued closures that are waiting for a worker is bounded.
+// Once the bound is reached, submit() throws ResourceException instead of
+// queuing more work.
+
+class ThreadPool : public boost::executors::executor
+{
+public:
+    struct Stats
+    {
+        int64_t threads_created;
+        int64_t submitted;
+        int64_t executed;
+        int64_t rejected;              // Number of submit() calls that failed because the queue was full.
+        int64_t stolen;                // Number of closures executed by a worker other than the one it was queued for.
+        int64_t queue_wait_nsecs;      // Total time that executed closures spent waiting in the queue.
+        int64_t max_queue_wait_nsecs;
+    };
+
+    // num_threads and max_queue_depth must be > 0.
+    ThreadPool(int num_threads, int max_queue_depth);
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    using boost::executors::executor::submit;
+
+    // Once closed, submit() throws. Closures that are queued already still run.
+    void close() override;
+    bool closed() override;
+    void submit(work&& closure) override;
+
+    // Runs a queued closure, if any, in the calling thread. This allows a thread
+    // that waits for closures it has submitted to help out instead of blocking.
+    bool try_executing_one() override;
+
+    int num_threads() const noexcept;
+    int max_queue_depth() const noexcept;
+    int queue_depth() const noexcept;
+    Stats stats() const noexcept;
+
+private:
+    struct State;
+
+    std::shared_ptr<State> state_;  // Shared with the workers, so the pool can be destroyed by one of its own threads.
+    std::vector<std::thread> threads_;
+};
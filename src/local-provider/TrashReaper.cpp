@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "TrashReaper.h"
+
+#include "DirStream.h"
+#include "utils.h"
+
+#include <unity/storage/internal/safe_strerror.h>
+#include <unity/storage/provider/Exceptions.h>
+
+#include <boost/filesystem.hpp>
+#include <QDebug>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace unity::storage::internal;
+using namespace unity::storage::provider;
+using namespace std;
+
+// A directory being reaped. pending counts the scan of the directory itself
+// plus any subdirectories that have not been removed yet. When it drops to
+// zero, the directory is empty and can be removed, which in turn releases
+// the parent.
+
+struct TrashReaper::Node
+{
+    Node(string const& path, shared_ptr<Node> const& parent)
+        : path(path)
+        , parent(parent)
+        , pending(1)
+    {
+    }
+
+    string const path;
+    shared_ptr<Node> const parent;
+    atomic<int> pending;
+};
+
+namespace
+{
+
+int constexpr REAPER_THREADS = 2;
+int constexpr REAPER_QUEUE_DEPTH = 4096;
+
+}  // namespace
+
+TrashReaper::TrashReaper(string const& trash_dir)
+    : trash_dir_(trash_dir)
+    , stopping_(false)
+    , pending_(0)
+    , trashed_(0)
+    , files_removed_(0)
+    , dirs_removed_(0)
+    , errors_(0)
+    , pool_(REAPER_THREADS, REAPER_QUEUE_DEPTH)
+{
+}
+
+TrashReaper::~TrashReaper()
+{
+    stopping_ = true;  // Tasks still queued return immediately.
+}
+
+bool TrashReaper::trash(string const& method, string const& path)
+{
+    if (mkdir(trash_dir_.c_str(), 0700) == -1 && errno != EEXIST)
+    {
+        throw_storage_exception(method, "mkdir", trash_dir_, errno);  // LCOV_EXCL_LINE
+    }
+    string const trash_path = trash_dir_ + "/" + boost::filesystem::unique_path("%%%%-%%%%-%%%%-%%%%").native();
+    if (rename(path.c_str(), trash_path.c_str()) == -1)
+    {
+        if (errno == EXDEV)
+        {
+            return false;
+        }
+        throw_storage_exception(method, "rename", path, errno);
+    }
+    ++trashed_;
+    schedule(trash_path);
+    return true;
+}
+
+void TrashReaper::resume()
+{
+    try
+    {
+        for (DirStream dir("TrashReaper::resume()", trash_dir_); !dir.at_end(); dir.advance())
+        {
+            schedule(trash_dir_ + "/" + dir.name());
+        }
+    }
+    catch (NotExistsException const&)
+    {
+        // Nothing was ever deleted.
+    }
+    catch (StorageException const& e)
+    {
+        qWarning().noquote() << QString::fromStdString(e.what());  // LCOV_EXCL_LINE
+    }
+}
+
+bool TrashReaper::idle() const noexcept
+{
+    return pending_ == 0;
+}
+
+TrashReaper::Stats TrashReaper::stats() const noexcept
+{
+    return Stats{ trashed_, files_removed_, dirs_removed_, errors_ };
+}
+
+// Start reaping an entry of the trash directory.
+
+void TrashReaper::schedule(string const& path)
+{
+    ++pending_;
+    auto node = make_shared<Node>(path, nullptr);
+    try
+    {
+        pool_.submit([this, node]{ reap(node); });
+    }
+    catch (StorageException const& e)
+    {
+        // The pool is overloaded. The entry stays in the trash until the next resume().
+        --pending_;
+        qWarning().noquote() << QString::fromStdString(e.what());
+    }
+}
+
+// Remove everything in node's directory. Subdirectories are handed to the pool.
+// If node is not a directory (which can only be the case for an entry at the
+// top level of the trash), it is simply unlinked.
+
+void TrashReaper::reap(shared_ptr<Node> const& node) noexcept
+{
+    lower_thread_priority();  // Reaping must not compete with requests.
+    if (stopping_)
+    {
+        return;  // We are shutting down, so there is no point in keeping count.
+    }
+
+    if (!node->parent)
+    {
+        if (unlink(node->path.c_str()) == 0)
+        {
+            ++files_removed_;
+            --pending_;
+            return;
+        }
+        if (errno != EISDIR)
+        {
+            if (errno != ENOENT)
+            {
+                ++errors_;
+                qWarning().nospace() << "TrashReaper: cannot unlink \"" << QString::fromStdString(node->path)
+                                     << "\": " << QString::fromStdString(safe_strerror(errno));
+            }
+            --pending_;
+            return;
+        }
+    }
+
+    try
+    {
+        for (DirStream dir("TrashReaper::reap()", node->path); !dir.at_end(); dir.advance())
+        {
+            if (stopping_)
+            {
+                return;  // The directory will be reaped by the next resume().
+            }
+            auto const& name = dir.name();
+            if (unlinkat(dir.fd(), name.c_str(), 0) == 0)
+            {
+                ++files_removed_;
+                continue;
+            }
+            if (errno != EISDIR)
+            {
+                if (errno != ENOENT)
+                {
+                    ++errors_;
+                    qWarning().nospace() << "TrashReaper: cannot unlink \""
+                                         << QString::fromStdString(node->path + "/" + name)
+                                         << "\": " << QString::fromStdString(safe_strerror(errno));
+                }
+                continue;
+            }
+            auto child = make_shared<Node>(node->path + "/" + name, node);
+            ++node->pending;
+            try
+            {
+                pool_.submit([this, child]{ reap(child); });
+            }
+            catch (StorageException const&)
+            {
+                reap(child);  // Pool is overloaded, so we do it ourselves.
+            }
+        }
+    }
+    catch (StorageException const& e)
+    {
+        ++errors_;
+        qWarning().noquote() << QString::fromStdString(e.what());
+    }
+    finish(node);
+}
+
+// Called when the scan of a directory or one of its subdirectories is done.
+// Removes directories whose contents are all gone, working up the tree.
+
+void TrashReaper::finish(shared_ptr<Node> node) noexcept
+{
+    while (node && --node->pending == 0)
+    {
+        if (rmdir(node->path.c_str()) == 0)
+        {
+            ++dirs_removed_;
+        }
+        else if (errno != ENOENT)
+        {
+            ++errors_;
+            qWarning().nospace() << "TrashReaper: cannot remove \"" << QString::fromStdString(node->path)
+                                 << "\": " << QString::fromStdString(safe_strerror(errno));
+        }
+        if (!node->parent)
+        {
+            --pending_;
+        }
+        node = node->parent;
+    }
+}
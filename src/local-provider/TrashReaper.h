@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+// Deferred deletion. trash() renames a file or directory into the trash
+// directory, which is cheap and atomic, so delete_item() can reply straight
+// away. The reaper then deletes the contents of the trash in the background.
+//
+// Reaping uses unlinkat() relative to the open directory, so it needs no stat()
+// calls and never follows symlinks. Subdirectories are reaped in parallel on a
+// small pool whose threads run at the lowest CPU and I/O priority. A directory
+// is removed once all of its subdirectories are gone.
+//
+// Anything still in the trash when the provider shuts down is left there;
+// resume() picks it up again on the next start.
+
+class TrashReaper
+{
+public:
+    struct Stats
+    {
+        int64_t trashed;
+        int64_t files_removed;
+        int64_t dirs_removed;
+        int64_t errors;
+    };
+
+    TrashReaper(std::string const& trash_dir);
+    ~TrashReaper();
+
+    TrashReaper(TrashReaper const&) = delete;
+    TrashReaper& operator=(TrashReaper const&) = delete;
+
+    // Moves path into the trash and schedules it for deletion. Returns false,
+    // without doing anything, if path is on a different file system than the trash.
+    // Throws a StorageException if the rename fails for any other reason.
+    bool trash(std::string const& method, std::string const& path);
+
+    // Schedules deletion of whatever is in the trash right now.
+    void resume();
+
+    // True once everything that was scheduled for deletion has been dealt with.
+    bool idle() const noexcept;
+
+    Stats stats() const noexcept;
+
+private:
+    struct Node;
+
+    void schedule(std::string const& path);
+    void reap(std::shared_ptr<Node> const& node) noexcept;
+    void finish(std::shared_ptr<Node> node) noexcept;
+
+    std::string const trash_dir_;
+    std::atomic<bool> stopping_;
+    std::atomic<int> pending_;
+    std::atomic<int64_t> trashed_;
+    std::atomic<int64_t> files_removed_;
+    std::atomic<int64_t> dirs_removed_;
+    std::atomic<int64_t> errors_;
+    ThreadPool pool_;  // Must be last, so it finishes its tasks before anything else is destroyed.
+};
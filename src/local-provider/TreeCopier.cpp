@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "TreeCopier.h"
+
+#include "DirStream.h"
+#include "ThreadPool.h"
+#include "utils.h"
+
+#include <unity/storage/provider/Exceptions.h>
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <unistd.h>
+
+using namespace unity::storage::provider;
+using namespace std;
+
+TreeCopier::TreeCopier(ThreadPool& pool, string const& method, CopyOptions const& options, Special special)
+    : pool_(pool)
+    , method_(method)
+    , options_(options)
+    , special_(special)
+    , max_in_flight_(2 * pool.num_threads())
+{
+}
+
+TreeCopier::~TreeCopier()
+{
+    wait_for_all();
+}
+
+void TreeCopier::copy_contents(string const& source, string const& target)
+{
+    try
+    {
+        copy_dir(source, target);
+        while (!in_flight_.empty())
+        {
+            wait_for_oldest();
+        }
+        // The copies create their target files, so a directory can only be flushed
+        // once all copies are done.
+        for (auto const& dir : dirs_to_sync_)
+        {
+            fsync_dir(method_, dir);
+        }
+        dirs_to_sync_.clear();
+    }
+    catch (...)
+    {
+        wait_for_all();  // Don't let any copies continue after we return.
+        throw;
+    }
+}
+
+void TreeCopier::copy_dir(string const& source, string const& target)
+{
+    for (DirStream dir(method_, source); !dir.at_end(); dir.advance())
+    {
+        FileCopier::throw_if_cancelled(method_, source, options_);
+        auto const& name = dir.name();
+        bool const recreate = special_ == Special::recreate;
+        if (!recreate && is_reserved_path(name))
+        {
+            continue;  // Don't copy temporary files and directories.
+        }
+        struct stat st;
+        if (!(recreate ? dir.lstat(st) : dir.stat(st)))
+        {
+            continue;  // Entry disappeared since we read the directory, or dangling symlink.
+        }
+        string const source_entry = source + "/" + name;
+        string const target_entry = target + "/" + name;
+        if (S_ISREG(st.st_mode))
+        {
+            copy_file(source_entry, target_entry);
+        }
+        else if (S_ISDIR(st.st_mode))
+        {
+            if (mkdir(target_entry.c_str(), st.st_mode & 07777) == -1)
+            {
+                throw_storage_exception(method_, "mkdir", target_entry, errno);
+            }
+            copy_dir(source_entry, target_entry);
+        }
+        else if (recreate)
+        {
+            copy_special(method_, source_entry, st, target_entry);
+        }
+        else
+        {
+            // Ignore everything that's not a directory or file.
+        }
+    }
+    if (options_.sync)
+    {
+        dirs_to_sync_.push_back(target);
+    }
+}
+
+void TreeCopier::copy_special(string const& method, string const& source, struct stat const& st, string const& target)
+{
+    if (S_ISLNK(st.st_mode))
+    {
+        // One more byte than needed, so we can tell if the link changed since the stat().
+        string link(st.st_size > 0 ? st.st_size + 1 : PATH_MAX, '\0');
+        ssize_t len = readlink(source.c_str(), &link[0], link.size());
+        if (len == -1 || size_t(len) == link.size())
+        {
+            throw_storage_exception(method, "readlink", source, len == -1 ? errno : ENAMETOOLONG);
+        }
+        link.resize(len);
+        if (symlink(link.c_str(), target.c_str()) == -1)
+        {
+            throw_storage_exception(method, "symlink", target, errno);
+        }
+        return;
+    }
+    if (mknod(target.c_str(), st.st_mode & (S_IFMT | 07777), st.st_rdev) == -1)
+    {
+        throw_storage_exception(method, "mknod", target, errno);
+    }
+}
+
+void TreeCopier::copy_file(string const& source, string const& target)
+{
+    while (in_flight_.size() >= max_in_flight_)
+    {
+        wait_for_oldest();
+    }
+
+    auto method = method_;
+    auto options = options_;
+    auto do_copy = [method, source, target, options]
+    {
+        FileCopier::copy(method, source, target, options);
+    };
+    try
+    {
+        in_flight_.emplace_back(boost::async(pool_, do_copy));
+    }
+    catch (ResourceException const&)
+    {
+        do_copy();  // Pool is overloaded, so we do it ourselves.
+    }
+}
+
+// Wait for the oldest copy in flight to finish, running queued tasks
+// in the meantime. Throws if that copy failed.
+
+void TreeCopier::wait_for_oldest()
+{
+    auto f = std::move(in_flight_.front());
+    in_flight_.pop_front();
+    while (!f.is_ready())
+    {
+        if (!pool_.try_executing_one())
+        {
+            f.wait_for(boost::chrono::milliseconds(1));
+        }
+    }
+    f.get();
+}
+
+void TreeCopier::wait_for_all() noexcept
+{
+    while (!in_flight_.empty())
+    {
+        try
+        {
+            wait_for_oldest();
+        }
+        catch (...)
+        {
+            // Only the first error is reported.
+        }
+    }
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include "FileCopier.h"
+
+#include <boost/thread/future.hpp>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+class ThreadPool;
+
+// Recursive directory copy that copies files in parallel.
+//
+// The calling thread walks the source tree and creates the target directories
+// as it goes. Each regular file is copied by a task on the pool. The number of
+// copies in flight is bounded; when the bound is reached, the walker helps out
+// by running queued tasks itself instead of blocking, which avoids a deadlock
+// if the walker is itself running on the pool. If the pool rejects a task
+// because its queue is full, the walker copies the file itself.
+//
+// With Special::skip, anything that has the temp file prefix or is neither a file
+// nor a directory is ignored, and symlinks are followed. With Special::recreate,
+// every entry is copied and symlinks are never followed: symlinks, FIFOs, sockets
+// and device nodes are recreated, and the copy fails if that isn't possible. This
+// is what a move needs, because the source is removed afterwards.
+//
+// The destructor waits for any copies that are still in flight. The options are
+// passed to FileCopier; with options.sync, each target directory is also flushed
+// once all copies have finished.
+
+class TreeCopier
+{
+public:
+    enum class Special { skip, recreate };
+
+    TreeCopier(ThreadPool& pool,
+               std::string const& method,
+               CopyOptions const& options = CopyOptions(),
+               Special special = Special::skip);
+    ~TreeCopier();
+
+    TreeCopier(TreeCopier const&) = delete;
+    TreeCopier& operator=(TreeCopier const&) = delete;
+
+    // Copy the contents of directory source into the existing directory target.
+    // Throws if anything goes wrong, but only once all copies in flight have finished.
+    void copy_contents(std::string const& source, std::string const& target);
+
+    // Recreate a symlink, FIFO, socket, or device node with the attributes in st at target.
+    static void copy_special(std::string const& method,
+                             std::string const& source,
+                             struct stat const& st,
+                             std::string const& target);
+
+private:
+    void copy_dir(std::string const& source, std::string const& target);
+    void copy_file(std::string const& source, std::string const& target);
+    void wait_for_oldest();
+    void wait_for_all() noexcept;
+
+    ThreadPool& pool_;
+    std::string const method_;
+    CopyOptions const options_;
+    Special const special_;
+    size_t const max_in_flight_;
+    std::deque<boost::future<void>> in_flight_;
+    std::vector<std::string> dirs_to_sync_;  // Children before their parents
+};
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "UploadManifest.h"
+
+#include "utils.h"
+
+#include <unity/storage/provider/Exceptions.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace unity::storage::provider;
+using namespace std;
+
+namespace
+{
+
+char const MANIFEST_VERSION[] = "1";
+
+}  // namespace
+
+void UploadManifest::write(string const& method, string const& path) const
+{
+    string contents;
+    for (auto const& field : { string(MANIFEST_VERSION),
+                               item_id,
+                               partial_path,
+                               to_string(size),
+                               to_string(committed),
+                               string(is_update ? "1" : "0"),
+                               string(allow_overwrite ? "1" : "0"),
+                               old_etag })
+    {
+        contents += field;
+        contents += '\0';
+    }
+
+    // Write to a temp file and rename it, so a crash never leaves a truncated manifest behind.
+    string const tmp_path = path + ".new";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1)
+    {
+        throw_storage_exception(method, "open", tmp_path, errno);
+    }
+    char const* p = contents.data();
+    size_t remaining = contents.size();
+    while (remaining > 0)
+    {
+        auto bytes_written = ::write(fd, p, remaining);
+        if (bytes_written == -1)
+        {
+            // LCOV_EXCL_START
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            int err = errno;
+            close(fd);
+            unlink(tmp_path.c_str());
+            throw_storage_exception(method, "write", tmp_path, err);
+            // LCOV_EXCL_STOP
+        }
+        p += bytes_written;
+        remaining -= bytes_written;
+    }
+    if (fsync(fd) == -1)
+    {
+        // LCOV_EXCL_START
+        int err = errno;
+        close(fd);
+        unlink(tmp_path.c_str());
+        throw_storage_exception(method, "fsync", tmp_path, err);
+        // LCOV_EXCL_STOP
+    }
+    close(fd);
+    if (rename(tmp_path.c_str(), path.c_str()) == -1)
+    {
+        // LCOV_EXCL_START
+        int err = errno;
+        unlink(tmp_path.c_str());
+        throw_storage_exception(method, "rename", path, err);
+        // LCOV_EXCL_STOP
+    }
+    fsync_dir(method, boost::filesystem::path(path).parent_path().native());
+}
+
+UploadManifest UploadManifest::read(string const& method, string const& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        throw_storage_exception(method, "open", path, errno);
+    }
+    string contents;
+    char buf[4096];
+    for (;;)
+    {
+        auto bytes_read = ::read(fd, buf, sizeof(buf));
+        if (bytes_read == -1)
+        {
+            // LCOV_EXCL_START
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            int err = errno;
+            close(fd);
+            throw_storage_exception(method, "read", path, err);
+            // LCOV_EXCL_STOP
+        }
+        if (bytes_read == 0)
+        {
+            break;
+        }
+        contents.append(buf, bytes_read);
+    }
+    close(fd);
+
+    vector<string> fields;
+    boost::split(fields, contents, boost::is_any_of(string(1, '\0')));
+    // Every field is terminated by a NUL, so the split produces an empty last field.
+    if (fields.size() != 9 || fields[0] != MANIFEST_VERSION || !fields[8].empty())
+    {
+        throw boost::enable_current_exception(ResourceException(method + ": corrupt upload manifest \"" + path + "\"", EINVAL));
+    }
+
+    UploadManifest m;
+    try
+    {
+        m.item_id = fields[1];
+        m.partial_path = fields[2];
+        m.size = stoll(fields[3]);
+        m.committed = stoll(fields[4]);
+        m.is_update = fields[5] == "1";
+        m.allow_overwrite = fields[6] == "1";
+        m.old_etag = fields[7];
+    }
+    catch (std::exception const&)
+    {
+        throw boost::enable_current_exception(ResourceException(method + ": corrupt upload manifest \"" + path + "\"", EINVAL));
+    }
+    if (m.size < 0 || m.committed < 0 || m.committed > m.size)
+    {
+        throw boost::enable_current_exception(ResourceException(method + ": corrupt upload manifest \"" + path + "\"", EINVAL));
+    }
+    return m;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <string>
+
+// Persistent state of a resumable upload. A manifest is stored in the uploads
+// directory under the root, named after the upload ID. It records where the
+// partial file is, how many bytes of it are known to be on disk, and the
+// preconditions that must be checked again when the upload is resumed.
+// The fields are separated by NUL bytes because paths can contain anything else.
+
+struct UploadManifest
+{
+    std::string item_id;           // Target of the upload
+    std::string partial_path;      // Named temp file in the same directory as the target
+    int64_t size = 0;              // Declared size of the upload
+    int64_t committed = 0;         // Bytes that were flushed to the partial file
+    bool is_update = false;        // update() if true, create_file() otherwise
+    bool allow_overwrite = false;  // Only for create_file()
+    std::string old_etag;          // Only for update()
+
+    // Atomically replaces the manifest at path.
+    void write(std::string const& method, std::string const& path) const;
+
+    // Throws NotExistsException if there is no manifest at path, and
+    // ResourceException if the manifest cannot be parsed.
+    static UploadManifest read(std::string const& method, std::string const& path);
+};
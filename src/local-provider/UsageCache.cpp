@@ -0,0 +1,553 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "UsageCache.h"
+
+#include "DirStream.h"
+#include "utils.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <algorithm>
+
+#include <fcntl.h>
+
+using namespace std;
+
+namespace
+{
+
+// Max number of directory scans waiting for a thread. If there are more, we scan inline.
+
+constexpr int MAX_QUEUED_SCANS = 100000;
+
+// Modification times are only as precise as the kernel's clock tick (or worse, depending on the
+// file system), so a change right after we read a directory may leave its time unchanged.
+// We don't trust times that are more recent than this.
+
+constexpr int64_t RACY_NSECS = 2000000000;
+
+string parent_of(string const& path)
+{
+    auto const slash = path.rfind('/');
+    return slash == 0 || slash == string::npos ? "/" : path.substr(0, slash);
+}
+
+string name_of(string const& path)
+{
+    return path.substr(path.rfind('/') + 1);
+}
+
+void insert_sorted(vector<string>& names, string const& name)
+{
+    auto pos = lower_bound(names.begin(), names.end(), name);
+    if (pos == names.end() || *pos != name)
+    {
+        names.insert(pos, name);
+    }
+}
+
+void erase_sorted(vector<string>& names, string const& name)
+{
+    auto pos = lower_bound(names.begin(), names.end(), name);
+    if (pos != names.end() && *pos == name)
+    {
+        names.erase(pos);
+    }
+}
+
+bool same_time(struct timespec const& a, struct timespec const& b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+}  // namespace
+
+UsageCache::UsageCache(string const& root, int num_threads)
+    : root_(root)
+    , next_gen_(0)
+    , pending_(1)
+    , rescans_(0)
+    , ready_(false)
+    , stopping_(false)
+    , pool_(num_threads, MAX_QUEUED_SCANS)
+{
+    int64_t const gen = ++next_gen_;
+    dirs_.emplace(root_, DirNode{ gen, false, {}, 0, 0, 0, 1, {} });
+    schedule_scans({ { root_, gen } });
+}
+
+UsageCache::~UsageCache()
+{
+    // Scans that are still queued bail out early, but they use our state, so we have to wait for them.
+    stopping_ = true;
+    wait_until_idle();
+}
+
+bool UsageCache::get(string const& dir, struct stat const& st, Usage& usage)
+{
+    for (;;)
+    {
+        int64_t gen;
+        {
+            lock_guard<mutex> lock(mutex_);
+            auto it = dirs_.find(dir);
+            if (it == dirs_.end() || !it->second.scanned)
+            {
+                return false;  // The scan hasn't got here yet.
+            }
+            auto const& n = it->second;
+            if (same_time(n.mtime, st.st_mtim))
+            {
+                usage = Usage{ n.children, n.unscanned == 0 ? n.bytes : -1 };
+                return true;
+            }
+            gen = n.gen;
+            ++rescans_;
+        }
+
+        // The directory has changed since we last read it.
+        DirContents contents;
+        try
+        {
+            read_dir(dir, contents);
+        }
+        catch (std::exception const&)
+        {
+            return false;  // Gone or unreadable.
+        }
+
+        ScanList scans;
+        {
+            lock_guard<mutex> lock(mutex_);
+            auto it = dirs_.find(dir);
+            if (it == dirs_.end())
+            {
+                return false;  // Removed while we were reading it.
+            }
+            if (it->second.gen != gen)
+            {
+                continue;  // Changed while we were reading it.
+            }
+            apply(it, contents, scans);
+            auto const& n = it->second;
+            usage = Usage{ n.children, n.unscanned == 0 ? n.bytes : -1 };
+        }
+        schedule_scans(scans);
+        return true;
+    }
+}
+
+void UsageCache::file_written(string const& path, int64_t old_size)
+{
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        return;  // Already gone again; whoever removed it will tell us.
+    }
+
+    ScanList scans;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (old_size < 0)
+        {
+            entry_changed(parent_of(path), 1, st.st_size, scans);
+        }
+        else
+        {
+            entry_changed(parent_of(path), 0, st.st_size - old_size, scans);
+        }
+    }
+    schedule_scans(scans);
+}
+
+void UsageCache::added(string const& path)
+{
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == -1)
+    {
+        return;
+    }
+    string const parent = parent_of(path);
+
+    ScanList scans;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (S_ISREG(st.st_mode))
+        {
+            entry_changed(parent, 1, st.st_size, scans);
+        }
+        else if (S_ISDIR(st.st_mode))
+        {
+            entry_changed(parent, 1, 0, scans);
+            auto it = dirs_.find(parent);
+            if (it != dirs_.end() && it->second.scanned && dirs_.find(path) == dirs_.end())
+            {
+                add_dir(path, scans);  // The scan of the new folder works out its size.
+            }
+        }
+    }
+    schedule_scans(scans);
+}
+
+void UsageCache::removed(string const& path, struct stat const& st)
+{
+    ScanList scans;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (S_ISREG(st.st_mode))
+        {
+            entry_changed(parent_of(path), -1, -st.st_size, scans);
+        }
+        else if (S_ISDIR(st.st_mode))
+        {
+            remove_tree(path);
+            entry_changed(parent_of(path), -1, 0, scans);
+        }
+    }
+    schedule_scans(scans);
+}
+
+void UsageCache::moved(string const& old_path, string const& new_path)
+{
+    struct stat st;
+    if (::lstat(new_path.c_str(), &st) == -1)
+    {
+        return;
+    }
+
+    ScanList scans;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (S_ISREG(st.st_mode))
+        {
+            entry_changed(parent_of(old_path), -1, -st.st_size, scans);
+            entry_changed(parent_of(new_path), 1, st.st_size, scans);
+        }
+        else if (S_ISDIR(st.st_mode))
+        {
+            move_tree(old_path, new_path, scans);
+            entry_changed(parent_of(old_path), -1, 0, scans);
+            entry_changed(parent_of(new_path), 1, 0, scans);
+        }
+    }
+    schedule_scans(scans);
+}
+
+void UsageCache::wait_until_idle()
+{
+    unique_lock<mutex> lock(mutex_);
+    idle_.wait(lock, [this]{ return pending_ == 0; });
+}
+
+UsageCache::Stats UsageCache::stats() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return Stats{ int64_t(dirs_.size()), pending_, rescans_, ready_ };
+}
+
+// Count the entries of dir. Throws if dir can't be read.
+
+void UsageCache::read_dir(string const& dir, DirContents& contents)
+{
+    DirStream d("metadata()", dir);
+    struct stat st;
+    if (fstat(d.fd(), &st) == -1)
+    {
+        throw_storage_exception("metadata()", "fstat", dir, errno);  // LCOV_EXCL_LINE
+    }
+    // We take the time before reading, so anything that changes while we read shows up as a change later.
+    // If the time is too recent to be trusted, we record none, so the next get() reads the directory again.
+    contents.mtime = st.st_mtim;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t const age = (int64_t(now.tv_sec) - st.st_mtim.tv_sec) * 1000000000 + now.tv_nsec - st.st_mtim.tv_nsec;
+    if (age < RACY_NSECS)
+    {
+        contents.mtime = timespec{ 0, 0 };
+    }
+    contents.children = 0;
+    contents.own_bytes = 0;
+    contents.subdirs.clear();
+    for (; !d.at_end(); d.advance())
+    {
+        if (is_reserved_path(d.name()) || fstatat(d.fd(), d.name().c_str(), &st, AT_SYMLINK_NOFOLLOW) == -1)
+        {
+            continue;
+        }
+        if (S_ISREG(st.st_mode))
+        {
+            ++contents.children;
+            contents.own_bytes += st.st_size;
+        }
+        else if (S_ISDIR(st.st_mode))
+        {
+            ++contents.children;
+            contents.subdirs.push_back(d.name());
+        }
+    }
+    sort(contents.subdirs.begin(), contents.subdirs.end());
+}
+
+// Queue a scan for each of scans. The caller has added them to pending_ already.
+
+void UsageCache::schedule_scans(ScanList const& scans)
+{
+    for (auto const& s : scans)
+    {
+        string const dir = s.first;
+        int64_t const gen = s.second;
+        try
+        {
+            pool_.submit([this, dir, gen]
+            {
+                thread_local bool lowered = false;
+                if (!lowered)
+                {
+                    lower_thread_priority();  // Only our own pool's threads.
+                    lowered = true;
+                }
+                scan_task(dir, gen);
+            });
+        }
+        catch (std::exception const&)
+        {
+            scan_task(dir, gen);  // Queue full or pool closed.
+        }
+    }
+}
+
+void UsageCache::scan_task(string const& dir, int64_t gen)
+{
+    auto is_current = [this, &dir, gen]
+    {
+        auto it = dirs_.find(dir);
+        return it != dirs_.end() && it->second.gen == gen ? it : dirs_.end();
+    };
+
+    bool current;
+    {
+        lock_guard<mutex> lock(mutex_);
+        current = !stopping_ && is_current() != dirs_.end();
+    }
+    if (!current)
+    {
+        scan_finished();  // Something changed and scheduled a new scan, or the directory is gone.
+        return;
+    }
+
+    DirContents contents;
+    try
+    {
+        read_dir(dir, contents);
+    }
+    catch (std::exception const&)
+    {
+        // The directory has disappeared or can't be read. Whoever removed it will tell us,
+        // or the next read of the parent will drop it.
+        contents = DirContents{ {}, 0, 0, {} };
+    }
+
+    ScanList scans;
+    {
+        lock_guard<mutex> lock(mutex_);
+        auto it = is_current();
+        if (it != dirs_.end())
+        {
+            apply(it, contents, scans);
+        }
+    }
+    schedule_scans(scans);
+    scan_finished();
+}
+
+void UsageCache::scan_finished()
+{
+    lock_guard<mutex> lock(mutex_);
+    if (--pending_ == 0)
+    {
+        ready_ = true;
+        idle_.notify_all();
+    }
+}
+
+// Replace the counts for a directory with what we just read and pass the difference up the tree.
+// Subdirectories that have gone away are dropped, new ones are added to scans. Called with mutex_ held.
+
+void UsageCache::apply(DirMap::iterator it, DirContents const& contents, ScanList& scans)
+{
+    string const dir = it->first;
+    auto& n = it->second;
+    int64_t const bytes = contents.own_bytes - n.own_bytes;
+    int64_t const unscanned = n.scanned ? 0 : -1;
+    n.gen = ++next_gen_;
+    n.scanned = true;
+    n.mtime = contents.mtime;
+    n.children = contents.children;
+    n.own_bytes = contents.own_bytes;
+    propagate(dir, bytes, unscanned);
+
+    vector<string> gone;
+    set_difference(n.subdirs.begin(), n.subdirs.end(),
+                   contents.subdirs.begin(), contents.subdirs.end(),
+                   back_inserter(gone));
+    vector<string> added;
+    set_difference(contents.subdirs.begin(), contents.subdirs.end(),
+                   n.subdirs.begin(), n.subdirs.end(),
+                   back_inserter(added));
+    for (auto const& name : gone)
+    {
+        remove_tree(dir + "/" + name);
+    }
+    for (auto const& name : added)
+    {
+        add_dir(dir + "/" + name, scans);
+    }
+}
+
+// Add a node for dir and a scan for it to scans. The parent must be scanned already. Called with mutex_ held.
+
+void UsageCache::add_dir(string const& dir, ScanList& scans)
+{
+    string const parent = parent_of(dir);
+    int64_t const gen = ++next_gen_;
+    dirs_.emplace(dir, DirNode{ gen, false, {}, 0, 0, 0, 1, {} });
+    insert_sorted(dirs_.at(parent).subdirs, name_of(dir));
+    propagate(parent, 0, 1);
+    scans.emplace_back(dir, gen);
+    ++pending_;
+}
+
+// Drop dir and everything below it. Called with mutex_ held.
+
+void UsageCache::remove_tree(string const& dir)
+{
+    auto it = dirs_.find(dir);
+    if (it == dirs_.end())
+    {
+        return;
+    }
+    int64_t const bytes = it->second.bytes;
+    int64_t const unscanned = it->second.unscanned;
+    string const prefix = dir + "/";
+    dirs_.erase(it);
+    it = dirs_.lower_bound(prefix);
+    while (it != dirs_.end() && boost::starts_with(it->first, prefix))
+    {
+        it = dirs_.erase(it);
+    }
+
+    string const parent = parent_of(dir);
+    auto p = dirs_.find(parent);
+    if (p != dirs_.end())
+    {
+        erase_sorted(p->second.subdirs, name_of(dir));
+        propagate(parent, -bytes, -unscanned);
+    }
+}
+
+// Re-key the nodes for old_dir and everything below it. Called with mutex_ held.
+
+void UsageCache::move_tree(string const& old_dir, string const& new_dir, ScanList& scans)
+{
+    auto it = dirs_.find(old_dir);
+    if (it == dirs_.end())
+    {
+        return;  // The scan hasn't got to it yet, so entry_changed() takes care of it.
+    }
+    auto np = dirs_.find(parent_of(new_dir));
+    if (np == dirs_.end() || !np->second.scanned)
+    {
+        remove_tree(old_dir);  // The scan of the new parent will find it.
+        return;
+    }
+
+    vector<pair<string, DirNode>> nodes{ { new_dir, it->second } };
+    string const prefix = old_dir + "/";
+    for (auto i = dirs_.lower_bound(prefix); i != dirs_.end() && boost::starts_with(i->first, prefix); ++i)
+    {
+        nodes.emplace_back(new_dir + i->first.substr(old_dir.size()), i->second);
+    }
+    int64_t const bytes = it->second.bytes;
+    int64_t const unscanned = it->second.unscanned;
+    remove_tree(old_dir);
+
+    for (auto& node : nodes)
+    {
+        // Scans that are in flight for the old paths are stale now.
+        node.second.gen = ++next_gen_;
+        if (!node.second.scanned)
+        {
+            scans.emplace_back(node.first, node.second.gen);
+            ++pending_;
+        }
+        dirs_.emplace(std::move(node));
+    }
+    string const new_parent = parent_of(new_dir);
+    insert_sorted(dirs_.at(new_parent).subdirs, name_of(new_dir));
+    propagate(new_parent, bytes, unscanned);
+}
+
+// The provider added, removed, or changed an entry of dir. If we haven't read dir yet,
+// its scan may have read the directory before the change, so we scan it again.
+// Called with mutex_ held.
+
+void UsageCache::entry_changed(string const& dir, int64_t children, int64_t bytes, ScanList& scans)
+{
+    auto it = dirs_.find(dir);
+    if (it == dirs_.end())
+    {
+        return;  // The scan of one of its ancestors will find it.
+    }
+    auto& n = it->second;
+    n.gen = ++next_gen_;
+    if (!n.scanned)
+    {
+        scans.emplace_back(dir, n.gen);
+        ++pending_;
+        return;
+    }
+    n.children += children;
+    n.own_bytes += bytes;
+    propagate(dir, bytes, 0);
+}
+
+// Add bytes and unscanned to dir and all its ancestors. Called with mutex_ held.
+
+void UsageCache::propagate(string const& dir, int64_t bytes, int64_t unscanned)
+{
+    if (bytes == 0 && unscanned == 0)
+    {
+        return;
+    }
+    string d = dir;
+    for (;;)
+    {
+        auto it = dirs_.find(d);
+        if (it != dirs_.end())
+        {
+            it->second.bytes += bytes;
+            it->second.unscanned += unscanned;
+        }
+        if (d.size() <= root_.size())
+        {
+            return;
+        }
+        d = parent_of(d);
+    }
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+// Number of entries and recursive size of every folder below the root, for the
+// child_count and recursive_size_in_bytes metadata.
+//
+// The constructor starts a parallel scan of the tree on a private pool at low priority
+// and returns immediately. After that, the provider reports each change it makes, and we
+// adjust the counts of the affected folders and their ancestors, so get() is a map lookup,
+// no matter how much is underneath the folder.
+//
+// Changes made by other processes are noticed by comparing a folder's modification time
+// with the one we saw when we last read it. If they differ, get() reads the folder's
+// entries again (but not those of its subfolders) and passes the difference up the tree.
+// Our own changes also modify the folder, so the first get() after a change reads the
+// folder once more; the folder's ancestors are not affected. Modification times are
+// coarse, so a folder that changed in the last two seconds is read by every get().
+// Files that are rewritten in place by other processes, and changes further down the
+// tree, are not noticed until someone asks about the folder that contains them.
+//
+// Only regular files and folders are counted. Symlinks are not followed, anything with
+// the temp file prefix is ignored, and sizes are apparent sizes (st_size).
+// All methods are thread-safe.
+
+class UsageCache
+{
+public:
+    struct Usage
+    {
+        int64_t child_count;      // Files and folders directly in the folder.
+        int64_t bytes;            // Size of all files below the folder, -1 until the scan has reached all of them.
+    };
+
+    struct Stats
+    {
+        int64_t dirs;             // Number of folders we have counts for.
+        int64_t pending_scans;
+        int64_t rescans;          // Folders read again because their modification time changed.
+        bool ready;               // True if the initial scan has finished.
+    };
+
+    UsageCache(std::string const& root, int num_threads);
+    ~UsageCache();
+
+    UsageCache(UsageCache const&) = delete;
+    UsageCache& operator=(UsageCache const&) = delete;
+
+    // Returns false if the scan has not reached dir yet. st is the stat() result for dir.
+    bool get(std::string const& dir, struct stat const& st, Usage& usage);
+
+    // Must be called by the provider after it has changed something.
+    void file_written(std::string const& path, int64_t old_size);  // old_size is -1 for a new file.
+    void added(std::string const& path);                           // New file or folder (create or copy).
+    void removed(std::string const& path, struct stat const& st);  // st is from before the removal.
+    void moved(std::string const& old_path, std::string const& new_path);
+
+    // Waits until all scans have finished. For testing.
+    void wait_until_idle();
+
+    Stats stats() const;
+
+private:
+    struct DirNode
+    {
+        int64_t gen;                         // Changes with every update, so scans can tell that they are stale.
+        bool scanned;                        // False until the directory has been read.
+        struct timespec mtime;               // Of the directory when we read it.
+        int64_t children;
+        int64_t own_bytes;                   // Size of the files directly in the directory.
+        int64_t bytes;                       // own_bytes plus bytes of all subdirectories we know about.
+        int64_t unscanned;                   // Directories in the subtree (including this one) not read yet.
+        std::vector<std::string> subdirs;    // Sorted names of the subdirectories we have nodes for.
+    };
+
+    struct DirContents
+    {
+        struct timespec mtime;
+        int64_t children;
+        int64_t own_bytes;
+        std::vector<std::string> subdirs;    // Sorted
+    };
+
+    typedef std::map<std::string, DirNode> DirMap;        // Ordered, so we can find subtrees.
+    typedef std::vector<std::pair<std::string, int64_t>> ScanList;  // Directories to scan, with their gen.
+
+    static void read_dir(std::string const& dir, DirContents& contents);
+    void schedule_scans(ScanList const& scans);
+    void scan_task(std::string const& dir, int64_t gen);
+    void scan_finished();
+    void apply(DirMap::iterator it, DirContents const& contents, ScanList& scans);
+    void add_dir(std::string const& dir, ScanList& scans);
+    void remove_tree(std::string const& dir);
+    void move_tree(std::string const& old_dir, std::string const& new_dir, ScanList& scans);
+    void entry_changed(std::string const& dir, int64_t children, int64_t bytes, ScanList& scans);
+    void propagate(std::string const& dir, int64_t bytes, int64_t unscanned);
+
+    std::string const root_;
+    mutable std::mutex mutex_;
+    std::condition_variable idle_;
+    DirMap dirs_;
+    int64_t next_gen_;
+    int64_t pending_;                        // Number of scans that are queued or running.
+    int64_t rescans_;
+    bool ready_;
+    std::atomic<bool> stopping_;
+    ThreadPool pool_;                        // Must be last, so it is destroyed first.
+};
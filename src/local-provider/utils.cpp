@@ -24,7 +24,11 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/exception/enable_current_exception.hpp>
 
+#include <fcntl.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 using namespace unity::storage::provider;
 using namespace std;
@@ -54,6 +58,52 @@ bool is_reserved_path(boost::filesystem::path const& path)
     return boost::starts_with(filename, TMPFILE_PREFIX);
 }
 
+namespace
+{
+
+// glibc has no wrapper for ioprio_set(), so we define what we need.
+int constexpr IOPRIO_WHO_PROCESS = 1;
+int constexpr IOPRIO_CLASS_IDLE = 3;
+int constexpr IOPRIO_CLASS_SHIFT = 13;
+
+}  // namespace
+
+// Drop the calling thread to the lowest CPU and I/O priority, for background
+// work that should not compete with requests. Background threads belong to
+// their own pool, so doing this once per thread is enough.
+
+void lower_thread_priority() noexcept
+{
+    thread_local bool lowered = false;
+    if (lowered)
+    {
+        return;
+    }
+    lowered = true;
+    auto tid = syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, tid, 19);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+}
+
+// Flush the directory entries of path to disk, so newly created
+// or renamed entries survive a crash.
+
+void fsync_dir(string const& method, string const& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        throw_storage_exception(method, "open", path, errno);
+    }
+    int rc = fsync(fd);
+    int err = errno;
+    close(fd);
+    if (rc == -1)
+    {
+        throw_storage_exception(method, "fsync", path, err);  // LCOV_EXCL_LINE
+    }
+}
+
 // Check that name is a valid file or directory name, that is, has a single component
 // and is not "", ".", or "..". Also check that the name does not start with the
 // temp file prefix. Throw if the name is invalid.
@@ -121,6 +171,15 @@ void throw_storage_exception(string const& method, boost::filesystem::filesystem
     }
 }
 
+// Throw a StorageException for a system call on path that failed with errno set to err.
+// The mapping of error codes is the same as for boost::filesystem errors.
+
+void throw_storage_exception(string const& method, string const& syscall, string const& path, int err)
+{
+    boost::system::error_code ec(err, boost::system::system_category());
+    throw_storage_exception(method, boost::filesystem::filesystem_error(syscall, path, ec));
+}
+
 // Throw a storage exception that corresponds to a FileError.
 
 void throw_storage_exception(string const& method, string const& msg, QFileDevice::FileError e)
@@ -18,7 +18,12 @@
 
 #pragma once
 
+#include "ThreadPool.h"
+
+#include <unity/storage/provider/Exceptions.h>
+
 #include <boost/filesystem.hpp>
+#include <boost/thread/future.hpp>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wctor-dtor-privacy"
@@ -30,16 +35,107 @@
 #include <string>
 
 constexpr char const* TMPFILE_PREFIX = ".storage-framework";
+constexpr char const* TRASH_DIR = ".storage-framework-trash";  // Has the temp file prefix, so it is never visible
+constexpr char const* UPLOADS_DIR = ".storage-framework-uploads";  // Manifests of resumable uploads
+constexpr char const* SEARCH_INDEX_FILE = ".storage-framework-index";  // Saved search index
+
+constexpr char const* THREAD_POOL_SIZE = "SF_LOCAL_PROVIDER_THREADS";  // 0 means "twice the number of cores, min 4"
+constexpr int THREAD_POOL_SIZE_DFLT = 0;
+
+constexpr char const* THREAD_POOL_QUEUE_DEPTH = "SF_LOCAL_PROVIDER_QUEUE_DEPTH";
+constexpr int THREAD_POOL_QUEUE_DEPTH_DFLT = 1024;
+
+constexpr char const* LIST_PAGE_SIZE = "SF_LOCAL_PROVIDER_PAGE_SIZE";  // Max number of items returned by list()
+constexpr int LIST_PAGE_SIZE_DFLT = 500;
+
+constexpr char const* LIST_CURSOR_TTL = "SF_LOCAL_PROVIDER_CURSOR_TTL";  // Seconds until a page token expires
+constexpr int LIST_CURSOR_TTL_DFLT = 60;
+
+constexpr char const* UPLOAD_TTL = "SF_LOCAL_PROVIDER_UPLOAD_TTL";  // Seconds an interrupted upload can be resumed, 0 = never
+constexpr int UPLOAD_TTL_DFLT = 0;
+
+constexpr char const* CONTENT_TYPE_CACHE_SIZE = "SF_LOCAL_PROVIDER_CONTENT_TYPE_CACHE_SIZE";  // Max number of entries
+constexpr int CONTENT_TYPE_CACHE_SIZE_DFLT = 10000;
+
+constexpr char const* SEARCH_INDEX = "SF_LOCAL_PROVIDER_SEARCH_INDEX";  // 0 disables search()
+constexpr int SEARCH_INDEX_DFLT = 1;
+
+constexpr char const* SEARCH_INDEX_THREADS = "SF_LOCAL_PROVIDER_SEARCH_INDEX_THREADS";  // 0 means "number of cores"
+constexpr int SEARCH_INDEX_THREADS_DFLT = 0;
+
+constexpr char const* SEARCH_INDEX_WATCHES = "SF_LOCAL_PROVIDER_SEARCH_INDEX_WATCHES";  // Max inotify watches
+constexpr int SEARCH_INDEX_WATCHES_DFLT = 1024;
+
+constexpr char const* USAGE_CACHE = "SF_LOCAL_PROVIDER_USAGE_CACHE";  // 0 disables child_count and recursive_size_in_bytes
+constexpr int USAGE_CACHE_DFLT = 1;
+
+constexpr char const* USAGE_CACHE_THREADS = "SF_LOCAL_PROVIDER_USAGE_CACHE_THREADS";  // 0 means "number of cores"
+constexpr int USAGE_CACHE_THREADS_DFLT = 0;
+
+constexpr char const* METADATA_CACHE_SIZE = "SF_LOCAL_PROVIDER_METADATA_CACHE_SIZE";  // Max KB of cached metadata, 0 = off
+constexpr int METADATA_CACHE_SIZE_DFLT = 16 * 1024;
+
+constexpr char const* METADATA_CACHE_WATCHES = "SF_LOCAL_PROVIDER_METADATA_CACHE_WATCHES";  // Max inotify watches
+constexpr int METADATA_CACHE_WATCHES_DFLT = 1024;
 
 int64_t get_mtime_nsecs(std::string const& method, std::string const& path);
 bool is_reserved_path(boost::filesystem::path const& path);
 boost::filesystem::path sanitize(std::string const& method, std::string const& name);
+void fsync_dir(std::string const& method, std::string const& path);
+void lower_thread_priority() noexcept;
 
 [[ noreturn ]]
 void throw_storage_exception(std::string const& method, boost::filesystem::filesystem_error const& e);
 
+[[ noreturn ]]
+void throw_storage_exception(std::string const& method,
+                             std::string const& syscall,
+                             std::string const& path,
+                             int err);
+
 [[ noreturn ]]
 void throw_storage_exception(std::string const& method, std::string const& msg, QFileDevice::FileError e);
 
 [[ noreturn ]]
 void throw_storage_exception(std::string const& method, std::string const& msg, QLocalSocket::LocalSocketError e);
+
+// Simple wrapper template that deals with exception handling so we don't
+// have to repeat ourselves endlessly in the various lambdas that run on the pool.
+// The auto deduction of the return type requires C++ 14.
+// If the pool is overloaded or closed, the returned future holds the exception.
+
+template<typename F>
+auto invoke_async(ThreadPool& pool, std::string const& method, F& functor)
+{
+    using namespace unity::storage::provider;
+
+    auto lambda = [method, functor]
+    {
+        try
+        {
+            return functor();
+        }
+        catch (StorageException const&)
+        {
+            throw;
+        }
+        catch (boost::filesystem::filesystem_error const& e)
+        {
+            throw_storage_exception(method, e);
+        }
+        // LCOV_EXCL_START
+        catch (std::exception const& e)
+        {
+            throw boost::enable_current_exception(UnknownException(e.what()));
+        }
+        // LCOV_EXCL_STOP
+    };
+    try
+    {
+        return boost::async(pool, lambda);
+    }
+    catch (StorageException const&)
+    {
+        return boost::make_exceptional_future<decltype(functor())>(boost::current_exception());
+    }
+}
@@ -17,6 +17,15 @@
  */
 
 #include <unity/storage/provider/ProviderBase.h>
+#include <unity/storage/provider/DownloadJob.h>
+#include <unity/storage/provider/Exceptions.h>
+#include <unity/storage/provider/UploadJob.h>
+#include <unity/storage/provider/internal/MainLoopExecutor.h>
+
+#include <algorithm>
+#include <functional>
+
+using namespace std;
 
 namespace unity
 {
@@ -25,12 +34,249 @@ namespace storage
 namespace provider
 {
 
+namespace
+{
+
+using internal::MainLoopExecutor;
+
+// Maximum number of items of a batch that are in progress at any one time. Providers
+// typically queue the work for each call to a single-item method, so starting all items
+// of a large batch at once could overflow their queue and fail items that are valid.
+
+size_t const BATCH_WINDOW = 16;
+
+// State of a batch: the functions that start an item and store its outcome, the results,
+// filled in as the single-item futures complete, and the index of the next item to start.
+// Only the main thread touches it.
+
+template<typename R, typename T>
+struct Batch
+{
+    typedef function<boost::future<T>(size_t)> Start;
+    typedef function<void(boost::future<T>&, R&)> Store;
+
+    Batch(size_t size, Start const& start, Store const& store)
+        : size(size)
+        , start(start)
+        , store(store)
+        , results(size)
+        , next(0)
+        , remaining(size)
+    {
+    }
+
+    void item_done()
+    {
+        if (--remaining == 0)
+        {
+            promise.set_value(std::move(results));
+        }
+    }
+
+    size_t const size;
+    Start const start;
+    Store const store;
+    vector<R> results;
+    size_t next;
+    size_t remaining;
+    boost::promise<vector<R>> promise;
+};
+
+void set_error(exception_ptr& result, exception_ptr const& error)
+{
+    result = error;
+}
+
+void set_error(BatchResult& result, exception_ptr const& error)
+{
+    result.error = error;
+}
+
+// Starts the next item of the batch, if there is one. Once that item completes, the next one
+// is started in turn, so at most as many items are in progress as there were calls to start_next()
+// from fan_out(). The continuation runs in the main loop, even if the item completed in another
+// thread, so the single-item methods are always called from the main thread. Because the
+// continuation is queued rather than run immediately, a ready future doesn't cause recursion.
+
+template<typename R, typename T>
+void start_next(shared_ptr<Batch<R, T>> const& batch)
+{
+    while (batch->next < batch->size)
+    {
+        size_t i = batch->next++;
+        boost::future<T> item_future;
+        try
+        {
+            item_future = batch->start(i);
+        }
+        catch (...)
+        {
+            set_error(batch->results[i], current_exception());
+            batch->item_done();
+            continue;  // Nothing is in progress for this slot, so start another item.
+        }
+        item_future.then(EXEC_IN_MAIN [batch, i](boost::future<T> f)
+        {
+            batch->store(f, batch->results[i]);
+            batch->item_done();
+            start_next(batch);
+        });
+        return;
+    }
+}
+
+// Calls start(i) for each of size items and returns a future that becomes ready once all
+// of the futures returned by start() are ready. store() transfers the outcome of each future
+// into its slot in the results. At most BATCH_WINDOW items are in progress at a time. Must be
+// called from the main thread, and the returned future only becomes ready if the main loop runs.
+
+template<typename R, typename T>
+boost::future<vector<R>> fan_out(size_t size,
+                                 typename Batch<R, T>::Start const& start,
+                                 typename Batch<R, T>::Store const& store)
+{
+    if (size == 0)
+    {
+        return boost::make_ready_future(vector<R>());
+    }
+
+    auto batch = std::make_shared<Batch<R, T>>(size, start, store);
+    auto f = batch->promise.get_future();
+    for (size_t i = 0; i < min(size, BATCH_WINDOW); ++i)
+    {
+        start_next(batch);
+    }
+    return f;
+}
+
+boost::future<BatchResultList> fan_out_items(size_t size, function<boost::future<Item>(size_t)> const& start)
+{
+    return fan_out<BatchResult, Item>(size, start, [](boost::future<Item>& f, BatchResult& result)
+    {
+        try
+        {
+            result.item = f.get();
+        }
+        catch (...)
+        {
+            set_error(result, current_exception());
+        }
+    });
+}
+
+}  // namespace
+
 ProviderBase::ProviderBase()
 {
 }
 
 ProviderBase::~ProviderBase() = default;
 
+boost::future<tuple<ItemList, string>> ProviderBase::search(string const& /*item_id*/,
+                                                           string const& /*pattern*/,
+                                                           string const& /*page_token*/,
+                                                           vector<string> const& /*keys*/,
+                                                           Context const& /*context*/)
+{
+    string msg = "search(): provider does not support search";
+    return boost::make_exceptional_future<tuple<ItemList, string>>(LogicException(msg));
+}
+
+boost::future<BatchResultList> ProviderBase::metadata_items(vector<string> const& item_ids,
+                                                            vector<string> const& keys,
+                                                            Context const& context)
+{
+    auto This = shared_from_this();
+    return fan_out_items(item_ids.size(), [This, item_ids, keys, context](size_t i)
+    {
+        return This->metadata(item_ids[i], keys, context);
+    });
+}
+
+boost::future<tuple<unique_ptr<UploadJob>, int64_t>> ProviderBase::resume_upload(string const& /*upload_id*/,
+                                                                                 vector<string> const& /*keys*/,
+                                                                                 Context const& /*context*/)
+{
+    string msg = "resume_upload(): provider does not support resumable uploads";
+    return boost::make_exceptional_future<tuple<unique_ptr<UploadJob>, int64_t>>(LogicException(msg));
+}
+
+boost::future<unique_ptr<DownloadJob>> ProviderBase::download_range(string const& item_id,
+                                                                    string const& match_etag,
+                                                                    int64_t offset,
+                                                                    int64_t length,
+                                                                    Context const& context)
+{
+    if (offset == 0 && length < 0)
+    {
+        return download(item_id, match_etag, context);
+    }
+    string msg = "download_range(): provider does not support downloading a range";
+    return boost::make_exceptional_future<unique_ptr<DownloadJob>>(LogicException(msg));
+}
+
+boost::future<vector<exception_ptr>> ProviderBase::delete_items(vector<string> const& item_ids,
+                                                                Context const& context)
+{
+    auto This = shared_from_this();
+    auto start = [This, item_ids, context](size_t i)
+    {
+        return This->delete_item(item_ids[i], context);
+    };
+    return fan_out<exception_ptr, void>(item_ids.size(), start, [](boost::future<void>& f, exception_ptr& error)
+    {
+        try
+        {
+            f.get();
+        }
+        catch (...)
+        {
+            set_error(error, current_exception());
+        }
+    });
+}
+
+boost::future<BatchResultList> ProviderBase::move_items(vector<string> const& item_ids,
+                                                        string const& new_parent_id,
+                                                        vector<string> const& new_names,
+                                                        vector<string> const& keys,
+                                                        Context const& context)
+{
+    if (new_names.size() != item_ids.size())
+    {
+        string msg = "move_items(): item_ids and new_names must have the same size";
+        return boost::make_exceptional_future<BatchResultList>(InvalidArgumentException(msg));
+    }
+    auto This = shared_from_this();
+    return fan_out_items(item_ids.size(), [This, item_ids, new_parent_id, new_names, keys, context](size_t i)
+    {
+        return This->move(item_ids[i], new_parent_id, new_names[i], keys, context);
+    });
+}
+
+boost::future<BatchResultList> ProviderBase::copy_items(vector<string> const& item_ids,
+                                                        string const& new_parent_id,
+                                                        vector<string> const& new_names,
+                                                        vector<string> const& keys,
+                                                        Context const& context)
+{
+    if (new_names.size() != item_ids.size())
+    {
+        string msg = "copy_items(): item_ids and new_names must have the same size";
+        return boost::make_exceptional_future<BatchResultList>(InvalidArgumentException(msg));
+    }
+    auto This = shared_from_this();
+    return fan_out_items(item_ids.size(), [This, item_ids, new_parent_id, new_names, keys, context](size_t i)
+    {
+        return This->copy(item_ids[i], new_parent_id, new_names[i], keys, context);
+    });
+}
+
+vector<string> ProviderBase::capabilities() const
+{
+    return {};
+}
+
 }
 }
 }
@@ -69,6 +69,11 @@ void UploadJob::report_error(std::exception_ptr p)
     p_->report_error(p);
 }
 
+boost::future<void> UploadJob::suspend()
+{
+    return cancel();
+}
+
 }
 }
 }
@@ -17,14 +17,18 @@
  */
 
 #include <unity/storage/provider/internal/AccountData.h>
+#include <unity/storage/internal/EnvVars.h>
 #include <unity/storage/internal/InactivityTimer.h>
 #include <unity/storage/provider/ProviderBase.h>
 #include <unity/storage/provider/internal/DBusPeerCache.h>
+#include <unity/storage/provider/internal/ListCursors.h>
 #include <unity/storage/provider/internal/PendingJobs.h>
+#include <unity/storage/provider/internal/RequestStats.h>
 
 #include <QDebug>
 
 using namespace std;
+using unity::storage::internal::EnvVars;
 using unity::storage::internal::InactivityTimer;
 
 namespace unity {
@@ -38,7 +42,9 @@ AccountData::AccountData(shared_ptr<ProviderBase> const& provider,
                          QDBusConnection const& bus,
                          QObject* parent)
     : QObject(parent), provider_(provider), dbus_peer_(dbus_peer),
-      inactivity_timer_(inactivity_timer), jobs_(new PendingJobs(bus))
+      inactivity_timer_(inactivity_timer), jobs_(new PendingJobs(bus)),
+      list_cursors_(new ListCursors(bus)),
+      stats_(EnvVars::provider_stats() ? new RequestStats : nullptr)
 {
 }
 
@@ -64,6 +70,16 @@ PendingJobs& AccountData::jobs()
     return *jobs_;
 }
 
+ListCursors& AccountData::list_cursors()
+{
+    return *list_cursors_;
+}
+
+RequestStats* AccountData::stats()
+{
+    return stats_.get();
+}
+
 }
 }
 }
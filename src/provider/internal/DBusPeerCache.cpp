@@ -63,6 +63,8 @@ struct DBusPeerCache::Request
 DBusPeerCache::DBusPeerCache(QDBusConnection const& bus)
     : bus_daemon_(new BusInterface(DBUS_BUS_NAME, DBUS_BUS_PATH, bus))
     , apparmor_enabled_(aa_is_enabled())
+    , hits_(0)
+    , misses_(0)
 {
 }
 
@@ -74,6 +76,7 @@ boost::future<DBusPeerCache::Credentials> DBusPeerCache::get(QString const& peer
     try
     {
         Credentials const& credentials = cache_.at(peer);
+        hits_.fetch_add(1, memory_order_relaxed);
         boost::promise<Credentials> p;
         p.set_value(credentials);
         return p.get_future();
@@ -91,6 +94,7 @@ boost::future<DBusPeerCache::Credentials> DBusPeerCache::get(QString const& peer
         // No real way to get coverage here because we'd
         // need more than 50 peers with different credentials.
         // LCOV_EXCL_START
+        hits_.fetch_add(1, memory_order_relaxed);
         cache_.emplace(peer, std::move(credentials));
         old_cache_.erase(peer);
         boost::promise<Credentials> p;
@@ -103,6 +107,7 @@ boost::future<DBusPeerCache::Credentials> DBusPeerCache::get(QString const& peer
         // ignore
     }
 
+    misses_.fetch_add(1, memory_order_relaxed);
     boost::promise<Credentials> promise;
     auto future = promise.get_future();
     // If the credentials are already being requested, add ourselves
@@ -131,6 +136,16 @@ boost::future<DBusPeerCache::Credentials> DBusPeerCache::get(QString const& peer
     return future;
 }
 
+int64_t DBusPeerCache::hits() const noexcept
+{
+    return hits_.load(memory_order_relaxed);
+}
+
+int64_t DBusPeerCache::misses() const noexcept
+{
+    return misses_.load(memory_order_relaxed);
+}
+
 void DBusPeerCache::received_credentials(QString const& peer, QDBusPendingReply<QVariantMap> const& reply)
 {
     Credentials credentials;
@@ -18,11 +18,11 @@
 
 #include <unity/storage/provider/internal/Handler.h>
 
-#include <unity/storage/internal/dbus_error.h>
 #include <unity/storage/provider/internal/AccountData.h>
 #include <unity/storage/provider/internal/dbusmarshal.h>
 #include <unity/storage/provider/internal/DBusPeerCache.h>
 #include <unity/storage/provider/internal/MainLoopExecutor.h>
+#include <unity/storage/provider/internal/marshal_error.h>
 #include <unity/storage/provider/ProviderBase.h>
 #include <unity/storage/provider/Exceptions.h>
 
@@ -48,14 +48,21 @@ namespace internal
 
 Handler::Handler(shared_ptr<AccountData> const& account,
                  Callback const& callback,
-                 QDBusConnection const& bus, QDBusMessage const& message)
+                 QDBusConnection const& bus, QDBusMessage const& message,
+                 Priority priority)
     : account_(account), callback_(callback), bus_(bus), message_(message),
-      activity_(account->inactivity_timer())
+      priority_(priority), activity_(account->inactivity_timer()),
+      created_(chrono::steady_clock::now())
 {
 }
 
 void Handler::begin()
 {
+    if (begun_ == chrono::steady_clock::time_point())
+    {
+        begun_ = chrono::steady_clock::now();
+    }
+
     // If we have already retrieved credentials from OnlineAccounts,
     // and we aren't retrying the request, go to on_authenticated
     // immediately.
@@ -95,7 +102,7 @@ void Handler::on_authenticated()
             if (info.valid)
             {
                 context_ = {info.uid, info.pid, std::move(info.label),
-                            account_->credentials()};
+                            account_->credentials(), priority_};
                 QMetaObject::invokeMethod(this, "credentials_received",
                                           Qt::QueuedConnection);
             }
@@ -164,65 +171,40 @@ void Handler::handle_unauthorized(exception_ptr ep)
     }
 }
 
+QDBusMessage const& Handler::message() const
+{
+    return message_;
+}
+
+QDBusMessage const& Handler::reply() const
+{
+    return reply_;
+}
+
+chrono::microseconds Handler::wait_time() const
+{
+    return chrono::duration_cast<chrono::microseconds>(begun_ - created_);
+}
+
+chrono::microseconds Handler::latency() const
+{
+    return chrono::duration_cast<chrono::microseconds>(finished_ - created_);
+}
+
 void Handler::send_reply()
 {
+    finished_ = chrono::steady_clock::now();
     bus_.send(reply_);
     Q_EMIT finished();
 }
 
 void Handler::marshal_exception(exception_ptr ep)
 {
-    try
-    {
-        rethrow_exception(ep);
-    }
-    catch (StorageException const& e)
-    {
-        reply_ = message_.createErrorReply(QString(DBUS_ERROR_PREFIX) + QString::fromStdString(e.type()),
-                                           QString::fromStdString(e.error_message()));
-        try
-        {
-            throw;
-        }
-        catch (NotExistsException const& e)
-        {
-            reply_ << QVariant(QString::fromStdString(e.key()));
-        }
-        catch (ExistsException const& e)
-        {
-            reply_ << QVariant(QString::fromStdString(e.native_identity()));
-            reply_ << QVariant(QString::fromStdString(e.name()));
-        }
-        catch (ResourceException const& e)
-        {
-            qDebug() << e.what();
-            reply_ << QVariant(e.error_code());
-        }
-        catch (RemoteCommsException const& e)
-        {
-            qDebug() << e.what();
-        }
-        catch (UnknownException const& e)
-        {
-            qDebug() << e.what();
-        }
-        catch (StorageException const&)
-        {
-            // Some other sub-type of StorageException without additional data members,
-            // and we don't want to log this (not surprising) exception.
-        }
-    }
-    catch (std::exception const& e)
-    {
-        QString msg = QString("unknown exception thrown by provider: ") + e.what();
-        qDebug() << msg;
-        reply_ = message_.createErrorReply(QString(DBUS_ERROR_PREFIX) + "UnknownException", msg);
-    }
-    catch (...)
+    auto error = marshal_error(ep);
+    reply_ = message_.createErrorReply(error.name, error.message);
+    for (auto const& arg : error.args)
     {
-        QString msg = "unknown exception thrown by provider";
-        qDebug() << msg;
-        reply_ = message_.createErrorReply(QString(DBUS_ERROR_PREFIX) + "UnknownException", msg);
+        reply_ << arg;
     }
 }
 
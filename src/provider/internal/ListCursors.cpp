@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/provider/internal/ListCursors.h>
+#include <unity/storage/internal/EnvVars.h>
+#include <unity/storage/provider/Exceptions.h>
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+
+using namespace std;
+using unity::storage::internal::EnvVars;
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+namespace
+{
+
+// Providers are unlikely to produce tokens that start with this.
+char const CURSOR_PREFIX[] = "sf-list-cursor:";
+
+}  // namespace
+
+ListCursors::ListCursors(QDBusConnection const& bus, QObject *parent)
+    : QObject(parent)
+    , page_size_(EnvVars::provider_list_page_size())
+    , ttl_(EnvVars::provider_list_cursor_ttl_ms())
+    , max_cursors_(EnvVars::provider_max_list_cursors())
+    , max_client_cursors_(EnvVars::provider_max_client_list_cursors())
+{
+    watcher_.setConnection(bus);
+    watcher_.setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    connect(&watcher_, &QDBusServiceWatcher::serviceUnregistered,
+            this, &ListCursors::service_disconnected);
+}
+
+ListCursors::~ListCursors() = default;
+
+bool ListCursors::is_cursor_token(string const& token)
+{
+    return token.compare(0, sizeof(CURSOR_PREFIX) - 1, CURSOR_PREFIX) == 0;
+}
+
+string ListCursors::add(QString const& client_bus_name,
+                        string const& method,
+                        string const& item_id,
+                        ItemList& items,
+                        string const& next_token)
+{
+    if (items.size() <= page_size_)
+    {
+        return next_token;
+    }
+
+    Cursor cursor;
+    cursor.method = method;
+    cursor.item_id = item_id;
+    cursor.items.assign(make_move_iterator(items.begin() + page_size_), make_move_iterator(items.end()));
+    cursor.pos = 0;
+    cursor.next_token = next_token;
+    items.resize(page_size_);
+
+    lock_guard<mutex> guard(lock_);
+    purge_expired();
+    return store(client_bus_name, move(cursor));
+}
+
+tuple<ItemList,string> ListCursors::next_page(QString const& client_bus_name,
+                                              string const& method,
+                                              string const& item_id,
+                                              string const& token)
+{
+    lock_guard<mutex> guard(lock_);
+    purge_expired();
+
+    auto it = cursors_.find({client_bus_name, token});
+    if (it == cursors_.end() || it->second.method != method || it->second.item_id != item_id)
+    {
+        throw InvalidArgumentException(method + ": invalid or expired page token: \"" + token + "\"");
+    }
+    Cursor cursor = move(it->second);
+    cursors_.erase(it);
+    unwatch_peer(client_bus_name);
+
+    auto const begin = cursor.items.begin() + cursor.pos;
+    auto const count = min(page_size_, cursor.items.size() - cursor.pos);
+    ItemList page(make_move_iterator(begin), make_move_iterator(begin + count));
+    cursor.pos += count;
+
+    if (cursor.pos == cursor.items.size())
+    {
+        return make_tuple(move(page), cursor.next_token);
+    }
+    return make_tuple(move(page), store(client_bus_name, move(cursor)));
+}
+
+string ListCursors::store(QString const& client_bus_name, Cursor&& cursor)
+{
+    assert(!client_bus_name.isEmpty());
+
+    // The token must not be reused by a different cursor, but it need not be
+    // hard to guess: it is only valid for the client that received it.
+    string token = CURSOR_PREFIX + to_string(next_id_++);
+
+    // Make room, first among the client's own cursors, then among everyone's.
+    auto s = services_.find(client_bus_name);
+    if (s != services_.end() && size_t(s->second) >= max_client_cursors_)
+    {
+        auto const begin = cursors_.lower_bound(make_pair(client_bus_name, string()));
+        auto end = begin;
+        while (end != cursors_.end() && end->first.first == client_bus_name)
+        {
+            ++end;
+        }
+        drop_oldest(begin, end);
+    }
+    if (cursors_.size() >= max_cursors_)
+    {
+        drop_oldest(cursors_.begin(), cursors_.end());
+    }
+
+    cursor.expiry = chrono::steady_clock::now() + ttl_;
+    cursors_.emplace(make_pair(client_bus_name, token), move(cursor));
+    watch_peer(client_bus_name);
+    return token;
+}
+
+void ListCursors::purge_expired()
+{
+    auto const now = chrono::steady_clock::now();
+    for (auto it = cursors_.begin(); it != cursors_.end(); )
+    {
+        if (it->second.expiry <= now)
+        {
+            auto const client = it->first.first;
+            it = cursors_.erase(it);
+            unwatch_peer(client);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+// All cursors live for the same TTL, so the one that expires first is the oldest.
+
+void ListCursors::drop_oldest(CursorMap::iterator begin, CursorMap::iterator end)
+{
+    auto oldest = min_element(begin, end,
+                              [](CursorMap::value_type const& a, CursorMap::value_type const& b)
+                              {
+                                  return a.second.expiry < b.second.expiry;
+                              });
+    if (oldest == end)
+    {
+        return;  // LCOV_EXCL_LINE
+    }
+    auto const client = oldest->first.first;
+    cursors_.erase(oldest);
+    unwatch_peer(client);
+}
+
+void ListCursors::watch_peer(QString const& bus_name)
+{
+    auto it = services_.find(bus_name);
+    if (it != services_.end())
+    {
+        it->second++;
+    }
+    else
+    {
+        watcher_.addWatchedService(bus_name);
+        services_[bus_name] = 1;
+    }
+}
+
+void ListCursors::unwatch_peer(QString const& bus_name)
+{
+    auto it = services_.find(bus_name);
+    if (it == services_.end())
+    {
+        return;
+    }
+    it->second--;
+    if (it->second == 0)
+    {
+        services_.erase(it);
+        watcher_.removeWatchedService(bus_name);
+    }
+}
+
+void ListCursors::service_disconnected(QString const& service_name)
+{
+    lock_guard<mutex> guard(lock_);
+
+    services_.erase(service_name);
+    watcher_.removeWatchedService(service_name);
+
+    auto it = cursors_.lower_bound(make_pair(service_name, string()));
+    while (it != cursors_.end() && it->first.first == service_name)
+    {
+        it = cursors_.erase(it);
+    }
+}
+
+}
+}
+}
+}
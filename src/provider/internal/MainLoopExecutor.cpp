@@ -18,19 +18,26 @@
 
 #include <unity/storage/provider/internal/MainLoopExecutor.h>
 
+#include <boost/thread/sync_queue.hpp>
 #include <QCoreApplication>
 #include <QEvent>
+#include <QThread>
 
+#include <cassert>
+#include <chrono>
 #include <stdexcept>
 
+using namespace std;
+
 namespace {
 
-class WorkEvent : public QEvent {
-public:
-    typedef unity::storage::provider::internal::MainLoopExecutor::work work;
+// Longest time a batch of closures may hold up the main loop.
+auto const TIME_SLICE = chrono::milliseconds(10);
 
-    WorkEvent(work&& closure)
-        : QEvent(WorkEvent::eventType()), closure_(std::move(closure))
+class WakeUpEvent : public QEvent {
+public:
+    WakeUpEvent()
+        : QEvent(WakeUpEvent::eventType())
     {
     }
 
@@ -39,8 +46,6 @@ public:
         static auto type = static_cast<QEvent::Type>(QEvent::registerEventType());
         return type;
     }
-
-    work closure_;
 };
 
 }
@@ -54,8 +59,40 @@ namespace provider
 namespace internal
 {
 
+struct MainLoopExecutor::Node
+{
+    Node() : next(nullptr) {}
+    explicit Node(work&& c) : closure(std::move(c)), next(nullptr) {}
+
+    work closure;
+    atomic<Node*> next;
+};
+
 MainLoopExecutor::MainLoopExecutor()
+    : head_(new Node)
+    , wake_up_pending_(false)
+    , closed_(false)
+{
+    tail_ = head_.load();
+
+    // The first call to instance() may come from any thread, but the
+    // closures must run in the thread of the main loop.
+    if (QCoreApplication::instance())
+    {
+        moveToThread(QCoreApplication::instance()->thread());
+    }
+}
+
+MainLoopExecutor::~MainLoopExecutor()
 {
+    // Closures that never ran are destroyed along with their nodes.
+    Node* n = tail_;
+    while (n)
+    {
+        Node* next = n->next.load(memory_order_relaxed);
+        delete n;
+        n = next;
+    }
 }
 
 MainLoopExecutor& MainLoopExecutor::instance()
@@ -66,33 +103,49 @@ MainLoopExecutor& MainLoopExecutor::instance()
 
 void MainLoopExecutor::submit(work&& closure)
 {
-    QCoreApplication::instance()->postEvent(
-        this, new WorkEvent(std::move(closure)));
+    if (closed_.load(memory_order_acquire))
+    {
+        throw boost::sync_queue_is_closed();
+    }
+
+    Node* n = new Node(std::move(closure));
+    Node* prev = head_.exchange(n, memory_order_acq_rel);
+    prev->next.store(n, memory_order_release);
+    wake_up();
 }
 
 void MainLoopExecutor::close()
 {
+    closed_.store(true, memory_order_release);
 }
 
 bool MainLoopExecutor::closed()
 {
-    return false;
+    return closed_.load(memory_order_acquire);
 }
 
 bool MainLoopExecutor::try_executing_one()
 {
-    return false;
+    if (QThread::currentThread() != thread())
+    {
+        return false;
+    }
+    work closure;
+    if (!pop(closure))
+    {
+        return false;
+    }
+    execute(closure);
+    return true;
 }
 
-
 bool MainLoopExecutor::event(QEvent *e)
 {
-    if (e->type() != WorkEvent::eventType())
+    if (e->type() != WakeUpEvent::eventType())
     {
         return QObject::event(e);
     }
-    auto *we = static_cast<WorkEvent*>(e);
-    execute(we->closure_);
+    run_batch();
     return true;
 }
 
@@ -101,6 +154,57 @@ void MainLoopExecutor::execute(work& closure) noexcept
     closure();
 }
 
+// Posts a wake-up event, unless one is pending already. The flag is cleared
+// before the queue is drained, so a closure that is pushed while we drain
+// either gets drained or posts a new event.
+
+void MainLoopExecutor::wake_up()
+{
+    if (!wake_up_pending_.exchange(true, memory_order_acq_rel))
+    {
+        QCoreApplication::postEvent(this, new WakeUpEvent);
+    }
+}
+
+// Called from the main thread only. May return false while a producer is
+// between the two steps of submit(); that producer calls wake_up() afterwards.
+
+bool MainLoopExecutor::pop(work& closure)
+{
+    Node* next = tail_->next.load(memory_order_acquire);
+    if (!next)
+    {
+        return false;
+    }
+    closure = std::move(next->closure);
+    delete tail_;
+    tail_ = next;  // next becomes the new stub node.
+    return true;
+}
+
+void MainLoopExecutor::run_batch()
+{
+    // Must be a read-modify-write, so we see the queue of any producer that found the flag set.
+    wake_up_pending_.exchange(false, memory_order_acq_rel);
+
+    auto const deadline = chrono::steady_clock::now() + TIME_SLICE;
+    work closure;
+    while (pop(closure))
+    {
+        execute(closure);
+        closure = work();
+        if (chrono::steady_clock::now() >= deadline)
+        {
+            // Let the main loop handle other events before we continue.
+            if (tail_->next.load(memory_order_acquire))
+            {
+                wake_up();
+            }
+            return;
+        }
+    }
+}
+
 }
 }
 }
@@ -52,11 +52,11 @@ PendingJobs::~PendingJobs()
 {
     for (const auto& pair : downloads_)
     {
-        cancel_job(pair.second, "download " + pair.second->download_id());
+        cancel_job(pair.second, pair.second->p_->cancel(*pair.second), "download " + pair.second->download_id());
     }
     for (const auto& pair : uploads_)
     {
-        cancel_job(pair.second, "upload " + pair.second->upload_id());
+        cancel_job(pair.second, pair.second->p_->cancel(*pair.second), "upload " + pair.second->upload_id());
     }
 }
 
@@ -120,6 +120,18 @@ shared_ptr<UploadJob> PendingJobs::remove_upload(QString const& client_bus_name,
     return job;
 }
 
+int PendingJobs::num_downloads()
+{
+    lock_guard<mutex> guard(lock_);
+    return int(downloads_.size());
+}
+
+int PendingJobs::num_uploads()
+{
+    lock_guard<mutex> guard(lock_);
+    return int(uploads_.size());
+}
+
 void PendingJobs::watch_peer(QString const& bus_name)
 {
     auto it = services_.find(bus_name);
@@ -163,7 +175,7 @@ void PendingJobs::service_disconnected(QString const& service_name)
     {
         auto job = it->second;
         it = downloads_.erase(it);
-        cancel_job(job, "download " + job->download_id());
+        cancel_job(job, job->p_->cancel(*job), "download " + job->download_id());
     }
 
     for (auto it = uploads_.lower_bound(lower);
@@ -171,14 +183,14 @@ void PendingJobs::service_disconnected(QString const& service_name)
     {
         auto job = it->second;
         it = uploads_.erase(it);
-        cancel_job(job, "upload " + job->upload_id());
+        // The client may reconnect and resume the upload, so we keep what was received so far.
+        cancel_job(job, job->p_->suspend(*job), "upload " + job->upload_id());
     }
 }
 
 template<typename Job>
-void PendingJobs::cancel_job(shared_ptr<Job> const& job, string const& identifier)
+void PendingJobs::cancel_job(shared_ptr<Job> const& job, boost::future<void> f, string const& identifier)
 {
-    auto f = job->p_->cancel(*job);
     // This continuation also ensures that the job remains
     // alive until the cancel method has completed.
     auto cancel_future = std::make_shared<boost::future<void>>();
@@ -17,16 +17,23 @@
  */
 
 #include <unity/storage/provider/internal/ProviderInterface.h>
+#include <unity/storage/internal/dbus_error.h>
 #include <unity/storage/provider/DownloadJob.h>
 #include <unity/storage/provider/Exceptions.h>
 #include <unity/storage/provider/ProviderBase.h>
 #include <unity/storage/provider/UploadJob.h>
 #include <unity/storage/provider/internal/AccountData.h>
 #include <unity/storage/provider/internal/DownloadJobImpl.h>
+#include <unity/storage/provider/internal/ListCursors.h>
 #include <unity/storage/provider/internal/MainLoopExecutor.h>
 #include <unity/storage/provider/internal/PendingJobs.h>
+#include <unity/storage/provider/internal/RequestStats.h>
 #include <unity/storage/provider/internal/UploadJobImpl.h>
 #include <unity/storage/provider/internal/dbusmarshal.h>
+#include <unity/storage/provider/internal/DBusPeerCache.h>
+#include <unity/storage/provider/internal/marshal_error.h>
+
+#include "statsadaptor.h"
 
 #include <OnlineAccounts/AuthenticationData>
 #include <QDebug>
@@ -46,6 +53,97 @@ vector<string> to_vector(QList<QString> const& l)
     return v;
 }
 
+// Per-item errors of a batch reply: the D-Bus error name and message that a single-item
+// request would return, plus the additional arguments of that error reply (such as the key
+// of a NotExistsException). All three are empty for an item that succeeded.
+
+struct BatchErrors
+{
+    QStringList names;
+    QStringList messages;
+    QVariantList details;
+
+    void append(exception_ptr const& ep);
+};
+
+void BatchErrors::append(exception_ptr const& ep)
+{
+    if (!ep)
+    {
+        names.append(QString());
+        messages.append(QString());
+        details.append(QVariant(QVariantList()));
+        return;
+    }
+    auto error = unity::storage::provider::internal::marshal_error(ep);
+    names.append(error.name);
+    messages.append(error.message);
+    details.append(QVariant(error.args));
+}
+
+QDBusMessage make_batch_reply(QDBusMessage const& message, unity::storage::provider::BatchResultList const& results)
+{
+    unity::storage::provider::ItemList items;
+    BatchErrors errors;
+    for (auto const& r : results)
+    {
+        if (!r.error)
+        {
+            items.push_back(r.item);
+        }
+        errors.append(r.error);
+    }
+    return message.createReply({
+            QVariant::fromValue(items),
+            QVariant(errors.names),
+            QVariant(errors.messages),
+            QVariant(errors.details),
+        });
+}
+
+// Priority of the requests for each method, unless the client has set a lower one with SetPriority.
+// Methods that are not listed are interactive.
+
+unity::storage::provider::Priority method_priority(QString const& method)
+{
+    using unity::storage::provider::Priority;
+
+    static map<QString, Priority> const priorities =
+    {
+        { "List",          Priority::bulk },
+        { "Search",        Priority::bulk },
+        { "MetadataMany",  Priority::bulk },
+        { "Copy",          Priority::bulk },
+        { "DeleteMany",    Priority::bulk },
+        { "MoveMany",      Priority::bulk },
+        { "CopyMany",      Priority::bulk },
+        { "CreateFile",    Priority::background },
+        { "Update",        Priority::background },
+        { "ResumeUpload",  Priority::background },
+        { "Download",      Priority::background },
+        { "DownloadRange", Priority::background },
+    };
+    auto it = priorities.find(method);
+    return it != priorities.end() ? it->second : Priority::interactive;
+}
+
+// Replies with the next page of a result that was too large for a single reply.
+
+QDBusMessage next_page_reply(unity::storage::provider::internal::AccountData& account,
+                             QDBusMessage const& message,
+                             string const& method,
+                             string const& item_id,
+                             string const& token)
+{
+    unity::storage::provider::ItemList items;
+    string next_token;
+    tie(items, next_token) = account.list_cursors().next_page(message.service(), method, item_id, token);
+    return message.createReply({
+            QVariant::fromValue(items),
+            QVariant(QString::fromStdString(next_token)),
+        });
+}
+
 }
 
 namespace unity {
@@ -56,23 +154,40 @@ namespace internal {
 ProviderInterface::ProviderInterface(shared_ptr<AccountData> const& account, QObject *parent)
     : QObject(parent), account_(account)
 {
+    if (account_->stats())
+    {
+        // This instance is managed by Qt's parent/child memory management.
+        new StatsAdaptor(this);
+    }
 }
 
 ProviderInterface::~ProviderInterface() = default;
 
-void ProviderInterface::queue_request(Handler::Callback callback)
+void ProviderInterface::queue_request(Handler::Callback callback, int64_t cost)
 {
+    auto const client = message().service();
+    auto const priority = scheduler_.client_priority(client, method_priority(message().member()));
     unique_ptr<Handler> handler(
-        new Handler(account_, callback, connection(), message()));
+        new Handler(account_, callback, connection(), message(), priority));
     connect(handler.get(), &Handler::finished, this, &ProviderInterface::request_finished);
     setDelayedReply(true);
-    handler->begin();
-    requests_.emplace(handler.get(), std::move(handler));
+    auto h = handler.get();
+    requests_.emplace(h, std::move(handler));
+    scheduler_.submit(client, h, priority, cost);
 }
 
 void ProviderInterface::request_finished()
 {
     Handler* handler = static_cast<Handler*>(sender());
+    scheduler_.finished(handler);
+    if (auto stats = account_->stats())
+    {
+        auto const& reply = handler->reply();
+        stats->record(handler->message().member(),
+                      reply.type() == QDBusMessage::ErrorMessage ? reply.errorName() : QString(),
+                      handler->latency().count(),
+                      handler->wait_time().count());
+    }
     try
     {
         auto& h = requests_.at(handler);
@@ -112,13 +227,20 @@ QList<ProviderInterface::IMD> ProviderInterface::List(QString const& item_id,
     queue_request([item_id, page_token, keys](shared_ptr<AccountData> const& account,
                                               Context const& ctx,
                                               QDBusMessage const& message) {
-            auto f = account->provider().list(item_id.toStdString(), page_token.toStdString(), to_vector(keys), ctx);
+            auto const id = item_id.toStdString();
+            auto const token = page_token.toStdString();
+            if (ListCursors::is_cursor_token(token))
+            {
+                return boost::make_ready_future(next_page_reply(*account, message, "List()", id, token));
+            }
+            auto f = account->provider().list(id, token, to_vector(keys), ctx);
             return f.then(
                 EXEC_IN_MAIN
-                [account, message](decltype(f) f) -> QDBusMessage {
+                [account, message, id](decltype(f) f) -> QDBusMessage {
                     vector<Item> children;
                     string next_token;
                     tie(children, next_token) = f.get();
+                    next_token = account->list_cursors().add(message.service(), "List()", id, children, next_token);
                     return message.createReply({
                             QVariant::fromValue(children),
                             QVariant(QString::fromStdString(next_token)),
@@ -128,6 +250,41 @@ QList<ProviderInterface::IMD> ProviderInterface::List(QString const& item_id,
     return {};
 }
 
+QList<ProviderInterface::IMD> ProviderInterface::Search(QString const& item_id,
+                                                        QString const& pattern,
+                                                        QString const& page_token,
+                                                        QList<QString> const& keys,
+                                                        QString& /*next_token*/)
+{
+    queue_request([item_id, pattern, page_token, keys](shared_ptr<AccountData> const& account,
+                                                       Context const& ctx,
+                                                       QDBusMessage const& message) {
+            // The pattern is part of the cursor's identity, so a token cannot be used
+            // to continue a search for something else.
+            auto const id = item_id.toStdString();
+            auto const search_id = id + '\0' + pattern.toStdString();
+            auto const token = page_token.toStdString();
+            if (ListCursors::is_cursor_token(token))
+            {
+                return boost::make_ready_future(next_page_reply(*account, message, "Search()", search_id, token));
+            }
+            auto f = account->provider().search(id, pattern.toStdString(), token, to_vector(keys), ctx);
+            return f.then(
+                EXEC_IN_MAIN
+                [account, message, search_id](decltype(f) f) -> QDBusMessage {
+                    vector<Item> items;
+                    string next_token;
+                    tie(items, next_token) = f.get();
+                    next_token = account->list_cursors().add(message.service(), "Search()", search_id, items, next_token);
+                    return message.createReply({
+                            QVariant::fromValue(items),
+                            QVariant(QString::fromStdString(next_token)),
+                        });
+                });
+        });
+    return {};
+}
+
 QList<ProviderInterface::IMD> ProviderInterface::Lookup(QString const& parent_id,
                                                         QString const& name,
                                                         QList<QString> const& keys)
@@ -162,6 +319,25 @@ ProviderInterface::IMD ProviderInterface::Metadata(QString const& item_id, QList
     return {};
 }
 
+QList<ProviderInterface::IMD> ProviderInterface::MetadataMany(QList<QString> const& item_ids,
+                                                              QList<QString> const& keys,
+                                                              QStringList& /*error_names*/,
+                                                              QStringList& /*error_messages*/,
+                                                              QVariantList& /*error_details*/)
+{
+    queue_request([item_ids, keys](shared_ptr<AccountData> const& account,
+                                   Context const& ctx,
+                                   QDBusMessage const& message) {
+            auto f = account->provider().metadata_items(to_vector(item_ids), to_vector(keys), ctx);
+            return f.then(
+                EXEC_IN_MAIN
+                [account, message](decltype(f) f) -> QDBusMessage {
+                    return make_batch_reply(message, f.get());
+                });
+        }, item_ids.size());
+    return {};
+}
+
 ProviderInterface::IMD ProviderInterface::CreateFolder(QString const& parent_id,
                                                        QString const& name,
                                                        QList<QString> const& keys)
@@ -262,6 +438,12 @@ ProviderInterface::IMD ProviderInterface::FinishUpload(QString const& upload_id)
                 EXEC_IN_MAIN
                 [account, message, job](decltype(f) f) -> QDBusMessage {
                     auto item = f.get();
+                    auto stats = account->stats();
+                    auto it = item.metadata.find(unity::storage::metadata::SIZE_IN_BYTES);
+                    if (stats && it != item.metadata.end() && it->second.type() == typeid(int64_t))
+                    {
+                        stats->add_bytes_uploaded(boost::get<int64_t>(it->second));
+                    }
                     return message.createReply(QVariant::fromValue(item));
                 });
         });
@@ -285,6 +467,36 @@ void ProviderInterface::CancelUpload(QString const& upload_id)
         });
 }
 
+int64_t ProviderInterface::ResumeUpload(QString const& upload_id,
+                                        QList<QString> const& keys,
+                                        QDBusUnixFileDescriptor& /*file_descriptor*/)
+{
+    queue_request([upload_id, keys](shared_ptr<AccountData> const& account,
+                                    Context const& ctx,
+                                    QDBusMessage const& message) {
+            auto f = account->provider().resume_upload(upload_id.toStdString(), to_vector(keys), ctx);
+            return f.then(
+                EXEC_IN_MAIN
+                [account, message](decltype(f) f) -> QDBusMessage {
+                    auto result = f.get();
+                    auto job = std::move(get<0>(result));
+                    qlonglong committed_size = get<1>(result);
+                    job->p_->set_activity(account->inactivity_timer());
+                    QDBusUnixFileDescriptor file_desc;
+                    int fd = job->p_->take_write_socket();
+                    file_desc.setFileDescriptor(fd);
+                    close(fd);
+
+                    account->jobs().add_upload(message.service(), std::move(job));
+                    return message.createReply({
+                            QVariant(committed_size),
+                            QVariant::fromValue(file_desc),
+                        });
+                });
+        });
+    return 0;
+}
+
 QString ProviderInterface::Download(QString const& item_id, QString const& match_etag, QDBusUnixFileDescriptor& /*file_descriptor*/)
 {
     queue_request([item_id, match_etag](shared_ptr<AccountData> const& account, Context const& ctx, QDBusMessage const& message) {
@@ -311,6 +523,38 @@ QString ProviderInterface::Download(QString const& item_id, QString const& match
     return "";
 }
 
+QString ProviderInterface::DownloadRange(QString const& item_id,
+                                         QString const& match_etag,
+                                         int64_t offset,
+                                         int64_t length,
+                                         QDBusUnixFileDescriptor& /*file_descriptor*/)
+{
+    queue_request([item_id, match_etag, offset, length](shared_ptr<AccountData> const& account,
+                                                        Context const& ctx,
+                                                        QDBusMessage const& message) {
+            auto f = account->provider().download_range(
+                item_id.toStdString(), match_etag.toStdString(), offset, length, ctx);
+            return f.then(
+                EXEC_IN_MAIN
+                [account, message](decltype(f) f) -> QDBusMessage {
+                    auto job = f.get();
+                    job->p_->set_activity(account->inactivity_timer());
+                    auto download_id = QString::fromStdString(job->download_id());
+                    QDBusUnixFileDescriptor file_desc;
+                    int fd = job->p_->take_read_socket();
+                    file_desc.setFileDescriptor(fd);
+                    close(fd);
+
+                    account->jobs().add_download(message.service(), std::move(job));
+                    return message.createReply({
+                            QVariant(download_id),
+                            QVariant::fromValue(file_desc),
+                        });
+                });
+        });
+    return "";
+}
+
 void ProviderInterface::FinishDownload(QString const& download_id)
 {
     queue_request([download_id](shared_ptr<AccountData> const& account,
@@ -344,6 +588,30 @@ void ProviderInterface::Delete(QString const& item_id)
         });
 }
 
+QStringList ProviderInterface::DeleteMany(QList<QString> const& item_ids,
+                                          QStringList& /*error_messages*/,
+                                          QVariantList& /*error_details*/)
+{
+    queue_request([item_ids](shared_ptr<AccountData> const& account, Context const& ctx, QDBusMessage const& message) {
+            auto f = account->provider().delete_items(to_vector(item_ids), ctx);
+            return f.then(
+                EXEC_IN_MAIN
+                [account, message](decltype(f) f) -> QDBusMessage {
+                    BatchErrors errors;
+                    for (auto const& ep : f.get())
+                    {
+                        errors.append(ep);
+                    }
+                    return message.createReply({
+                            QVariant(errors.names),
+                            QVariant(errors.messages),
+                            QVariant(errors.details),
+                        });
+                });
+        }, item_ids.size());
+    return {};
+}
+
 ProviderInterface::IMD ProviderInterface::Move(QString const& item_id,
                                                QString const& new_parent_id,
                                                QString const& new_name,
@@ -386,6 +654,117 @@ ProviderInterface::IMD ProviderInterface::Copy(QString const& item_id,
     return {};
 }
 
+QList<ProviderInterface::IMD> ProviderInterface::MoveMany(QList<QString> const& item_ids,
+                                                          QString const& new_parent_id,
+                                                          QList<QString> const& new_names,
+                                                          QList<QString> const& keys,
+                                                          QStringList& /*error_names*/,
+                                                          QStringList& /*error_messages*/,
+                                                          QVariantList& /*error_details*/)
+{
+    queue_request([item_ids, new_parent_id, new_names, keys](shared_ptr<AccountData> const& account,
+                                                             Context const& ctx,
+                                                             QDBusMessage const& message) {
+            if (new_names.size() != item_ids.size())
+            {
+                throw InvalidArgumentException("MoveMany(): item_ids and new_names must have the same size");
+            }
+            auto f = account->provider().move_items(
+                to_vector(item_ids), new_parent_id.toStdString(),
+                to_vector(new_names), to_vector(keys), ctx);
+            return f.then(
+                EXEC_IN_MAIN
+                [account, message](decltype(f) f) -> QDBusMessage {
+                    return make_batch_reply(message, f.get());
+                });
+        }, item_ids.size());
+    return {};
+}
+
+QList<ProviderInterface::IMD> ProviderInterface::CopyMany(QList<QString> const& item_ids,
+                                                          QString const& new_parent_id,
+                                                          QList<QString> const& new_names,
+                                                          QList<QString> const& keys,
+                                                          QStringList& /*error_names*/,
+                                                          QStringList& /*error_messages*/,
+                                                          QVariantList& /*error_details*/)
+{
+    queue_request([item_ids, new_parent_id, new_names, keys](shared_ptr<AccountData> const& account,
+                                                             Context const& ctx,
+                                                             QDBusMessage const& message) {
+            if (new_names.size() != item_ids.size())
+            {
+                throw InvalidArgumentException("CopyMany(): item_ids and new_names must have the same size");
+            }
+            auto f = account->provider().copy_items(
+                to_vector(item_ids), new_parent_id.toStdString(),
+                to_vector(new_names), to_vector(keys), ctx);
+            return f.then(
+                EXEC_IN_MAIN
+                [account, message](decltype(f) f) -> QDBusMessage {
+                    return make_batch_reply(message, f.get());
+                });
+        }, item_ids.size());
+    return {};
+}
+
+QStringList ProviderInterface::Capabilities()
+{
+    queue_request([](shared_ptr<AccountData> const& account,
+                     Context const& /*ctx*/,
+                     QDBusMessage const& message) {
+            QStringList capabilities;
+            for (auto const& c : account->provider().capabilities())
+            {
+                capabilities.append(QString::fromStdString(c));
+            }
+            return boost::make_ready_future(message.createReply(QVariant(capabilities)));
+        });
+    return {};
+}
+
+QVariantMap ProviderInterface::Snapshot(bool reset)
+{
+    // Only reachable if the adaptor was created, that is, if stats are enabled.
+    auto stats = account_->stats()->snapshot(reset);
+
+    auto const sched = scheduler_.stats();
+    stats["queued"] = qlonglong(sched.queued);
+    stats["in_flight"] = qlonglong(sched.in_flight);
+    stats["clients"] = qlonglong(sched.clients);
+    stats["active_uploads"] = account_->jobs().num_uploads();
+    stats["active_downloads"] = account_->jobs().num_downloads();
+    stats["peer_cache_hits"] = qlonglong(account_->dbus_peer().hits());
+    stats["peer_cache_misses"] = qlonglong(account_->dbus_peer().misses());
+    return stats;
+}
+
+void ProviderInterface::SetPriority(QString const& priority)
+{
+    // No need to go through queue_request() here: this neither calls the provider
+    // nor reveals anything, and it must not wait behind the client's other requests.
+    static map<QString, Priority> const priorities =
+    {
+        { "interactive", Priority::interactive },
+        { "bulk",        Priority::bulk },
+        { "background",  Priority::background },
+    };
+
+    if (priority.isEmpty())
+    {
+        scheduler_.clear_client_priority(message().service());
+        return;
+    }
+    auto it = priorities.find(priority);
+    if (it == priorities.end())
+    {
+        sendErrorReply(QString(unity::storage::internal::DBUS_ERROR_PREFIX) + "InvalidArgumentException",
+                       "SetPriority(): invalid priority: \"" + priority + "\"");
+        return;
+    }
+    scheduler_.set_client_priority(message().service(), it->second, connection());
+}
+
 }
 }
 }
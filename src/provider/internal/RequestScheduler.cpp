@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/provider/internal/RequestScheduler.h>
+#include <unity/storage/internal/EnvVars.h>
+#include <unity/storage/provider/internal/Handler.h>
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+using unity::storage::internal::EnvVars;
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+namespace
+{
+
+// Credit a client receives per turn. A single request costs 1.
+int64_t const QUANTUM = 4;
+
+}  // namespace
+
+RequestScheduler::RequestScheduler(QObject* parent)
+    : QObject(parent)
+    , max_requests_(EnvVars::provider_max_requests())
+    , max_client_requests_(EnvVars::provider_max_client_requests())
+    , limits_{{max_requests_, max(1, max_requests_ * 3 / 4), max(1, max_requests_ / 4)}}
+{
+    watcher_.setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    connect(&watcher_, &QDBusServiceWatcher::serviceUnregistered,
+            this, &RequestScheduler::service_disconnected);
+}
+
+RequestScheduler::~RequestScheduler() = default;
+
+void RequestScheduler::submit(QString const& client_bus_name, Handler* handler, Priority priority, int64_t cost)
+{
+    assert(handler);
+
+    int const p = static_cast<int>(priority);
+    assert(p >= 0 && p < NUM_PRIORITIES);
+    auto& queue = clients_[client_bus_name].queues[p];
+    if (queue.empty())
+    {
+        active_[p].push_back(client_bus_name);
+    }
+    queue.push_back({handler, max<int64_t>(cost, 1), chrono::steady_clock::now()});
+    ++queued_;
+    dispatch();
+}
+
+void RequestScheduler::finished(Handler* handler)
+{
+    auto it = running_.find(handler);
+    if (it == running_.end())
+    {
+        return;  // LCOV_EXCL_LINE
+    }
+    auto const running = it->second;
+    running_.erase(it);
+    --running_by_priority_[running.priority];
+
+    auto cit = clients_.find(running.client_bus_name);
+    assert(cit != clients_.end());
+    --cit->second.in_flight;
+    erase_if_idle(running.client_bus_name);
+    dispatch();
+}
+
+void RequestScheduler::set_client_priority(QString const& client_bus_name,
+                                           Priority priority,
+                                           QDBusConnection const& bus)
+{
+    if (client_priorities_.find(client_bus_name) == client_priorities_.end())
+    {
+        // The connection is not known until the first request arrives.
+        watcher_.setConnection(bus);
+        watcher_.addWatchedService(client_bus_name);
+    }
+    client_priorities_[client_bus_name] = priority;
+}
+
+void RequestScheduler::clear_client_priority(QString const& client_bus_name)
+{
+    if (client_priorities_.erase(client_bus_name) != 0)
+    {
+        watcher_.removeWatchedService(client_bus_name);
+    }
+}
+
+Priority RequestScheduler::client_priority(QString const& client_bus_name, Priority dflt) const
+{
+    auto it = client_priorities_.find(client_bus_name);
+    if (it == client_priorities_.end())
+    {
+        return dflt;
+    }
+    // A client can only lower its priority, otherwise any client could claim
+    // the slots that are kept for interactive requests.
+    return int(it->second) > int(dflt) ? it->second : dflt;
+}
+
+RequestScheduler::Stats RequestScheduler::stats() const
+{
+    return {queued_,
+            int64_t(running_.size()),
+            int64_t(clients_.size()),
+            started_,
+            total_wait_us_,
+            max_wait_us_};
+}
+
+void RequestScheduler::service_disconnected(QString const& service_name)
+{
+    // Requests that are queued already still run; their replies go nowhere.
+    clear_client_priority(service_name);
+}
+
+void RequestScheduler::dispatch()
+{
+    for (int p = 0; p < NUM_PRIORITIES; ++p)
+    {
+        dispatch(p);
+    }
+}
+
+void RequestScheduler::dispatch(int priority)
+{
+    auto& active = active_[priority];
+
+    // Clients that are at their cap are skipped. We stop once we have
+    // gone round all clients without finding one that may run something.
+    size_t blocked = 0;
+    while (may_start(priority) && !active.empty() && blocked < active.size())
+    {
+        auto const client_bus_name = active.front();
+        active.pop_front();
+        auto& client = clients_.at(client_bus_name);
+        auto& queue = client.queues[priority];
+        auto& deficit = client.deficits[priority];
+        assert(!queue.empty());
+
+        if (client.in_flight >= max_client_requests_)
+        {
+            active.push_back(client_bus_name);
+            ++blocked;
+            continue;
+        }
+        blocked = 0;
+
+        deficit += QUANTUM;
+        while (!queue.empty()
+               && queue.front().cost <= deficit
+               && client.in_flight < max_client_requests_
+               && may_start(priority))
+        {
+            deficit -= queue.front().cost;
+            start(client, client_bus_name, priority);
+        }
+
+        if (queue.empty())
+        {
+            // Credit is not carried over once the client has nothing left to do.
+            deficit = 0;
+        }
+        else
+        {
+            active.push_back(client_bus_name);
+        }
+    }
+}
+
+bool RequestScheduler::may_start(int priority) const
+{
+    if (int(running_.size()) >= max_requests_)
+    {
+        return false;
+    }
+    int running = 0;
+    for (int p = priority; p < NUM_PRIORITIES; ++p)
+    {
+        running += running_by_priority_[p];
+    }
+    return running < limits_[priority];
+}
+
+void RequestScheduler::start(Client& client, QString const& client_bus_name, int priority)
+{
+    auto& queue = client.queues[priority];
+    auto const request = queue.front();
+    queue.pop_front();
+    --queued_;
+
+    auto const wait_us = chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now() - request.queued_at).count();
+    total_wait_us_ += wait_us;
+    max_wait_us_ = max<int64_t>(max_wait_us_, wait_us);
+    ++started_;
+
+    ++client.in_flight;
+    ++running_by_priority_[priority];
+    running_.emplace(request.handler, Running{client_bus_name, priority});
+    request.handler->begin();
+}
+
+void RequestScheduler::erase_if_idle(QString const& client_bus_name)
+{
+    auto it = clients_.find(client_bus_name);
+    if (it == clients_.end() || it->second.in_flight != 0)
+    {
+        return;
+    }
+    for (auto const& queue : it->second.queues)
+    {
+        if (!queue.empty())
+        {
+            return;
+        }
+    }
+    clients_.erase(it);
+}
+
+}
+}
+}
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/provider/internal/RequestStats.h>
+#include <unity/storage/internal/dbus_error.h>
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+namespace
+{
+
+// The methods of the Provider interface that go through queue_request().
+char const* const METHODS[] =
+{
+    "Roots", "List", "Search", "Lookup", "Metadata", "MetadataMany", "CreateFolder",
+    "CreateFile", "Update", "FinishUpload", "CancelUpload", "ResumeUpload",
+    "Download", "DownloadRange", "FinishDownload", "Delete", "DeleteMany",
+    "Move", "Copy", "MoveMany", "CopyMany", "Capabilities",
+};
+
+// The types of StorageException. Anything else is counted as "Other".
+char const* const ERRORS[] =
+{
+    "RemoteCommsException", "NotExistsException", "ExistsException", "ConflictException",
+    "UnauthorizedException", "PermissionException", "QuotaException", "CancelledException",
+    "LogicException", "InvalidArgumentException", "ResourceException", "UnknownException",
+    "Other",
+};
+constexpr int NUM_ERRORS = sizeof(ERRORS) / sizeof(ERRORS[0]);
+
+int64_t take(atomic<int64_t>& counter, bool reset) noexcept
+{
+    return reset ? counter.exchange(0, memory_order_relaxed) : counter.load(memory_order_relaxed);
+}
+
+}  // namespace
+
+struct RequestStats::MethodCounters
+{
+    atomic<int64_t> calls {0};
+    atomic<int64_t> total_latency_us {0};
+    atomic<int64_t> total_wait_us {0};
+    atomic<int64_t> max_wait_us {0};
+    array<atomic<int64_t>, NUM_BUCKETS> latency;
+    array<atomic<int64_t>, NUM_ERRORS> errors;
+
+    MethodCounters()
+    {
+        for (auto& b : latency)
+        {
+            b.store(0, memory_order_relaxed);
+        }
+        for (auto& e : errors)
+        {
+            e.store(0, memory_order_relaxed);
+        }
+    }
+};
+
+RequestStats::RequestStats()
+    : bytes_uploaded_(0)
+{
+    for (auto m : METHODS)
+    {
+        methods_.emplace(m, unique_ptr<MethodCounters>(new MethodCounters));
+    }
+}
+
+RequestStats::~RequestStats() = default;
+
+void RequestStats::record(QString const& method, QString const& error_name, int64_t latency_us, int64_t wait_us) noexcept
+{
+    auto it = methods_.find(method);
+    if (it == methods_.end())
+    {
+        return;
+    }
+    auto& m = *it->second;
+
+    m.calls.fetch_add(1, memory_order_relaxed);
+    m.total_latency_us.fetch_add(latency_us, memory_order_relaxed);
+    m.total_wait_us.fetch_add(wait_us, memory_order_relaxed);
+    auto max_wait = m.max_wait_us.load(memory_order_relaxed);
+    while (wait_us > max_wait && !m.max_wait_us.compare_exchange_weak(max_wait, wait_us, memory_order_relaxed))
+    {
+    }
+    m.latency[bucket(latency_us)].fetch_add(1, memory_order_relaxed);
+
+    if (!error_name.isEmpty())
+    {
+        QString const prefix = unity::storage::internal::DBUS_ERROR_PREFIX;
+        auto const type = error_name.startsWith(prefix) ? error_name.mid(prefix.size()) : QString();
+        int e = 0;
+        while (e < NUM_ERRORS - 1 && type != ERRORS[e])
+        {
+            ++e;
+        }
+        m.errors[e].fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void RequestStats::add_bytes_uploaded(int64_t bytes) noexcept
+{
+    bytes_uploaded_.fetch_add(bytes, memory_order_relaxed);
+}
+
+QVariantMap RequestStats::snapshot(bool reset)
+{
+    QVariantMap methods;
+    for (auto const& pair : methods_)
+    {
+        auto& m = *pair.second;
+
+        // The histogram is read first, so calls is never less than the
+        // number of latencies, even if requests finish meanwhile.
+        array<int64_t, NUM_BUCKETS> latency;
+        int64_t counted = 0;
+        for (int b = 0; b < NUM_BUCKETS; ++b)
+        {
+            latency[b] = take(m.latency[b], reset);
+            counted += latency[b];
+        }
+        auto const calls = take(m.calls, reset);
+        if (calls == 0)
+        {
+            continue;
+        }
+
+        QVariantMap errors;
+        int64_t total_errors = 0;
+        for (int e = 0; e < NUM_ERRORS; ++e)
+        {
+            auto const n = take(m.errors[e], reset);
+            if (n != 0)
+            {
+                errors[ERRORS[e]] = qlonglong(n);
+                total_errors += n;
+            }
+        }
+
+        QVariantMap entry;
+        entry["calls"] = qlonglong(calls);
+        entry["errors"] = qlonglong(total_errors);
+        entry["errors_by_type"] = errors;
+        entry["total_latency_us"] = qlonglong(take(m.total_latency_us, reset));
+        entry["total_wait_us"] = qlonglong(take(m.total_wait_us, reset));
+        entry["max_wait_us"] = qlonglong(take(m.max_wait_us, reset));
+
+        for (auto const& p : { make_pair("latency_p50_us", 50), make_pair("latency_p95_us", 95), make_pair("latency_p99_us", 99) })
+        {
+            // Smallest bucket that covers the percentile.
+            int64_t const rank = (counted * p.second + 99) / 100;
+            int64_t seen = 0;
+            int b = 0;
+            while (b < NUM_BUCKETS - 1 && seen + latency[b] < rank)
+            {
+                seen += latency[b];
+                ++b;
+            }
+            entry[p.first] = qlonglong(bucket_limit(b));
+        }
+        methods[pair.first] = entry;
+    }
+
+    QVariantMap stats;
+    stats["methods"] = methods;
+    stats["bytes_uploaded"] = qlonglong(take(bytes_uploaded_, reset));
+    return stats;
+}
+
+// Buckets 0 to 3 hold 0 to 3 us. After that, each power of two is split into four buckets.
+
+int RequestStats::bucket(int64_t us) noexcept
+{
+    if (us < 4)
+    {
+        return int(max<int64_t>(us, 0));
+    }
+    int const msb = 63 - __builtin_clzll(static_cast<unsigned long long>(us));
+    int const sub = int((us >> (msb - 2)) & 3);
+    return min((msb - 1) * 4 + sub, NUM_BUCKETS - 1);
+}
+
+// Returns the largest value that goes into bucket b.
+
+int64_t RequestStats::bucket_limit(int b) noexcept
+{
+    if (b < 4)
+    {
+        return b;
+    }
+    int const msb = b / 4 + 1;
+    int const sub = b % 4;
+    return ((int64_t(4 + sub) << (msb - 2)) + (int64_t(1) << (msb - 2))) - 1;
+}
+
+}
+}
+}
+}
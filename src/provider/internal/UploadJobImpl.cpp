@@ -158,6 +158,16 @@ boost::future<void> UploadJobImpl::cancel(UploadJob& job)
     return job.cancel();
 }
 
+boost::future<void> UploadJobImpl::suspend(UploadJob& job)
+{
+    lock_guard<mutex> guard(completion_lock_);
+    if (completed_)
+    {
+        return boost::make_ready_future();
+    }
+    return job.suspend();
+}
+
 }
 }
 }
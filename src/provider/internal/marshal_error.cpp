@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include <unity/storage/provider/internal/marshal_error.h>
+
+#include <unity/storage/internal/dbus_error.h>
+#include <unity/storage/provider/Exceptions.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wctor-dtor-privacy"
+#pragma GCC diagnostic ignored "-Wswitch-default"
+#include <QDebug>
+#pragma GCC diagnostic pop
+
+using namespace unity::storage::internal;
+using namespace std;
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+DBusError marshal_error(exception_ptr const& ep)
+{
+    DBusError error;
+    try
+    {
+        rethrow_exception(ep);
+    }
+    catch (StorageException const& e)
+    {
+        error.name = QString(DBUS_ERROR_PREFIX) + QString::fromStdString(e.type());
+        error.message = QString::fromStdString(e.error_message());
+        try
+        {
+            throw;
+        }
+        catch (NotExistsException const& e)
+        {
+            error.args.append(QString::fromStdString(e.key()));
+        }
+        catch (ExistsException const& e)
+        {
+            error.args.append(QString::fromStdString(e.native_identity()));
+            error.args.append(QString::fromStdString(e.name()));
+        }
+        catch (ResourceException const& e)
+        {
+            qDebug() << e.what();
+            error.args.append(e.error_code());
+        }
+        catch (RemoteCommsException const& e)
+        {
+            qDebug() << e.what();
+        }
+        catch (UnknownException const& e)
+        {
+            qDebug() << e.what();
+        }
+        catch (StorageException const&)
+        {
+            // Some other sub-type of StorageException without additional data members,
+            // and we don't want to log this (not surprising) exception.
+        }
+    }
+    catch (std::exception const& e)
+    {
+        error.name = QString(DBUS_ERROR_PREFIX) + "UnknownException";
+        error.message = QString("unknown exception thrown by provider: ") + e.what();
+        qDebug() << error.message;
+    }
+    catch (...)
+    {
+        error.name = QString(DBUS_ERROR_PREFIX) + "UnknownException";
+        error.message = "unknown exception thrown by provider";
+        qDebug() << error.message;
+    }
+    return error;
+}
+
+}
+}
+}
+}
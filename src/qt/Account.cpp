@@ -113,6 +113,31 @@ ItemJob* Account::get(QString const& itemId, QStringList const& keys) const
     return p_->get(itemId, keys);
 }
 
+ItemListJob* Account::getItems(QStringList const& itemIds, QStringList const& keys) const
+{
+    return p_->getItems(itemIds, keys);
+}
+
+VoidJob* Account::deleteItems(QList<Item> const& items) const
+{
+    return p_->deleteItems(items);
+}
+
+ItemListJob* Account::moveItems(QList<Item> const& items, Item const& newParent, QStringList const& keys) const
+{
+    return p_->moveItems(items, newParent, keys);
+}
+
+ItemListJob* Account::copyItems(QList<Item> const& items, Item const& newParent, QStringList const& keys) const
+{
+    return p_->copyItems(items, newParent, keys);
+}
+
+CapabilitiesJob* Account::capabilities() const
+{
+    return p_->capabilities();
+}
+
 bool Account::operator==(Account const& other) const
 {
     return p_->operator==(*other.p_);
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/qt/CapabilitiesJob.h>
+
+#include <unity/storage/qt/internal/CapabilitiesJobImpl.h>
+
+using namespace unity::storage::qt;
+using namespace std;
+
+namespace unity
+{
+namespace storage
+{
+namespace qt
+{
+
+CapabilitiesJob::CapabilitiesJob(unique_ptr<internal::CapabilitiesJobImpl> p)
+    : p_(move(p))
+{
+}
+
+CapabilitiesJob::~CapabilitiesJob() = default;
+
+bool CapabilitiesJob::isValid() const
+{
+    return p_->isValid();
+}
+
+CapabilitiesJob::Status CapabilitiesJob::status() const
+{
+    return p_->status();
+}
+
+StorageError CapabilitiesJob::error() const
+{
+    return p_->error();
+}
+
+QStringList CapabilitiesJob::capabilities() const
+{
+    return p_->capabilities();
+}
+
+}  // namespace qt
+}  // namespace storage
+}  // namespace unity
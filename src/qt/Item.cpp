@@ -149,7 +149,12 @@ Uploader* Item::createUploader(ConflictPolicy policy, qint64 sizeInBytes, QStrin
 
 Downloader* Item::createDownloader(ConflictPolicy policy) const
 {
-    return p_->createDownloader(policy);
+    return p_->createDownloader(policy, 0, -1);
+}
+
+Downloader* Item::createDownloader(ConflictPolicy policy, qint64 offset, qint64 length) const
+{
+    return p_->createDownloader(policy, offset, length);
 }
 
 ItemListJob* Item::list(QStringList const& keys) const
@@ -162,6 +167,11 @@ ItemListJob* Item::lookup(QString const& name, QStringList const& keys) const
     return p_->lookup(name, keys);
 }
 
+ItemListJob* Item::search(QString const& pattern, QStringList const& keys) const
+{
+    return p_->search(pattern, keys);
+}
+
 ItemJob* Item::createFolder(QString const& name, QStringList const& keys) const
 {
     return p_->createFolder(name, keys);
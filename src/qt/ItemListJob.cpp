@@ -19,7 +19,6 @@
 #include <unity/storage/qt/ItemListJob.h>
 
 #include <unity/storage/qt/internal/ItemListJobImpl.h>
-#include <unity/storage/qt/internal/MultiItemJobImpl.h>
 
 using namespace unity::storage::qt;
 using namespace std;
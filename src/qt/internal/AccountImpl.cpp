@@ -20,11 +20,14 @@
 
 #include "ProviderInterface.h"
 #include <unity/storage/qt/Account.h>
+#include <unity/storage/qt/internal/CapabilitiesJobImpl.h>
 #include <unity/storage/qt/internal/ItemImpl.h>
 #include <unity/storage/qt/internal/ItemJobImpl.h>
 #include <unity/storage/qt/internal/ItemListJobImpl.h>
+#include <unity/storage/qt/internal/MultiItemJobImpl.h>
 #include <unity/storage/qt/internal/RuntimeImpl.h>
 #include <unity/storage/qt/internal/StorageErrorImpl.h>
+#include <unity/storage/qt/internal/VoidJobImpl.h>
 #include <unity/storage/qt/Runtime.h>
 
 #include <boost/functional/hash.hpp>
@@ -140,6 +143,156 @@ ItemJob* AccountImpl::get(QString const& itemId, QStringList const& keys) const
     return ItemJobImpl::make_job(This, method, reply, validate);
 }
 
+ItemListJob* AccountImpl::getItems(QStringList const& itemIds, QStringList const& keys) const
+{
+    QString const method = "Account::getItems()";
+
+    auto e = check_batch_precondition(method, {});
+    if (e.type() != StorageError::NoError)
+    {
+        return ItemListJobImpl::make_job(e);
+    }
+
+    auto validate = [](storage::internal::ItemMetadata const&)
+    {
+    };
+
+    auto This = const_pointer_cast<AccountImpl>(shared_from_this());
+    return MultiItemJobImpl::make_job(This, method, itemIds, keys, validate);
+}
+
+VoidJob* AccountImpl::deleteItems(QList<Item> const& items) const
+{
+    QString const method = "Account::deleteItems()";
+
+    auto e = check_batch_precondition(method, items);
+    if (e.type() != StorageError::NoError)
+    {
+        return VoidJobImpl::make_job(e);
+    }
+    QStringList ids;
+    for (auto const& item : items)
+    {
+        if (item.type() == Item::Type::Root)
+        {
+            e = StorageErrorImpl::logic_error(method + ": cannot delete root");
+            return VoidJobImpl::make_job(e);
+        }
+        ids.append(item.itemId());
+    }
+
+    auto reply = provider_->DeleteMany(ids);
+    auto This = const_pointer_cast<AccountImpl>(shared_from_this());
+    return VoidJobImpl::make_job(This, method, reply);
+}
+
+ItemListJob* AccountImpl::moveItems(QList<Item> const& items, Item const& newParent, QStringList const& keys) const
+{
+    return move_or_copy_items("Account::moveItems()", items, newParent, keys, false);
+}
+
+ItemListJob* AccountImpl::copyItems(QList<Item> const& items, Item const& newParent, QStringList const& keys) const
+{
+    return move_or_copy_items("Account::copyItems()", items, newParent, keys, true);
+}
+
+CapabilitiesJob* AccountImpl::capabilities() const
+{
+    QString const method = "Account::capabilities()";
+
+    if (!is_valid_)
+    {
+        auto e = StorageErrorImpl::logic_error(method + ": cannot create job from invalid account");
+        return CapabilitiesJobImpl::make_job(e);
+    }
+    auto runtime = runtime_impl_.lock();
+    if (!runtime || !runtime->isValid())
+    {
+        auto e = StorageErrorImpl::runtime_destroyed_error(method + ": Runtime was destroyed previously");
+        return CapabilitiesJobImpl::make_job(e);
+    }
+
+    auto reply = provider_->Capabilities();
+    auto This = const_pointer_cast<AccountImpl>(shared_from_this());
+    return CapabilitiesJobImpl::make_job(This, method, reply);
+}
+
+StorageError AccountImpl::check_batch_precondition(QString const& method, QList<Item> const& items) const
+{
+    if (!is_valid_)
+    {
+        return StorageErrorImpl::logic_error(method + ": cannot create job from invalid account");
+    }
+    auto runtime = runtime_impl_.lock();
+    if (!runtime || !runtime->isValid())
+    {
+        return StorageErrorImpl::runtime_destroyed_error(method + ": Runtime was destroyed previously");
+    }
+    for (auto const& item : items)
+    {
+        if (!item.isValid())
+        {
+            return StorageErrorImpl::invalid_argument_error(method + ": invalid item");
+        }
+        if (*item.account().p_ != *this)
+        {
+            return StorageErrorImpl::logic_error(method + ": items must belong to this account");
+        }
+    }
+    return StorageError();
+}
+
+ItemListJob* AccountImpl::move_or_copy_items(QString const& method,
+                                             QList<Item> const& items,
+                                             Item const& newParent,
+                                             QStringList const& keys,
+                                             bool copy) const
+{
+    auto e = check_batch_precondition(method, items);
+    if (e.type() != StorageError::NoError)
+    {
+        return ItemListJobImpl::make_job(e);
+    }
+    if (!newParent.isValid())
+    {
+        e = StorageErrorImpl::invalid_argument_error(method + ": newParent is invalid");
+        return ItemListJobImpl::make_job(e);
+    }
+    if (*newParent.account().p_ != *this)
+    {
+        e = StorageErrorImpl::logic_error(method + ": newParent must belong to this account");
+        return ItemListJobImpl::make_job(e);
+    }
+    if (newParent.type() == Item::Type::File)
+    {
+        e = StorageErrorImpl::logic_error(method + ": newParent cannot be a file");
+        return ItemListJobImpl::make_job(e);
+    }
+
+    QStringList ids;
+    QStringList names;
+    for (auto const& item : items)
+    {
+        ids.append(item.itemId());
+        names.append(item.name());
+    }
+
+    auto validate = [method](storage::internal::ItemMetadata const& md)
+    {
+        if (md.type == ItemType::root)
+        {
+            QString msg = method + ": impossible root item returned by provider (id = " + md.item_id + ")";
+            qCritical().noquote() << msg;
+            throw StorageErrorImpl::local_comms_error(msg);
+        }
+    };
+
+    auto reply = copy ? provider_->CopyMany(ids, newParent.itemId(), names, keys)
+                      : provider_->MoveMany(ids, newParent.itemId(), names, keys);
+    auto This = const_pointer_cast<AccountImpl>(shared_from_this());
+    return ItemListJobImpl::make_job(This, method, reply, validate);
+}
+
 bool AccountImpl::operator==(AccountImpl const& other) const
 {
     if (is_valid_)
@@ -192,6 +345,16 @@ shared_ptr<ProviderInterface> AccountImpl::provider() const
     return provider_;
 }
 
+bool AccountImpl::supports_metadata_many() const
+{
+    return supports_metadata_many_;
+}
+
+void AccountImpl::set_supports_metadata_many(bool supported)
+{
+    supports_metadata_many_ = supported;
+}
+
 size_t AccountImpl::hash() const
 {
     if (!is_valid_)
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/qt/internal/CapabilitiesJobImpl.h>
+
+#include <unity/storage/qt/internal/AccountImpl.h>
+#include <unity/storage/qt/internal/HandlerBase.h>
+#include <unity/storage/qt/internal/RuntimeImpl.h>
+#include <unity/storage/qt/internal/StorageErrorImpl.h>
+#include <unity/storage/qt/internal/unmarshal_error.h>
+
+#include <QDBusError>
+
+#include <cassert>
+
+using namespace std;
+
+namespace unity
+{
+namespace storage
+{
+namespace qt
+{
+namespace internal
+{
+
+CapabilitiesJobImpl::CapabilitiesJobImpl(shared_ptr<AccountImpl> const& account_impl,
+                                         QString const& method,
+                                         QDBusPendingReply<QStringList>& reply)
+    : status_(CapabilitiesJob::Status::Loading)
+    , method_(method)
+    , account_impl_(account_impl)
+{
+    assert(!method_.isEmpty());
+    assert(account_impl);
+
+    auto process_reply = [this](QDBusPendingCallWatcher& call)
+    {
+        auto runtime = account_impl_->runtime_impl();
+        if (!runtime || !runtime->isValid())
+        {
+            error_ = StorageErrorImpl::runtime_destroyed_error(method_ + ": Runtime was destroyed previously");
+            status_ = CapabilitiesJob::Status::Error;
+            Q_EMIT public_instance_->statusChanged(status_);
+            return;
+        }
+
+        if (call.isError())
+        {
+            if (call.error().type() == QDBusError::UnknownMethod)
+            {
+                // The provider predates Capabilities, so it has none of the optional features.
+                status_ = CapabilitiesJob::Status::Finished;
+                Q_EMIT public_instance_->statusChanged(status_);
+                return;
+            }
+            error_ = unmarshal_error(call);
+            status_ = CapabilitiesJob::Status::Error;
+            Q_EMIT public_instance_->statusChanged(status_);
+            return;
+        }
+
+        QDBusPendingReply<QStringList> r = call;
+        capabilities_ = r.value();
+        status_ = CapabilitiesJob::Status::Finished;
+        Q_EMIT public_instance_->statusChanged(status_);
+    };
+
+    new HandlerBase(this, reply, process_reply);
+}
+
+CapabilitiesJobImpl::CapabilitiesJobImpl(StorageError const& error)
+    : status_(CapabilitiesJob::Status::Error)
+    , error_(error)
+{
+}
+
+bool CapabilitiesJobImpl::isValid() const
+{
+    return status_ != CapabilitiesJob::Status::Error;
+}
+
+CapabilitiesJob::Status CapabilitiesJobImpl::status() const
+{
+    return status_;
+}
+
+StorageError CapabilitiesJobImpl::error() const
+{
+    return error_;
+}
+
+QStringList CapabilitiesJobImpl::capabilities() const
+{
+    return capabilities_;
+}
+
+CapabilitiesJob* CapabilitiesJobImpl::make_job(shared_ptr<AccountImpl> const& account_impl,
+                                               QString const& method,
+                                               QDBusPendingReply<QStringList>& reply)
+{
+    unique_ptr<CapabilitiesJobImpl> impl(new CapabilitiesJobImpl(account_impl, method, reply));
+    auto job = new CapabilitiesJob(move(impl));
+    job->p_->public_instance_ = job;
+    return job;
+}
+
+CapabilitiesJob* CapabilitiesJobImpl::make_job(StorageError const& error)
+{
+    unique_ptr<CapabilitiesJobImpl> impl(new CapabilitiesJobImpl(error));
+    auto job = new CapabilitiesJob(move(impl));
+    job->p_->public_instance_ = job;
+    QMetaObject::invokeMethod(job,
+                              "statusChanged",
+                              Qt::QueuedConnection,
+                              Q_ARG(unity::storage::qt::CapabilitiesJob::Status, job->p_->status_));
+    return job;
+}
+
+}  // namespace internal
+}  // namespace qt
+}  // namespace storage
+}  // namespace unity
@@ -142,13 +142,6 @@ ItemListJob* ItemImpl::parents(QStringList const& keys) const
 
     assert(!md_.parent_ids.isEmpty());
 
-    QList<QDBusPendingReply<storage::internal::ItemMetadata>> replies;
-    for (auto const& id : md_.parent_ids)
-    {
-        auto reply = account_impl_->provider()->Metadata(id, keys);
-        replies.append(reply);
-    }
-
     auto validate = [method](storage::internal::ItemMetadata const& md)
     {
         if (md.type == ItemType::file)
@@ -159,7 +152,7 @@ ItemListJob* ItemImpl::parents(QStringList const& keys) const
         }
     };
 
-    return MultiItemJobImpl::make_job(account_impl_, method, replies, validate);
+    return MultiItemJobImpl::make_job(account_impl_, method, md_.parent_ids, keys, validate);
 }
 
 ItemJob* ItemImpl::copy(Item const& newParent, QString const& newName, QStringList const& keys) const
@@ -280,7 +273,7 @@ Uploader* ItemImpl::createUploader(Item::ConflictPolicy policy, qint64 sizeInByt
     return UploaderImpl::make_job(This, method, reply, validate, policy, sizeInBytes);
 }
 
-Downloader* ItemImpl::createDownloader(Item::ConflictPolicy policy) const
+Downloader* ItemImpl::createDownloader(Item::ConflictPolicy policy, qint64 offset, qint64 length) const
 {
     QString const method = "Item::createDownloader()";
 
@@ -294,9 +287,17 @@ Downloader* ItemImpl::createDownloader(Item::ConflictPolicy policy) const
         auto e = StorageErrorImpl::logic_error(method + ": cannot download a folder");
         return DownloaderImpl::make_job(e);
     }
+    if (offset < 0)
+    {
+        auto e = StorageErrorImpl::invalid_argument_error(method + ": offset must be >= 0");
+        return DownloaderImpl::make_job(e);
+    }
 
     auto etag = policy == Item::ConflictPolicy::IgnoreConflict ? "" : md_.etag;
-    auto reply = account_impl_->provider()->Download(md_.item_id, etag);
+    // We use plain Download for whole files, so this works with providers that don't support ranges.
+    auto reply = offset == 0 && length < 0
+                     ? account_impl_->provider()->Download(md_.item_id, etag)
+                     : account_impl_->provider()->DownloadRange(md_.item_id, etag, offset, length);
     auto This = const_pointer_cast<ItemImpl>(shared_from_this());
     return DownloaderImpl::make_job(This, method, reply);
 }
@@ -336,6 +337,46 @@ ItemListJob* ItemImpl::list(QStringList const& keys) const
     return MultiItemListJobImpl::make_job(This, method, reply, validate, fetch_next);
 }
 
+ItemListJob* ItemImpl::search(QString const& pattern, QStringList const& keys) const
+{
+    QString const method = "Item::search()";
+
+    auto invalid_job = check_invalid_or_destroyed<MultiItemListJobImpl>(method);
+    if (invalid_job)
+    {
+        return invalid_job;
+    }
+    if (md_.type == storage::ItemType::file)
+    {
+        auto e = StorageErrorImpl::logic_error(method + ": cannot perform search on a file");
+        return ItemListJobImpl::make_job(e);
+    }
+    if (pattern.isEmpty())
+    {
+        auto e = StorageErrorImpl::invalid_argument_error(method + ": pattern cannot be empty");
+        return ItemListJobImpl::make_job(e);
+    }
+
+    auto validate = [method](storage::internal::ItemMetadata const& md)
+    {
+        if (md.type == storage::ItemType::root)
+        {
+            QString msg = method + ": impossible root item returned by provider (id = " + md.item_id + ")";
+            qCritical().noquote() << msg;
+            throw StorageErrorImpl::local_comms_error(msg);
+        }
+    };
+
+    auto fetch_next = [this, pattern, keys](QString const& page_token)
+    {
+        return account_impl_->provider()->Search(md_.item_id, pattern, page_token, keys);
+    };
+
+    auto reply = account_impl_->provider()->Search(md_.item_id, pattern, "", keys);
+    auto This = const_pointer_cast<ItemImpl>(shared_from_this());
+    return MultiItemListJobImpl::make_job(This, method, reply, validate, fetch_next);
+}
+
 ItemListJob* ItemImpl::lookup(QString const& name, QStringList const& keys) const
 {
     QString const method = "Item::lookup()";
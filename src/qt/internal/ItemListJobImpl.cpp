@@ -52,22 +52,7 @@ ItemListJobImpl::ItemListJobImpl(shared_ptr<AccountImpl> const& account_impl,
             return;
         }
 
-        QList<Item> items;
-        auto metadata = r.value();
-        for (auto const& md : metadata)
-        {
-            try
-            {
-                validate_(md);
-                auto item = ItemImpl::make_item(method_, md, account_impl_);
-                items.append(item);
-            }
-            catch (StorageError const& e)
-            {
-                // Bad metadata received from provider, validate_() or make_item() have logged it.
-                error_ = e;
-            }
-        }
+        auto items = make_items(r.value());
         status_ = error_.type() == StorageError::NoError ? ItemListJob::Finished : ItemListJob::Error;
         Q_EMIT public_instance_->itemsReady(items);
         Q_EMIT public_instance_->statusChanged(status_);
@@ -84,6 +69,68 @@ ItemListJobImpl::ItemListJobImpl(shared_ptr<AccountImpl> const& account_impl,
     new Handler<QList<storage::internal::ItemMetadata>>(this, reply, process_reply, process_error);
 }
 
+// For MoveMany and CopyMany: the items that succeeded are reported, and the job
+// fails with the error for the first item that did not.
+
+ItemListJobImpl::ItemListJobImpl(shared_ptr<AccountImpl> const& account_impl,
+                                 QString const& method,
+                                 QDBusPendingReply<QList<storage::internal::ItemMetadata>, QStringList, QStringList, QVariantList>& reply,
+                                 std::function<void(storage::internal::ItemMetadata const&)> const& validate)
+    : ListJobImplBase(account_impl, method, validate)
+{
+    auto process_reply = [this](decltype(reply)& r)
+    {
+        auto runtime = account_impl_->runtime_impl();
+        if (!runtime || !runtime->isValid())
+        {
+            error_ = StorageErrorImpl::runtime_destroyed_error(method_ + ": Runtime was destroyed previously");
+            status_ = ItemListJob::Status::Error;
+            Q_EMIT public_instance_->statusChanged(status_);
+            return;
+        }
+
+        auto items = make_items(r.argumentAt<0>());
+        auto error = unmarshal_error(r.argumentAt<1>(), r.argumentAt<2>(), r.argumentAt<3>());
+        if (error.type() != StorageError::NoError)
+        {
+            error_ = error;
+        }
+        status_ = error_.type() == StorageError::NoError ? ItemListJob::Finished : ItemListJob::Error;
+        Q_EMIT public_instance_->itemsReady(items);
+        Q_EMIT public_instance_->statusChanged(status_);
+    };
+
+    auto process_error = [this](StorageError const& error)
+    {
+        error_ = error;
+        status_ = ItemListJob::Status::Error;
+        Q_EMIT public_instance_->statusChanged(status_);
+    };
+
+    new Handler<QDBusPendingReply<QList<storage::internal::ItemMetadata>, QStringList, QStringList, QVariantList>>(
+            this, reply, process_reply, process_error);
+}
+
+QList<Item> ItemListJobImpl::make_items(QList<storage::internal::ItemMetadata> const& metadata)
+{
+    QList<Item> items;
+    for (auto const& md : metadata)
+    {
+        try
+        {
+            validate_(md);
+            auto item = ItemImpl::make_item(method_, md, account_impl_);
+            items.append(item);
+        }
+        catch (StorageError const& e)
+        {
+            // Bad metadata received from provider, validate_() or make_item() have logged it.
+            error_ = e;
+        }
+    }
+    return items;
+}
+
 ItemListJobImpl::ItemListJobImpl(shared_ptr<ItemImpl> const& item_impl,
                                  QString const& method,
                                  QDBusPendingReply<QList<storage::internal::ItemMetadata>>& reply,
@@ -115,6 +162,17 @@ ItemListJob* ItemListJobImpl::make_job(shared_ptr<ItemImpl> const& item_impl,
     return job;
 }
 
+ItemListJob* ItemListJobImpl::make_job(shared_ptr<AccountImpl> const& account_impl,
+                                       QString const& method,
+                                       QDBusPendingReply<QList<storage::internal::ItemMetadata>, QStringList, QStringList, QVariantList>& reply,
+                                       std::function<void(storage::internal::ItemMetadata const&)> const& validate)
+{
+    unique_ptr<ItemListJobImpl> impl(new ItemListJobImpl(account_impl, method, reply, validate));
+    auto job = new ItemListJob(move(impl));
+    job->p_->set_public_instance(job);
+    return job;
+}
+
 ItemListJob* ItemListJobImpl::make_job(StorageError const& error)
 {
     return ListJobImplBase::make_job(error);
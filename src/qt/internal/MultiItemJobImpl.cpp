@@ -18,12 +18,15 @@
 
 #include <unity/storage/qt/internal/MultiItemJobImpl.h>
 
+#include "ProviderInterface.h"
 #include <unity/storage/internal/dbusmarshal.h>
 #include <unity/storage/qt/internal/AccountImpl.h>
 #include <unity/storage/qt/internal/Handler.h>
 #include <unity/storage/qt/internal/ItemImpl.h>
 #include <unity/storage/qt/internal/RuntimeImpl.h>
 
+#include <QDBusError>
+
 using namespace std;
 
 namespace unity
@@ -37,91 +40,145 @@ namespace internal
 
 MultiItemJobImpl::MultiItemJobImpl(shared_ptr<AccountImpl> const& account_impl,
                                    QString const& method,
-                                   ReplyType& replies,
+                                   QStringList const& item_ids,
+                                   QStringList const& keys,
                                    ValidateFunc const& validate)
     : ListJobImplBase(account_impl, method, validate)
-    , replies_remaining_(replies.size())
+    , item_ids_(item_ids)
+    , keys_(keys)
 {
-    assert(!method.isEmpty());
-    assert(account_impl);
-    assert(validate);
-
-    // We ask the provider for the metadata for each of this item's parents.
-    // As the replies trickle in, we track when the last reply has arrived and
-    // signal that the job is complete.
-    // If anything goes wrong at all, we report the first error and then ignore all
-    // other replies.
+    assert(!item_ids.isEmpty());
 
-    auto process_reply = [this](QDBusPendingReply<storage::internal::ItemMetadata>& r)
+    if (account_impl_->supports_metadata_many())
     {
-        if (status_ != ItemListJob::Status::Loading)
-        {
-            return;
-        }
+        get_all();
+    }
+    else
+    {
+        get_each();
+    }
+}
 
-        --replies_remaining_;
+void MultiItemJobImpl::get_all()
+{
+    auto reply = account_impl_->provider()->MetadataMany(item_ids_, keys_);
 
-        auto runtime = account_impl_->runtime_impl();
-        if (!runtime || !runtime->isValid())
+    auto process_reply = [this](QDBusPendingCallWatcher& call)
+    {
+        if (call.isError())
         {
-            error_ = StorageErrorImpl::runtime_destroyed_error(method_ + ": Runtime was destroyed previously");
+            if (call.error().type() == QDBusError::UnknownMethod)
+            {
+                // The provider predates MetadataMany.
+                account_impl_->set_supports_metadata_many(false);
+                get_each();
+                return;
+            }
+            error_ = unmarshal_error(call);
             status_ = ItemListJob::Status::Error;
             Q_EMIT public_instance_->statusChanged(status_);
             return;
         }
+        QDBusPendingReply<QList<storage::internal::ItemMetadata>, QStringList, QStringList, QVariantList> r = call;
+        finish(r.argumentAt<0>(), unmarshal_error(r.argumentAt<1>(), r.argumentAt<2>(), r.argumentAt<3>()));
+    };
 
-        auto metadata = r.value();
-        Item item;
-        try
+    new HandlerBase(this, reply, process_reply);
+}
+
+void MultiItemJobImpl::get_each()
+{
+    replies_remaining_ = item_ids_.size();
+    metadata_.resize(item_ids_.size());
+    errors_.resize(item_ids_.size());
+    for (int i = 0; i < item_ids_.size(); ++i)
+    {
+        auto reply = account_impl_->provider()->Metadata(item_ids_[i], keys_);
+
+        auto process_reply = [this, i](decltype(reply)& r)
         {
-            validate_(metadata);
-            item = ItemImpl::make_item(method_, metadata, account_impl_);
-        }
-        catch (StorageError const& e)
+            metadata_[i] = r.value();
+            item_done();
+        };
+
+        auto process_error = [this, i](StorageError const& error)
         {
-            // Bad metadata received from provider, validate_() or make_item() have logged it.
-            status_ = ItemListJob::Status::Error;
-            error_ = e;
-            Q_EMIT public_instance_->statusChanged(status_);
-            return;
-        }
-        QList<Item> items;
-        items.append(item);
-        if (replies_remaining_ == 0)
+            errors_[i] = error;
+            item_done();
+        };
+
+        new Handler<storage::internal::ItemMetadata>(this, reply, process_reply, process_error);
+    }
+}
+
+void MultiItemJobImpl::item_done()
+{
+    if (--replies_remaining_ != 0)
+    {
+        return;
+    }
+
+    QList<storage::internal::ItemMetadata> metadata;
+    StorageError first_error;
+    for (int i = 0; i < item_ids_.size(); ++i)
+    {
+        if (errors_[i].type() == StorageError::NoError)
         {
-            status_ = ItemListJob::Status::Finished;
+            metadata.append(metadata_[i]);
         }
-        Q_EMIT public_instance_->itemsReady(items);
-        if (replies_remaining_ == 0)
+        else if (first_error.type() == StorageError::NoError)
         {
-            Q_EMIT public_instance_->statusChanged(status_);
+            first_error = errors_[i];
         }
-    };
+    }
+    finish(metadata, first_error);
+}
 
-    auto process_error = [this](StorageError const& error)
+void MultiItemJobImpl::finish(QList<storage::internal::ItemMetadata> const& metadata, StorageError const& error)
+{
+    auto runtime = account_impl_->runtime_impl();
+    if (!runtime || !runtime->isValid())
     {
-        if (status_ != ItemListJob::Status::Loading)
-        {
-            return;
-        }
-        // TODO: method name is not being set this way.
-        error_ = error;
+        error_ = StorageErrorImpl::runtime_destroyed_error(method_ + ": Runtime was destroyed previously");
         status_ = ItemListJob::Status::Error;
         Q_EMIT public_instance_->statusChanged(status_);
-    };
+        return;
+    }
 
-    for (auto& reply : replies)
+    QList<Item> items;
+    for (auto const& md : metadata)
     {
-        new Handler<storage::internal::ItemMetadata>(this, reply, process_reply, process_error);
+        try
+        {
+            validate_(md);
+            items.append(ItemImpl::make_item(method_, md, account_impl_));
+        }
+        catch (StorageError const& e)
+        {
+            // Bad metadata received from provider, validate_() or make_item() have logged it.
+            error_ = e;
+        }
     }
+    if (error.type() != StorageError::NoError)
+    {
+        error_ = error;
+    }
+    status_ = error_.type() == StorageError::NoError ? ItemListJob::Finished : ItemListJob::Error;
+    Q_EMIT public_instance_->itemsReady(items);
+    Q_EMIT public_instance_->statusChanged(status_);
 }
 
 ItemListJob* MultiItemJobImpl::make_job(shared_ptr<AccountImpl> const& account_impl,
                                         QString const& method,
-                                        ReplyType& replies,
+                                        QStringList const& item_ids,
+                                        QStringList const& keys,
                                         ValidateFunc const& validate)
 {
-    unique_ptr<MultiItemJobImpl> impl(new MultiItemJobImpl(account_impl, method, replies, validate));
+    if (item_ids.isEmpty())
+    {
+        return ListJobImplBase::make_empty_job();
+    }
+    unique_ptr<MultiItemJobImpl> impl(new MultiItemJobImpl(account_impl, method, item_ids, keys, validate));
     auto job = new ItemListJob(move(impl));
     job->p_->set_public_instance(job);
     return job;
@@ -24,6 +24,7 @@
 #include <unity/storage/qt/internal/AccountImpl.h>
 #include <unity/storage/qt/internal/AccountsJobImpl.h>
 #include <unity/storage/qt/internal/StorageErrorImpl.h>
+#include <unity/storage/qt/CapabilitiesJob.h>
 #include <unity/storage/qt/Downloader.h>
 #include <unity/storage/qt/ItemJob.h>
 #include <unity/storage/qt/ItemListJob.h>
@@ -53,6 +54,7 @@ void register_meta_types()
     qRegisterMetaType<unity::storage::qt::AccountsJob::Status>();
     qRegisterMetaType<unity::storage::qt::Account>();
     qRegisterMetaType<QList<unity::storage::qt::Account>>();
+    qRegisterMetaType<unity::storage::qt::CapabilitiesJob::Status>();
     qRegisterMetaType<unity::storage::qt::Downloader::Status>();
     qRegisterMetaType<unity::storage::qt::Item>();
     qRegisterMetaType<QList<unity::storage::qt::Item>>();
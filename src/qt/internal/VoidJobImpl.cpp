@@ -18,6 +18,7 @@
 
 #include <unity/storage/qt/internal/VoidJobImpl.h>
 
+#include <unity/storage/qt/internal/AccountImpl.h>
 #include <unity/storage/qt/internal/Handler.h>
 #include <unity/storage/qt/internal/ItemImpl.h>
 #include <unity/storage/qt/internal/RuntimeImpl.h>
@@ -38,6 +39,7 @@ VoidJobImpl::VoidJobImpl(shared_ptr<ItemImpl> const& item_impl,
                          QDBusPendingReply<void>& reply)
     : status_(VoidJob::Status::Loading)
     , method_(method)
+    , account_impl_(item_impl->account_impl())
     , item_impl_(item_impl)
 {
     assert(!method_.isEmpty());
@@ -45,7 +47,7 @@ VoidJobImpl::VoidJobImpl(shared_ptr<ItemImpl> const& item_impl,
 
     auto process_reply = [this](decltype(reply)&)
     {
-        auto runtime = item_impl_->runtime_impl();
+        auto runtime = account_impl_->runtime_impl();
         if (!runtime || !runtime->isValid())
         {
             error_ = StorageErrorImpl::runtime_destroyed_error(method_ + ": Runtime was destroyed previously");
@@ -68,6 +70,44 @@ VoidJobImpl::VoidJobImpl(shared_ptr<ItemImpl> const& item_impl,
     new Handler<void>(this, reply, process_reply, process_error);
 }
 
+// For DeleteMany: the job fails with the error for the first item that could not be deleted.
+
+VoidJobImpl::VoidJobImpl(shared_ptr<AccountImpl> const& account_impl,
+                         QString const& method,
+                         QDBusPendingReply<QStringList, QStringList, QVariantList>& reply)
+    : status_(VoidJob::Status::Loading)
+    , method_(method)
+    , account_impl_(account_impl)
+{
+    assert(!method_.isEmpty());
+    assert(account_impl);
+
+    auto process_reply = [this](decltype(reply)& r)
+    {
+        auto runtime = account_impl_->runtime_impl();
+        if (!runtime || !runtime->isValid())
+        {
+            error_ = StorageErrorImpl::runtime_destroyed_error(method_ + ": Runtime was destroyed previously");
+            status_ = VoidJob::Status::Error;
+            Q_EMIT public_instance_->statusChanged(status_);
+            return;
+        }
+
+        error_ = unmarshal_error(r.argumentAt<0>(), r.argumentAt<1>(), r.argumentAt<2>());
+        status_ = error_.type() == StorageError::NoError ? VoidJob::Status::Finished : VoidJob::Status::Error;
+        Q_EMIT public_instance_->statusChanged(status_);
+    };
+
+    auto process_error = [this](StorageError const& error)
+    {
+        error_ = error;
+        status_ = VoidJob::Status::Error;
+        Q_EMIT public_instance_->statusChanged(status_);
+    };
+
+    new Handler<QDBusPendingReply<QStringList, QStringList, QVariantList>>(this, reply, process_reply, process_error);
+}
+
 VoidJobImpl::VoidJobImpl(StorageError const& error)
     : status_(VoidJob::Status::Error)
     , error_(error)
@@ -99,6 +139,16 @@ VoidJob* VoidJobImpl::make_job(shared_ptr<ItemImpl> const& item,
     return job;
 }
 
+VoidJob* VoidJobImpl::make_job(shared_ptr<AccountImpl> const& account_impl,
+                               QString const& method,
+                               QDBusPendingReply<QStringList, QStringList, QVariantList>& reply)
+{
+    unique_ptr<VoidJobImpl> impl(new VoidJobImpl(account_impl, method, reply));
+    auto job = new VoidJob(move(impl));
+    job->p_->public_instance_ = job;
+    return job;
+}
+
 VoidJob* VoidJobImpl::make_job(StorageError const& error)
 {
     unique_ptr<VoidJobImpl> impl(new VoidJobImpl(error));
@@ -21,7 +21,9 @@
 #include <unity/storage/internal/dbus_error.h>
 #include <unity/storage/qt/internal/StorageErrorImpl.h>
 
-#include <QDBusPendingReply>
+#include <QDBusArgument>
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
 
 #include <cassert>
 #include <map>
@@ -40,43 +42,39 @@ namespace internal
 namespace
 {
 
+// The factories take the message of an error reply and its remaining arguments. For errors
+// returned in a D-Bus error reply, the arguments follow the message in the reply; for the
+// per-item errors of the batch methods (DeleteMany, etc.), they arrive in a variant list.
+
 template<StorageError::Type T>
-StorageError make_error(QDBusPendingCallWatcher const& call)
+StorageError make_error(QString const& msg, QVariantList const& /* args */)
 {
-    QDBusPendingReply<QString> reply = call;
-    auto msg = reply.argumentAt<0>();
     return StorageErrorImpl::make_error(T, msg);
 }
 
 template<>
-StorageError make_error<StorageError::Type::NotExists>(QDBusPendingCallWatcher const& call)
+StorageError make_error<StorageError::Type::NotExists>(QString const& msg, QVariantList const& args)
 {
-    QDBusPendingReply<QString, QString> reply = call;
-    auto msg = reply.argumentAt<0>();
-    auto key = reply.argumentAt<1>();
+    auto key = args.value(0).toString();
     return StorageErrorImpl::not_exists_error(msg, key);
 }
 
 template<>
-StorageError make_error<StorageError::Type::Exists>(QDBusPendingCallWatcher const& call)
+StorageError make_error<StorageError::Type::Exists>(QString const& msg, QVariantList const& args)
 {
-    QDBusPendingReply<QString, QString, QString> reply = call;
-    auto msg = reply.argumentAt<0>();
-    auto id = reply.argumentAt<1>();
-    auto name = reply.argumentAt<2>();
+    auto id = args.value(0).toString();
+    auto name = args.value(1).toString();
     return StorageErrorImpl::exists_error(msg, id, name);
 }
 
 template<>
-StorageError make_error<StorageError::Type::ResourceError>(QDBusPendingCallWatcher const& call)
+StorageError make_error<StorageError::Type::ResourceError>(QString const& msg, QVariantList const& args)
 {
-    QDBusPendingReply<QString, int> reply = call;
-    auto msg = reply.argumentAt<0>();
-    auto error_code = reply.argumentAt<1>();
+    auto error_code = args.value(0).toInt();
     return StorageErrorImpl::resource_error(msg, error_code);
 }
 
-static const map<QString, function<StorageError(QDBusPendingCallWatcher const& call)>> exception_factories =
+static const map<QString, function<StorageError(QString const& msg, QVariantList const& args)>> exception_factories =
 {
     { "RemoteCommsException",     make_error<StorageError::Type::RemoteCommsError> },
     { "NotExistsException",       make_error<StorageError::Type::NotExists> },
@@ -123,7 +121,43 @@ StorageError unmarshal_error(QDBusPendingCallWatcher const& call)
                       + ": " + call.error().message();
         return StorageErrorImpl::local_comms_error(msg);
     }
-    return factory_it->second(call);
+    auto args = call.reply().arguments();
+    auto msg = args.isEmpty() ? QString() : args.takeFirst().toString();
+    return factory_it->second(msg, args);
+}
+
+StorageError unmarshal_error(QStringList const& error_names,
+                             QStringList const& error_messages,
+                             QVariantList const& error_details)
+{
+    for (int i = 0; i < error_names.size(); ++i)
+    {
+        auto const& error_name = error_names[i];
+        if (error_name.isEmpty())
+        {
+            continue;
+        }
+        auto message = error_messages.value(i);
+        auto details = qdbus_cast<QVariantList>(error_details.value(i));
+
+        if (!error_name.startsWith(DBUS_ERROR_PREFIX))
+        {
+            QString msg = "unmarshal_exception(): unknown exception type received from server: " + error_name
+                          + ": " + message;
+            return StorageErrorImpl::local_comms_error(msg);
+        }
+        auto exception_type = error_name.mid(strlen(DBUS_ERROR_PREFIX));
+
+        auto factory_it = exception_factories.find(exception_type);
+        if (factory_it == exception_factories.end())
+        {
+            QString msg = "unmarshal_exception(): unknown exception type received from server: " + exception_type
+                          + ": " + message;
+            return StorageErrorImpl::local_comms_error(msg);
+        }
+        return factory_it->second(message, details);
+    }
+    return StorageError();
 }
 
 }  // namespace internal
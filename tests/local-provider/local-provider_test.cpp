@@ -16,9 +16,15 @@
  * Authors: Michi Henning <michi.henning@canonical.com>
  */
 
+#include "../../src/local-provider/ContentTypeCache.h"
+#include "../../src/local-provider/CrossDeviceMover.h"
+#include "../../src/local-provider/FileCopier.h"
 #include "../../src/local-provider/LocalDownloadJob.h"
 #include "../../src/local-provider/LocalProvider.h"
 #include "../../src/local-provider/LocalUploadJob.h"
+#include "../../src/local-provider/MetadataCache.h"
+#include "../../src/local-provider/ThreadPool.h"
+#include "../../src/local-provider/TrashReaper.h"
 
 #include <unity/storage/provider/DownloadJob.h>
 #include <unity/storage/provider/Exceptions.h>
@@ -30,12 +36,22 @@
 #include <boost/algorithm/string.hpp>
 #include <gtest/gtest.h>
 #include <QCoreApplication>
+#include <QDBusServiceWatcher>
 #include <QSignalSpy>
 
 #include <chrono>
 #include <regex>
+#include <set>
 
 #include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/statvfs.h>
+#include <sys/xattr.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#include <glib.h>
+#pragma GCC diagnostic pop
 
 using namespace unity::storage;
 using namespace std;
@@ -98,6 +114,18 @@ void wait(Job* job)
     }
 }
 
+// The batch methods start each item from the main loop, so we run it while we wait.
+
+template <typename T>
+T get_batch(boost::future<T> f)
+{
+    while (!f.is_ready())
+    {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    return f.get();
+}
+
 qt::Item get_root(qt::Account const& account)
 {
     unique_ptr<qt::ItemListJob> j(account.roots());
@@ -375,6 +403,138 @@ TEST_F(LocalProviderTest, delete_root)
     }
 }
 
+TEST_F(LocalProviderTest, batch_delete_move_copy)
+{
+    using namespace unity::storage::qt;
+
+    set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
+
+    auto root = get_root(acc_);
+    QList<Item> folders;
+    for (auto const name : { "f1", "f2", "f3", "dst" })
+    {
+        unique_ptr<ItemJob> job(root.createFolder(name));
+        wait(job.get());
+        ASSERT_EQ(ItemJob::Finished, job->status()) << job->error().errorString().toStdString();
+        folders.append(job->item());
+    }
+    auto dst = folders.takeLast();
+
+    QList<Item> copies;
+    {
+        unique_ptr<ItemListJob> job(acc_.copyItems(folders, dst));
+        copies = get_items(job.get());
+        ASSERT_EQ(ItemListJob::Finished, job->status()) << job->error().errorString().toStdString();
+        ASSERT_EQ(3, copies.size());
+        EXPECT_EQ(ROOT_DIR() + "/dst/f1", copies[0].itemId().toStdString());
+        EXPECT_EQ(ROOT_DIR() + "/dst/f2", copies[1].itemId().toStdString());
+        EXPECT_EQ(ROOT_DIR() + "/dst/f3", copies[2].itemId().toStdString());
+        EXPECT_TRUE(boost::filesystem::is_directory(ROOT_DIR() + "/f1"));
+    }
+
+    {
+        unique_ptr<VoidJob> job(acc_.deleteItems({ copies[0], copies[2] }));
+        wait(job.get());
+        ASSERT_EQ(VoidJob::Finished, job->status()) << job->error().errorString().toStdString();
+        EXPECT_FALSE(boost::filesystem::exists(ROOT_DIR() + "/dst/f1"));
+        EXPECT_TRUE(boost::filesystem::exists(ROOT_DIR() + "/dst/f2"));
+        EXPECT_FALSE(boost::filesystem::exists(ROOT_DIR() + "/dst/f3"));
+    }
+
+    // The copy of f2 is still there, so f2 cannot be moved, but the others can.
+    {
+        unique_ptr<ItemListJob> job(acc_.moveItems(folders, dst));
+        auto items = get_items(job.get());
+        ASSERT_EQ(ItemListJob::Error, job->status());
+        EXPECT_EQ(string("Exists: move(): \"") + ROOT_DIR() + "/dst/f2\" exists already",
+                  job->error().errorString().toStdString());
+        ASSERT_EQ(2, items.size());
+        EXPECT_EQ(ROOT_DIR() + "/dst/f1", items[0].itemId().toStdString());
+        EXPECT_EQ(ROOT_DIR() + "/dst/f3", items[1].itemId().toStdString());
+        EXPECT_FALSE(boost::filesystem::exists(ROOT_DIR() + "/f1"));
+        EXPECT_TRUE(boost::filesystem::exists(ROOT_DIR() + "/f2"));
+    }
+
+    // f1 no longer exists, but f2 is still deleted.
+    {
+        unique_ptr<VoidJob> job(acc_.deleteItems({ folders[0], folders[1] }));
+        wait(job.get());
+        ASSERT_EQ(VoidJob::Error, job->status());
+        EXPECT_EQ(StorageError::NotExists, job->error().type()) << job->error().errorString().toStdString();
+        EXPECT_FALSE(boost::filesystem::exists(ROOT_DIR() + "/f2"));
+    }
+
+    {
+        unique_ptr<VoidJob> job(acc_.deleteItems({ dst, root }));
+        wait(job.get());
+        ASSERT_EQ(VoidJob::Error, job->status());
+        EXPECT_EQ("LogicError: Account::deleteItems(): cannot delete root", job->error().errorString().toStdString());
+        EXPECT_TRUE(boost::filesystem::exists(ROOT_DIR() + "/dst"));
+    }
+
+    // The provider reports a result for each item, in order.
+    auto p = make_shared<LocalProvider>();
+    auto results = get_batch(p->copy_items({ ROOT_DIR() + "/dst", ROOT_DIR() + "/no_such_item" }, ROOT_DIR(),
+                                           { "dst2", "x" }, {}, provider::Context()));
+    ASSERT_EQ(2u, results.size());
+    EXPECT_FALSE(results[0].error);
+    EXPECT_EQ(ROOT_DIR() + "/dst2", results[0].item.item_id);
+    ASSERT_TRUE(bool(results[1].error));
+    EXPECT_THROW(rethrow_exception(results[1].error), provider::NotExistsException);
+    try
+    {
+        get_batch(p->move_items({ ROOT_DIR() + "/dst" }, ROOT_DIR(), {}, {}, provider::Context()));
+        FAIL();
+    }
+    catch (provider::InvalidArgumentException const& e)
+    {
+        EXPECT_STREQ("InvalidArgumentException: move_items(): item_ids and new_names must have the same size",
+                     e.what());
+    }
+    auto errors = get_batch(p->delete_items({ ROOT_DIR() + "/dst", ROOT_DIR() + "/dst2" }, provider::Context()));
+    ASSERT_EQ(2u, errors.size());
+    EXPECT_FALSE(errors[0]);
+    EXPECT_FALSE(errors[1]);
+    EXPECT_FALSE(boost::filesystem::exists(ROOT_DIR() + "/dst2"));
+}
+
+TEST_F(LocalProviderTest, batch_larger_than_queue)
+{
+    // A batch with more items than the thread pool can queue still succeeds for every item.
+    shared_ptr<LocalProvider> p;
+    {
+        EnvVarGuard env("SF_LOCAL_PROVIDER_QUEUE_DEPTH", "32");
+        p = make_shared<LocalProvider>();
+    }
+
+    int const num_items = 500;
+    vector<string> ids;
+    for (int i = 0; i < num_items; ++i)
+    {
+        string path = ROOT_DIR() + "/file" + to_string(i);
+        int fd = creat(path.c_str(), 0644);
+        ASSERT_GT(fd, 0);
+        close(fd);
+        ids.push_back(path);
+    }
+
+    auto results = get_batch(p->metadata_items(ids, {}, provider::Context()));
+    ASSERT_EQ(size_t(num_items), results.size());
+    for (int i = 0; i < num_items; ++i)
+    {
+        EXPECT_FALSE(results[i].error);
+        EXPECT_EQ(ids[i], results[i].item.item_id);
+    }
+
+    auto errors = get_batch(p->delete_items(ids, provider::Context()));
+    ASSERT_EQ(size_t(num_items), errors.size());
+    for (int i = 0; i < num_items; ++i)
+    {
+        EXPECT_FALSE(errors[i]);
+        EXPECT_FALSE(boost::filesystem::exists(ids[i]));
+    }
+}
+
 TEST_F(LocalProviderTest, metadata)
 {
     // Client-side API does not call the Metadata DBus method (except as part of parents()),
@@ -400,6 +560,92 @@ TEST_F(LocalProviderTest, metadata)
     }
 }
 
+TEST_F(LocalProviderTest, get_items)
+{
+    using namespace unity::storage::qt;
+
+    set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
+
+    QStringList ids;
+    for (int i = 0; i < 100; ++i)
+    {
+        string path = ROOT_DIR() + "/file" + to_string(i);
+        ASSERT_EQ(0, system(("touch " + path).c_str()));
+        ids.append(QString::fromStdString(path));
+    }
+
+    {
+        unique_ptr<ItemListJob> job(acc_.getItems(ids));
+        auto items = get_items(job.get());
+        ASSERT_EQ(ItemListJob::Finished, job->status()) << job->error().errorString().toStdString();
+        ASSERT_EQ(100, items.size());
+        for (int i = 0; i < 100; ++i)
+        {
+            EXPECT_EQ(ids[i], items[i].itemId());
+            EXPECT_EQ(Item::Type::File, items[i].type());
+            EXPECT_EQ(0, items[i].sizeInBytes());
+        }
+    }
+
+    // A missing item doesn't stop the others from being returned.
+    ids.insert(1, QString::fromStdString(ROOT_DIR() + "/no_such_file"));
+    {
+        unique_ptr<ItemListJob> job(acc_.getItems(ids));
+        auto items = get_items(job.get());
+        ASSERT_EQ(ItemListJob::Error, job->status());
+        EXPECT_EQ(StorageError::NotExists, job->error().type()) << job->error().errorString().toStdString();
+        EXPECT_EQ(QString::fromStdString(ROOT_DIR() + "/no_such_file"), job->error().itemId());
+        EXPECT_EQ(100, items.size());
+    }
+
+    // parents() uses the same batched call.
+    {
+        unique_ptr<ItemJob> job(acc_.get(ids[0]));
+        wait(job.get());
+        ASSERT_EQ(ItemJob::Finished, job->status()) << job->error().errorString().toStdString();
+        unique_ptr<ItemListJob> parents_job(job->item().parents());
+        auto parents = get_items(parents_job.get());
+        ASSERT_EQ(ItemListJob::Finished, parents_job->status()) << parents_job->error().errorString().toStdString();
+        ASSERT_EQ(1, parents.size());
+        EXPECT_EQ(ROOT_DIR(), parents[0].itemId().toStdString());
+        EXPECT_EQ(Item::Type::Root, parents[0].type());
+    }
+}
+
+TEST_F(LocalProviderTest, metadata_keys)
+{
+    using namespace unity::storage::metadata;
+
+    auto p = make_shared<LocalProvider>();
+
+    string cmd = string("echo hello >") + ROOT_DIR() + "/hello";
+    ASSERT_EQ(0, system(cmd.c_str()));
+    string const file_id = ROOT_DIR() + "/hello";
+
+    // Size and modification time are always returned for files.
+    auto item = p->metadata(file_id, { CONTENT_TYPE }, provider::Context()).get();
+    EXPECT_EQ(3, item.metadata.size());
+    EXPECT_EQ(6, boost::get<int64_t>(item.metadata.at(SIZE_IN_BYTES)));
+    EXPECT_EQ(1, item.metadata.count(LAST_MODIFIED_TIME));
+    EXPECT_EQ("application/octet-stream", boost::get<string>(item.metadata.at(CONTENT_TYPE)));
+    EXPECT_NE("", item.etag);
+
+    // Unknown keys are ignored.
+    item = p->metadata(ROOT_DIR(), { WRITABLE, "no_such_key" }, provider::Context()).get();
+    EXPECT_EQ(1, item.metadata.size());
+    EXPECT_EQ(1, item.metadata.count(WRITABLE));
+
+    item = p->metadata(ROOT_DIR(), { FREE_SPACE_BYTES }, provider::Context()).get();
+    EXPECT_EQ(1, item.metadata.size());
+    EXPECT_EQ(1, item.metadata.count(FREE_SPACE_BYTES));
+
+    // ALL and the empty list return everything.
+    item = p->metadata(file_id, { ALL }, provider::Context()).get();
+    EXPECT_EQ(6, item.metadata.size());
+    item = p->metadata(file_id, {}, provider::Context()).get();
+    EXPECT_EQ(6, item.metadata.size());
+}
+
 TEST_F(LocalProviderTest, lookup)
 {
     using namespace unity::storage::qt;
@@ -432,9 +678,12 @@ TEST_F(LocalProviderTest, lookup)
     job.reset(root.lookup("child"));
     wait(job.get());
     EXPECT_EQ(ItemJob::Error, job->status());
-    EXPECT_EQ(string("NotExists: lookup(): \"") + ROOT_DIR() + "/child\": boost::filesystem::canonical: "
-              + "No such file or directory: \"" + ROOT_DIR() + "/child\"",
-              job->error().errorString().toStdString());
+    // Without openat2() (old kernel or kernel headers), the provider falls back to canonical().
+    string const msg = job->error().errorString().toStdString();
+    string const prefix = string("NotExists: lookup(): \"") + ROOT_DIR() + "/child\": ";
+    string const suffix = "No such file or directory: \"" + ROOT_DIR() + "/child\"";
+    EXPECT_TRUE(msg == prefix + "openat2: " + suffix || msg == prefix + "boost::filesystem::canonical: " + suffix)
+        << msg;
 }
 
 TEST_F(LocalProviderTest, list)
@@ -472,171 +721,515 @@ TEST_F(LocalProviderTest, list)
     EXPECT_EQ(5, child.metadata().size());
 }
 
-void make_hierarchy(string const& root_dir)
-{
-    // Make a small tree so we have something to test with for move() and copy().
-    ASSERT_EQ(0, mkdir((root_dir + "/a").c_str(), 0755));
-    ASSERT_EQ(0, mkdir((root_dir + "/a/b").c_str(), 0755));
-    string cmd = string("echo hello >") + root_dir + "/hello";
-    ASSERT_EQ(0, system(cmd.c_str()));
-    cmd = string("echo text >") + root_dir + "/a/foo.txt";
-    ASSERT_EQ(0, system(cmd.c_str()));
-    ASSERT_EQ(0, mknod((root_dir + "/a/pipe").c_str(), S_IFIFO | 06666, 0));
-    ASSERT_EQ(0, mkdir((root_dir + "/a/.storage-framework-").c_str(), 0755));
-    ASSERT_EQ(0, mkdir((root_dir + "/a/b/.storage-framework-").c_str(), 0755));
-    ASSERT_EQ(0, mknod((root_dir + "/a/b/pipe").c_str(), S_IFIFO | 06666, 0));
-}
-
-TEST_F(LocalProviderTest, move)
+TEST_F(LocalProviderTest, list_paged)
 {
     using namespace unity::storage::qt;
 
+    EnvVarGuard env("SF_LOCAL_PROVIDER_PAGE_SIZE", "2");
     set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
 
-    auto start_time = nanosecs_now();
-
-    make_hierarchy(ROOT_DIR());
+    for (int i = 0; i < 5; ++i)
+    {
+        ASSERT_EQ(0, mkdir((ROOT_DIR() + "/child" + to_string(i)).c_str(), 0755));
+    }
+    // Hidden entries do not count towards the page size.
+    ASSERT_EQ(0, mkdir((ROOT_DIR() + "/.storage-framework-").c_str(), 0755));
 
     auto root = get_root(acc_);
-
-    qt::Item hello;
+    unique_ptr<ItemListJob> job(root.list());
+    auto items = get_items(job.get());
+    ASSERT_EQ(5, items.size());
+    set<string> names;
+    for (auto const& item : items)
     {
-        unique_ptr<ItemListJob> job(root.lookup("hello"));
-        auto items = get_items(job.get());
-        ASSERT_EQ(ItemListJob::Finished, job->status()) << job->error().errorString().toStdString();
-        ASSERT_EQ(1, items.size());
-        hello = items.at(0);
+        names.insert(item.name().toStdString());
     }
+    EXPECT_EQ((set<string>{ "child0", "child1", "child2", "child3", "child4" }), names);
+}
 
-    struct stat st;
-    ASSERT_EQ(0, stat(hello.itemId().toStdString().c_str(), &st));
-    auto old_ino = st.st_ino;
-
-    // Check metadata.
-    EXPECT_EQ("hello", hello.name());
-    ASSERT_EQ(1, hello.parentIds().size());
-    EXPECT_EQ(ROOT_DIR(), hello.parentIds().at(0).toStdString());
-    EXPECT_EQ(Item::Type::File, hello.type());
-
-    ASSERT_EQ(6, hello.metadata().size());
-    auto free_space_bytes = hello.metadata().value("free_space_bytes").toLongLong();
-    cout << "free_space_bytes: " << free_space_bytes << endl;
-    EXPECT_GT(free_space_bytes, 0);
-    auto used_space_bytes = hello.metadata().value("used_space_bytes").toLongLong();
-    cout << "used_space_bytes: " << used_space_bytes << endl;
-    EXPECT_GT(used_space_bytes, 0);
-    auto content_type = hello.metadata().value("content_type").toString();
-    EXPECT_EQ("application/octet-stream", content_type);
-    auto writable = hello.metadata().value("writable").toBool();
-    EXPECT_TRUE(writable);
-    auto size = hello.metadata().value("size_in_bytes").toLongLong();
-    EXPECT_EQ(6, size);
+TEST_F(LocalProviderTest, list_page_token)
+{
+    EnvVarGuard env("SF_LOCAL_PROVIDER_PAGE_SIZE", "2");
+    auto p = make_shared<LocalProvider>();
 
-    // yyyy-mm-ddThh:mm:ssZ
-    string const date_time_fmt = "^[0-9][0-9][0-9][0-9]-[0-9][0-9]-[0-9][0-9]T[0-9][0-9]:[0-9][0-9]:[0-9][0-9]Z$";
-    string date_time = hello.metadata().value("last_modified_time").toString().toStdString();
-    cout << "last_modified_time: " << date_time << endl;
-    regex re(date_time_fmt);
-    EXPECT_TRUE(regex_match(date_time, re));
+    for (int i = 0; i < 3; ++i)
+    {
+        ASSERT_EQ(0, mkdir((ROOT_DIR() + "/child" + to_string(i)).c_str(), 0755));
+    }
 
-    // Check that the file was modified in the last two seconds.
-    // Because the system clock can tick a lot more frequently than the file system time stamp,
-    // we allow the mtime to be up to one second *earlier* than the time we started the operation.
-    string mtime_str = hello.etag().toStdString();
-    char* end;
-    int64_t mtime = strtoll(mtime_str.c_str(), &end, 10);
-    EXPECT_LE(start_time - 1000000000, mtime);
-    EXPECT_LT(mtime, start_time + 2000000000);
+    provider::ItemList items;
+    string token;
+    tie(items, token) = p->list(ROOT_DIR(), "", {}, provider::Context()).get();
+    EXPECT_EQ(2, items.size());
+    ASSERT_NE("", token);
 
-    // Move hello -> world
-    qt::Item world;
+    // A token cannot be used for a different folder.
+    string const child_id = ROOT_DIR() + "/child0";
+    try
     {
-        unique_ptr<ItemJob> job(hello.move(root, "world"));
-        wait(job.get());
-        ASSERT_EQ(ItemJob::Finished, job->status()) << job->error().errorString().toStdString();
-        world = job->item();
+        p->list(child_id, token, {}, provider::Context()).get();
+        FAIL();
+    }
+    catch (provider::InvalidArgumentException const& e)
+    {
+        EXPECT_EQ("InvalidArgumentException: list(): invalid or expired page token: \"" + token + "\"", string(e.what()));
     }
-    EXPECT_FALSE(boost::filesystem::exists(hello.itemId().toStdString()));
-    EXPECT_EQ(ROOT_DIR() + "/world", world.itemId().toStdString());
 
-    ASSERT_EQ(0, stat(world.itemId().toStdString().c_str(), &st));
-    auto new_ino = st.st_ino;
-    EXPECT_EQ(old_ino, new_ino);
+    // The token is still good for the folder it belongs to.
+    string const used_token = token;
+    tie(items, token) = p->list(ROOT_DIR(), token, {}, provider::Context()).get();
+    EXPECT_EQ(1, items.size());
+    EXPECT_EQ("", token);
 
-    // For coverage: try moving world -> a (which must fail)
-    unique_ptr<ItemJob> job(world.move(root, "a"));
-    wait(job.get());
-    ASSERT_EQ(ItemJob::Error, job->status()) << job->error().errorString().toStdString();
-    EXPECT_EQ(string("Exists: move(): \"") + ROOT_DIR() + "/a\" exists already",
-              job->error().errorString().toStdString());
+    // Each token can be used only once.
+    try
+    {
+        p->list(ROOT_DIR(), used_token, {}, provider::Context()).get();
+        FAIL();
+    }
+    catch (provider::InvalidArgumentException const& e)
+    {
+        EXPECT_EQ("InvalidArgumentException: list(): invalid or expired page token: \"" + used_token + "\"",
+                  string(e.what()));
+    }
 }
 
-TEST_F(LocalProviderTest, copy_file)
+TEST_F(LocalProviderTest, list_chunked)
 {
     using namespace unity::storage::qt;
 
+    // The framework splits each page of the provider into pages of at most three items,
+    // and hands out the provider's token once it has handed out the whole page.
+    EnvVarGuard provider_page_size("SF_LOCAL_PROVIDER_PAGE_SIZE", "4");
+    EnvVarGuard list_page_size("SF_PROVIDER_LIST_PAGE_SIZE", "3");
     set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
 
-    make_hierarchy(ROOT_DIR());
+    for (int i = 0; i < 10; ++i)
+    {
+        ASSERT_EQ(0, mkdir((ROOT_DIR() + "/child" + to_string(i)).c_str(), 0755));
+    }
 
     auto root = get_root(acc_);
+    {
+        unique_ptr<ItemListJob> job(root.list());
+        QSignalSpy spy(job.get(), &ItemListJob::itemsReady);
+        auto items = get_items(job.get());
+        ASSERT_EQ(ItemListJob::Finished, job->status()) << job->error().errorString().toStdString();
+        set<string> names;
+        for (auto const& item : items)
+        {
+            names.insert(item.name().toStdString());
+        }
+        EXPECT_EQ(10, names.size());
+        ASSERT_EQ(5, spy.count());
+        vector<int> page_sizes;
+        for (auto const& args : spy)
+        {
+            page_sizes.push_back(qvariant_cast<QList<Item>>(args.at(0)).size());
+        }
+        EXPECT_EQ((vector<int>{ 3, 1, 3, 1, 2 }), page_sizes);
+    }
 
-    // Copy hello -> world
-    qt::Item hello;
     {
-        unique_ptr<ItemListJob> job(root.lookup("hello"));
+        unique_ptr<ItemListJob> job(root.search("child*"));
+        QSignalSpy spy(job.get(), &ItemListJob::itemsReady);
         auto items = get_items(job.get());
         ASSERT_EQ(ItemListJob::Finished, job->status()) << job->error().errorString().toStdString();
-        ASSERT_EQ(1, items.size());
-        hello = items.at(0);
+        EXPECT_EQ(10, items.size());
+        EXPECT_EQ(5, spy.count());
     }
+}
 
-    struct stat st;
-    ASSERT_EQ(0, stat(hello.itemId().toStdString().c_str(), &st));
-    auto old_ino = st.st_ino;
+TEST_F(LocalProviderTest, list_chunked_cursor_limit)
+{
+    // Each List leaves a remainder behind. A client can hold on to two; the third evicts the oldest.
+    EnvVarGuard list_page_size("SF_PROVIDER_LIST_PAGE_SIZE", "1");
+    EnvVarGuard max_client_cursors("SF_PROVIDER_MAX_CLIENT_LIST_CURSORS", "2");
+    set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
 
-    qt::Item world;
+    for (int i = 0; i < 3; ++i)
     {
-        unique_ptr<ItemJob> job(hello.copy(root, "world"));
-        wait(job.get());
-        ASSERT_EQ(ItemJob::Finished, job->status()) << job->error().errorString().toStdString();
-        world = job->item();
+        ASSERT_EQ(0, mkdir((ROOT_DIR() + "/child" + to_string(i)).c_str(), 0755));
     }
-    EXPECT_TRUE(boost::filesystem::exists(hello.itemId().toStdString()));
-    EXPECT_EQ(ROOT_DIR() + "/world", world.itemId().toStdString());
 
-    ASSERT_EQ(0, stat(world.itemId().toStdString().c_str(), &st));
-    auto new_ino = st.st_ino;
-    EXPECT_NE(old_ino, new_ino);
+    ProviderClient client(bus_name(), object_path(), connection());
+    QString const root_id = QString::fromStdString(ROOT_DIR());
+    vector<QString> tokens;
+    for (int i = 0; i < 3; ++i)
+    {
+        auto reply = client.List(root_id, "", QList<QString>());
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+        EXPECT_EQ(1, reply.argumentAt<0>().size());
+        ASSERT_FALSE(reply.argumentAt<1>().isEmpty());
+        tokens.push_back(reply.argumentAt<1>());
+    }
+
+    {
+        auto reply = client.List(root_id, tokens[0], QList<QString>());
+        wait_for(reply);
+        ASSERT_TRUE(reply.isError());
+        EXPECT_EQ("List(): invalid or expired page token: \"" + tokens[0].toStdString() + "\"",
+                  reply.error().message().toStdString());
+    }
+    for (int i = 1; i < 3; ++i)
+    {
+        auto reply = client.List(root_id, tokens[i], QList<QString>());
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+        EXPECT_EQ(1, reply.argumentAt<0>().size());
+    }
 }
 
-TEST_F(LocalProviderTest, copy_tree)
+TEST_F(LocalProviderTest, search)
 {
     using namespace unity::storage::qt;
-    using namespace boost::filesystem;
 
+    EnvVarGuard env("SF_LOCAL_PROVIDER_PAGE_SIZE", "2");
     set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
 
-    make_hierarchy(ROOT_DIR());
+    auto touch = [](string const& path)
+    {
+        int fd = creat(path.c_str(), 0644);
+        ASSERT_GT(fd, 0);
+        close(fd);
+    };
+    ASSERT_EQ(0, mkdir((ROOT_DIR() + "/a").c_str(), 0755));
+    ASSERT_EQ(0, mkdir((ROOT_DIR() + "/a/b").c_str(), 0755));
+    ASSERT_EQ(0, mkdir((ROOT_DIR() + "/a/Notes").c_str(), 0755));
+    touch(ROOT_DIR() + "/notes.txt");
+    touch(ROOT_DIR() + "/a/b/NOTES.TXT");
+    touch(ROOT_DIR() + "/a/b/other.txt");
+    // Reserved names are never returned (for coverage).
+    touch(ROOT_DIR() + "/a/.storage-framework-notes");
 
     auto root = get_root(acc_);
-
-    // Copy a -> c
-    qt::Item a;
     {
-        unique_ptr<ItemListJob> job(root.lookup("a"));
+        unique_ptr<ItemListJob> job(root.search("notes*"));
         auto items = get_items(job.get());
-        ASSERT_EQ(ItemListJob::Finished, job->status()) << job->error().errorString().toStdString();
-        ASSERT_EQ(1, items.size());
-        a = items.at(0);
+        set<string> ids;
+        for (auto const& item : items)
+        {
+            ids.insert(item.itemId().toStdString());
+        }
+        EXPECT_EQ((set<string>{ ROOT_DIR() + "/notes.txt", ROOT_DIR() + "/a/Notes", ROOT_DIR() + "/a/b/NOTES.TXT" }),
+                  ids);
     }
 
-    qt::Item c;
+    // Search below a folder. Changes are visible immediately.
+    unlink((ROOT_DIR() + "/a/b/NOTES.TXT").c_str());
+    touch(ROOT_DIR() + "/a/b/more-notes.txt");
     {
-        unique_ptr<ItemJob> job(a.copy(root, "c"));
+        unique_ptr<ItemJob> job(acc_.get(QString::fromStdString(ROOT_DIR() + "/a/b")));
         wait(job.get());
         ASSERT_EQ(ItemJob::Finished, job->status()) << job->error().errorString().toStdString();
-        c = job->item();
+        auto b = job->item();
+
+        unique_ptr<ItemListJob> list_job(b.search("*notes*"));
+        auto items = get_items(list_job.get());
+        ASSERT_EQ(1, items.size());
+        EXPECT_EQ(ROOT_DIR() + "/a/b/more-notes.txt", items.at(0).itemId().toStdString());
+        ASSERT_EQ(1, items.at(0).parentIds().size());
+        EXPECT_EQ(ROOT_DIR() + "/a/b", items.at(0).parentIds().at(0).toStdString());
+
+        unique_ptr<ItemListJob> empty_job(b.search(""));
+        wait(empty_job.get());
+        ASSERT_EQ(ItemListJob::Error, empty_job->status());
+        EXPECT_EQ("InvalidArgument: Item::search(): pattern cannot be empty",
+                  empty_job->error().errorString().toStdString());
+    }
+}
+
+TEST_F(LocalProviderTest, search_page_token)
+{
+    EnvVarGuard env("SF_LOCAL_PROVIDER_PAGE_SIZE", "2");
+    auto p = make_shared<LocalProvider>();
+
+    auto caps = p->capabilities();
+    EXPECT_NE(caps.end(), find(caps.begin(), caps.end(), string(unity::storage::capability::SEARCH)));
+
+    ASSERT_EQ(0, mkdir((ROOT_DIR() + "/sub").c_str(), 0755));
+    for (int i = 0; i < 3; ++i)
+    {
+        int fd = creat((ROOT_DIR() + "/sub/file" + to_string(i) + ".txt").c_str(), 0644);
+        ASSERT_GT(fd, 0);
+        close(fd);
+    }
+
+    provider::ItemList items;
+    string token;
+    tie(items, token) = p->search(ROOT_DIR(), "*.TXT", "", {}, provider::Context()).get();
+    ASSERT_EQ(2, items.size());
+    EXPECT_EQ(ROOT_DIR() + "/sub/file0.txt", items[0].item_id);
+    EXPECT_EQ(ROOT_DIR() + "/sub/file1.txt", items[1].item_id);
+    ASSERT_NE("", token);
+
+    // A search token is not good for list().
+    try
+    {
+        p->list(ROOT_DIR(), token, {}, provider::Context()).get();
+        FAIL();
+    }
+    catch (provider::InvalidArgumentException const& e)
+    {
+        EXPECT_EQ("InvalidArgumentException: list(): invalid or expired page token: \"" + token + "\"", string(e.what()));
+    }
+
+    tie(items, token) = p->search(ROOT_DIR(), "*.TXT", token, {}, provider::Context()).get();
+    ASSERT_EQ(1, items.size());
+    EXPECT_EQ(ROOT_DIR() + "/sub/file2.txt", items[0].item_id);
+    EXPECT_EQ("", token);
+
+    try
+    {
+        p->search(ROOT_DIR() + "/sub/file0.txt", "*", "", {}, provider::Context()).get();
+        FAIL();
+    }
+    catch (provider::InvalidArgumentException const& e)
+    {
+        EXPECT_EQ("InvalidArgumentException: search(): \"" + ROOT_DIR() + "/sub/file0.txt\" is not a folder",
+                  string(e.what()));
+    }
+
+    // With the index disabled, search() is not supported.
+    EnvVarGuard no_index("SF_LOCAL_PROVIDER_SEARCH_INDEX", "0");
+    p = make_shared<LocalProvider>();
+    caps = p->capabilities();
+    EXPECT_EQ(caps.end(), find(caps.begin(), caps.end(), string(unity::storage::capability::SEARCH)));
+    try
+    {
+        p->search(ROOT_DIR(), "*", "", {}, provider::Context()).get();
+        FAIL();
+    }
+    catch (provider::LogicException const& e)
+    {
+        EXPECT_STREQ("LogicException: search(): provider does not support search", e.what());
+    }
+}
+
+TEST_F(LocalProviderTest, search_corrupt_index)
+{
+    // A saved index with a count that doesn't fit is ignored, and we wait for the scan instead.
+    {
+        string const index = string("1") + '\0' + '\0' + "99999999999999999999999" + '\0';
+        int fd = creat((ROOT_DIR() + "/.storage-framework-index").c_str(), 0644);
+        ASSERT_GT(fd, 0);
+        ASSERT_EQ(ssize_t(index.size()), write(fd, index.data(), index.size()));
+        close(fd);
+    }
+    int fd = creat((ROOT_DIR() + "/notes.txt").c_str(), 0644);
+    ASSERT_GT(fd, 0);
+    close(fd);
+
+    auto p = make_shared<LocalProvider>();
+    provider::ItemList items;
+    string token;
+    tie(items, token) = p->search(ROOT_DIR(), "notes*", "", {}, provider::Context()).get();
+    ASSERT_EQ(1, items.size());
+    EXPECT_EQ(ROOT_DIR() + "/notes.txt", items[0].item_id);
+    EXPECT_EQ("", token);
+}
+
+TEST_F(LocalProviderTest, list_benchmark)
+{
+    using namespace unity::storage::metadata;
+
+    int const num_entries = 5000;
+    for (int i = 0; i < num_entries; ++i)
+    {
+        int fd = creat((ROOT_DIR() + "/file" + to_string(i)).c_str(), 0644);
+        ASSERT_GT(fd, 0);
+        close(fd);
+    }
+
+    auto p = make_shared<LocalProvider>();
+
+    // Name-only listing, as used by a file manager, and a listing with everything.
+    for (auto const& keys : vector<vector<string>>{ { DISPLAY_NAME }, { ALL } })
+    {
+        auto start = nanosecs_now();
+        int count = 0;
+        string token;
+        do
+        {
+            provider::ItemList items;
+            tie(items, token) = p->list(ROOT_DIR(), token, keys, provider::Context()).get();
+            count += items.size();
+        }
+        while (!token.empty());
+        auto nsecs = nanosecs_now() - start;
+
+        EXPECT_EQ(num_entries, count);
+        cout << "list() of " << num_entries << " files with keys " << keys[0] << ": "
+             << nsecs / 1000 << " usecs (" << nsecs / num_entries << " nsecs per entry)" << endl;
+    }
+}
+
+void make_hierarchy(string const& root_dir)
+{
+    // Make a small tree so we have something to test with for move() and copy().
+    ASSERT_EQ(0, mkdir((root_dir + "/a").c_str(), 0755));
+    ASSERT_EQ(0, mkdir((root_dir + "/a/b").c_str(), 0755));
+    string cmd = string("echo hello >") + root_dir + "/hello";
+    ASSERT_EQ(0, system(cmd.c_str()));
+    cmd = string("echo text >") + root_dir + "/a/foo.txt";
+    ASSERT_EQ(0, system(cmd.c_str()));
+    ASSERT_EQ(0, mknod((root_dir + "/a/pipe").c_str(), S_IFIFO | 06666, 0));
+    ASSERT_EQ(0, mkdir((root_dir + "/a/.storage-framework-").c_str(), 0755));
+    ASSERT_EQ(0, mkdir((root_dir + "/a/b/.storage-framework-").c_str(), 0755));
+    ASSERT_EQ(0, mknod((root_dir + "/a/b/pipe").c_str(), S_IFIFO | 06666, 0));
+}
+
+TEST_F(LocalProviderTest, move)
+{
+    using namespace unity::storage::qt;
+
+    set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
+
+    auto start_time = nanosecs_now();
+
+    make_hierarchy(ROOT_DIR());
+
+    auto root = get_root(acc_);
+
+    qt::Item hello;
+    {
+        unique_ptr<ItemListJob> job(root.lookup("hello"));
+        auto items = get_items(job.get());
+        ASSERT_EQ(ItemListJob::Finished, job->status()) << job->error().errorString().toStdString();
+        ASSERT_EQ(1, items.size());
+        hello = items.at(0);
+    }
+
+    struct stat st;
+    ASSERT_EQ(0, stat(hello.itemId().toStdString().c_str(), &st));
+    auto old_ino = st.st_ino;
+
+    // Check metadata.
+    EXPECT_EQ("hello", hello.name());
+    ASSERT_EQ(1, hello.parentIds().size());
+    EXPECT_EQ(ROOT_DIR(), hello.parentIds().at(0).toStdString());
+    EXPECT_EQ(Item::Type::File, hello.type());
+
+    ASSERT_EQ(6, hello.metadata().size());
+    auto free_space_bytes = hello.metadata().value("free_space_bytes").toLongLong();
+    cout << "free_space_bytes: " << free_space_bytes << endl;
+    EXPECT_GT(free_space_bytes, 0);
+    auto used_space_bytes = hello.metadata().value("used_space_bytes").toLongLong();
+    cout << "used_space_bytes: " << used_space_bytes << endl;
+    EXPECT_GT(used_space_bytes, 0);
+    auto content_type = hello.metadata().value("content_type").toString();
+    EXPECT_EQ("application/octet-stream", content_type);
+    auto writable = hello.metadata().value("writable").toBool();
+    EXPECT_TRUE(writable);
+    auto size = hello.metadata().value("size_in_bytes").toLongLong();
+    EXPECT_EQ(6, size);
+
+    // yyyy-mm-ddThh:mm:ssZ
+    string const date_time_fmt = "^[0-9][0-9][0-9][0-9]-[0-9][0-9]-[0-9][0-9]T[0-9][0-9]:[0-9][0-9]:[0-9][0-9]Z$";
+    string date_time = hello.metadata().value("last_modified_time").toString().toStdString();
+    cout << "last_modified_time: " << date_time << endl;
+    regex re(date_time_fmt);
+    EXPECT_TRUE(regex_match(date_time, re));
+
+    // Check that the file was modified in the last two seconds.
+    // Because the system clock can tick a lot more frequently than the file system time stamp,
+    // we allow the mtime to be up to one second *earlier* than the time we started the operation.
+    string mtime_str = hello.etag().toStdString();
+    char* end;
+    int64_t mtime = strtoll(mtime_str.c_str(), &end, 10);
+    EXPECT_LE(start_time - 1000000000, mtime);
+    EXPECT_LT(mtime, start_time + 2000000000);
+
+    // Move hello -> world
+    qt::Item world;
+    {
+        unique_ptr<ItemJob> job(hello.move(root, "world"));
+        wait(job.get());
+        ASSERT_EQ(ItemJob::Finished, job->status()) << job->error().errorString().toStdString();
+        world = job->item();
+    }
+    EXPECT_FALSE(boost::filesystem::exists(hello.itemId().toStdString()));
+    EXPECT_EQ(ROOT_DIR() + "/world", world.itemId().toStdString());
+
+    ASSERT_EQ(0, stat(world.itemId().toStdString().c_str(), &st));
+    auto new_ino = st.st_ino;
+    EXPECT_EQ(old_ino, new_ino);
+
+    // For coverage: try moving world -> a (which must fail)
+    unique_ptr<ItemJob> job(world.move(root, "a"));
+    wait(job.get());
+    ASSERT_EQ(ItemJob::Error, job->status()) << job->error().errorString().toStdString();
+    EXPECT_EQ(string("Exists: move(): \"") + ROOT_DIR() + "/a\" exists already",
+              job->error().errorString().toStdString());
+}
+
+TEST_F(LocalProviderTest, copy_file)
+{
+    using namespace unity::storage::qt;
+
+    set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
+
+    make_hierarchy(ROOT_DIR());
+
+    auto root = get_root(acc_);
+
+    // Copy hello -> world
+    qt::Item hello;
+    {
+        unique_ptr<ItemListJob> job(root.lookup("hello"));
+        auto items = get_items(job.get());
+        ASSERT_EQ(ItemListJob::Finished, job->status()) << job->error().errorString().toStdString();
+        ASSERT_EQ(1, items.size());
+        hello = items.at(0);
+    }
+
+    struct stat st;
+    ASSERT_EQ(0, stat(hello.itemId().toStdString().c_str(), &st));
+    auto old_ino = st.st_ino;
+
+    qt::Item world;
+    {
+        unique_ptr<ItemJob> job(hello.copy(root, "world"));
+        wait(job.get());
+        ASSERT_EQ(ItemJob::Finished, job->status()) << job->error().errorString().toStdString();
+        world = job->item();
+    }
+    EXPECT_TRUE(boost::filesystem::exists(hello.itemId().toStdString()));
+    EXPECT_EQ(ROOT_DIR() + "/world", world.itemId().toStdString());
+
+    ASSERT_EQ(0, stat(world.itemId().toStdString().c_str(), &st));
+    auto new_ino = st.st_ino;
+    EXPECT_NE(old_ino, new_ino);
+}
+
+TEST_F(LocalProviderTest, copy_tree)
+{
+    using namespace unity::storage::qt;
+    using namespace boost::filesystem;
+
+    set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
+
+    make_hierarchy(ROOT_DIR());
+
+    auto root = get_root(acc_);
+
+    // Copy a -> c
+    qt::Item a;
+    {
+        unique_ptr<ItemListJob> job(root.lookup("a"));
+        auto items = get_items(job.get());
+        ASSERT_EQ(ItemListJob::Finished, job->status()) << job->error().errorString().toStdString();
+        ASSERT_EQ(1, items.size());
+        a = items.at(0);
+    }
+
+    qt::Item c;
+    {
+        unique_ptr<ItemJob> job(a.copy(root, "c"));
+        wait(job.get());
+        ASSERT_EQ(ItemJob::Finished, job->status()) << job->error().errorString().toStdString();
+        c = job->item();
     }
     EXPECT_TRUE(exists(c.itemId().toStdString()));
 
@@ -659,6 +1252,123 @@ TEST_F(LocalProviderTest, copy_tree)
     }
 }
 
+TEST_F(LocalProviderTest, copy_tree_parallel)
+{
+    // Run with a single thread and a tiny queue, so the copy has to help out
+    // with queued tasks and copy some files itself.
+    EnvVarGuard threads("SF_LOCAL_PROVIDER_THREADS", "1");
+    EnvVarGuard depth("SF_LOCAL_PROVIDER_QUEUE_DEPTH", "1");
+    auto p = make_shared<LocalProvider>();
+
+    int const num_dirs = 10;
+    int const files_per_dir = 20;
+    for (int d = 0; d < num_dirs; ++d)
+    {
+        string const dir = ROOT_DIR() + "/src/dir" + to_string(d);
+        ASSERT_TRUE(boost::filesystem::create_directories(dir));
+        for (int f = 0; f < files_per_dir; ++f)
+        {
+            string cmd = "echo " + to_string(d * files_per_dir + f) + " >" + dir + "/file" + to_string(f);
+            ASSERT_EQ(0, system(cmd.c_str()));
+        }
+    }
+
+    auto start = nanosecs_now();
+    auto item = p->copy(ROOT_DIR() + "/src", ROOT_DIR(), "dst", {}, provider::Context()).get();
+    auto nsecs = nanosecs_now() - start;
+    cout << "copy() of " << num_dirs * files_per_dir << " files: " << nsecs / 1000 << " usecs" << endl;
+    EXPECT_EQ(ROOT_DIR() + "/dst", item.item_id);
+    EXPECT_EQ(provider::ItemType::folder, item.type);
+
+    for (int d = 0; d < num_dirs; ++d)
+    {
+        for (int f = 0; f < files_per_dir; ++f)
+        {
+            QFile file(QString::fromStdString(ROOT_DIR() + "/dst/dir" + to_string(d) + "/file" + to_string(f)));
+            ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+            EXPECT_EQ(to_string(d * files_per_dir + f) + "\n", file.readAll().toStdString());
+        }
+    }
+
+    // No temporary directory must be left behind.
+    int entries = 0;
+    for (boost::filesystem::directory_iterator it(ROOT_DIR()); it != boost::filesystem::directory_iterator(); ++it)
+    {
+        ++entries;
+    }
+    EXPECT_EQ(2, entries);
+}
+
+TEST_F(LocalProviderTest, cross_device_move)
+{
+    using namespace boost::filesystem;
+
+    // We can't count on having a second file system in the test environment,
+    // so we exercise the mover directly. It works just as well on a single file system.
+    auto p = make_shared<LocalProvider>();
+    CrossDeviceMover mover(*p);
+
+    ASSERT_EQ(0, system((string("echo hello >") + ROOT_DIR() + "/hello").c_str()));
+    auto item = mover.move("move()", ROOT_DIR() + "/hello", ROOT_DIR() + "/world", {}).get();
+    EXPECT_EQ(ROOT_DIR() + "/world", item.item_id);
+    EXPECT_EQ(provider::ItemType::file, item.type);
+    EXPECT_FALSE(exists(ROOT_DIR() + "/hello"));
+    {
+        QFile file(QString::fromStdString(ROOT_DIR() + "/world"));
+        ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+        EXPECT_EQ("hello\n", file.readAll().toStdString());
+    }
+
+    // A symlink is moved as a symlink.
+    ASSERT_EQ(0, symlink("world", (ROOT_DIR() + "/link").c_str()));
+    item = mover.move("move()", ROOT_DIR() + "/link", ROOT_DIR() + "/link2", {}).get();
+    EXPECT_FALSE(exists(symlink_status(ROOT_DIR() + "/link")));
+    ASSERT_TRUE(is_symlink(ROOT_DIR() + "/link2"));
+    EXPECT_EQ("world", read_symlink(ROOT_DIR() + "/link2").native());
+    EXPECT_TRUE(is_regular_file(ROOT_DIR() + "/world"));
+
+    // Nothing in a tree is lost: FIFOs, temporary directories and symlinks are recreated,
+    // and symlinks to directories are not followed.
+    make_hierarchy(ROOT_DIR());
+    ASSERT_EQ(0, symlink("../hello", (ROOT_DIR() + "/a/file_link").c_str()));
+    ASSERT_EQ(0, symlink("/", (ROOT_DIR() + "/a/b/root_link").c_str()));
+    item = mover.move("move()", ROOT_DIR() + "/a", ROOT_DIR() + "/c", {}).get();
+    EXPECT_EQ(ROOT_DIR() + "/c", item.item_id);
+    EXPECT_EQ(provider::ItemType::folder, item.type);
+    EXPECT_FALSE(exists(ROOT_DIR() + "/a"));
+    EXPECT_TRUE(exists(ROOT_DIR() + "/c/b"));
+    EXPECT_TRUE(exists(ROOT_DIR() + "/c/foo.txt"));
+    EXPECT_EQ(fifo_file, symlink_status(ROOT_DIR() + "/c/pipe").type());
+    EXPECT_EQ(fifo_file, symlink_status(ROOT_DIR() + "/c/b/pipe").type());
+    EXPECT_TRUE(is_directory(symlink_status(ROOT_DIR() + "/c/.storage-framework-")));
+    EXPECT_TRUE(is_directory(symlink_status(ROOT_DIR() + "/c/b/.storage-framework-")));
+    ASSERT_TRUE(is_symlink(ROOT_DIR() + "/c/file_link"));
+    EXPECT_EQ("../hello", read_symlink(ROOT_DIR() + "/c/file_link").native());
+    ASSERT_TRUE(is_symlink(ROOT_DIR() + "/c/b/root_link"));
+    EXPECT_EQ("/", read_symlink(ROOT_DIR() + "/c/b/root_link").native());
+
+    // After cancellation, a move must fail and leave the source alone.
+    mover.cancel();
+    try
+    {
+        mover.move("move()", ROOT_DIR() + "/c", ROOT_DIR() + "/d", {}).get();
+        FAIL();
+    }
+    catch (provider::CancelledException const& e)
+    {
+        EXPECT_EQ(string("CancelledException: move(): copy of \"") + ROOT_DIR() + "/c\" was cancelled", e.what());
+    }
+    EXPECT_TRUE(exists(ROOT_DIR() + "/c/foo.txt"));
+    EXPECT_FALSE(exists(ROOT_DIR() + "/d"));
+
+    int entries = 0;
+    for (directory_iterator it(ROOT_DIR()); it != directory_iterator(); ++it)
+    {
+        ++entries;
+    }
+    EXPECT_EQ(4, entries);  // hello, world, link2, and c, but no temporary directory
+}
+
 TEST_F(LocalProviderTest, download)
 {
     using namespace unity::storage::qt;
@@ -709,6 +1419,200 @@ TEST_F(LocalProviderTest, download)
     EXPECT_EQ(int64_t(large_contents.size()), n_read);
 }
 
+TEST_F(LocalProviderTest, download_large)
+{
+    using namespace unity::storage::qt;
+
+    set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
+
+    // Large enough to need many notifications, with contents that differ from block to block.
+    int64_t const size = 64 * 1024 * 1024 + 123;
+    string large_contents(size, '\0');
+    for (int64_t i = 0; i < size; ++i)
+    {
+        large_contents[i] = char((i * 7 + i / 4096) & 0xff);
+    }
+    string const full_path = ROOT_DIR() + "/foo.bin";
+    {
+        int fd = open(full_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0);
+        ASSERT_EQ(ssize_t(large_contents.size()), write(fd, &large_contents[0], large_contents.size())) << strerror(errno);
+        ASSERT_EQ(0, close(fd));
+    }
+
+    unique_ptr<ItemJob> job(acc_.get(QString::fromStdString(full_path)));
+    wait(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status()) << job->error().errorString().toStdString();
+
+    auto file = job->item();
+    unique_ptr<Downloader> downloader(file.createDownloader(Item::ErrorIfConflict));
+
+    int64_t n_read = 0;
+    bool contents_match = true;
+    QObject::connect(downloader.get(), &QIODevice::readyRead,
+                     [&]() {
+                         auto bytes = downloader->readAll();
+                         if (n_read + bytes.size() > size
+                             || large_contents.compare(n_read, bytes.size(), bytes.constData(), bytes.size()) != 0)
+                         {
+                             contents_match = false;
+                         }
+                         n_read += bytes.size();
+                     });
+    QSignalSpy read_finished_spy(downloader.get(), &QIODevice::readChannelFinished);
+    ASSERT_TRUE(read_finished_spy.wait(SIGNAL_WAIT_TIME));
+
+    QSignalSpy status_spy(downloader.get(), &Downloader::statusChanged);
+    downloader->close();
+    while (downloader->status() == Downloader::Ready)
+    {
+        ASSERT_TRUE(status_spy.wait(SIGNAL_WAIT_TIME));
+    }
+    ASSERT_EQ(Downloader::Finished, downloader->status()) << downloader->error().errorString().toStdString();
+
+    EXPECT_EQ(size, n_read);
+    EXPECT_TRUE(contents_match);
+}
+
+TEST_F(LocalProviderTest, download_cancel)
+{
+    using namespace unity::storage::qt;
+
+    set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
+
+    // Much larger than the socket buffer, so the download is still in progress when we cancel.
+    int const segments = 10000;
+    string const full_path = ROOT_DIR() + "/foo.txt";
+    {
+        int fd = open(full_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0);
+        for (int i = 0; i < segments; i++)
+        {
+            ASSERT_EQ(ssize_t(file_contents.size()), write(fd, &file_contents[0], file_contents.size())) << strerror(errno);
+        }
+        ASSERT_EQ(0, close(fd));
+    }
+
+    unique_ptr<ItemJob> job(acc_.get(QString::fromStdString(full_path)));
+    wait(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status()) << job->error().errorString().toStdString();
+    auto file = job->item();
+
+    {
+        unique_ptr<Downloader> downloader(file.createDownloader(Item::ErrorIfConflict));
+        QSignalSpy ready_read_spy(downloader.get(), &QIODevice::readyRead);
+        ASSERT_TRUE(ready_read_spy.wait(SIGNAL_WAIT_TIME));
+        EXPECT_GT(downloader->bytesAvailable(), 0);
+
+        // Cancel after the first chunk, without reading anything.
+        QSignalSpy status_spy(downloader.get(), &Downloader::statusChanged);
+        downloader->cancel();
+        while (downloader->status() != Downloader::Cancelled)
+        {
+            ASSERT_TRUE(status_spy.wait(SIGNAL_WAIT_TIME));
+        }
+        EXPECT_EQ(StorageError::Cancelled, downloader->error().type());
+    }
+
+    // The provider is still in good shape: the next download of the same file completes.
+    {
+        unique_ptr<Downloader> downloader(file.createDownloader(Item::ErrorIfConflict));
+        int64_t n_read = 0;
+        QObject::connect(downloader.get(), &QIODevice::readyRead,
+                         [&]() {
+                             n_read += downloader->readAll().size();
+                         });
+        QSignalSpy read_finished_spy(downloader.get(), &QIODevice::readChannelFinished);
+        ASSERT_TRUE(read_finished_spy.wait(SIGNAL_WAIT_TIME));
+
+        QSignalSpy status_spy(downloader.get(), &Downloader::statusChanged);
+        downloader->close();
+        while (downloader->status() == Downloader::Ready)
+        {
+            ASSERT_TRUE(status_spy.wait(SIGNAL_WAIT_TIME));
+        }
+        ASSERT_EQ(Downloader::Finished, downloader->status()) << downloader->error().errorString().toStdString();
+        EXPECT_EQ(int64_t(file_contents.size()) * segments, n_read);
+    }
+}
+
+TEST_F(LocalProviderTest, download_range)
+{
+    using namespace unity::storage::qt;
+
+    set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
+
+    int const segments = 1000;
+    string large_contents;
+    for (int i = 0; i < segments; i++)
+    {
+        large_contents += file_contents;
+    }
+    string const full_path = ROOT_DIR() + "/foo.txt";
+    {
+        int fd = open(full_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0);
+        ASSERT_EQ(ssize_t(large_contents.size()), write(fd, &large_contents[0], large_contents.size())) << strerror(errno);
+        ASSERT_EQ(0, close(fd));
+    }
+
+    unique_ptr<ItemJob> job(acc_.get(QString::fromStdString(full_path)));
+    wait(job.get());
+    EXPECT_TRUE(job->isValid());
+    auto file = job->item();
+
+    auto download = [&](qint64 offset, qint64 length)
+    {
+        unique_ptr<Downloader> downloader(file.createDownloader(Item::ErrorIfConflict, offset, length));
+        string data;
+        QObject::connect(downloader.get(), &QIODevice::readyRead,
+                         [&]() {
+                             data += downloader->readAll().toStdString();
+                         });
+        QSignalSpy read_finished_spy(downloader.get(), &QIODevice::readChannelFinished);
+        EXPECT_TRUE(read_finished_spy.wait(SIGNAL_WAIT_TIME));
+
+        QSignalSpy status_spy(downloader.get(), &Downloader::statusChanged);
+        downloader->close();
+        while (downloader->status() == Downloader::Ready)
+        {
+            EXPECT_TRUE(status_spy.wait(SIGNAL_WAIT_TIME));
+        }
+        EXPECT_EQ(Downloader::Finished, downloader->status()) << downloader->error().errorString().toStdString();
+        return data;
+    };
+
+    EXPECT_EQ(large_contents.substr(1000, 5000), download(1000, 5000));
+    EXPECT_EQ(large_contents.substr(1000), download(1000, -1));
+    EXPECT_EQ(large_contents.substr(large_contents.size() - 10), download(large_contents.size() - 10, 1000));
+    EXPECT_EQ("", download(large_contents.size(), 1000));
+
+    // Offset beyond the end of the file.
+    {
+        unique_ptr<Downloader> downloader(file.createDownloader(Item::ErrorIfConflict, large_contents.size() + 1, 1));
+        QSignalSpy spy(downloader.get(), &Downloader::statusChanged);
+        while (downloader->status() == Downloader::Loading)
+        {
+            ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+        }
+        ASSERT_EQ(Downloader::Error, downloader->status());
+        EXPECT_EQ(string("download(): invalid offset ") + to_string(large_contents.size() + 1) + " for \""
+                  + full_path + "\" of size " + to_string(large_contents.size()),
+                  downloader->error().message().toStdString());
+    }
+
+    // Negative offset is rejected by the client.
+    {
+        unique_ptr<Downloader> downloader(file.createDownloader(Item::ErrorIfConflict, -1, 1));
+        EXPECT_EQ(Downloader::Error, downloader->status());
+        EXPECT_EQ(StorageError::InvalidArgument, downloader->error().type());
+    }
+
+    auto p = make_shared<LocalProvider>();
+    auto caps = p->capabilities();
+    EXPECT_NE(caps.end(), find(caps.begin(), caps.end(), string(unity::storage::capability::DOWNLOAD_RANGE)));
+}
+
 TEST_F(LocalProviderTest, download_short_read)
 {
     using namespace unity::storage::qt;
@@ -1205,36 +2109,178 @@ TEST_F(LocalProviderTest, upload_wrong_file_type)
 
     try
     {
-        LocalUploadJob(p, dir, 0, "");
-        FAIL();
+        LocalUploadJob(p, dir, 0, "");
+        FAIL();
+    }
+    catch (provider::InvalidArgumentException const& e)
+    {
+        EXPECT_EQ(string("InvalidArgumentException: update(): \"" + dir + "\" is not a file"), e.what());
+    }
+}
+
+TEST_F(LocalProviderTest, upload_root_noperm)
+{
+    // Force an error in prepare_channels when creating temp file.
+
+    auto p = make_shared<LocalProvider>();
+
+    ASSERT_EQ(0, chmod(ROOT_DIR().c_str(), 0644));
+
+    try
+    {
+        LocalUploadJob(p, ROOT_DIR(), "name", 0, true);
+        chmod(ROOT_DIR().c_str(), 0755);
+        FAIL();
+    }
+    catch (provider::ResourceException const& e)
+    {
+        EXPECT_EQ(string("ResourceException: create_file(): cannot create temp file \"") + ROOT_DIR()
+                         + "/.storage-framework-%%%%-%%%%-%%%%-%%%%\": Invalid argument",
+                  e.what());
+    }
+    chmod(ROOT_DIR().c_str(), 0755);
+}
+
+TEST_F(LocalProviderTest, upload_preallocated)
+{
+    using namespace unity::storage::qt;
+
+    // Not all file systems can preallocate. Without it, we only check the contents.
+    bool can_preallocate;
+    {
+        string const probe = ROOT_DIR() + "/probe";
+        int fd = open(probe.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0);
+        can_preallocate = fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, 4096) == 0;
+        close(fd);
+        unlink(probe.c_str());
+    }
+
+    // Resumable, so the temp file has a name we can look at.
+    EnvVarGuard env("SF_LOCAL_PROVIDER_UPLOAD_TTL", "60");
+    set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
+
+    // Several times the pipe size, so the data takes more than one splice().
+    int64_t const size = 8 * 1024 * 1024 + 17;
+    string contents(size, '\0');
+    for (int64_t i = 0; i < size; ++i)
+    {
+        contents[i] = char((i * 13 + i / 1000) & 0xff);
+    }
+
+    {
+        auto p = make_shared<LocalProvider>();
+        LocalUploadJob job(p, ROOT_DIR(), "foo.bin", size, true);
+        string const partial = ROOT_DIR() + "/.storage-framework-upload-" + job.upload_id();
+        struct stat st;
+        ASSERT_EQ(0, stat(partial.c_str(), &st)) << strerror(errno);
+        EXPECT_EQ(0, st.st_size);  // The space is reserved, but the size doesn't change.
+        if (can_preallocate)
+        {
+            EXPECT_GE(int64_t(st.st_blocks) * 512, size);
+        }
+        job.cancel().get();
+    }
+
+    auto root = get_root(acc_);
+    unique_ptr<Uploader> uploader(root.createFile("foo.bin", Item::ErrorIfConflict, size, "application/octet-stream"));
+
+    int64_t const chunk_size = 256 * 1024;
+    int64_t written = 0;
+    QTimer timer;
+    timer.setSingleShot(false);
+    timer.setInterval(0);
+    QObject::connect(&timer, &QTimer::timeout, [&] {
+            auto const n = min(chunk_size, size - written);
+            uploader->write(&contents[written], n);
+            written += n;
+            if (written == size)
+            {
+                timer.stop();
+                uploader->close();
+            }
+        });
+
+    QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+    while (uploader->status() != Uploader::Ready)
+    {
+        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
     }
-    catch (provider::InvalidArgumentException const& e)
+    timer.start();
+    while (uploader->status() != Uploader::Finished)
     {
-        EXPECT_EQ(string("InvalidArgumentException: update(): \"" + dir + "\" is not a file"), e.what());
+        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME)) << uploader->error().errorString().toStdString();
     }
-}
+    EXPECT_EQ(size, uploader->item().sizeInBytes());
 
-TEST_F(LocalProviderTest, upload_root_noperm)
-{
-    // Force an error in prepare_channels when creating temp file.
+    string const full_path = ROOT_DIR() + "/foo.bin";
+    int fd = open(full_path.c_str(), O_RDONLY);
+    ASSERT_GT(fd, 0);
+    string buf(size + 1, '\0');
+    int64_t n_read = 0;
+    ssize_t n;
+    while ((n = read(fd, &buf[n_read], buf.size() - n_read)) > 0)
+    {
+        n_read += n;
+    }
+    close(fd);
+    ASSERT_EQ(size, n_read);
+    buf.resize(size);
+    EXPECT_TRUE(contents == buf);
 
-    auto p = make_shared<LocalProvider>();
+    // The reserved space never shows up in the size.
+    struct stat st;
+    ASSERT_EQ(0, stat(full_path.c_str(), &st));
+    EXPECT_EQ(size, st.st_size);
+}
 
-    ASSERT_EQ(0, chmod(ROOT_DIR().c_str(), 0644));
+TEST_F(LocalProviderTest, upload_no_space)
+{
+    // More than the file system has left.
+    struct statvfs sv;
+    ASSERT_EQ(0, statvfs(ROOT_DIR().c_str(), &sv));
+    int64_t const size = int64_t(sv.f_bavail) * sv.f_frsize + 1024 * 1024 * 1024;
 
-    try
+    // Not all file systems can preallocate, and those that can't don't report ENOSPC up front.
     {
-        LocalUploadJob(p, ROOT_DIR(), "name", 0, true);
-        chmod(ROOT_DIR().c_str(), 0755);
-        FAIL();
+        string const probe = ROOT_DIR() + "/probe";
+        int fd = open(probe.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0);
+        int rc = fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size);
+        int err = errno;
+        close(fd);
+        unlink(probe.c_str());
+        if (rc == 0 || err != ENOSPC)
+        {
+            cerr << "upload_no_space test skipped: fallocate() does not fail with ENOSPC in " << ROOT_DIR() << endl;
+            return;
+        }
     }
-    catch (provider::ResourceException const& e)
+
+    // Without and with resumable uploads, which use a named temp file.
+    for (auto ttl : { "0", "60" })
     {
-        EXPECT_EQ(string("ResourceException: create_file(): cannot create temp file \"") + ROOT_DIR()
-                         + "/.storage-framework-%%%%-%%%%-%%%%-%%%%\": Invalid argument",
-                  e.what());
+        EnvVarGuard env("SF_LOCAL_PROVIDER_UPLOAD_TTL", ttl);
+        auto p = make_shared<LocalProvider>();
+        try
+        {
+            LocalUploadJob(p, ROOT_DIR(), "foo.bin", size, true);
+            FAIL();
+        }
+        catch (provider::QuotaException const& e)
+        {
+            string const msg = e.what();
+            EXPECT_TRUE(boost::starts_with(msg, "QuotaException: create_file(): ")) << msg;
+            EXPECT_NE(string::npos, msg.find("fallocate")) << msg;
+        }
+
+        // The temp file is gone.
+        for (boost::filesystem::directory_iterator it(ROOT_DIR()); it != boost::filesystem::directory_iterator(); ++it)
+        {
+            EXPECT_FALSE(boost::starts_with(it->path().filename().native(), ".storage-framework-upload-"))
+                << it->path().native();
+        }
     }
-    chmod(ROOT_DIR().c_str(), 0755);
 }
 
 TEST_F(LocalProviderTest, sanitize)
@@ -1300,6 +2346,23 @@ TEST_F(LocalProviderTest, throw_if_not_valid)
     {
         EXPECT_STREQ("InvalidArgumentException: create_file(): invalid id: \"/bin\"", e.what());
     }
+
+    // Paths that lead to the right place, but are not canonical, are rejected, too.
+    ASSERT_EQ(0, mkdir((ROOT_DIR() + "/sub").c_str(), 0755));
+    ASSERT_EQ(0, symlink((ROOT_DIR() + "/sub").c_str(), (ROOT_DIR() + "/link").c_str()));
+    for (auto const& id : { ROOT_DIR() + "/sub/../sub", ROOT_DIR() + "/./sub", ROOT_DIR() + "//sub",
+                            ROOT_DIR() + "/sub/", ROOT_DIR() + "/link" })
+    {
+        try
+        {
+            LocalUploadJob(p, id, "a", 0, true);
+            FAIL();
+        }
+        catch (provider::InvalidArgumentException const& e)
+        {
+            EXPECT_EQ("InvalidArgumentException: create_file(): invalid id: \"" + id + "\"", e.what());
+        }
+    }
 }
 
 TEST_F(LocalProviderTest, create_file)
@@ -1341,6 +2404,162 @@ TEST_F(LocalProviderTest, create_file)
     EXPECT_EQ(int64_t(file_contents.size() * segments), file.sizeInBytes());
 }
 
+TEST_F(LocalProviderTest, md5)
+{
+    using namespace unity::storage::qt;
+
+    // The digest is stored in an extended attribute, which not all file systems support.
+    {
+        string const probe = ROOT_DIR() + "/probe";
+        int fd = open(probe.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0);
+        int rc = fsetxattr(fd, "user.probe", "x", 1, 0);
+        close(fd);
+        unlink(probe.c_str());
+        if (rc == -1 && errno == ENOTSUP)
+        {
+            cerr << "md5 test skipped: no user extended attributes in " << ROOT_DIR() << endl;
+            return;
+        }
+    }
+
+    set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
+
+    int const segments = 50;
+    string contents;
+    for (int i = 0; i < segments; i++)
+    {
+        contents += file_contents;
+    }
+    auto root = get_root(acc_);
+    unique_ptr<Uploader> uploader(root.createFile("foo.txt", Item::ErrorIfConflict, contents.size(), "text/plain"));
+    QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+    while (uploader->status() != Uploader::Ready)
+    {
+        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+    }
+    uploader->write(&contents[0], contents.size());
+    uploader->close();
+    while (uploader->status() != Uploader::Finished)
+    {
+        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+    }
+
+    // The upload was spliced into the file, so the digest is computed in the background.
+    gchar* expected = g_compute_checksum_for_data(G_CHECKSUM_MD5,
+                                                  reinterpret_cast<guchar const*>(contents.data()),
+                                                  contents.size());
+    string const expected_md5 = expected;
+    g_free(expected);
+
+    auto p = make_shared<LocalProvider>();
+    string const upload_path = ROOT_DIR() + "/foo.txt";
+    auto item = p->metadata(upload_path, { metadata::MD5 }, provider::Context()).get();
+    for (int i = 0; i < 1000 && item.metadata.count(metadata::MD5) == 0; ++i)
+    {
+        this_thread::sleep_for(chrono::milliseconds(10));
+        item = p->metadata(upload_path, { metadata::MD5 }, provider::Context()).get();
+    }
+    ASSERT_EQ(1, item.metadata.count(metadata::MD5));
+    EXPECT_EQ(expected_md5, boost::get<string>(item.metadata.at(metadata::MD5)));
+
+    // A file written behind our back is hashed in the background.
+    string const hello_path = ROOT_DIR() + "/hello";
+    ASSERT_EQ(0, system(("echo hello >" + hello_path).c_str()));
+    item = p->metadata(hello_path, { metadata::MD5 }, provider::Context()).get();
+    EXPECT_EQ(0, item.metadata.count(metadata::MD5));
+    for (int i = 0; i < 1000 && item.metadata.count(metadata::MD5) == 0; ++i)
+    {
+        this_thread::sleep_for(chrono::milliseconds(10));
+        item = p->metadata(hello_path, { metadata::MD5 }, provider::Context()).get();
+    }
+    ASSERT_EQ(1, item.metadata.count(metadata::MD5));
+    EXPECT_EQ("b1946ac92492d2347c6235b4d2611184", boost::get<string>(item.metadata.at(metadata::MD5)));
+
+    // Once the file changes, the stored digest is no longer returned.
+    sleep(1);  // Make sure mtime changes.
+    ASSERT_EQ(0, system(("echo goodbye >" + hello_path).c_str()));
+    item = p->metadata(hello_path, { metadata::MD5 }, provider::Context()).get();
+    EXPECT_EQ(0, item.metadata.count(metadata::MD5));
+
+    // The digest must be asked for by name.
+    item = p->metadata(upload_path, { metadata::ALL }, provider::Context()).get();
+    EXPECT_EQ(0, item.metadata.count(metadata::MD5));
+}
+
+TEST_F(LocalProviderTest, folder_usage)
+{
+    using namespace unity::storage::metadata;
+
+    ASSERT_EQ(0, mkdir((ROOT_DIR() + "/a").c_str(), 0755));
+    ASSERT_EQ(0, mkdir((ROOT_DIR() + "/a/b").c_str(), 0755));
+    ASSERT_EQ(0, system(("echo hello >" + ROOT_DIR() + "/a/hello").c_str()));
+    ASSERT_EQ(0, system(("echo goodbye >" + ROOT_DIR() + "/a/b/goodbye").c_str()));
+    // Reserved names are not counted.
+    ASSERT_EQ(0, system(("echo hidden >" + ROOT_DIR() + "/a/.storage-framework-x").c_str()));
+
+    auto p = make_shared<LocalProvider>();
+    ASSERT_NE(nullptr, p->usage_cache());
+    p->usage_cache()->wait_until_idle();
+
+    auto usage = [&p](string const& id)
+    {
+        auto item = p->metadata(id, { CHILD_COUNT, RECURSIVE_SIZE_IN_BYTES }, provider::Context()).get();
+        return make_pair(boost::get<int64_t>(item.metadata.at(CHILD_COUNT)),
+                         boost::get<int64_t>(item.metadata.at(RECURSIVE_SIZE_IN_BYTES)));
+    };
+    typedef pair<int64_t, int64_t> Usage;
+
+    EXPECT_EQ(Usage(1, 14), usage(ROOT_DIR()));
+    EXPECT_EQ(Usage(2, 14), usage(ROOT_DIR() + "/a"));
+    EXPECT_EQ(Usage(1, 8), usage(ROOT_DIR() + "/a/b"));
+
+    // Changes made through the provider.
+    p->copy(ROOT_DIR() + "/a", ROOT_DIR(), "c", {}, provider::Context()).get();
+    p->usage_cache()->wait_until_idle();
+    EXPECT_EQ(Usage(2, 28), usage(ROOT_DIR()));
+    EXPECT_EQ(Usage(2, 14), usage(ROOT_DIR() + "/c"));
+
+    p->move(ROOT_DIR() + "/c/hello", ROOT_DIR() + "/a/b", "hello", {}, provider::Context()).get();
+    EXPECT_EQ(Usage(2, 28), usage(ROOT_DIR()));
+    EXPECT_EQ(Usage(1, 8), usage(ROOT_DIR() + "/c"));
+    EXPECT_EQ(Usage(2, 20), usage(ROOT_DIR() + "/a"));
+    EXPECT_EQ(Usage(2, 14), usage(ROOT_DIR() + "/a/b"));
+
+    p->delete_item(ROOT_DIR() + "/a/b", provider::Context()).get();
+    EXPECT_EQ(Usage(2, 14), usage(ROOT_DIR()));
+    EXPECT_EQ(Usage(1, 6), usage(ROOT_DIR() + "/a"));
+
+    p->create_folder(ROOT_DIR() + "/a", "empty", {}, provider::Context()).get();
+    p->usage_cache()->wait_until_idle();
+    EXPECT_EQ(Usage(0, 0), usage(ROOT_DIR() + "/a/empty"));
+    EXPECT_EQ(Usage(2, 6), usage(ROOT_DIR() + "/a"));
+
+    // Changes made behind our back show up once someone asks about the folder.
+    ASSERT_EQ(0, system(("echo more >" + ROOT_DIR() + "/a/more").c_str()));
+    EXPECT_EQ(Usage(3, 11), usage(ROOT_DIR() + "/a"));
+    EXPECT_EQ(Usage(2, 19), usage(ROOT_DIR()));
+
+    // The usage must be asked for by name.
+    auto item = p->metadata(ROOT_DIR(), { ALL }, provider::Context()).get();
+    EXPECT_EQ(0, item.metadata.count(CHILD_COUNT));
+    EXPECT_EQ(0, item.metadata.count(RECURSIVE_SIZE_IN_BYTES));
+
+    // Files don't have it.
+    item = p->metadata(ROOT_DIR() + "/a/more", { CHILD_COUNT, RECURSIVE_SIZE_IN_BYTES }, provider::Context()).get();
+    EXPECT_EQ(0, item.metadata.count(CHILD_COUNT));
+    EXPECT_EQ(0, item.metadata.count(RECURSIVE_SIZE_IN_BYTES));
+
+    {
+        EnvVarGuard env("SF_LOCAL_PROVIDER_USAGE_CACHE", "0");
+        p = make_shared<LocalProvider>();
+        EXPECT_EQ(nullptr, p->usage_cache());
+        item = p->metadata(ROOT_DIR(), { CHILD_COUNT, RECURSIVE_SIZE_IN_BYTES }, provider::Context()).get();
+        EXPECT_EQ(0, item.metadata.count(CHILD_COUNT));
+        EXPECT_EQ(0, item.metadata.count(RECURSIVE_SIZE_IN_BYTES));
+    }
+}
+
 TEST_F(LocalProviderTest, create_file_ignore_conflict)
 {
     using namespace unity::storage::qt;
@@ -1452,6 +2671,515 @@ TEST_F(LocalProviderTest, create_file_created_during_upload)
               uploader->error().message().toStdString());
 }
 
+TEST_F(LocalProviderTest, resume_upload)
+{
+    EnvVarGuard env("SF_LOCAL_PROVIDER_UPLOAD_TTL", "60");
+    set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
+
+    ProviderClient client(bus_name(), object_path(), connection());
+    {
+        auto reply = client.Capabilities();
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+        EXPECT_TRUE(reply.value().contains(QString(unity::storage::capability::RESUMABLE_UPLOAD)));
+    }
+
+    // Small enough to fit into the socket buffer, so we can write without blocking the provider.
+    int const segments = 50;
+    string contents;
+    for (int i = 0; i < segments; i++)
+    {
+        contents += file_contents;
+    }
+    int64_t const half = contents.size() / 2;
+
+    QDBusServiceWatcher service_watcher;
+    service_watcher.setConnection(*service_connection_);
+    service_watcher.setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    QSignalSpy service_spy(&service_watcher, &QDBusServiceWatcher::serviceUnregistered);
+
+    // Send half the file and disconnect without finishing.
+    QString upload_id;
+    {
+        QDBusConnection connection2 = QDBusConnection::connectToBus(dbus_->busAddress(), "resume-upload");
+        QDBusConnection::disconnectFromBus("resume-upload");
+        service_watcher.addWatchedService(connection2.baseService());
+        ProviderClient client2(bus_name(), object_path(), connection2);
+        auto reply = client2.CreateFile(QString::fromStdString(ROOT_DIR()), "foo.txt", contents.size(),
+                                        "text/plain", false, QList<QString>());
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+        upload_id = reply.argumentAt<0>();
+        QDBusUnixFileDescriptor socket = reply.argumentAt<1>();
+        ASSERT_EQ(half, write(socket.fileDescriptor(), &contents[0], half));
+    }
+    if (service_spy.count() == 0)
+    {
+        ASSERT_TRUE(service_spy.wait());
+    }
+    QTimer timer;
+    timer.setSingleShot(true);
+    timer.setInterval(100);
+    timer.start();
+    QSignalSpy timer_spy(&timer, &QTimer::timeout);
+    ASSERT_TRUE(timer_spy.wait());
+
+    // The partial file survives, but is not visible.
+    {
+        unique_ptr<qt::ItemListJob> job(get_root(acc_).list());
+        EXPECT_EQ(0, get_items(job.get()).size());
+    }
+
+    // Send the rest.
+    {
+        auto reply = client.ResumeUpload(upload_id, QList<QString>());
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+        EXPECT_EQ(half, reply.argumentAt<0>());
+        QDBusUnixFileDescriptor socket = reply.argumentAt<1>();
+        ASSERT_EQ(ssize_t(contents.size() - half), write(socket.fileDescriptor(), &contents[half], contents.size() - half));
+        ASSERT_EQ(0, shutdown(socket.fileDescriptor(), SHUT_WR));
+
+        // The upload cannot be resumed a second time while it is in progress.
+        auto reply2 = client.ResumeUpload(upload_id, QList<QString>());
+        wait_for(reply2);
+        ASSERT_TRUE(reply2.isError());
+        EXPECT_EQ(string("resume_upload(): upload \"") + upload_id.toStdString() + "\" is still in progress",
+                  reply2.error().message().toStdString());
+    }
+    {
+        auto reply = client.FinishUpload(upload_id);
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+        EXPECT_EQ("foo.txt", reply.value().name);
+    }
+
+    string const full_path = ROOT_DIR() + "/foo.txt";
+    int fd = open(full_path.c_str(), O_RDONLY);
+    ASSERT_GT(fd, 0);
+    string buf(contents.size() + 1, '\0');
+    EXPECT_EQ(ssize_t(contents.size()), read(fd, &buf[0], buf.size()));
+    close(fd);
+    buf.resize(contents.size());
+    EXPECT_EQ(contents, buf);
+
+    // The manifest is gone once the upload has finished.
+    {
+        auto reply = client.ResumeUpload(upload_id, QList<QString>());
+        wait_for(reply);
+        ASSERT_TRUE(reply.isError());
+        EXPECT_EQ(string("resume_upload(): no such upload: \"") + upload_id.toStdString() + "\"",
+                  reply.error().message().toStdString());
+    }
+
+    // An upload that was cancelled explicitly cannot be resumed.
+    {
+        auto reply = client.Update(QString::fromStdString(full_path), contents.size(), "", QList<QString>());
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+        upload_id = reply.argumentAt<0>();
+
+        auto cancel_reply = client.CancelUpload(upload_id);
+        wait_for(cancel_reply);
+        ASSERT_TRUE(cancel_reply.isValid()) << cancel_reply.error().message().toStdString();
+
+        auto resume_reply = client.ResumeUpload(upload_id, QList<QString>());
+        wait_for(resume_reply);
+        ASSERT_TRUE(resume_reply.isError());
+        EXPECT_EQ(string("resume_upload(): no such upload: \"") + upload_id.toStdString() + "\"",
+                  resume_reply.error().message().toStdString());
+    }
+
+    // Only foo.txt and the (reserved) uploads directory remain.
+    set<string> names;
+    for (auto const& entry : boost::filesystem::directory_iterator(ROOT_DIR()))
+    {
+        names.insert(entry.path().filename().native());
+    }
+    EXPECT_EQ(set<string>({ "foo.txt", ".storage-framework-uploads" }), names);
+    EXPECT_TRUE(boost::filesystem::is_empty(ROOT_DIR() + "/.storage-framework-uploads"));
+}
+
+TEST(ContentTypeCache, basic)
+{
+    QTemporaryDir tmp_dir(TEST_DIR "/data.XXXXXX");
+    ASSERT_TRUE(tmp_dir.isValid());
+    string const dir = tmp_dir.path().toStdString();
+
+    auto make_file = [](string const& path)
+    {
+        int fd = creat(path.c_str(), 0644);
+        ASSERT_GT(fd, 0);
+        close(fd);
+    };
+
+    ContentTypeCache cache(2);
+    struct stat st;
+
+    // Directories and well-known extensions don't go to GIO.
+    ASSERT_EQ(0, stat(dir.c_str(), &st));
+    EXPECT_EQ("inode/directory", cache.get(dir, st));
+    make_file(dir + "/photo.JPG");
+    ASSERT_EQ(0, stat((dir + "/photo.JPG").c_str(), &st));
+    EXPECT_EQ("image/jpeg", cache.get(dir + "/photo.JPG", st));
+    auto stats = cache.stats();
+    EXPECT_EQ(2, stats.fast_path);
+    EXPECT_EQ(0, stats.misses);
+    EXPECT_EQ(0, stats.size);
+
+    // Everything else goes to GIO once.
+    make_file(dir + "/hello");
+    ASSERT_EQ(0, stat((dir + "/hello").c_str(), &st));
+    EXPECT_EQ("application/octet-stream", cache.get(dir + "/hello", st));
+    EXPECT_EQ("application/octet-stream", cache.get(dir + "/hello", st));
+    stats = cache.stats();
+    EXPECT_EQ(1, stats.misses);
+    EXPECT_EQ(1, stats.hits);
+    EXPECT_EQ(1, stats.size);
+
+    // Same inode and mtime, but different name.
+    ASSERT_EQ(0, rename((dir + "/hello").c_str(), (dir + "/hello2").c_str()));
+    EXPECT_EQ("application/octet-stream", cache.get(dir + "/hello2", st));
+    stats = cache.stats();
+    EXPECT_EQ(2, stats.misses);
+    EXPECT_EQ(1, stats.size);
+
+    // The cache does not grow beyond its limit.
+    for (int i = 0; i < 3; ++i)
+    {
+        string const path = dir + "/file" + to_string(i);
+        make_file(path);
+        ASSERT_EQ(0, stat(path.c_str(), &st));
+        cache.get(path, st);
+    }
+    stats = cache.stats();
+    EXPECT_EQ(5, stats.misses);
+    EXPECT_EQ(2, stats.size);
+}
+
+TEST(MetadataCache, basic)
+{
+    QTemporaryDir tmp_dir(TEST_DIR "/data.XXXXXX");
+    ASSERT_TRUE(tmp_dir.isValid());
+    string const dir = tmp_dir.path().toStdString();
+
+    auto write_file = [](string const& path, string const& contents)
+    {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ASSERT_GT(fd, 0);
+        ASSERT_EQ(ssize_t(contents.size()), write(fd, contents.data(), contents.size()));
+        close(fd);
+    };
+
+    write_file(dir + "/a", "x");
+    ASSERT_EQ(0, mkdir((dir + "/sub").c_str(), 0755));
+
+    MetadataCache cache(1024 * 1024, 10);
+    struct stat st;
+
+    // The listing fills in the stat() results for the files, but not the folders.
+    auto listing = cache.list("list()", dir);
+    ASSERT_NE(nullptr, listing);
+    EXPECT_EQ((set<string>{ "a", "sub" }), set<string>(listing->begin(), listing->end()));
+    ASSERT_TRUE(cache.stat(dir + "/a", st));
+    EXPECT_EQ(1, st.st_size);
+    ASSERT_TRUE(cache.stat(dir + "/sub", st));
+    EXPECT_TRUE(S_ISDIR(st.st_mode));
+    EXPECT_EQ(listing, cache.list("list()", dir));
+    auto stats = cache.stats();
+    EXPECT_EQ(1, stats.hits);
+    EXPECT_EQ(1, stats.misses);
+    EXPECT_EQ(1, stats.list_hits);
+    EXPECT_EQ(1, stats.list_misses);
+    EXPECT_EQ(1, stats.watches);
+
+    // Changes made behind our back are seen immediately.
+    write_file(dir + "/a", "xyz");
+    ASSERT_TRUE(cache.stat(dir + "/a", st));
+    EXPECT_EQ(3, st.st_size);
+    write_file(dir + "/b", "");
+    listing = cache.list("list()", dir);
+    EXPECT_EQ((set<string>{ "a", "b", "sub" }), set<string>(listing->begin(), listing->end()));
+    ASSERT_EQ(0, unlink((dir + "/a").c_str()));
+    EXPECT_FALSE(cache.stat(dir + "/a", st));
+    EXPECT_EQ(ENOENT, errno);
+    EXPECT_LT(0, cache.stats().invalidations);
+
+    // Renaming a folder drops what we know about the paths below it.
+    write_file(dir + "/sub/f", "abc");
+    ASSERT_EQ(1u, cache.list("list()", dir + "/sub")->size());
+    ASSERT_TRUE(cache.stat(dir + "/sub/f", st));
+    ASSERT_EQ(0, rename((dir + "/sub").c_str(), (dir + "/sub2").c_str()));
+    ASSERT_EQ(0, mkdir((dir + "/sub").c_str(), 0755));
+    EXPECT_EQ(0u, cache.list("list()", dir + "/sub")->size());
+    EXPECT_FALSE(cache.stat(dir + "/sub/f", st));
+
+    // We never use more than the permitted number of watches.
+    MetadataCache one_watch(1024 * 1024, 1);
+    EXPECT_NE(nullptr, one_watch.list("list()", dir));
+    EXPECT_NE(nullptr, one_watch.list("list()", dir + "/sub2"));
+    stats = one_watch.stats();
+    EXPECT_EQ(1, stats.watches);
+    EXPECT_EQ(1, stats.evictions);
+
+    // A listing that is too large is returned, but not kept.
+    MetadataCache tiny(100, 10);
+    EXPECT_NE(nullptr, tiny.list("list()", dir));
+    EXPECT_EQ(0, tiny.stats().bytes);
+
+    // A disabled cache still works.
+    MetadataCache disabled(0, 10);
+    EXPECT_EQ(nullptr, disabled.list("list()", dir));
+    ASSERT_TRUE(disabled.stat(dir + "/b", st));
+    EXPECT_EQ(0, disabled.stats().misses);
+}
+
+TEST(FileCopier, basic)
+{
+    QTemporaryDir tmp_dir(TEST_DIR "/data.XXXXXX");
+    ASSERT_TRUE(tmp_dir.isValid());
+    string const dir = tmp_dir.path().toStdString();
+
+    string const source = dir + "/source";
+    string const target = dir + "/target";
+    string contents;
+    for (int i = 0; i < 5000; ++i)
+    {
+        contents += file_contents;
+    }
+    {
+        int fd = open(source.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0640);
+        ASSERT_GT(fd, 0);
+        ASSERT_EQ(ssize_t(contents.size()), write(fd, &contents[0], contents.size()));
+        ASSERT_EQ(0, close(fd));
+    }
+
+    auto before = FileCopier::stats();
+    auto strategy = FileCopier::copy("copy()", source, target);
+    auto after = FileCopier::stats();
+    cout << "FileCopier strategy: " << FileCopier::strategy_name(strategy) << endl;
+
+    switch (strategy)
+    {
+        case FileCopier::reflink:
+            EXPECT_EQ(before.reflinks + 1, after.reflinks);
+            break;
+        case FileCopier::copy_file_range:
+            EXPECT_EQ(before.copy_file_range_copies + 1, after.copy_file_range_copies);
+            EXPECT_EQ(before.bytes_copied + int64_t(contents.size()), after.bytes_copied);
+            break;
+        case FileCopier::read_write:
+            EXPECT_EQ(before.read_write_copies + 1, after.read_write_copies);
+            EXPECT_EQ(before.bytes_copied + int64_t(contents.size()), after.bytes_copied);
+            break;
+        default:
+            FAIL() << "unexpected strategy " << int(strategy);
+    }
+
+    QFile copy(QString::fromStdString(target));
+    ASSERT_TRUE(copy.open(QIODevice::ReadOnly));
+    EXPECT_EQ(contents, copy.readAll().toStdString());
+    struct stat st;
+    ASSERT_EQ(0, stat(target.c_str(), &st));
+    EXPECT_EQ(0640, st.st_mode & 07777);
+
+    // The target must not exist, and an existing target is left alone.
+    try
+    {
+        FileCopier::copy("copy()", source, target);
+        FAIL();
+    }
+    catch (provider::ExistsException const& e)
+    {
+        EXPECT_EQ(string("ExistsException: copy(): \"") + target + "\": open: File exists: \"" + target + "\"", e.what());
+    }
+    EXPECT_EQ(int64_t(contents.size()), int64_t(boost::filesystem::file_size(target)));
+}
+
+TEST(TrashReaper, basic)
+{
+    QTemporaryDir tmp_dir(TEST_DIR "/data.XXXXXX");
+    ASSERT_TRUE(tmp_dir.isValid());
+    string const dir = tmp_dir.path().toStdString();
+    string const trash_dir = dir + "/trash";
+
+    // A tree with 50 subdirectories, each with 40 files, plus a symlink to
+    // a directory outside the tree, whose contents must survive.
+    ASSERT_EQ(0, mkdir((dir + "/outside").c_str(), 0755));
+    ASSERT_EQ(0, system(("touch " + dir + "/outside/keep").c_str()));
+    for (int d = 0; d < 50; ++d)
+    {
+        string const sub = dir + "/victim/d" + to_string(d);
+        ASSERT_TRUE(boost::filesystem::create_directories(sub + "/sub"));
+        for (int f = 0; f < 20; ++f)
+        {
+            string cmd = "touch " + sub + "/f" + to_string(f) + " " + sub + "/sub/f" + to_string(f);
+            ASSERT_EQ(0, system(cmd.c_str()));
+        }
+    }
+    ASSERT_EQ(0, symlink((dir + "/outside").c_str(), (dir + "/victim/link").c_str()));
+
+    // Left over from a previous run.
+    ASSERT_TRUE(boost::filesystem::create_directories(trash_dir + "/leftover/x"));
+    ASSERT_EQ(0, system(("touch " + trash_dir + "/leftover/x/y " + trash_dir + "/stray").c_str()));
+
+    auto wait_until_idle = [](TrashReaper const& r)
+    {
+        for (int i = 0; i < 1000 && !r.idle(); ++i)
+        {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        return r.idle();
+    };
+
+    {
+        TrashReaper reaper(trash_dir);
+        reaper.resume();
+        ASSERT_TRUE(reaper.trash("delete_item()", dir + "/victim"));
+        EXPECT_FALSE(boost::filesystem::exists(dir + "/victim"));
+        ASSERT_TRUE(wait_until_idle(reaper));
+
+        auto stats = reaper.stats();
+        EXPECT_EQ(1, stats.trashed);
+        EXPECT_EQ(2003, stats.files_removed);  // Includes the symlink, stray, and y.
+        EXPECT_EQ(103, stats.dirs_removed);    // Includes victim, leftover, and x.
+        EXPECT_EQ(0, stats.errors);
+        EXPECT_TRUE(boost::filesystem::is_empty(trash_dir));
+        EXPECT_TRUE(boost::filesystem::exists(dir + "/outside/keep"));
+
+        try
+        {
+            reaper.trash("delete_item()", dir + "/no_such_file");
+            FAIL();
+        }
+        catch (provider::NotExistsException const& e)
+        {
+            EXPECT_EQ(dir + "/no_such_file", e.key());
+        }
+    }
+}
+
+TEST(ThreadPool, basic)
+{
+    ThreadPool pool(3, 100);
+    EXPECT_EQ(3, pool.num_threads());
+    EXPECT_EQ(100, pool.max_queue_depth());
+    EXPECT_FALSE(pool.closed());
+
+    vector<boost::future<int>> futures;
+    for (int i = 0; i < 100; ++i)
+    {
+        futures.emplace_back(boost::async(pool, [i]{ return i * i; }));
+    }
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_EQ(i * i, futures[i].get());
+    }
+
+    auto stats = pool.stats();
+    EXPECT_EQ(3, stats.threads_created);
+    EXPECT_EQ(100, stats.submitted);
+    EXPECT_EQ(100, stats.executed);
+    EXPECT_EQ(0, stats.rejected);
+    EXPECT_EQ(0, pool.queue_depth());
+
+    pool.close();
+    EXPECT_TRUE(pool.closed());
+    try
+    {
+        boost::async(pool, []{});
+        FAIL();
+    }
+    catch (provider::LogicException const& e)
+    {
+        EXPECT_STREQ("LogicException: ThreadPool::submit(): thread pool is closed", e.what());
+    }
+}
+
+TEST(ThreadPool, queue_full)
+{
+    ThreadPool pool(1, 2);
+
+    // Block the only worker, then fill the queue.
+    boost::promise<void> started;
+    boost::promise<void> release;
+    auto release_future = release.get_future().share();
+    auto f1 = boost::async(pool, [&started, release_future]{ started.set_value(); release_future.wait(); });
+    started.get_future().wait();
+    auto f2 = boost::async(pool, []{});
+    auto f3 = boost::async(pool, []{});
+    EXPECT_EQ(2, pool.queue_depth());
+
+    try
+    {
+        boost::async(pool, []{});
+        FAIL();
+    }
+    catch (provider::ResourceException const& e)
+    {
+        EXPECT_STREQ("ResourceException: ThreadPool::submit(): too many pending requests (limit is 2)", e.what());
+        EXPECT_EQ(EAGAIN, e.error_code());
+    }
+    EXPECT_EQ(1, pool.stats().rejected);
+
+    // A thread that is not a worker can help drain the queue.
+    EXPECT_TRUE(pool.try_executing_one());
+    EXPECT_EQ(1, pool.queue_depth());
+
+    release.set_value();
+    f1.get();
+    f2.get();
+    f3.get();
+    EXPECT_FALSE(pool.try_executing_one());
+    EXPECT_EQ(3, pool.stats().executed);
+}
+
+TEST(ThreadPool, benchmark)
+{
+    int const num_requests = 2000;
+
+    // Simulate a burst of short metadata requests, as sent by a file manager that opens a folder.
+    auto request = []{ return nanosecs_now(); };
+
+    auto start = nanosecs_now();
+    {
+        vector<boost::future<int64_t>> futures;
+        for (int i = 0; i < num_requests; ++i)
+        {
+            futures.emplace_back(boost::async(boost::launch::async, request));
+        }
+        for (auto& f : futures)
+        {
+            f.get();
+        }
+    }
+    auto async_nsecs = nanosecs_now() - start;
+
+    start = nanosecs_now();
+    ThreadPool pool(8, num_requests);
+    {
+        vector<boost::future<int64_t>> futures;
+        for (int i = 0; i < num_requests; ++i)
+        {
+            futures.emplace_back(boost::async(pool, request));
+        }
+        for (auto& f : futures)
+        {
+            f.get();
+        }
+    }
+    auto pool_nsecs = nanosecs_now() - start;
+
+    auto stats = pool.stats();
+    EXPECT_EQ(num_requests, stats.executed);
+    cout << "boost::async():  " << num_requests << " requests, " << num_requests << " threads created, "
+         << async_nsecs / 1000 << " usecs" << endl;
+    cout << "ThreadPool:      " << num_requests << " requests, " << stats.threads_created << " threads created, "
+         << pool_nsecs / 1000 << " usecs" << endl;
+    cout << "ThreadPool wait: avg " << stats.queue_wait_nsecs / stats.executed / 1000 << " usecs, max "
+         << stats.max_queue_wait_nsecs / 1000 << " usecs, " << stats.stolen << " stolen" << endl;
+}
+
 int main(int argc, char** argv)
 {
     setenv("LANG", "C", true);
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include <unity/storage/provider/internal/MainLoopExecutor.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wctor-dtor-privacy"
+#include <gtest/gtest.h>
+#pragma GCC diagnostic pop
+
+#include <boost/thread/sync_queue.hpp>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEvent>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace unity::storage::provider::internal;
+
+namespace
+{
+
+int const WAIT_TIME = 10000;  // Milliseconds
+
+// Runs the event loop until done() returns true. Returns false on timeout.
+bool process_events_until(function<bool()> const& done)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!done())
+    {
+        if (timer.elapsed() > WAIT_TIME)
+        {
+            return false;
+        }
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    return true;
+}
+
+// Calls a function when it receives an event, so we can see where
+// an ordinary event falls among the executor's closures.
+class EventReceiver : public QObject
+{
+public:
+    explicit EventReceiver(function<void()> const& f)
+        : f_(f)
+    {
+    }
+
+    bool event(QEvent* e) override
+    {
+        if (e->type() != QEvent::User)
+        {
+            return QObject::event(e);
+        }
+        f_();
+        return true;
+    }
+
+private:
+    function<void()> f_;
+};
+
+}  // namespace
+
+TEST(MainLoopExecutor, runs_closures_in_main_loop)
+{
+    auto& executor = MainLoopExecutor::instance();
+    EXPECT_FALSE(executor.closed());
+
+    bool ran = false;
+    thread::id ran_on;
+    executor.submit([&]{ ran = true; ran_on = this_thread::get_id(); });
+    EXPECT_FALSE(ran);  // Nothing runs until we return to the event loop.
+    ASSERT_TRUE(process_events_until([&]{ return ran; }));
+    EXPECT_EQ(this_thread::get_id(), ran_on);
+}
+
+TEST(MainLoopExecutor, try_executing_one)
+{
+    auto& executor = MainLoopExecutor::instance();
+
+    // Nothing queued.
+    EXPECT_FALSE(executor.try_executing_one());
+
+    int count = 0;
+    executor.submit([&]{ ++count; });
+    executor.submit([&]{ ++count; });
+
+    // Not the main thread, so nothing runs.
+    bool result = true;
+    thread t([&]{ result = executor.try_executing_one(); });
+    t.join();
+    EXPECT_FALSE(result);
+    EXPECT_EQ(0, count);
+
+    // One closure per call, in submission order.
+    EXPECT_TRUE(executor.try_executing_one());
+    EXPECT_EQ(1, count);
+    EXPECT_TRUE(executor.try_executing_one());
+    EXPECT_EQ(2, count);
+    EXPECT_FALSE(executor.try_executing_one());
+
+    // The wake-up event finds an empty queue.
+    QCoreApplication::processEvents();
+    EXPECT_EQ(2, count);
+}
+
+TEST(MainLoopExecutor, order_with_multiple_producers)
+{
+    auto& executor = MainLoopExecutor::instance();
+
+    int const num_threads = 8;
+    int const per_thread = 5000;
+
+    // Only the main thread touches this, so no locking is needed.
+    vector<vector<int>> seen(num_threads);
+    int total = 0;
+
+    atomic<bool> go(false);
+    vector<thread> producers;
+    for (int t = 0; t < num_threads; ++t)
+    {
+        producers.emplace_back([&, t]
+        {
+            while (!go)
+            {
+                this_thread::yield();
+            }
+            for (int i = 0; i < per_thread; ++i)
+            {
+                executor.submit([&, t, i]{ seen[t].push_back(i); ++total; });
+            }
+        });
+    }
+    go = true;
+    for (auto& p : producers)
+    {
+        p.join();
+    }
+    ASSERT_TRUE(process_events_until([&]{ return total == num_threads * per_thread; }));
+
+    // Closures from the same thread run in the order they were submitted.
+    for (int t = 0; t < num_threads; ++t)
+    {
+        ASSERT_EQ(size_t(per_thread), seen[t].size());
+        for (int i = 0; i < per_thread; ++i)
+        {
+            ASSERT_EQ(i, seen[t][i]) << "thread " << t;
+        }
+    }
+}
+
+TEST(MainLoopExecutor, batch_yields_to_event_loop)
+{
+    auto& executor = MainLoopExecutor::instance();
+
+    // Each closure takes long enough that a single time slice cannot
+    // fit all of them.
+    int const num_closures = 50;
+    auto const closure_time = chrono::milliseconds(2);
+
+    int executed = 0;
+    for (int i = 0; i < num_closures; ++i)
+    {
+        executor.submit([&]{ this_thread::sleep_for(closure_time); ++executed; });
+    }
+
+    // Posted after the executor's wake-up event. If a batch ran to the end
+    // regardless of the time slice, this would only be delivered after
+    // every closure had run.
+    int executed_at_event = -1;
+    EventReceiver receiver([&]{ executed_at_event = executed; });
+    QCoreApplication::postEvent(&receiver, new QEvent(QEvent::User));
+
+    ASSERT_TRUE(process_events_until([&]{ return executed == num_closures && executed_at_event != -1; }));
+    EXPECT_GT(executed_at_event, 0);
+    EXPECT_LT(executed_at_event, num_closures);
+}
+
+// Closing is permanent for the singleton, so this must be the last test.
+
+TEST(MainLoopExecutor, close_with_pending_closures)
+{
+    auto& executor = MainLoopExecutor::instance();
+
+    int count = 0;
+    executor.submit([&]{ ++count; });
+    executor.submit([&]{ ++count; });
+
+    executor.close();
+    EXPECT_TRUE(executor.closed());
+    EXPECT_THROW(executor.submit([&]{ ++count; }), boost::sync_queue_is_closed);
+
+    // Closures queued before close() still run.
+    ASSERT_TRUE(process_events_until([&]{ return count == 2; }));
+    EXPECT_FALSE(executor.try_executing_one());
+    EXPECT_EQ(2, count);
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -24,12 +24,14 @@
 #include "TestProvider.h"
 
 #include <utils/ProviderFixture.h>
+#include <utils/env_var_guard.h>
 #include <utils/gtest_printer.h>
 
 #include <gtest/gtest.h>
 #include <OnlineAccounts/Account>
 #include <OnlineAccounts/Manager>
 #include <QCoreApplication>
+#include <QElapsedTimer>
 #include <QDBusConnection>
 #include <QDBusServiceWatcher>
 #include <QSignalSpy>
@@ -40,9 +42,13 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <exception>
+#include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <stdexcept>
+#include <thread>
+#include <vector>
 
 using namespace std;
 using unity::storage::ItemType;
@@ -51,6 +57,7 @@ using unity::storage::provider::Context;
 using unity::storage::provider::Item;
 using unity::storage::provider::ItemList;
 using unity::storage::provider::PasswordCredentials;
+using unity::storage::provider::Priority;
 using unity::storage::provider::UnauthorizedException;
 using unity::storage::provider::testing::TestServer;
 
@@ -788,6 +795,332 @@ TEST_F(ProviderInterfaceTest, copy)
     EXPECT_EQ(ItemType::file, item.type);
 }
 
+// Holds on to metadata() requests until release() is called.
+class BlockingProvider : public TestProvider
+{
+public:
+    boost::future<Item> metadata(string const& item_id,
+                                 vector<string> const& metadata_keys,
+                                 Context const& ctx) override
+    {
+        Q_UNUSED(metadata_keys);
+        priorities_[item_id] = ctx.priority;
+        pending_.emplace_back(item_id, boost::promise<Item>());
+        return pending_.back().second.get_future();
+    }
+
+    vector<string> pending_ids() const
+    {
+        vector<string> ids;
+        for (auto const& p : pending_)
+        {
+            ids.push_back(p.first);
+        }
+        return ids;
+    }
+
+    void release()
+    {
+        for (auto& p : pending_)
+        {
+            p.second.set_value({p.first, {"root_id"}, "Name", "etag", ItemType::file, {}});
+        }
+        pending_.clear();
+    }
+
+    map<string, Priority> priorities_;
+
+private:
+    vector<pair<string, boost::promise<Item>>> pending_;
+};
+
+bool wait_until(function<bool()> const& condition)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!condition())
+    {
+        if (timer.elapsed() > 10000)
+        {
+            return false;
+        }
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+    }
+    return true;
+}
+
+TEST_F(ProviderInterfaceTest, fair_queuing)
+{
+    EnvVarGuard max_client_requests("SF_PROVIDER_MAX_CLIENT_REQUESTS", "2");
+    auto provider = new BlockingProvider;
+    set_provider(unique_ptr<ProviderBase>(provider));
+
+    // The first client floods the provider. Only two of its requests are started.
+    QList<QDBusPendingReply<unity::storage::internal::ItemMetadata>> replies;
+    for (int i = 0; i < 5; ++i)
+    {
+        replies.append(client_->Metadata(QString("a%1").arg(i), QList<QString>()));
+    }
+    ASSERT_TRUE(wait_until([provider]{ return provider->pending_ids().size() == 2; }));
+
+    // A request from a second client does not have to wait for the queued ones.
+    QDBusConnection connection2 = QDBusConnection::connectToBus(dbus_->busAddress(), SECOND_CONNECTION_NAME);
+    QDBusConnection::disconnectFromBus(SECOND_CONNECTION_NAME);
+    ProviderClient client2(bus_name(), object_path(), connection2);
+    replies.append(client2.Metadata("b0", QList<QString>()));
+    ASSERT_TRUE(wait_until([provider]{ return provider->pending_ids().size() == 3; }));
+    EXPECT_EQ((vector<string>{"a0", "a1", "b0"}), provider->pending_ids());
+
+    // As requests finish, the queued ones are started in order.
+    provider->release();
+    ASSERT_TRUE(wait_until([provider]{ return provider->pending_ids().size() == 2; }));
+    EXPECT_EQ((vector<string>{"a2", "a3"}), provider->pending_ids());
+    provider->release();
+    ASSERT_TRUE(wait_until([provider]{ return provider->pending_ids().size() == 1; }));
+    EXPECT_EQ((vector<string>{"a4"}), provider->pending_ids());
+    provider->release();
+
+    for (auto& reply : replies)
+    {
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+    }
+    EXPECT_EQ("a4", replies[4].value().item_id);
+    EXPECT_EQ("b0", replies[5].value().item_id);
+}
+
+TEST_F(ProviderInterfaceTest, priorities)
+{
+    // Bulk requests may use three of the four slots, so one is left for interactive requests.
+    EnvVarGuard max_requests("SF_PROVIDER_MAX_REQUESTS", "4");
+    auto provider = new BlockingProvider;
+    set_provider(unique_ptr<ProviderBase>(provider));
+
+    QDBusConnection connection2 = QDBusConnection::connectToBus(dbus_->busAddress(), SECOND_CONNECTION_NAME);
+    QDBusConnection::disconnectFromBus(SECOND_CONNECTION_NAME);
+    ProviderClient client2(bus_name(), object_path(), connection2);
+
+    {
+        auto reply = client2.SetPriority("urgent");
+        wait_for(reply);
+        ASSERT_TRUE(reply.isError());
+        EXPECT_EQ(PROVIDER_ERROR + "InvalidArgumentException", reply.error().name());
+        EXPECT_EQ("SetPriority(): invalid priority: \"urgent\"", reply.error().message());
+    }
+    {
+        auto reply = client2.SetPriority("bulk");
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+    }
+
+    QList<QDBusPendingReply<unity::storage::internal::ItemMetadata>> replies;
+    for (int i = 0; i < 5; ++i)
+    {
+        replies.append(client2.Metadata(QString("b%1").arg(i), QList<QString>()));
+    }
+    ASSERT_TRUE(wait_until([provider]{ return provider->pending_ids().size() == 3; }));
+
+    // The first client's requests are interactive and get the remaining slot.
+    replies.append(client_->Metadata("a0", QList<QString>()));
+    ASSERT_TRUE(wait_until([provider]{ return provider->pending_ids().size() == 4; }));
+    EXPECT_EQ((vector<string>{"b0", "b1", "b2", "a0"}), provider->pending_ids());
+    EXPECT_EQ(Priority::interactive, provider->priorities_["a0"]);
+    EXPECT_EQ(Priority::bulk, provider->priorities_["b0"]);
+
+    provider->release();
+    ASSERT_TRUE(wait_until([provider]{ return provider->pending_ids().size() == 2; }));
+    EXPECT_EQ((vector<string>{"b3", "b4"}), provider->pending_ids());
+    provider->release();
+    for (auto& reply : replies)
+    {
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+    }
+}
+
+TEST_F(ProviderInterfaceTest, priority_cannot_be_raised)
+{
+    auto provider = new BlockingProvider;
+    set_provider(unique_ptr<ProviderBase>(provider));
+
+    {
+        auto reply = client_->SetPriority("interactive");
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+    }
+
+    // MetadataMany is a bulk request, and stays one.
+    auto many_reply = client_->MetadataMany({"a0"}, QList<QString>());
+    ASSERT_TRUE(wait_until([provider]{ return provider->pending_ids().size() == 1; }));
+    EXPECT_EQ(Priority::bulk, provider->priorities_["a0"]);
+
+    // Metadata is interactive anyway.
+    auto reply = client_->Metadata("a1", QList<QString>());
+    ASSERT_TRUE(wait_until([provider]{ return provider->pending_ids().size() == 2; }));
+    EXPECT_EQ(Priority::interactive, provider->priorities_["a1"]);
+
+    provider->release();
+    wait_for(many_reply);
+    ASSERT_TRUE(many_reply.isValid()) << many_reply.error().message().toStdString();
+    wait_for(reply);
+    ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+
+    // Lowering still works.
+    {
+        auto reply = client_->SetPriority("background");
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+    }
+    reply = client_->Metadata("a2", QList<QString>());
+    ASSERT_TRUE(wait_until([provider]{ return provider->pending_ids().size() == 1; }));
+    EXPECT_EQ(Priority::background, provider->priorities_["a2"]);
+    provider->release();
+    wait_for(reply);
+    ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+}
+
+// Completes metadata() and delete_item() in another thread, and records the thread
+// that each call was made from.
+class ThreadedProvider : public TestProvider
+{
+public:
+    boost::future<Item> metadata(string const& item_id,
+                                 vector<string> const& metadata_keys,
+                                 Context const& ctx) override
+    {
+        Q_UNUSED(metadata_keys);
+        Q_UNUSED(ctx);
+        record_caller();
+        return boost::async(boost::launch::async, [item_id]
+        {
+            return Item{item_id, {"root_id"}, "Name", "etag", ItemType::file, {}};
+        });
+    }
+
+    boost::future<void> delete_item(string const& item_id, Context const& ctx) override
+    {
+        Q_UNUSED(item_id);
+        Q_UNUSED(ctx);
+        record_caller();
+        return boost::async(boost::launch::async, []{});
+    }
+
+    vector<thread::id> callers() const
+    {
+        lock_guard<mutex> guard(mutex_);
+        return callers_;
+    }
+
+private:
+    void record_caller()
+    {
+        lock_guard<mutex> guard(mutex_);
+        callers_.push_back(this_thread::get_id());
+    }
+
+    mutable mutex mutex_;
+    vector<thread::id> callers_;
+};
+
+TEST_F(ProviderInterfaceTest, batch_calls_from_main_thread)
+{
+    auto provider = new ThreadedProvider;
+    set_provider(unique_ptr<ProviderBase>(provider));
+
+    // More items than a batch keeps in progress, so most items are started
+    // after an earlier one completed in another thread.
+    int const num_items = 40;
+    QList<QString> ids;
+    for (int i = 0; i < num_items; ++i)
+    {
+        ids.append(QString("item%1").arg(i));
+    }
+    {
+        auto reply = client_->MetadataMany(ids, QList<QString>());
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+        EXPECT_EQ(num_items, reply.argumentAt<0>().size());
+    }
+    {
+        auto reply = client_->DeleteMany(ids);
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+        for (auto const& name : reply.argumentAt<0>())
+        {
+            EXPECT_TRUE(name.isEmpty()) << name.toStdString();
+        }
+    }
+
+    auto callers = provider->callers();
+    ASSERT_EQ(size_t(2 * num_items), callers.size());
+    for (auto const& id : callers)
+    {
+        EXPECT_EQ(this_thread::get_id(), id);
+    }
+}
+
+TEST_F(ProviderInterfaceTest, stats)
+{
+    auto snapshot = [this](bool reset)
+    {
+        auto msg = QDBusMessage::createMethodCall(bus_name(), object_path(),
+                                                  "com.canonical.StorageFramework.Stats", "Snapshot");
+        msg << reset;
+        return QDBusPendingReply<QVariantMap>(connection().asyncCall(msg));
+    };
+
+    // The interface is not there unless it is enabled.
+    {
+        set_provider(unique_ptr<ProviderBase>(new TestProvider));
+        auto reply = snapshot(false);
+        wait_for(reply);
+        ASSERT_TRUE(reply.isError());
+        EXPECT_EQ(QDBusError::UnknownInterface, reply.error().type()) << reply.error().name().toStdString();
+    }
+
+    EnvVarGuard env("SF_PROVIDER_STATS", "1");
+    set_provider(unique_ptr<ProviderBase>(new TestProvider));
+
+    {
+        auto reply = client_->Metadata("root_id", QList<QString>());
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+        reply = client_->Metadata("no_such_id", QList<QString>());
+        wait_for(reply);
+        ASSERT_TRUE(reply.isError());
+        auto roots_reply = client_->Roots(QList<QString>());
+        wait_for(roots_reply);
+        ASSERT_TRUE(roots_reply.isValid()) << roots_reply.error().message().toStdString();
+    }
+
+    auto reply = snapshot(true);
+    wait_for(reply);
+    ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+    auto stats = reply.value();
+    EXPECT_EQ(0, stats["queued"].toLongLong());
+    EXPECT_EQ(0, stats["in_flight"].toLongLong());
+    EXPECT_EQ(0, stats["active_uploads"].toLongLong());
+    EXPECT_EQ(0, stats["active_downloads"].toLongLong());
+    EXPECT_EQ(2, stats["peer_cache_hits"].toLongLong());
+    EXPECT_EQ(1, stats["peer_cache_misses"].toLongLong());
+
+    auto methods = qdbus_cast<QVariantMap>(stats["methods"]);
+    EXPECT_EQ((QStringList{"Metadata", "Roots"}), methods.keys());
+    auto metadata = qdbus_cast<QVariantMap>(methods["Metadata"]);
+    EXPECT_EQ(2, metadata["calls"].toLongLong());
+    EXPECT_EQ(1, metadata["errors"].toLongLong());
+    auto errors = qdbus_cast<QVariantMap>(metadata["errors_by_type"]);
+    EXPECT_EQ(1, errors["NotExistsException"].toLongLong());
+    EXPECT_GT(metadata["latency_p50_us"].toLongLong(), 0);
+    EXPECT_LE(metadata["latency_p50_us"].toLongLong(), metadata["latency_p99_us"].toLongLong());
+
+    // The counters were reset by the previous snapshot.
+    reply = snapshot(false);
+    wait_for(reply);
+    ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+    EXPECT_TRUE(qdbus_cast<QVariantMap>(reply.value()["methods"]).isEmpty());
+}
+
 class ReauthenticateProvider : public TestProvider
 {
     boost::future<ItemList> roots(vector<string> const& metadata_keys,
@@ -485,6 +485,11 @@ boost::future<Item> MockProvider::copy(
     return make_ready_future(metadata);
 }
 
+vector<string> MockProvider::capabilities() const
+{
+    return { capability::DOWNLOAD_RANGE };
+}
+
 MockUploadJob::MockUploadJob()
     : UploadJob("some_id")
 {
@@ -557,3 +562,26 @@ boost::future<void> MockDownloadJob::finish()
     }
     return make_ready_future();
 }
+
+int LegacyProvider::num_metadata_calls() const
+{
+    return num_metadata_calls_;
+}
+
+unity::storage::internal::ItemMetadata LegacyProvider::Metadata(QString const& item_id, QStringList const&)
+{
+    ++num_metadata_calls_;
+    if (item_id == "child_id")
+    {
+        return
+        {
+            "child_id", { "root_id", "child_folder_id" }, "Child", "etag", ItemType::file,
+            { { metadata::SIZE_IN_BYTES, 0 }, { metadata::LAST_MODIFIED_TIME, "2007-04-05T14:30Z" } }
+        };
+    }
+    if (item_id == "child_folder_id")
+    {
+        return { "child_folder_id", { "root_id" }, "Child_Folder", "etag", ItemType::folder, {} };
+    }
+    return { "root_id", {}, "Root", "etag", ItemType::root, {} };
+}
@@ -18,10 +18,14 @@
 
 #pragma once
 
+#include <unity/storage/internal/ItemMetadata.h>
 #include <unity/storage/provider/DownloadJob.h>
 #include <unity/storage/provider/ProviderBase.h>
 #include <unity/storage/provider/UploadJob.h>
 
+#include <QObject>
+#include <QStringList>
+
 class MockProvider : public unity::storage::provider::ProviderBase
 {
 public:
@@ -66,6 +70,8 @@ public:
         std::string const& new_name, std::vector<std::string> const& keys,
         unity::storage::provider::Context const& ctx) override;
 
+    std::vector<std::string> capabilities() const override;
+
 private:
     std::string cmd_;
 };
@@ -99,3 +105,19 @@ public:
 private:
     std::string cmd_;
 };
+
+// Provider object that predates MetadataMany: it implements only the Metadata
+// method of the provider interface.
+class LegacyProvider : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "com.canonical.StorageFramework.Provider")
+public:
+    int num_metadata_calls() const;
+
+public Q_SLOTS:
+    unity::storage::internal::ItemMetadata Metadata(QString const& item_id, QStringList const& keys);
+
+private:
+    int num_metadata_calls_ = 0;
+};
@@ -391,6 +391,57 @@ TEST_F(AccountTest, runtime_destroyed)
     EXPECT_EQ(AccountsJob::Status::Error, qvariant_cast<AccountsJob::Status>(arg.at(0)));
 }
 
+TEST_F(AccountTest, capabilities)
+{
+    set_provider(unique_ptr<provider::ProviderBase>(new MockProvider()));
+
+    unique_ptr<CapabilitiesJob> j(acc_.capabilities());
+    EXPECT_TRUE(j->isValid());
+    EXPECT_EQ(CapabilitiesJob::Status::Loading, j->status());
+    EXPECT_EQ(QStringList(), j->capabilities());  // We haven't waited for the result yet.
+
+    QSignalSpy spy(j.get(), &CapabilitiesJob::statusChanged);
+    spy.wait(SIGNAL_WAIT_TIME);
+    ASSERT_EQ(1, spy.count());
+    auto arg = spy.takeFirst();
+    EXPECT_EQ(CapabilitiesJob::Status::Finished, qvariant_cast<CapabilitiesJob::Status>(arg.at(0)));
+
+    EXPECT_TRUE(j->isValid());
+    EXPECT_EQ(StorageError::Type::NoError, j->error().type());
+    EXPECT_EQ(QStringList{ "download_range" }, j->capabilities());
+}
+
+TEST_F(AccountTest, capabilities_legacy_provider)
+{
+    LegacyProvider legacy;
+    ASSERT_TRUE(service_connection_->registerObject("/legacy", &legacy, QDBusConnection::ExportAllSlots));
+    auto acc = runtime_->make_test_account(service_connection_->baseService(), "/legacy");
+
+    // A provider without the Capabilities method has no optional features.
+    unique_ptr<CapabilitiesJob> j(acc.capabilities());
+    QSignalSpy spy(j.get(), &CapabilitiesJob::statusChanged);
+    spy.wait(SIGNAL_WAIT_TIME);
+    ASSERT_EQ(CapabilitiesJob::Status::Finished, j->status()) << j->error().errorString().toStdString();
+    EXPECT_EQ(QStringList(), j->capabilities());
+
+    service_connection_->unregisterObject("/legacy");
+}
+
+TEST_F(AccountTest, capabilities_invalid_account)
+{
+    Account acc;
+    unique_ptr<CapabilitiesJob> j(acc.capabilities());
+    EXPECT_FALSE(j->isValid());
+    EXPECT_EQ(CapabilitiesJob::Status::Error, j->status());
+    EXPECT_EQ(StorageError::Type::LogicError, j->error().type());
+    EXPECT_EQ("Account::capabilities(): cannot create job from invalid account", j->error().message());
+
+    // Signal must be received.
+    QSignalSpy spy(j.get(), &CapabilitiesJob::statusChanged);
+    spy.wait(SIGNAL_WAIT_TIME);
+    ASSERT_EQ(1, spy.count());
+}
+
 TEST_F(RootsTest, roots)
 {
     set_provider(unique_ptr<provider::ProviderBase>(new MockProvider));
@@ -1364,17 +1415,11 @@ TEST_F(ParentsTest, two_parents)
     QSignalSpy ready_spy(j.get(), &ItemListJob::itemsReady);
     QSignalSpy status_spy(j.get(), &ItemListJob::statusChanged);
 
+    // Both parents arrive with a single MetadataMany call.
     ready_spy.wait(SIGNAL_WAIT_TIME);
+    ASSERT_EQ(1, ready_spy.count());
     auto list_arg = ready_spy.takeFirst();
-    auto this_parent = qvariant_cast<QList<Item>>(list_arg.at(0));
-    parents.append(this_parent);
-    while (ready_spy.count() < 1)
-    {
-        ready_spy.wait(SIGNAL_WAIT_TIME);
-    }
-    list_arg = ready_spy.takeFirst();
-    this_parent = qvariant_cast<QList<Item>>(list_arg.at(0));
-    parents.append(this_parent);
+    parents = qvariant_cast<QList<Item>>(list_arg.at(0));
 
     // Finished signal must be received.
     if (status_spy.count() == 0)
@@ -1419,13 +1464,47 @@ TEST_F(ParentsTest, two_parents_throw)
         EXPECT_EQ("ResourceError: metadata(): weird error", j->error().errorString());
         EXPECT_EQ(42, j->error().errorCode());
 
-        // We wait here to allow the error return for the second parent to arrive in MultiItemJobImpl.
-        // This gives us coverage on the early return in the process_error lambda, when the job is
-        // already in the error state.
+        // The error for the second parent is not reported separately.
         EXPECT_FALSE(ready_spy.wait(1000));
     }
 }
 
+TEST_F(ParentsTest, provider_without_metadata_many)
+{
+    LegacyProvider legacy;
+    ASSERT_TRUE(service_connection_->registerObject("/legacy", &legacy, QDBusConnection::ExportAllSlots));
+    auto acc = runtime_->make_test_account(service_connection_->baseService(), "/legacy");
+
+    Item child;
+    {
+        unique_ptr<ItemJob> j(acc.get("child_id"));
+        QSignalSpy spy(j.get(), &ItemJob::statusChanged);
+        spy.wait(SIGNAL_WAIT_TIME);
+        ASSERT_EQ(ItemJob::Status::Finished, j->status()) << j->error().errorString().toStdString();
+        child = j->item();
+    }
+    EXPECT_EQ(1, legacy.num_metadata_calls());
+
+    // The first call gets UnknownMethod for MetadataMany and falls back to Metadata for
+    // each parent; the second one doesn't try MetadataMany again.
+    for (int i = 0; i < 2; ++i)
+    {
+        unique_ptr<ItemListJob> j(child.parents());
+        QSignalSpy ready_spy(j.get(), &ItemListJob::itemsReady);
+        QSignalSpy status_spy(j.get(), &ItemListJob::statusChanged);
+        status_spy.wait(SIGNAL_WAIT_TIME);
+        ASSERT_EQ(ItemListJob::Status::Finished, j->status()) << j->error().errorString().toStdString();
+        ASSERT_EQ(1, ready_spy.count());
+        auto parents = qvariant_cast<QList<Item>>(ready_spy.takeFirst().at(0));
+        ASSERT_EQ(2, parents.size());
+        EXPECT_EQ("root_id", parents[0].itemId());
+        EXPECT_EQ("child_folder_id", parents[1].itemId());
+    }
+    EXPECT_EQ(5, legacy.num_metadata_calls());
+
+    service_connection_->unregisterObject("/legacy");
+}
+
 TEST_F(ParentsTest, invalid_item)
 {
     set_provider(unique_ptr<provider::ProviderBase>(new MockProvider()));
@@ -31,11 +31,15 @@ case "$SERIES" in
         ;;
     xenial)
         # New C++11 ABI, Boost 1.58
-        echo 4
+        # 4: first release
+        # 6: virtual methods added to ProviderBase and UploadJob, Context::priority added
+        echo 6
         ;;
     yakkety|zesty)
         # New C++11 ABI, Boost 1.61
-        echo 5
+        # 5: first release
+        # 7: virtual methods added to ProviderBase and UploadJob, Context::priority added
+        echo 7
         ;;
     *)
         echo "Unknown distro series $SERIES" >&2